@@ -25,6 +25,7 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <signal.h>
 #include <sys/fcntl.h>
 #include <sys/socket.h>
 
@@ -37,48 +38,53 @@
 
 //////////////////////////////// ClientTCPSession //////////////////////////////
 ClientTCPSession::ClientTCPSession(const uint16_t connIdx,
+                                   const uint16_t route,
                                    struct event_base *base,
                                    evutil_socket_t fd,
                                    Client *client):
-bev_(nullptr), client_(client), connIdx_(connIdx)
+bev_(nullptr), client_(client), connIdx_(connIdx), route_(route),
+opening_(false), openTime_(0), openMs_(-1), connectMs_(-1), openTries_(0),
+replayable_(true), startTime_(iclock64()), recvBytes_(0), sentBytes_(0),
+prio_(STREAM_PRIO_NORMAL), readPaused_(false), idleNode_(this),
+lastReadTime_(cachedClock64(base)), lastWriteTime_(lastReadTime_)
 {
+  struct sockaddr_storage ss;
+  socklen_t ssLen = sizeof(ss);
+  if (getpeername(fd, (struct sockaddr *)&ss, &ssLen) == 0) {
+    peer_ = sockaddrToString((struct sockaddr *)&ss);
+  }
+
   bev_ = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
   assert(bev_ != nullptr);
 
   bufferevent_setcb(bev_,
                     Client::cb_tcpRead, NULL,
                     Client::cb_tcpEvent, (void*)this);
+  evbuffer_add_cb(bufferevent_get_output(bev_), ClientTCPSession::cb_output, this);
+  setTcpSocketOptions(fd, client_->socketOptions());
 
   // By default, a newly created bufferevent has writing enabled.
   bufferevent_enable(bev_, EV_READ|EV_WRITE);
 }
 
 ClientTCPSession::~ClientTCPSession() {
+  evbuffer_remove_cb(bufferevent_get_output(bev_), ClientTCPSession::cb_output, this);
   // BEV_OPT_CLOSE_ON_FREE: fd will auto close
   bufferevent_free(bev_);
 }
 
-void ClientTCPSession::setTimeout(const int32_t readTimeout,
-                                  const int32_t writeTimeout) {
-  // clear it
-  bufferevent_set_timeouts(bev_, NULL, NULL);
-
-  // set a new one
-  struct timeval readtv  = {readTimeout, 0};
-  struct timeval writetv = {writeTimeout, 0};
-  bufferevent_set_timeouts(bev_,
-                           readTimeout  > 0 ? &readtv  : nullptr,
-                           writeTimeout > 0 ? &writetv : nullptr);
-}
-
 void ClientTCPSession::recvData(struct evbuffer *buf) {
+  lastReadTime_ = cachedClock64(bufferevent_get_base(bev_));
+
   string msg;
   msg.resize(evbuffer_get_length(buf));
 
   // copies and removes the first datlen bytes from the front of buf
   // into the memory at data
   evbuffer_remove(buf, (uint8_t *)msg.data(), msg.size());
-  DLOG(INFO) << "tcp recv(" << connIdx_ << "): " << msg;
+  LOG_PAYLOAD("tcp recv", connIdx_, msg.data(), msg.size());
+  recvBytes_ += msg.size();
+  rearmTcpQuickAck(bufferevent_getfd(bev_), client_->socketOptions());
 
   client_->handleIncomingTCPMesasge(this, msg);
 }
@@ -86,7 +92,75 @@ void ClientTCPSession::recvData(struct evbuffer *buf) {
 void ClientTCPSession::sendData(const char *data, size_t len) {
   // add data to a bufferevent’s output buffer
   bufferevent_write(bev_, data, len);
-  DLOG(INFO) << "tcp send(" << connIdx_ << "): " << string(data, len);
+  LOG_PAYLOAD("tcp send", connIdx_, data, len);
+  sentBytes_ += len;
+}
+
+void ClientTCPSession::setReadPaused(const bool paused) {
+  if (paused == readPaused_)
+    return;
+  readPaused_ = paused;
+
+  // the kernel buffer fills up, tcp flow control pushes back on the miner
+  if (paused) {
+    bufferevent_disable(bev_, EV_READ);
+  } else {
+    bufferevent_enable(bev_, EV_READ);
+    // the read timeout restarts, as it does in bufferevent
+    lastReadTime_ = cachedClock64(bufferevent_get_base(bev_));
+  }
+}
+
+void ClientTCPSession::setRateLimit(struct ev_token_bucket_cfg *cfg,
+                                    struct bufferevent_rate_limit_group *group) {
+  // nullptr removes the limit
+  bufferevent_set_rate_limit(bev_, cfg);
+  if (group) {
+    bufferevent_add_to_rate_limit_group(bev_, group);
+  } else {
+    bufferevent_remove_from_rate_limit_group(bev_);
+  }
+}
+
+size_t ClientTCPSession::inputQueued() const {
+  return evbuffer_get_length(bufferevent_get_input(bev_));
+}
+
+size_t ClientTCPSession::outputQueued() const {
+  return evbuffer_get_length(bufferevent_get_output(bev_));
+}
+
+IINT64 ClientTCPSession::idleDeadline(const int32_t readTimeout,
+                                      const int32_t writeTimeout,
+                                      const IINT64 now, short *what) const {
+  IINT64 deadline = 0;
+  *what = 0;
+
+  // as bufferevent does: the read timeout runs while reading is enabled,
+  // the write timeout while there is something to write
+  if (readTimeout > 0) {
+    const bool running = !readPaused_;
+    deadline = (running ? lastReadTime_ : now) + (IINT64)readTimeout * 1000;
+    *what    = running ? BEV_EVENT_READING : 0;
+  }
+  if (writeTimeout > 0) {
+    const bool running = outputQueued() > 0;
+    const IINT64 t = (running ? lastWriteTime_ : now) + (IINT64)writeTimeout * 1000;
+    if (deadline == 0 || t < deadline) {
+      deadline = t;
+      *what    = running ? BEV_EVENT_WRITING : 0;
+    }
+  }
+  return deadline;
+}
+
+void ClientTCPSession::cb_output(struct evbuffer *buf,
+                                 const struct evbuffer_cb_info *info, void *ptr) {
+  // written to the socket, or the first bytes to write after a while
+  if (info->n_deleted > 0 || info->orig_size == 0) {
+    ClientTCPSession *session = static_cast<ClientTCPSession *>(ptr);
+    session->lastWriteTime_ = cachedClock64(bufferevent_get_base(session->bev_));
+  }
 }
 
 
@@ -95,41 +169,57 @@ Client::Client(const string &udpUpstreamHost, const uint16_t udpUpstreamPort,
                const string &listenIP, const uint16_t listenPort,
                const int32_t tcpReadTimeout, const int32_t tcpWriteTimeout):
 base_(nullptr), exitEvTimer_(nullptr), kcpUpdateTimer_(nullptr),
-kcpKeepAliveTimer_(nullptr),
+kcpKeepAliveTimer_(nullptr), pmtuTimer_(nullptr), reloadEvent_(nullptr),
+captureEvent_(nullptr), control_(nullptr), capture_(nullptr),
+captureMaxPackets_(0), captureSnaplen_(0),
+ioEngine_(nullptr),
 udpSockFd_(-1), udpUpstreamHost_(udpUpstreamHost), udpUpstreamPort_(udpUpstreamPort),
-udpReadEvent_(nullptr), listener_(nullptr),
-listenIP_(listenIP), listenPort_(listenPort),
+udpUpstreamFamily_(ADDR_FAMILY_ANY), udpUpstreamAddrLen_(0),
+udpChannel_(nullptr), udpSockConnected_(false), initKCPConvSendTime_(0), routesEnabled_(false),
+openStatusWanted_(false), openStatusEnabled_(false), streamOpenRetries_(1),
+streamPreopen_(0), connIdx_(1u),
 tcpReadTimeout_(tcpReadTimeout), tcpWriteTimeout_(tcpWriteTimeout),
+idleWheel_(IDLE_WHEEL_SLOTS, IDLE_WHEEL_TICK, iclock64()), idleTimer_(nullptr),
+pmtuEnabled_(true), pmtuMax_(PMTU_MAX_DEFAULT), pmtu_(0), pmtuLow_(0),
+pmtuHigh_(0), pmtuProbeSize_(0), pmtuProbeId_(0), pmtuProbeTries_(0),
+pmtuProbeSendTime_(0), pmtuNextSearchTime_(0), pmtuSetAcked_(true),
+pingInterval_(0), pingEnabled_(false), pingSilent_(false), pingStartTime_(0),
+udpSent_(0), udpRecv_(0),
 isInitKCPConv_(false), kcpConv_((uint32_t)time(nullptr)),
-kcpInBuf_(nullptr), running_(true), kcp_(nullptr)
+kcpInBuf_(nullptr), tunnelCipher_(AEAD_AUTO), checksumWanted_(false),
+compactWanted_(false), notifyDeltaWanted_(false), notifyDeltaEnabled_(false),
+streamRateCfg_(nullptr),
+listenerRateGroup_(nullptr), backpressureLevel_(0), running_(true), kcp_(nullptr)
 {
   base_ = event_base_new();
   assert(base_ != nullptr);
 
   kcp_ = ikcp_create(kcpConv_, this);
   kcp_->output = cb_kcpOutput;
-  ikcp_wndsize(kcp_, 256, 256);  // set kcp windown size
-  ikcp_nodelay(kcp_,
-               1,  // enable nodelay
-               10, // interval ms
-               2,  // fastresend: 2
-               1); // no traffic control
+  kcpParams_.apply(kcp_);
 
   kcpInBuf_ = evbuffer_new();
   assert(kcpInBuf_ != nullptr);
+
+  randomBytes(helloRandom_, sizeof(helloRandom_));
+
+  addListeners({RouteListener{listenIP, listenPort, ROUTE_DEFAULT}});
 }
 
 Client::~Client() {
-  if (listener_)
-    evconnlistener_free(listener_);
+  if (control_)
+    delete control_;
+  for (auto l : listeners_) {
+    if (l->listener_)
+      delete l->listener_;
+    delete l;
+  }
 
   evbuffer_free(kcpInBuf_);
   ikcp_release(kcp_);
 
-  if (udpReadEvent_) {
-    event_del(udpReadEvent_);
-  	event_free(udpReadEvent_);
-  }
+  if (udpChannel_)
+    delete udpChannel_;  // fd will auto close
   if (exitEvTimer_) {
     event_del(exitEvTimer_);
     event_free(exitEvTimer_);
@@ -138,7 +228,36 @@ Client::~Client() {
     event_del(kcpKeepAliveTimer_);
     event_free(kcpKeepAliveTimer_);
   }
+  if (kcpUpdateTimer_) {
+    event_del(kcpUpdateTimer_);
+    event_free(kcpUpdateTimer_);
+  }
+  if (pmtuTimer_) {
+    event_del(pmtuTimer_);
+    event_free(pmtuTimer_);
+  }
+  if (reloadEvent_) {
+    event_del(reloadEvent_);
+    event_free(reloadEvent_);
+  }
+  if (idleTimer_) {
+    event_del(idleTimer_);
+    event_free(idleTimer_);
+  }
+  if (captureEvent_) {
+    event_del(captureEvent_);
+    event_free(captureEvent_);
+  }
+  if (capture_)
+    delete capture_;
+
+  if (listenerRateGroup_)
+    bufferevent_rate_limit_group_free(listenerRateGroup_);
+  if (streamRateCfg_)
+    ev_token_bucket_cfg_free(streamRateCfg_);
 
+  if (ioEngine_)
+    delete ioEngine_;
   event_base_free(base_);
 
   LOG(INFO) << "client closed";
@@ -150,12 +269,25 @@ void Client::stop() {
 
   running_ = false;
 
-  LOG(INFO) << "stop tcp listener...";
-  evconnlistener_disable(listener_);
+  LOG(INFO) << "stop tcp listeners...";
+  for (auto l : listeners_) {
+    if (l->listener_)
+      l->listener_->disable();
+  }
 
   LOG(INFO) << "remove all tcp connections...";
+  vector<ClientTCPSession *> sessions;
   for (auto conn : conns_) {
-    removeConnection(conn.second, true);
+    sessions.push_back(conn.second);
+  }
+  for (auto session : sessions) {
+    removeConnection(session, true);
+  }
+  for (auto l : listeners_) {
+    for (const auto &p : l->preopened_) {
+      sendKcpCloseMsg(p.connIdx_);
+    }
+    l->preopened_.clear();
   }
 
   // stop server in N seconds, let it send close kcp msg to server
@@ -176,28 +308,92 @@ void Client::exitLoop() {
 }
 
 bool Client::setup() {
+  ioEngine_ = IoEngine::create(ioEngineName_, base_);
+  LOG(INFO) << "io engine: " << ioEngine_->name();
+
+  // reload config on SIGHUP, handled on the loop
+  reloadEvent_ = evsignal_new(base_, SIGHUP, Client::cb_reload, this);
+  event_add(reloadEvent_, nullptr);
+
+  // packet capture ring, SIGUSR1 dumps it
+  if (captureMaxPackets_ > 0) {
+    capture_ = new PacketCapture(captureMaxPackets_, captureSnaplen_);
+    captureEvent_ = evsignal_new(base_, SIGUSR1, Client::cb_dumpCapture, this);
+    event_add(captureEvent_, nullptr);
+    LOG(INFO) << "packet capture: " << captureMaxPackets_ << " packets, snaplen: "
+    << captureSnaplen_;
+  }
+
+  applyRateLimits();
+
+  // one timer for the idle timeouts of all the sessions
+  idleTimer_ = event_new(base_, -1, EV_PERSIST, Client::cb_idleTick, this);
+  struct timeval idleTick = {IDLE_WHEEL_TICK / 1000, (IDLE_WHEEL_TICK % 1000) * 1000};
+  event_add(idleTimer_, &idleTick);
+
+  //
+  // get upstream udp address
   //
-  // create udp sock
+  vector<struct sockaddr_storage> addrs;
+  if (!resolve(udpUpstreamHost_, udpUpstreamPort_, udpUpstreamFamily_,
+               SOCK_DGRAM, &addrs)) {
+    return false;
+  }
+  if (udpUpstreamFamily_ != ADDR_FAMILY_FASTEST) {
+    addrs.resize(1);  // the first one of the preferred family
+  }
+
+  bool hasV6 = false;
+  for (const auto &a : addrs) {
+    if (a.ss_family == AF_INET6)
+      hasV6 = true;
+  }
+
   //
-  udpSockFd_ = socket(AF_INET, SOCK_DGRAM, 0);
+  // create udp sock, a dual-stack v6 one if any candidate is v6
+  //
+  udpSockFd_ = socket(hasV6 ? AF_INET6 : AF_INET, SOCK_DGRAM, 0);
   if (udpSockFd_ == -1) {
     LOG(ERROR) << "create udp socket failure: " << strerror(errno);
     return false;
   }
+  if (hasV6) {
+    int off = 0;
+    setsockopt(udpSockFd_, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  }
+  if (pmtuEnabled_ && sockOpts_.udpPmtuDisc_ < 0) {
+    // DF on every datagram, ignore the kernel's pmtu cache: we probe it
+    sockOpts_.udpPmtuDisc_ = IP_PMTUDISC_PROBE;
+  }
+  else if (pmtuEnabled_ && sockOpts_.udpPmtuDisc_ != IP_PMTUDISC_PROBE) {
+    LOG(WARNING) << "pmtu discovery expects udp_pmtu_discover \"probe\", "
+    << "probes may be refused by the kernel's pmtu cache or sent without DF";
+  }
+  setUdpSocketOptions(udpSockFd_, sockOpts_);
+  sockOpts_.log();
+
+  udpUpstreamCandidates_.clear();
+  for (const auto &a : addrs) {
+    struct sockaddr_storage ss;
+    if (hasV6) {
+      sockaddrToV4Mapped(&a, &ss);
+    } else {
+      ss = a;
+    }
+    udpUpstreamCandidates_.push_back(ss);
+  }
+  udpUpstreamAddr_    = udpUpstreamCandidates_[0];
+  udpUpstreamAddrLen_ = sockaddrLen((struct sockaddr *)&udpUpstreamAddr_);
 
   // make non-blocking
   fcntl(udpSockFd_, F_SETFL, O_NONBLOCK);
 
   // add event
-  udpReadEvent_ = event_new(base_, udpSockFd_, EV_READ|EV_PERSIST,
-                            cb_udpRead, this);
-  event_add(udpReadEvent_, nullptr);
-
-  // get upstream udp address
-  memset(&udpUpstreamAddr_, 0, sizeof(udpUpstreamAddr_));
-  udpUpstreamAddr_.sin_family = AF_INET;
-  udpUpstreamAddr_.sin_port   = htons(udpUpstreamPort_);
-  if (!resolve(udpUpstreamHost_, &udpUpstreamAddr_.sin_addr)) {
+  // large enough for the biggest pmtu probe
+  udpChannel_ = ioEngine_->openUdp(udpSockFd_,
+                                   std::max((size_t)MAX_MESSAGE_LEN, (size_t)pmtuMax_),
+                                   cb_udpRead, this);
+  if (udpChannel_ == nullptr) {
     return false;
   }
 
@@ -226,29 +422,35 @@ bool Client::setup() {
     return false;
   }
 
-  //
-  // listen tcp address
-  //
-  struct sockaddr_in sin;
-  memset(&sin, 0, sizeof(sin));
-  sin.sin_family = AF_INET;
-  sin.sin_port   = htons(listenPort_);
-  sin.sin_addr.s_addr = htonl(INADDR_ANY);
-  if (inet_pton(AF_INET, listenIP_.c_str(), &sin.sin_addr) == 0) {
-    LOG(ERROR) << "invalid ip: " << listenIP_;
+  // an old server would send the streams of every route to its upstream
+  if (routesWanted() && !routesEnabled_) {
+    LOG(ERROR) << "server doesn't support tcp_listeners of routes other "
+    << "than 0";
     return false;
   }
+  if (openStatusWanted_ && !openStatusEnabled_) {
+    LOG(WARNING) << "server doesn't answer stream opens, no retries & "
+    << "preopened streams";
+  }
 
-  listener_ = evconnlistener_new_bind(base_,
-                                      Client::listenerCallback,
-                                      (void*)this,
-                                      LEV_OPT_REUSEABLE|LEV_OPT_CLOSE_ON_FREE,
-                                      // backlog, Set to -1 for a reasonable default
-                                      -1,
-                                      (struct sockaddr*)&sin, sizeof(sin));
-  if(!listener_) {
-    LOG(ERROR) << "cannot create listener: " << listenIP_ << ":" << listenPort_;
-    return false;
+  //
+  // listen tcp addresses
+  //
+  for (auto l : listeners_) {
+    struct sockaddr_storage sin;
+    if (!parseIPAddr(l->ip_, l->port_, &sin)) {
+      return false;
+    }
+
+    l->listener_ = ioEngine_->listen((struct sockaddr*)&sin,
+                                     sockaddrLen((struct sockaddr*)&sin),
+                                     Client::listenerCallback, (void*)l);
+    if(!l->listener_) {
+      LOG(ERROR) << "cannot create listener: " << l->ip_ << ":" << l->port_;
+      return false;
+    }
+    LOG(INFO) << "listen tcp: " << l->ip_ << ":" << l->port_
+    << ", route: " << l->route_;
   }
 
   //
@@ -256,35 +458,168 @@ bool Client::setup() {
   //
   kcpUpdateTimer_ = event_new(base_, -1, EV_PERSIST,
                               Client::cb_kcpUpdate, this);
-  struct timeval timer_10ms = {0, 10000};  // 10ms
-  event_add(kcpUpdateTimer_, &timer_10ms);
+  struct timeval interval = kcpParams_.updateInterval();
+  event_add(kcpUpdateTimer_, &interval);
 
   //
-  // KCP keep alive
+  // KCP keep alive, pings instead when the server took them
   //
   kcpKeepAliveTimer_ = event_new(base_, -1, EV_PERSIST,
                                  Client::cb_kcpKeepAlive, this);
   struct timeval timer_20s = {20, 0};
-  event_add(kcpKeepAliveTimer_, &timer_20s);
+  struct timeval pingInterval = {pingInterval_ / 1000, (pingInterval_ % 1000) * 1000};
+  event_add(kcpKeepAliveTimer_, pingEnabled_ ? &pingInterval : &timer_20s);
+  if (pingEnabled_) {
+    pingStartTime_ = iclock64();
+    sendPing();
+  }
+
+  //
+  // control socket
+  //
+  if (!controlPath_.empty()) {
+    control_ = new ControlServer(base_, Client::cb_control, this);
+    if (!control_->listen(controlPath_)) {
+      return false;
+    }
+  }
+
+  //
+  // path mtu discovery
+  //
+  if (pmtuEnabled_) {
+    pmtuTimer_ = event_new(base_, -1, EV_PERSIST, Client::cb_pmtu, this);
+    struct timeval timer_pmtu = {0, PMTU_PROBE_TIMEOUT * 1000};
+    event_add(pmtuTimer_, &timer_pmtu);
+
+    // try the max first, it's the common case
+    startPmtuSearch(pmtuMax_);
+  }
+
+  for (auto l : listeners_) {
+    preopenStreams(l);
+  }
 
   return true;
 }
 
+void Client::addListeners(const vector<RouteListener> &listeners) {
+  for (const auto &r : listeners) {
+    ClientListener *l = new ClientListener();
+    l->client_   = this;
+    l->listener_ = nullptr;
+    l->ip_       = r.ip_;
+    l->port_     = r.port_;
+    l->route_    = r.route_;
+    listeners_.push_back(l);
+  }
+}
+
+bool Client::routesWanted() const {
+  for (auto l : listeners_) {
+    if (l->route_ != ROUTE_DEFAULT)
+      return true;
+  }
+  return false;
+}
+
+uint32_t Client::offeredFeatures() const {
+  uint32_t features = 0;
+  if (!tunnelKey_.empty()) {
+    features |= aeadOfferedFeatures(tunnelCipher_);
+  }
+  if (checksumWanted_) {
+    features |= TUNNEL_FEATURE_CRC32C;
+  }
+  if (compactWanted_) {
+    features |= TUNNEL_FEATURE_COMPACT_HEADER;
+  }
+  if (routesWanted()) {
+    features |= TUNNEL_FEATURE_STREAM_ROUTES;
+  }
+  if (openStatusWanted_) {
+    features |= TUNNEL_FEATURE_OPEN_STATUS;
+  }
+  if (pingInterval_ > 0) {
+    features |= TUNNEL_FEATURE_DATAGRAM_PING;
+  }
+  if (notifyDeltaWanted_) {
+    features |= TUNNEL_FEATURE_NOTIFY_DELTA;
+  }
+  return features;
+}
+
+uint16_t Client::newConnIdx() {
+  // 0 is KCP_MSG_CONNIDX_NONE, skip the ones still in use after a wrap
+  size_t pos;
+  do {
+    connIdx_++;
+  } while (connIdx_ == KCP_MSG_CONNIDX_NONE || conns_.count(connIdx_) ||
+           findPreopened(connIdx_, &pos) != nullptr);
+  return connIdx_;
+}
+
+void Client::preopenStreams(ClientListener *listener) {
+  if (!openStatusEnabled_)
+    return;
+
+  while (listener->preopened_.size() < (size_t)streamPreopen_) {
+    PreopenedStream p;
+    p.connIdx_   = newConnIdx();
+    p.openTime_  = iclock64();
+    p.openMs_    = -1;
+    p.connectMs_ = -1;
+    listener->preopened_.push_back(p);
+    sendKcpOpenMsg(p.connIdx_, listener->route_, "");
+  }
+}
+
+ClientListener *Client::findPreopened(const uint16_t connIdx, size_t *pos) {
+  for (auto l : listeners_) {
+    for (size_t i = 0; i < l->preopened_.size(); i++) {
+      if (l->preopened_[i].connIdx_ == connIdx) {
+        *pos = i;
+        return l;
+      }
+    }
+  }
+  return nullptr;
+}
+
 void Client::sendInitKCPConvPkg() {
   // send init kcp conv pkg
   string msg;
-  msg.resize(12);
-
-  uint8_t *p = (uint8_t *)msg.data();
-  *(uint32_t *)p = 0u;
-  p += 4;
-  *(uint32_t *)p = kcpConv_;
-  p += 4;
-  *(uint32_t *)p = kcpConv_ + 1;
+  if (offeredFeatures() == 0) {
+    msg.resize(LEGACY_HELLO_LEN);
+
+    uint8_t *p = (uint8_t *)msg.data();
+    *(uint32_t *)p = 0u;
+    p += 4;
+    *(uint32_t *)p = kcpConv_;
+    p += 4;
+    *(uint32_t *)p = kcpConv_ + 1;
+  } else {
+    Hello hello;
+    hello.conv_     = kcpConv_;
+    hello.features_ = offeredFeatures();
+    memcpy(hello.random_, helloRandom_, HELLO_RANDOM_LEN);
+    hello.time_     = (uint64_t)iclock64();
+    msg = tunnelKey_.makeHello(hello, nullptr);
+  }
 
-  sendto(udpSockFd_, msg.data(), msg.size(), MSG_DONTWAIT,
-         (struct sockaddr *)&udpUpstreamAddr_,
-         sizeof(udpUpstreamAddr_));
+  // before the handshake, send to every candidate, after it (re-send) only
+  // to the chosen one
+  if (isInitKCPConv_) {
+    sendPlainDatagram(msg.data(), msg.size(),
+                      (struct sockaddr *)&udpUpstreamAddr_, udpUpstreamAddrLen_);
+  } else {
+    for (const auto &a : udpUpstreamCandidates_) {
+      sendPlainDatagram(msg.data(), msg.size(), (struct sockaddr *)&a,
+                        sockaddrLen((struct sockaddr *)&a));
+    }
+  }
+  ioEngine_->flush();
+  initKCPConvSendTime_ = iclock64();
 }
 
 void Client::cb_initKCP(evutil_socket_t fd,
@@ -321,16 +656,99 @@ void Client::cb_kcpUpdate(evutil_socket_t fd,
                           short events, void *ptr) {
   Client *client = static_cast<Client *>(ptr);
   ikcp_update(client->kcp_, iclock());
+  client->ioEngine_->flush();
+  client->checkBackpressure();
+}
+
+void Client::checkBackpressure() {
+  int level = backpressureLevel(ikcp_waitsnd(kcp_), kcpParams_.sndWnd_);
+  // over the tunnel ceiling, counting what's queued in kcp but not sent yet:
+  // only HIGH streams are read until it refills
+  if (tunnelBucket_.isEmpty(iclock64(), (int64_t)kcp_->nsnd_que * kcp_->mss)) {
+    level = BACKPRESSURE_LEVEL_MAX;
+  }
+  if (level == backpressureLevel_)
+    return;
+
+  DLOG(INFO) << "kcp backpressure level: " << backpressureLevel_ << " -> " << level;
+  backpressureLevel_ = level;
+  for (auto conn : conns_) {
+    conn.second->setReadPaused(isStreamPaused(conn.second->prio_, level));
+  }
+}
+
+void Client::cb_idleTick(evutil_socket_t fd, short events, void *ptr) {
+  Client *client = static_cast<Client *>(ptr);
+  client->idleWheel_.advance(iclock64(), Client::cb_idleTimeout, client);
+}
+
+void Client::cb_idleTimeout(TimerWheelNode *node, void *ptr) {
+  static_cast<Client *>(ptr)->checkIdleTimeout(
+    static_cast<ClientTCPSession *>(node->owner_), iclock64());
+}
+
+void Client::checkIdleTimeout(ClientTCPSession *session, const IINT64 now) {
+  short what;
+  const IINT64 deadline = session->idleDeadline(tcpReadTimeout_,
+                                                tcpWriteTimeout_, now, &what);
+  if (what != 0 && deadline <= now) {
+    // the same as bufferevent's own timeout event
+    cb_tcpEvent(nullptr, BEV_EVENT_TIMEOUT | what, session);
+    return;
+  }
+
+  if (deadline == 0) {
+    session->idleNode_.unlink();  // timeouts are off
+    return;
+  }
+  // activity only moves the stamps, the wheel brings it back here
+  idleWheel_.schedule(&session->idleNode_, deadline);
+}
+
+void Client::applyRateLimits() {
+  // the sessions keep a pointer to the cfg, free the old one after them
+  struct ev_token_bucket_cfg *oldCfg = streamRateCfg_;
+  streamRateCfg_ = rateLimits_.stream_.newBucketCfg();
+
+  struct bufferevent_rate_limit_group *oldGroup = nullptr;
+  struct ev_token_bucket_cfg *groupCfg = rateLimits_.listener_.newBucketCfg();
+  if (groupCfg == nullptr) {
+    oldGroup = listenerRateGroup_;
+    listenerRateGroup_ = nullptr;
+  } else {
+    // the group copies the cfg
+    if (listenerRateGroup_ == nullptr) {
+      listenerRateGroup_ = bufferevent_rate_limit_group_new(base_, groupCfg);
+    } else {
+      bufferevent_rate_limit_group_set_cfg(listenerRateGroup_, groupCfg);
+    }
+    ev_token_bucket_cfg_free(groupCfg);
+  }
+
+  for (auto conn : conns_) {
+    conn.second->setRateLimit(streamRateCfg_, listenerRateGroup_);
+  }
+  if (oldCfg)
+    ev_token_bucket_cfg_free(oldCfg);
+  if (oldGroup)
+    bufferevent_rate_limit_group_free(oldGroup);  // no members left
+
+  tunnelBucket_.setLimit(rateLimits_.tunnel_, iclock64());
+
+  LOG(INFO) << "rate limit, stream: " << rateLimits_.stream_.toString()
+  << ", listener: " << rateLimits_.listener_.toString()
+  << ", tunnel: " << rateLimits_.tunnel_.toString();
 }
 
 void Client::kcpUpdateManually() {
   event_del(kcpUpdateTimer_);
 
   ikcp_update(kcp_, iclock());
+  ioEngine_->flush();
 
   // set agagin
-  struct timeval timer_10ms = {0, 10000};  // 10ms
-  event_add(kcpUpdateTimer_, &timer_10ms);
+  struct timeval interval = kcpParams_.updateInterval();
+  event_add(kcpUpdateTimer_, &interval);
 }
 
 void Client::cb_kcpKeepAlive(evutil_socket_t fd,
@@ -339,6 +757,11 @@ void Client::cb_kcpKeepAlive(evutil_socket_t fd,
 }
 
 void Client::kcpKeepAlive() {
+  if (pingEnabled_) {
+    sendPing();
+    return;
+  }
+
   //
   // KCP_MSG_TYPE_KEEPALIVE
   // | len(2) | 0x0000(2) | 0x02(1) |
@@ -361,49 +784,483 @@ void Client::kcpKeepAlive() {
   sendKcpMsg(kcpMsg);
 }
 
-void Client::listenerCallback(struct evconnlistener *listener,
-                              evutil_socket_t fd,
-                              struct sockaddr* saddr,
-                              int socklen, void *ptr) {
-  static uint16_t connIdx = 1u;  // TODO
+void Client::sendPing() {
+  const IINT64 now = iclock64();
+  const IINT64 silent = now - std::max(ping_.pongTime_, pingStartTime_);
+  if (!pingSilent_ && silent >= (IINT64)pingInterval_ * PING_SILENT_INTERVALS) {
+    LOG(WARNING) << "tunnel silent, no pong for " << silent << " ms";
+    pingSilent_ = true;
+  }
 
-  Client *client = static_cast<Client *>(ptr);
+  const string msg = ping_.makePing(udpSent_, udpRecv_, now);
+  sendDatagram(msg.data(), msg.size(),
+               (struct sockaddr *)&udpUpstreamAddr_, udpUpstreamAddrLen_);
+  ioEngine_->flush();
+}
+
+void Client::cb_pmtu(evutil_socket_t fd, short events, void *ptr) {
+  static_cast<Client *>(ptr)->pmtuTick();
+}
+
+void Client::pmtuTick() {
+  if (!pmtuSetAcked_) {
+    sendPmtuSet();
+  }
+
+  if (pmtuProbeSize_ == 0) {
+    // idle, re-probe: the path may have changed
+    if (iclock64() >= pmtuNextSearchTime_) {
+      startPmtuSearch(pmtu_);
+    }
+    return;
+  }
+
+  if (iclock64() - pmtuProbeSendTime_ < PMTU_PROBE_TIMEOUT) {
+    return;
+  }
+
+  // probe lost, the loss of a probe is not congestion, try again
+  if (++pmtuProbeTries_ < PMTU_PROBE_MAX_TRIES) {
+    sendPmtuProbe();
+    return;
+  }
+
+  DLOG(INFO) << "pmtu probe failure, size: " << pmtuProbeSize_;
+  pmtuHigh_ = pmtuProbeSize_;
+  nextPmtuProbe();
+}
+
+void Client::startPmtuSearch(const uint16_t firstProbeSize) {
+  pmtuLow_  = PMTU_MIN;
+  pmtuHigh_ = pmtuMax_ + 1;
+
+  pmtuProbeSize_  = std::max((uint16_t)PMTU_MIN, firstProbeSize);
+  pmtuProbeTries_ = 0;
+  sendPmtuProbe();
+}
+
+void Client::nextPmtuProbe() {
+  if (pmtuHigh_ - pmtuLow_ > PMTU_SEARCH_GRANULARITY) {
+    pmtuProbeSize_  = (pmtuLow_ + pmtuHigh_) / 2;
+    pmtuProbeTries_ = 0;
+    sendPmtuProbe();
+    return;
+  }
+
+  // search done
+  pmtuProbeSize_      = 0;
+  pmtuNextSearchTime_ = iclock64() + PMTU_REPROBE_INTERVAL;
+
+  if (pmtuLow_ == pmtu_) {
+    return;
+  }
+  LOG(INFO) << "path mtu: " << pmtuLow_ << ", was: " << pmtu_;
+  pmtu_ = pmtuLow_;
+
+  applyKcpMtu();
+  pmtuSetAcked_ = false;
+  sendPmtuSet();
+}
+
+void Client::sendPmtuProbe() {
+  //
+  // KCP_CTRL_TYPE_PMTU_PROBE
+  // | 0u(4) | magic(4) | 0x01 | id(4) | size(2) | padding |
+  //
+  // pmtuProbeSize_ is the datagram on the wire, sealed or not
+  string msg = makeCtrlDatagram(KCP_CTRL_TYPE_PMTU_PROBE,
+                                pmtuProbeSize_ - datagramOverhead());
+  uint8_t *p = (uint8_t *)msg.data() + KCP_CTRL_HEADER_LEN;
+  *(uint32_t *)p = ++pmtuProbeId_;
+  p += 4;
+  *(uint16_t *)p = pmtuProbeSize_;
+
+  sendDatagram(msg.data(), msg.size(),
+               (struct sockaddr *)&udpUpstreamAddr_, udpUpstreamAddrLen_);
+  ioEngine_->flush();
+  pmtuProbeSendTime_ = iclock64();
+}
+
+void Client::sendPmtuSet() {
+  //
+  // KCP_CTRL_TYPE_PMTU_SET
+  // | 0u(4) | magic(4) | 0x02 | mtu(2) |
+  //
+  string msg = makeCtrlDatagram(KCP_CTRL_TYPE_PMTU_SET, KCP_CTRL_HEADER_LEN + 2);
+  *(uint16_t *)(msg.data() + KCP_CTRL_HEADER_LEN) = pmtu_;
+
+  sendDatagram(msg.data(), msg.size(),
+               (struct sockaddr *)&udpUpstreamAddr_, udpUpstreamAddrLen_);
+  ioEngine_->flush();
+}
+
+void Client::applyKcpMtu() {
+  // pmtu_ is the datagram size, the seal overhead is outside of kcp
+  ikcp_setmtu(kcp_, (pmtu_ ? pmtu_ : KCP_MTU_DEFAULT) - datagramOverhead());
+}
+
+void Client::handleCtrlDatagram(const int type,
+                                const uint8_t *data, size_t len) {
+  const uint8_t *p = data + KCP_CTRL_HEADER_LEN;
+
+  if (type == KCP_CTRL_TYPE_PMTU_PROBE) {
+    // the echo must be intact, a truncated or stale one doesn't count
+    if (len < KCP_CTRL_HEADER_LEN + 6 || pmtuProbeSize_ == 0 ||
+        *(uint32_t *)p != pmtuProbeId_ ||
+        *(uint16_t *)(p + 4) != pmtuProbeSize_ ||
+        len + datagramOverhead() != pmtuProbeSize_) {
+      return;
+    }
+    pmtuLow_ = pmtuProbeSize_;
+    nextPmtuProbe();
+  }
+  else if (type == KCP_CTRL_TYPE_PMTU_SET) {
+    if (len < KCP_CTRL_HEADER_LEN + 2)
+      return;
+    // the server clamps it to its pmtu_max, take what it applied
+    const uint16_t mtu = *(uint16_t *)p;
+    if (mtu < PMTU_MIN || mtu > pmtu_) {
+      return;  // stale
+    }
+    if (mtu != pmtu_) {
+      LOG(INFO) << "path mtu: " << mtu << ", was: " << pmtu_
+      << ", clamped by the server";
+      pmtu_ = mtu;
+      applyKcpMtu();
+    }
+    pmtuSetAcked_ = true;
+  }
+  else if (type == KCP_CTRL_TYPE_PONG) {
+    const IINT64 now = iclock64();
+    if (ping_.handlePong(data, len, udpRecv_, now) && pingSilent_) {
+      LOG(INFO) << "tunnel back, " << ping_.stats(now);
+      pingSilent_ = false;
+    }
+  }
+  else {
+    LOG_EVERY_MS(ERROR, 1000) << "unknown control datagram type: " << type;
+  }
+}
+
+void Client::cb_reload(evutil_socket_t fd, short events, void *ptr) {
+  static_cast<Client *>(ptr)->reloadConfig();
+}
+
+void Client::reloadConfig() {
+  if (config_.path().empty())
+    return;
+
+  Config conf = config_;
+  if (!conf.load(config_.path())) {
+    LOG(ERROR) << "reload config failure, keep the running one";
+    return;
+  }
+  LOG(INFO) << "reload config: " << conf.path() << ", changed keys: "
+  << conf.logDiff(config_);
+
+  if (conf.changed(config_, "tcp_read_timeout") ||
+      conf.changed(config_, "tcp_write_timeout")) {
+    tcpReadTimeout_  = (int32_t)conf.getInt("tcp_read_timeout");
+    tcpWriteTimeout_ = (int32_t)conf.getInt("tcp_write_timeout");
+    // against the new values, it may remove some
+    vector<ClientTCPSession *> sessions;
+    for (auto conn : conns_) {
+      sessions.push_back(conn.second);
+    }
+    const IINT64 now = iclock64();
+    for (auto session : sessions) {
+      checkIdleTimeout(session, now);
+    }
+  }
+  gLogPayloadSample = (uint32_t)conf.getInt("log_payload_sample");
+
+  {
+    RateLimits limits;
+    limits.load(conf);
+    if (limits.stream_ != rateLimits_.stream_ ||
+        limits.listener_ != rateLimits_.listener_ ||
+        limits.tunnel_ != rateLimits_.tunnel_) {
+      rateLimits_ = limits;
+      applyRateLimits();
+    }
+  }
+
+  // kcp, in place
+  {
+    const string before = KcpParams::effective(kcp_);
+    kcpParams_.load(conf);
+    kcpParams_.apply(kcp_);
+
+    const string after = KcpParams::effective(kcp_);
+    if (after != before) {
+      LOG(INFO) << "kcp params: " << before << " -> " << after;
+    }
+
+    // the update timer follows the interval
+    if (kcpUpdateTimer_) {
+      event_del(kcpUpdateTimer_);
+      struct timeval interval = kcpParams_.updateInterval();
+      event_add(kcpUpdateTimer_, &interval);
+    }
+  }
+
+  config_ = conf;
+}
+
+void Client::cb_dumpCapture(evutil_socket_t fd, short events, void *ptr) {
+  static_cast<Client *>(ptr)->dumpCapture("");
+}
+
+bool Client::dumpCapture(const string &path) {
+  if (capture_ == nullptr)
+    return false;
+
+  string file = path;
+  if (file.empty()) {
+    file = capturePath_ + "-" + std::to_string(time(nullptr)) + ".pcapng";
+  }
+
+  struct sockaddr_storage local;
+  socklen_t localLen = sizeof(local);
+  memset(&local, 0, sizeof(local));
+  getsockname(udpSockFd_, (struct sockaddr *)&local, &localLen);
+
+  return capture_->dump(file, (struct sockaddr *)&local);
+}
+
+bool Client::cb_control(const vector<string> &args, string *out, void *ptr) {
+  return static_cast<Client *>(ptr)->handleControlCommand(args, out);
+}
+
+bool Client::handleControlCommand(const vector<string> &args, string *out) {
+  const string &cmd = args[0];
+
+  if (cmd == "help") {
+    *out = "streams                       list streams with stats\n"
+           "kcp                           dump kcp state\n"
+           "close <connIdx>               close a stream\n"
+           "prio <connIdx> <high|normal|low>  set stream priority\n"
+           "flush                         flush kcp now\n"
+           "reload                        reload config\n"
+           "capture [file]                dump the packet capture ring\n";
+    return true;
+  }
+
+  if (cmd == "streams") {
+    const IINT64 now = iclock64();
+    char line[256];
+    snprintf(line, sizeof(line), "%-7s %-5s %-46s %-6s %8s %12s %12s %8s %8s %-6s %7s %7s\n",
+             "connIdx", "route", "peer", "prio", "age_s", "recv", "sent",
+             "in_q", "out_q", "paused", "open_ms", "conn_ms");
+    *out = line;
+    for (auto conn : conns_) {
+      const ClientTCPSession *s = conn.second;
+      snprintf(line, sizeof(line),
+               "%-7u %-5u %-46s %-6s %8lld %12llu %12llu %8zu %8zu %-6d %7d %7d\n",
+               s->connIdx_, s->route_, s->peer_.c_str(),
+               streamPrioName(s->prio_),
+               (long long)(now - s->startTime_) / 1000,
+               (unsigned long long)s->recvBytes_,
+               (unsigned long long)s->sentBytes_,
+               s->inputQueued(), s->outputQueued(), s->readPaused_ ? 1 : 0,
+               s->openMs_, s->connectMs_);
+      *out += line;
+    }
+    for (auto l : listeners_) {
+      for (const auto &p : l->preopened_) {
+        snprintf(line, sizeof(line),
+                 "%-7u %-5u %-46s %-6s %8lld %12d %12d %8d %8d %-6d %7d %7d\n",
+                 p.connIdx_, l->route_, "(preopened)", "-",
+                 (long long)(now - p.openTime_) / 1000, 0, 0, 0, 0, 0,
+                 p.openMs_, p.connectMs_);
+        *out += line;
+      }
+    }
+    return true;
+  }
+
+  if (cmd == "kcp") {
+    *out = dumpKcpState(kcp_);
+    *out += "tunnel tokens: " + std::to_string(tunnelBucket_.tokens()) +
+            " (" + rateLimits_.tunnel_.toString() + ")\n";
+    *out += "crypto: " + (codec_.enabled() ? codec_.stats() : "off") + "\n";
+    *out += "checksum: " + (checksum_.enabled() ?
+            string(crc32cHardware() ? "crc32c (sse4.2)" : "crc32c (table)") +
+            ", failures: " + std::to_string(checksum_.failures_) : "off") + "\n";
+    *out += "compact header: " +
+            (compact_.enabled() ? compact_.stats() : "off") + "\n";
+    *out += "backpressure: " + std::to_string(backpressureLevel_) +
+            ", streams: " + std::to_string(conns_.size()) + "\n";
+    *out += "udp datagrams, sent: " + std::to_string(udpSent_) +
+            ", recv: " + std::to_string(udpRecv_) + "\n";
+    *out += "ping: " + (pingEnabled_ ? ping_.stats(iclock64()) :
+                        string("off")) + "\n";
+    *out += "notify delta: " + (notifyDeltaEnabled_ ? notifyDelta_.stats() :
+                                string("off")) + "\n";
+    return true;
+  }
+
+  if (cmd == "close" || cmd == "prio") {
+    if (args.size() < 2) {
+      *out = "missing connIdx";
+      return false;
+    }
+    auto itr = conns_.find((uint16_t)strtoul(args[1].c_str(), nullptr, 10));
+    if (itr == conns_.end()) {
+      *out = "no such stream: " + args[1];
+      return false;
+    }
+    ClientTCPSession *session = itr->second;
+
+    if (cmd == "close") {
+      removeConnection(session, true);
+      return true;
+    }
+
+    int prio;
+    if (args.size() < 3 || !parseStreamPrio(args[2], &prio)) {
+      *out = "prio should be one of: high, normal, low";
+      return false;
+    }
+    session->prio_ = prio;
+    session->setReadPaused(isStreamPaused(prio, backpressureLevel_));
+    return true;
+  }
+
+  if (cmd == "flush") {
+    ikcp_flush(kcp_);
+    ioEngine_->flush();
+    return true;
+  }
+
+  if (cmd == "reload") {
+    reloadConfig();
+    return true;
+  }
+
+  if (cmd == "capture") {
+    if (capture_ == nullptr) {
+      *out = "packet capture is off, see capture_packets";
+      return false;
+    }
+    if (!dumpCapture(args.size() > 1 ? args[1] : "")) {
+      *out = "dump failure, see the log";
+      return false;
+    }
+    return true;
+  }
+
+  *out = "unknown command: " + cmd + ", try help";
+  return false;
+}
+
+void Client::listenerCallback(evutil_socket_t fd, void *ptr) {
+  ClientListener *listener = static_cast<ClientListener *>(ptr);
+  Client *client = listener->client_;
   struct event_base  *base = (struct event_base*)client->base_;
 
-  connIdx++;
-  ClientTCPSession *csession = new ClientTCPSession(connIdx, base,
-                                                    fd, client);
-  client->addConnection(csession);
+  // a preopened stream, an answered one first
+  vector<PreopenedStream> &preopened = listener->preopened_;
+  size_t pos = 0;
+  while (pos < preopened.size() && preopened[pos].openMs_ < 0) {
+    pos++;
+  }
+  if (pos == preopened.size()) {
+    pos = 0;
+  }
+
+  if (pos < preopened.size()) {
+    const PreopenedStream p = preopened[pos];
+    preopened.erase(preopened.begin() + pos);
+
+    ClientTCPSession *csession = new ClientTCPSession(p.connIdx_,
+                                                      listener->route_,
+                                                      base, fd, client);
+    csession->opening_   = (p.openMs_ < 0);
+    csession->openTime_  = p.openTime_;
+    csession->openMs_    = p.openMs_;
+    csession->connectMs_ = p.connectMs_;
+    csession->openTries_ = 1;
+    client->addConnection(csession, true);
+    client->preopenStreams(listener);
+    return;
+  }
+
+  ClientTCPSession *csession = new ClientTCPSession(client->newConnIdx(),
+                                                    listener->route_,
+                                                    base, fd, client);
+  client->addConnection(csession, false);
 }
 
-void Client::addConnection(ClientTCPSession *session) {
-  session->setTimeout(tcpReadTimeout_, tcpWriteTimeout_);
+void Client::addConnection(ClientTCPSession *session, const bool preopened) {
+  // before any data of it
+  if (explicitOpen() && !preopened) {
+    session->opening_   = openStatusEnabled_;
+    session->openTime_  = iclock64();
+    session->openTries_ = 1;
+    sendKcpOpenMsg(session->connIdx_, session->route_, "");
+  }
+  session->setRateLimit(streamRateCfg_, listenerRateGroup_);
+  session->setReadPaused(isStreamPaused(session->prio_, backpressureLevel_));
   conns_.insert(std::make_pair(session->connIdx_, session));
+  checkIdleTimeout(session, iclock64());
 }
 
-void Client::handleIncomingUDPMesasge(uint8_t *inData, size_t inDataSize) {
-  // check if it's init kcp conv pkg
-  if (inDataSize == 12 && recvInitKCPConvPkg(inData)) {
-    return;
+void Client::handleIncomingUDPMesasge(const struct sockaddr *addr,
+                                      const uint8_t *inData, size_t inDataSize) {
+  // check if it's init kcp conv pkg, it's never sealed
+  const bool isHello = recvInitKCPConvPkg(inData, inDataSize, addr);
+
+  if (!isHello && codec_.enabled()) {
+    inData = codec_.open(inData, inDataSize, &inDataSize);
+    if (inData == nullptr) {
+      LOG_EVERY_MS(WARNING, 1000) << "drop unauthenticated datagram from: "
+      << sockaddrToString(addr) << ", " << codec_.stats();
+      return;
+    }
+  } else if (!isHello && checksum_.enabled()) {
+    if (!checksum_.verify(inData, inDataSize, &inDataSize)) {
+      LOG_EVERY_MS(WARNING, 1000) << "drop corrupted datagram from: "
+      << sockaddrToString(addr) << ", checksum failures: "
+      << checksum_.failures_;
+      return;
+    }
+  } else if (!isHello && !tunnelKey_.empty()) {
+    return;  // not keyed yet
   }
 
-  if (ikcp_input(kcp_, (const char *)inData, inDataSize) < 0) {
-    LOG(ERROR) << "ikcp_input failure";
+  if (!isHello && compact_.enabled() &&
+      parseCtrlDatagram(inData, inDataSize) < 0) {
+    inData = compact_.expand(inData, inDataSize, kcpConv_, &inDataSize);
+    if (inData == nullptr) {
+      LOG_EVERY_MS(WARNING, 1000) << "drop malformed compact datagram from: "
+      << sockaddrToString(addr) << ", " << compact_.stats();
+      return;
+    }
+  }
 
+  if (capture_) {
+    capture_->record(CAPTURE_DIR_IN, inData, inDataSize, addr);
+  }
+  if (isHello) {
     return;
   }
+  udpRecv_++;
 
-  char buf[2048];
-  const int kLen = sizeof(buf);
+  const int ctrlType = parseCtrlDatagram(inData, inDataSize);
+  if (ctrlType >= 0) {
+    handleCtrlDatagram(ctrlType, inData, inDataSize);
+    return;
+  }
 
-  while (1) {
-    int size = ikcp_recv(kcp_, buf, kLen);
-    if (size < 0) break;
+  if (ikcp_input(kcp_, (const char *)inData, inDataSize) < 0) {
+    LOG_EVERY_MS(ERROR, 1000) << "ikcp_input failure";
 
-    // add to kcp coming evbuf
-    evbuffer_add(kcpInBuf_, buf, size);
+    return;
   }
 
+  readKcpRecvQueue(kcp_, kcpInBuf_);
+
   while (readKcpMsg()) {
   }
 
@@ -452,6 +1309,12 @@ bool Client::readKcpMsg() {
 
     if (type == KCP_MSG_TYPE_CLOSE_CONN) {
       handleKcpMsg_closeConn(msg);
+    } else if (type == KCP_MSG_TYPE_OPEN_OK) {
+      handleKcpMsg_openOk(msg);
+    } else if (type == KCP_MSG_TYPE_OPEN_FAIL) {
+      handleKcpMsg_openFail(msg);
+    } else if (type == KCP_MSG_TYPE_NOTIFY) {
+      handleKcpMsg_notify(msg);
     } else {
       LOG(ERROR) << "unkown kcp msg type: " << type;
     }
@@ -462,7 +1325,7 @@ bool Client::readKcpMsg() {
     // data message
     //
     handleKcpMsg(connIdx, msg.data() + 4, msg.size() - 4);
-    DLOG(INFO) << "kcp recv: " << string(msg.data() + 4, msg.size() - 4);
+    LOG_PAYLOAD("kcp recv", connIdx, msg.data() + 4, msg.size() - 4);
   }
 
   return true;  // read message success, return true
@@ -474,6 +1337,11 @@ void Client::handleKcpMsg(const uint16_t connIdx,
 
   if (itr == conns_.end()) {
     // can't find conn at Client side, tell Server close this conn
+    size_t pos;
+    ClientListener *l = findPreopened(connIdx, &pos);
+    if (l != nullptr) {
+      l->preopened_.erase(l->preopened_.begin() + pos);
+    }
     sendKcpCloseMsg(connIdx);
     return;
   }
@@ -482,6 +1350,47 @@ void Client::handleKcpMsg(const uint16_t connIdx,
   csession->sendData(data, len);
 }
 
+void Client::handleKcpMsg_notify(const string &msg) {
+  //
+  // KCP_MSG_TYPE_NOTIFY
+  // | len(2) | 0x0000(2) | 0x06 | connIdx(2) | flags(1) | crc32c(4) | ops |
+  //
+  if (msg.size() < NOTIFY_DELTA_HEADER) {
+    LOG(ERROR) << "invalid notify delta msg, len: " << msg.size();
+    return;
+  }
+  const uint8_t *p = (uint8_t *)msg.data();
+  const uint16_t connIdx = *(uint16_t *)(p + 5);
+  const uint8_t  flags   = *(p + 7);
+  const uint32_t crc     = *(uint32_t *)(p + 8);
+
+  auto itr = conns_.find(connIdx);
+  if (itr == conns_.end()) {
+    handleKcpMsg(connIdx, nullptr, 0);  // as data of it
+    return;
+  }
+  ClientTCPSession *csession = itr->second;
+
+  string line;
+  const string empty;
+  if (!NotifyDelta::decode((flags & NOTIFY_DELTA_FULL) ? empty : csession->lastNotify_,
+                           p + NOTIFY_DELTA_HEADER, msg.size() - NOTIFY_DELTA_HEADER,
+                           &line) ||
+      crc32c((const uint8_t *)line.data(), line.size()) != crc) {
+    // out of step with the server, the miner reconnects
+    LOG(ERROR) << "notify delta mismatch, close conn: " << connIdx;
+    removeConnection(csession, true);
+    return;
+  }
+  notifyDelta_.notifies_++;
+  notifyDelta_.inBytes_  += line.size();
+  notifyDelta_.outBytes_ += msg.size() - NOTIFY_DELTA_HEADER;
+
+  LOG_PAYLOAD("kcp recv", connIdx, line.data(), line.size());
+  csession->sendData(line.data(), line.size());
+  csession->lastNotify_.swap(line);
+}
+
 void Client::handleKcpMsg_closeConn(const string &msg) {
   //
   // KCP_MSG_TYPE_CLOSE_CONN
@@ -492,6 +1401,14 @@ void Client::handleKcpMsg_closeConn(const string &msg) {
 
   auto itr = conns_.find(connIdx);
   if (itr == conns_.end()) {
+    // a preopened one, the upstream closed it before any miner took it
+    size_t pos;
+    ClientListener *l = findPreopened(connIdx, &pos);
+    if (l != nullptr) {
+      l->preopened_.erase(l->preopened_.begin() + pos);
+      preopenStreams(l);
+      return;
+    }
     LOG(ERROR) << "handle close msg fail, can't find conn by Idx: " << connIdx;
     return;
   }
@@ -499,6 +1416,85 @@ void Client::handleKcpMsg_closeConn(const string &msg) {
   removeConnection(itr->second, false);
 }
 
+void Client::handleKcpMsg_openOk(const string &msg) {
+  //
+  // KCP_MSG_TYPE_OPEN_OK
+  // | len(2) | 0x0000(2) | 0x04 | connIdx(2) | connect ms(2) |
+  //
+  if (msg.size() < 9) {
+    LOG(ERROR) << "invalid open ok msg, size: " << msg.size();
+    return;
+  }
+  const uint8_t *p = (uint8_t *)msg.data();
+  const uint16_t connIdx   = *(uint16_t *)(p + 5);
+  const uint16_t connectMs = *(uint16_t *)(p + 7);
+
+  auto itr = conns_.find(connIdx);
+  if (itr != conns_.end()) {
+    ClientTCPSession *session = itr->second;
+    session->opening_   = false;
+    session->openMs_    = (int32_t)(iclock64() - session->openTime_);
+    session->connectMs_ = connectMs;
+    session->replay_.clear();
+    DLOG(INFO) << "conn opened: " << connIdx << ", open: "
+    << session->openMs_ << " ms, upstream connect: " << connectMs << " ms";
+    return;
+  }
+
+  size_t pos;
+  ClientListener *l = findPreopened(connIdx, &pos);
+  if (l != nullptr) {
+    PreopenedStream &s = l->preopened_[pos];
+    s.openMs_    = (int32_t)(iclock64() - s.openTime_);
+    s.connectMs_ = connectMs;
+  }
+}
+
+void Client::handleKcpMsg_openFail(const string &msg) {
+  //
+  // KCP_MSG_TYPE_OPEN_FAIL
+  // | len(2) | 0x0000(2) | 0x05 | connIdx(2) | reason(1) |
+  //
+  if (msg.size() < 8) {
+    LOG(ERROR) << "invalid open fail msg, size: " << msg.size();
+    return;
+  }
+  const uint8_t *p = (uint8_t *)msg.data();
+  const uint16_t connIdx = *(uint16_t *)(p + 5);
+  const int      reason  = *(p + 7);
+
+  auto itr = conns_.find(connIdx);
+  if (itr == conns_.end()) {
+    // a preopened one, the next accept opens a new one. the server keeps
+    // the failed conn until we close it
+    size_t pos;
+    ClientListener *l = findPreopened(connIdx, &pos);
+    if (l != nullptr) {
+      l->preopened_.erase(l->preopened_.begin() + pos);
+      LOG(WARNING) << "preopen conn failure: " << connIdx << ", "
+      << openFailReasonName(reason);
+    }
+    sendKcpCloseMsg(connIdx);
+    return;
+  }
+
+  // the server picks again, another upstream of the route maybe
+  ClientTCPSession *session = itr->second;
+  if (reason != OPEN_FAIL_ROUTE && session->replayable_ &&
+      session->openTries_ <= streamOpenRetries_) {
+    LOG(WARNING) << "open conn failure: " << connIdx << ", "
+    << openFailReasonName(reason) << ", open it again, try: "
+    << session->openTries_ + 1;
+    session->openTries_++;
+    sendKcpOpenMsg(connIdx, session->route_, session->replay_);
+    return;
+  }
+
+  LOG(WARNING) << "open conn failure: " << connIdx << ", "
+  << openFailReasonName(reason) << ", close the miner";
+  removeConnection(session, true);
+}
+
 void Client::removeConnection(ClientTCPSession *session,
                               bool isNeedSendCloseMsg) {
   if (isNeedSendCloseMsg)
@@ -508,6 +1504,34 @@ void Client::removeConnection(ClientTCPSession *session,
   delete session;
 }
 
+void Client::sendKcpOpenMsg(const uint16_t connIdx, const uint16_t route,
+                            const string &early) {
+  //
+  // KCP_MSG_TYPE_OPEN_CONN
+  // | len(2) | 0x0000(2) | 0x03 | connIdx(2) | route(2) | early data |
+  //
+  string kcpMsg;
+  kcpMsg.resize(2 + 2 + 1 + 2 + 2 + early.size());
+  assert(kcpMsg.size() <= UINT16_MAX);
+  uint8_t *p = (uint8_t *)kcpMsg.data();
+
+  *(uint16_t *)p = (uint16_t)kcpMsg.size();
+  p += 2;
+  *(uint16_t *)p = (uint16_t)KCP_MSG_CONNIDX_NONE;
+  p += 2;
+  *(uint8_t *)p++ = KCP_MSG_TYPE_OPEN_CONN;
+  *(uint16_t *)p = connIdx;
+  p += 2;
+  *(uint16_t *)p = route;
+  p += 2;
+  memcpy(p, early.data(), early.size());
+
+  sendKcpMsg(kcpMsg);
+
+  DLOG(INFO) << "send kcp msg, open conn: " << connIdx
+  << ", route: " << route << ", early data: " << early.size();
+}
+
 void Client::sendKcpCloseMsg(const uint16_t connIdx) {
   //
   // KCP Mesasge:
@@ -559,16 +1583,61 @@ void Client::sendKcpMsg(const string &msg) {
   kcpUpdateManually();
 }
 
-int Client::sendKcpDataLowLevel(const char *buf, int len, ikcpcb *kcp) {
-  // On success, these calls return the number of characters sent.
-  // On error, -1 is returned, and errno is set appropriately.
-  ssize_t r = sendto(udpSockFd_, buf, (size_t)len, MSG_DONTWAIT,
-                     (struct sockaddr *)&udpUpstreamAddr_,
-                     sizeof(udpUpstreamAddr_));
-  if (r == -1) {
-    LOG(ERROR) << "sendto error: " << strerror(errno);
+void Client::sendDatagram(const char *buf, size_t len,
+                          const struct sockaddr *addr, socklen_t addrLen) {
+  udpSent_++;  // not the hellos
+  if (!codec_.enabled() && !checksum_.enabled() && !compact_.enabled()) {
+    sendPlainDatagram(buf, len, addr, addrLen);
+    return;
+  }
+
+  // the capture keeps kcp's plaintext, kcpdump can't decode it otherwise
+  if (capture_) {
+    capture_->record(CAPTURE_DIR_OUT, (const uint8_t *)buf, len, addr);
+  }
+
+  const uint8_t *out = (const uint8_t *)buf;
+  size_t outLen = len;
+  if (compact_.enabled() && parseCtrlDatagram(out, outLen) < 0) {
+    out = compact_.compress(out, outLen, &outLen);
+    if (out == nullptr) {
+      LOG_EVERY_MS(ERROR, 1000) << "malformed kcp datagram, len: " << len;
+      return;
+    }
   }
-  return (int)r;
+  if (codec_.enabled()) {
+    out = codec_.seal(out, outLen, &outLen);
+  } else if (checksum_.enabled()) {
+    out = checksum_.append(out, outLen, &outLen);
+  }
+  tunnelBucket_.consume(outLen, iclock64());
+  if (udpSockConnected_ &&
+      sockaddrEqual((struct sockaddr *)&udpUpstreamAddr_, addr)) {
+    addr = nullptr;  // no route lookup per datagram
+    addrLen = 0;
+  }
+  udpChannel_->send((const char *)out, outLen, addr, addrLen);
+}
+
+void Client::sendPlainDatagram(const char *buf, size_t len,
+                               const struct sockaddr *addr, socklen_t addrLen) {
+  if (capture_) {
+    capture_->record(CAPTURE_DIR_OUT, (const uint8_t *)buf, len, addr);
+  }
+  tunnelBucket_.consume(len, iclock64());
+  if (udpSockConnected_ &&
+      sockaddrEqual((struct sockaddr *)&udpUpstreamAddr_, addr)) {
+    addr = nullptr;
+    addrLen = 0;
+  }
+  udpChannel_->send(buf, len, addr, addrLen);
+}
+
+int Client::sendKcpDataLowLevel(const char *buf, int len, ikcpcb *kcp) {
+  // queued, it will be sent with the others of this flush by ioEngine_->flush()
+  sendDatagram(buf, (size_t)len,
+               (struct sockaddr *)&udpUpstreamAddr_, udpUpstreamAddrLen_);
+  return len;
 }
 
 void Client::handleIncomingTCPMesasge(ClientTCPSession *session, string &msg) {
@@ -578,6 +1647,16 @@ void Client::handleIncomingTCPMesasge(ClientTCPSession *session, string &msg) {
   //
   const size_t maxMsgLen = UINT16_MAX - 4;
 
+  // for an open again, it must fit in the early data of one open msg
+  if (session->opening_ && session->replayable_) {
+    if (session->replay_.size() + msg.size() > STREAM_REPLAY_MAX) {
+      session->replayable_ = false;
+      session->replay_.clear();
+    } else {
+      session->replay_.append(msg);
+    }
+  }
+
   while (msg.size() > 0) {
     size_t len = std::min(maxMsgLen, msg.size());
     assert(len < UINT16_MAX);
@@ -604,7 +1683,7 @@ void Client::handleIncomingTCPMesasge(ClientTCPSession *session, string &msg) {
 
     // content
     memcpy(p, msg.data(), len);
-    DLOG(INFO) << "kcp send: " << string(msg.begin(), msg.begin() + len);
+    LOG_PAYLOAD("kcp send", session->connIdx_, msg.data(), len);
 
     // send
     sendKcpMsg(kcpMsg);
@@ -612,6 +1691,8 @@ void Client::handleIncomingTCPMesasge(ClientTCPSession *session, string &msg) {
     // remove the first `len` bytes from string
     msg.erase(msg.begin(), msg.begin() + len);
   } /* /while */
+
+  checkBackpressure();
 }
 
 int Client::cb_kcpOutput(const char *buf, int len, ikcpcb *kcp, void *ptr) {
@@ -619,30 +1700,99 @@ int Client::cb_kcpOutput(const char *buf, int len, ikcpcb *kcp, void *ptr) {
   return client->sendKcpDataLowLevel(buf, len, kcp);
 }
 
-bool Client::recvInitKCPConvPkg(const uint8_t *p) {
-  if (*(uint32_t *)p == 0u &&
-      *(uint32_t *)(p + 4) == kcpConv_ &&
-      *(uint32_t *)(p + 8) == kcpConv_ + 1) {
-    isInitKCPConv_ = true;
+bool Client::recvInitKCPConvPkg(const uint8_t *p, size_t len,
+                                const struct sockaddr *addr) {
+  if ((len != LEGACY_HELLO_LEN && len != HELLO_LEN) ||
+      *(uint32_t *)p != 0u ||
+      *(uint32_t *)(p + 4) != kcpConv_ ||
+      *(uint32_t *)(p + 8) != kcpConv_ + 1) {
+    return false;
+  }
+  if (isInitKCPConv_) {
+    return true;  // a later answer of another candidate
+  }
+
+  const struct sockaddr_storage *from = nullptr;
+  for (const auto &a : udpUpstreamCandidates_) {
+    if (sockaddrEqual((struct sockaddr *)&a, addr)) {
+      from = &a;
+      break;
+    }
+  }
+  if (from == nullptr) {
     return true;
   }
-  return false;
-}
 
-void Client::cb_udpRead(evutil_socket_t fd, short events, void *ptr) {
-  Client *client = static_cast<Client *>(ptr);
-  ssize_t res;
-  char buf[MAX_MESSAGE_LEN];
-
-  // These calls return the number of bytes received, or -1 if an error occurred.
-  // The return value will be 0 when the peer has performed an orderly shutdown.
-  res = recvfrom(fd, &buf, sizeof(buf), 0, nullptr, nullptr);
-  if (res == -1) {
-    LOG(ERROR) << "recvfrom error, return: " << res;
-    return;
+  int cipher = AEAD_NONE;
+  if (len == LEGACY_HELLO_LEN) {
+    if (!tunnelKey_.empty()) {
+      LOG_EVERY_MS(ERROR, 1000) << "server doesn't support tunnel_key: "
+      << sockaddrToString(addr);
+      return true;
+    }
+  } else {
+    Hello hello;
+    if (!tunnelKey_.parseHello(p, len, helloRandom_, &hello)) {
+      LOG_EVERY_MS(ERROR, 1000) << "hello authentication failure from: "
+      << sockaddrToString(addr) << ", tunnel_key mismatch?";
+      return true;
+    }
+
+    // only offered ones, exactly one cipher with a key
+    cipher = aeadFromFeatures(hello.features_);
+    if ((hello.features_ & ~offeredFeatures()) != 0 ||
+        (!tunnelKey_.empty() && cipher <= AEAD_NONE)) {
+      LOG_EVERY_MS(ERROR, 1000) << "invalid features of the server: "
+      << hello.features_ << ", offered: " << offeredFeatures()
+      << ", from: " << sockaddrToString(addr);
+      return true;
+    }
+    if (cipher != AEAD_NONE &&
+        !tunnelKey_.setSessionKeys(&codec_, cipher, true /* client */,
+                                   helloRandom_, hello.random_, kcpConv_)) {
+      return true;
+    }
+    checksum_.setEnabled(cipher == AEAD_NONE &&
+                         (hello.features_ & TUNNEL_FEATURE_CRC32C));
+    compact_.setEnabled(hello.features_ & TUNNEL_FEATURE_COMPACT_HEADER);
+    routesEnabled_ = (hello.features_ & TUNNEL_FEATURE_STREAM_ROUTES) != 0;
+    openStatusEnabled_ = (hello.features_ & TUNNEL_FEATURE_OPEN_STATUS) != 0;
+    pingEnabled_ = (hello.features_ & TUNNEL_FEATURE_DATAGRAM_PING) != 0;
+    notifyDeltaEnabled_ = (hello.features_ & TUNNEL_FEATURE_NOTIFY_DELTA) != 0;
+  }
+
+  // the first answer is from the path with the lowest rtt
+  udpUpstreamAddr_    = *from;
+  udpUpstreamAddrLen_ = sockaddrLen(addr);
+  isInitKCPConv_ = true;
+  if (sockOpts_.udpConnected_) {
+    // the kernel caches the route and drops the other candidates' answers
+    if (connect(udpSockFd_, (struct sockaddr *)&udpUpstreamAddr_,
+                udpUpstreamAddrLen_) == 0) {
+      udpSockConnected_ = true;
+    } else {
+      LOG(ERROR) << "connect udp socket failure: " << strerror(errno);
+    }
   }
+  applyKcpMtu();
+  LOG(INFO) << "init kcp conv with: " << sockaddrToString(addr)
+  << ", rtt: " << iclock64() - initKCPConvSendTime_ << " ms"
+  << ", candidates: " << udpUpstreamCandidates_.size()
+  << ", cipher: " << aeadCipherName(cipher)
+  << ", checksum: " << (checksum_.enabled() ? "crc32c" : "off")
+  << ", compact header: " << (compact_.enabled() ? "on" : "off")
+  << ", stream routes: " << (routesEnabled_ ? "on" : "off")
+  << ", open status: " << (openStatusEnabled_ ? "on" : "off")
+  << ", datagram ping: " << (pingEnabled_ ? "on" : "off")
+  << ", notify delta: " << (notifyDeltaEnabled_ ? "on" : "off");
+  return true;
+}
 
-  client->handleIncomingUDPMesasge((uint8_t *)buf, res);
+void Client::cb_udpRead(const uint8_t *data, size_t len,
+                        const struct sockaddr *addr, socklen_t addrLen,
+                        void *ptr) {
+  Client *client = static_cast<Client *>(ptr);
+  client->handleIncomingUDPMesasge(addr, data, len);
 }
 
 void Client::cb_tcpRead(struct bufferevent *bev, void *ptr) {
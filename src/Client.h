@@ -32,6 +32,20 @@
 #include <event2/listener.h>
 
 #include "ikcp.h"
+#include "IoEngine.h"
+#include "SocketOptions.h"
+#include "Config.h"
+#include "KcpParams.h"
+#include "RateLimit.h"
+#include "TimerWheel.h"
+#include "ControlServer.h"
+#include "PacketCapture.h"
+#include "TunnelCrypto.h"
+#include "Crc32c.h"
+#include "KcpCompact.h"
+#include "Routes.h"
+#include "TunnelPing.h"
+#include "NotifyDelta.h"
 
 
 class ClientTCPSession;
@@ -46,16 +60,78 @@ class ClientTCPSession {
 public:
   Client *client_;
   uint16_t connIdx_;  // connection index
+  uint16_t route_;    // of the listener
+
+  // TUNNEL_FEATURE_OPEN_STATUS: until the server answers the open, what has
+  // been sent is kept to open it again after an OPEN_FAIL
+  bool    opening_;
+  IINT64  openTime_;    // the open was sent
+  int32_t openMs_;      // open to OPEN_OK, -1: not yet
+  int32_t connectMs_;   // the server's upstream connect, -1: not yet
+  int     openTries_;
+  string  replay_;
+  bool    replayable_;  // replay_ holds all of it
+
+  // for the control socket
+  string   peer_;       // miner address
+  IINT64   startTime_;
+  uint64_t recvBytes_;  // read from tcp
+  uint64_t sentBytes_;  // written to tcp
+  int      prio_;
+  bool     readPaused_;
+  string   lastNotify_;  // reference of the next notify delta
+
+  // idle timeouts: stamped on activity, checked lazily on the Client's wheel
+  TimerWheelNode idleNode_;
+  IINT64 lastReadTime_;
+  IINT64 lastWriteTime_;  // last write progress, or when output got pending
 
 public:
-  ClientTCPSession(const uint16_t connIdx, struct event_base *base,
-                   evutil_socket_t fd, Client *client);
+  ClientTCPSession(const uint16_t connIdx, const uint16_t route,
+                   struct event_base *base, evutil_socket_t fd, Client *client);
   ~ClientTCPSession();
 
-	void setTimeout(const int32_t readTimeout, const int32_t writeTimeout);
+  void setReadPaused(const bool paused);
+  void setRateLimit(struct ev_token_bucket_cfg *cfg,
+                    struct bufferevent_rate_limit_group *group);
+  size_t inputQueued() const;
+  size_t outputQueued() const;
+
+  //
+  // the earliest time a timeout can fire: the deadline of a running one
+  // (`*what`: BEV_EVENT_READING or BEV_EVENT_WRITING), or now + the timeout
+  // of one that isn't running (`*what`: 0), it may start any time.
+  // 0: no timeouts.
+  //
+  IINT64 idleDeadline(const int32_t readTimeout, const int32_t writeTimeout,
+                      const IINT64 now, short *what) const;
 
   void recvData(struct evbuffer *buf);
   void sendData(const char *data, size_t len);
+
+  static void cb_output(struct evbuffer *buf,
+                        const struct evbuffer_cb_info *info, void *ptr);
+};
+
+
+
+//////////////////////////////// ClientListener //////////////////////////////
+// a stream opened ahead of an accept, the next miner takes it
+struct PreopenedStream {
+  uint16_t connIdx_;
+  IINT64   openTime_;
+  int32_t  openMs_;     // -1: not answered yet
+  int32_t  connectMs_;
+};
+
+// a tcp listener, its streams go to route_ on the server
+struct ClientListener {
+  Client      *client_;
+  TcpListener *listener_;
+  string       ip_;
+  uint16_t     port_;
+  uint16_t     route_;
+  vector<PreopenedStream> preopened_;
 };
 
 
@@ -67,37 +143,169 @@ class Client {
   struct event *exitEvTimer_;        // deley to stop server when exit
   struct event *kcpUpdateTimer_;     // call ikcp_update() interval
   struct event *kcpKeepAliveTimer_;  // kcp keep-alive
+  struct event *pmtuTimer_;          // path mtu probe timeout & re-probe
+  struct event *reloadEvent_;        // SIGHUP
+  struct event *captureEvent_;       // SIGUSR1: dump the capture ring
+
+  // the loaded config, SIGHUP reloads it
+  Config config_;
+
+  // runtime control
+  string controlPath_;
+  ControlServer *control_;
+
+  // the last udp datagrams, nullptr: off
+  PacketCapture *capture_;
+  size_t   captureMaxPackets_;
+  uint16_t captureSnaplen_;
+  string   capturePath_;  // prefix of the dump files
+
+  bool dumpCapture(const string &path);
+
+  // io backend
+  string      ioEngineName_;
+  IoEngine   *ioEngine_;
+
+  // socket tuning
+  SocketOptions sockOpts_;
 
   // upstream udp
   int      udpSockFd_;
   string   udpUpstreamHost_;
   uint16_t udpUpstreamPort_;
-  struct sockaddr_in udpUpstreamAddr_;
-  struct event *udpReadEvent_;
-
-  // listen tcp
-  struct evconnlistener *listener_;
-  string   listenIP_;
-  uint16_t listenPort_;
+  int      udpUpstreamFamily_;
+  struct sockaddr_storage udpUpstreamAddr_;
+  socklen_t udpUpstreamAddrLen_;
+  UdpChannel *udpChannel_;
+  bool udpSockConnected_;  // udp_connected, to udpUpstreamAddr_
+
+  // candidates of udpUpstreamAddr_, the first one answers the init kcp conv
+  // pkg wins (ADDR_FAMILY_FASTEST races all of them)
+  vector<struct sockaddr_storage> udpUpstreamCandidates_;
+  IINT64 initKCPConvSendTime_;
+
+  // listen tcp, the first one is listen_tcp_ip/port (route 0), then
+  // tcp_listeners
+  vector<ClientListener *> listeners_;
+
+  // the server opens the streams by route, offered in the hello when a
+  // listener has a route other than 0
+  bool routesEnabled_;
+  bool routesWanted() const;
+
+  // the server answers the opens, see Routes.h
+  bool openStatusWanted_;
+  bool openStatusEnabled_;
+  int  streamOpenRetries_;  // opens again after an OPEN_FAIL
+  int  streamPreopen_;      // streams opened ahead, per listener
+  bool explicitOpen() const { return routesEnabled_ || openStatusEnabled_; }
+
+  uint16_t connIdx_;  // the last one given
+  uint16_t newConnIdx();
+  void preopenStreams(ClientListener *listener);
+  // the listener it was opened for, nullptr: not preopened
+  ClientListener *findPreopened(const uint16_t connIdx, size_t *pos);
 
   // timeout
   int32_t tcpReadTimeout_;
   int32_t tcpWriteTimeout_;
+  TimerWheel idleWheel_;     // idle timeouts of all sessions
+  struct event *idleTimer_;  // ticks idleWheel_
+  void checkIdleTimeout(ClientTCPSession *session, const IINT64 now);
+
+  //
+  // path mtu discovery: binary search between pmtuLow_ (works) and pmtuHigh_
+  // (doesn't) with padded probes echoed by the server, the result is used
+  // as kcp mtu on both sides. re-probe every PMTU_REPROBE_INTERVAL.
+  //
+  bool     pmtuEnabled_;
+  uint16_t pmtuMax_;        // upper bound, also the udp recv buffer size
+  uint16_t pmtu_;           // confirmed, 0: not yet
+  uint16_t pmtuLow_;
+  uint16_t pmtuHigh_;
+  uint16_t pmtuProbeSize_;  // in flight, 0: idle
+  uint32_t pmtuProbeId_;
+  int32_t  pmtuProbeTries_;
+  IINT64   pmtuProbeSendTime_;
+  IINT64   pmtuNextSearchTime_;
+  bool     pmtuSetAcked_;   // server has applied pmtu_
+
+  void startPmtuSearch(const uint16_t firstProbeSize);
+  void nextPmtuProbe();
+  void sendPmtuProbe();
+  void sendPmtuSet();
+  void applyKcpMtu();
+  void handleCtrlDatagram(const int type, const uint8_t *data, size_t len);
+
+  //
+  // datagram ping beside kcp, see TunnelPing.h. off or with an old server,
+  // the keep-alive is a kcp message every 20s.
+  //
+  int32_t  pingInterval_;   // ms, 0: off
+  bool     pingEnabled_;    // the server took it
+  bool     pingSilent_;     // warned, until the next pong
+  IINT64   pingStartTime_;
+  uint32_t udpSent_;        // udp datagrams of the tunnel
+  uint32_t udpRecv_;
+  TunnelPing ping_;
+  void sendPing();
 
   // KDP connection
+  KcpParams kcpParams_;
   bool isInitKCPConv_;
   uint32_t kcpConv_;
   struct evbuffer *kcpInBuf_;
 
+  // encryption, keyed by the hello when tunnel_key is set
+  TunnelKey tunnelKey_;
+  int       tunnelCipher_;  // configured, AEAD_AUTO: offer both
+  uint8_t   helloRandom_[HELLO_RANDOM_LEN];
+  AeadCodec codec_;
+
+  // crc32c trailer, offered in the hello, used when there is no cipher
+  bool checksumWanted_;
+  DatagramChecksum checksum_;
+  size_t datagramOverhead() const {
+    return codec_.overhead() + checksum_.overhead();
+  }
+  uint32_t offeredFeatures() const;
+
+  // compact kcp headers, offered in the hello
+  bool compactWanted_;
+  KcpCompactCodec compact_;
+
+  // mining.notify as deltas, offered in the hello
+  bool notifyDeltaWanted_;
+  bool notifyDeltaEnabled_;
+  NotifyDelta notifyDelta_;  // in: the lines, out: the ops
+
   // idx -> conn
   map<uint16_t, ClientTCPSession *> conns_;
 
+  // bandwidth shaping
+  RateLimits rateLimits_;
+  struct ev_token_bucket_cfg *streamRateCfg_;  // shared by all sessions
+  struct bufferevent_rate_limit_group *listenerRateGroup_;
+  TokenBucket tunnelBucket_;  // udp bytes sent
+  void applyRateLimits();
+
+  // current backpressure level of kcp's send queue
+  int backpressureLevel_;
+  void checkBackpressure();
+
+  bool handleControlCommand(const vector<string> &args, string *out);
+
   bool readKcpMsg();
   void sendKcpMsg(const string &msg);
   void sendKcpCloseMsg(const uint16_t connIdx);
+  void sendKcpOpenMsg(const uint16_t connIdx, const uint16_t route,
+                      const string &early);
 
   void handleKcpMsg(const uint16_t connIdx, const char *data, size_t len);
   void handleKcpMsg_closeConn(const string &msg);
+  void handleKcpMsg_openOk(const string &msg);
+  void handleKcpMsg_openFail(const string &msg);
+  void handleKcpMsg_notify(const string &msg);
 
   void sendInitKCPConvPkg();
 
@@ -111,6 +319,43 @@ public:
          const int32_t tcpReadTimeout, const int32_t tcpWriteTimeout);
   ~Client();
 
+  void setIoEngine(const string &name) { ioEngineName_ = name; }
+  void setSocketOptions(const SocketOptions &opts) { sockOpts_ = opts; }
+  const SocketOptions &socketOptions() const { return sockOpts_; }
+  void setConfig(const Config &conf) { config_ = conf; }
+  void setControlSocket(const string &path) { controlPath_ = path; }
+  void setCapture(const size_t maxPackets, const uint16_t snaplen,
+                  const string &path) {
+    captureMaxPackets_ = maxPackets;
+    captureSnaplen_    = snaplen;
+    capturePath_       = path;
+  }
+  void setRateLimits(const RateLimits &limits) { rateLimits_ = limits; }
+  void setTunnelKey(const string &psk, const int cipher) {
+    tunnelKey_    = TunnelKey(psk);
+    tunnelCipher_ = cipher;
+  }
+  void setUdpChecksum(const bool enabled) { checksumWanted_ = enabled; }
+  void setPingInterval(const int32_t ms) { pingInterval_ = ms; }
+  void setCompactHeader(const bool enabled) { compactWanted_ = enabled; }
+  void setNotifyDelta(const bool enabled) { notifyDeltaWanted_ = enabled; }
+  void addListeners(const vector<RouteListener> &listeners);
+  void setStreamOpen(const bool openStatus, const int retries,
+                     const int preopen) {
+    openStatusWanted_  = openStatus;
+    streamOpenRetries_ = retries;
+    streamPreopen_     = preopen;
+  }
+  void setKcpParams(const KcpParams &params) {
+    kcpParams_ = params;
+    kcpParams_.apply(kcp_);
+  }
+  void setUpstreamFamily(const int family) { udpUpstreamFamily_ = family; }
+  void setPmtuDiscovery(const bool enabled, const uint16_t pmtuMax) {
+    pmtuEnabled_ = enabled;
+    pmtuMax_     = pmtuMax;
+  }
+
   bool setup();
   void run();
   void stop();
@@ -118,24 +363,32 @@ public:
 
   void checkInitKCP();
   void kcpUpdateManually();
-  bool recvInitKCPConvPkg(const uint8_t *p);
+  bool recvInitKCPConvPkg(const uint8_t *p, size_t len,
+                          const struct sockaddr *addr);
   void kcpKeepAlive();
+  void pmtuTick();
+  void reloadConfig();
 
-  static void listenerCallback(struct evconnlistener *listener,
-                               evutil_socket_t fd,
-                               struct sockaddr* saddr,
-                               int socklen, void *ptr);
+  static void listenerCallback(evutil_socket_t fd, void *ptr);
 
-  void handleIncomingUDPMesasge(uint8_t *inData, size_t inDataSize);
+  void handleIncomingUDPMesasge(const struct sockaddr *addr,
+                                const uint8_t *inData, size_t inDataSize);
   void handleIncomingTCPMesasge(ClientTCPSession *session, string &msg);
 
-  void addConnection(ClientTCPSession *session);
+  // `preopened`: its open is sent already
+  void addConnection(ClientTCPSession *session, const bool preopened);
   void removeConnection(ClientTCPSession *session, bool isNeedSendCloseMsg);
 
   int sendKcpDataLowLevel(const char *buf, int len, ikcpcb *kcp);
+  void sendDatagram(const char *buf, size_t len,
+                    const struct sockaddr *addr, socklen_t addrLen);
+  void sendPlainDatagram(const char *buf, size_t len,
+                         const struct sockaddr *addr, socklen_t addrLen);
 
   static int  cb_kcpOutput(const char *buf, int len, ikcpcb *kcp, void *user);
-  static void cb_udpRead  (evutil_socket_t fd, short events, void *ptr);
+  static void cb_udpRead  (const uint8_t *data, size_t len,
+                           const struct sockaddr *addr, socklen_t addrLen,
+                           void *ptr);
   static void cb_tcpRead  (struct bufferevent *bev, void *ptr);
   static void cb_tcpEvent (struct bufferevent *bev,
                            short events, void *ptr);
@@ -144,10 +397,19 @@ public:
                           short events, void *ptr);
   static void cb_kcpUpdate(evutil_socket_t fd,
                            short events, void *ptr);
+  static void cb_reload(evutil_socket_t fd,
+                        short events, void *ptr);
+  static void cb_idleTick(evutil_socket_t fd, short events, void *ptr);
+  static void cb_idleTimeout(TimerWheelNode *node, void *ptr);
+  static bool cb_control(const vector<string> &args, string *out, void *ptr);
+  static void cb_dumpCapture(evutil_socket_t fd,
+                             short events, void *ptr);
   static void cb_kcpKeepAlive(evutil_socket_t fd,
                               short events, void *ptr);
   static void cb_initKCP(evutil_socket_t fd,
                          short events, void *ptr);
+  static void cb_pmtu(evutil_socket_t fd,
+                      short events, void *ptr);
 };
 
 #endif
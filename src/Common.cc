@@ -34,14 +34,42 @@
 #include <event2/listener.h>
 
 
-bool resolve(const string &host, struct	in_addr *sin_addr) {
+bool parseAddrFamily(const string &str, int *family) {
+  if (str.empty() || str == "any") {
+    *family = ADDR_FAMILY_ANY;
+  } else if (str == "ipv4") {
+    *family = ADDR_FAMILY_IPV4;
+  } else if (str == "ipv6") {
+    *family = ADDR_FAMILY_IPV6;
+  } else if (str == "fastest") {
+    *family = ADDR_FAMILY_FASTEST;
+  } else {
+    LOG(ERROR) << "invalid address family: " << str
+    << ", should be one of: any, ipv4, ipv6, fastest";
+    return false;
+  }
+  return true;
+}
+
+const char *addrFamilyName(const int family) {
+  switch (family) {
+    case ADDR_FAMILY_IPV4:    return "ipv4";
+    case ADDR_FAMILY_IPV6:    return "ipv6";
+    case ADDR_FAMILY_FASTEST: return "fastest";
+  }
+  return "any";
+}
+
+bool resolve(const string &host, const uint16_t port, const int family,
+             const int socktype, vector<struct sockaddr_storage> *addrs) {
   struct evutil_addrinfo *ai = NULL;
   struct evutil_addrinfo hints_in;
   memset(&hints_in, 0, sizeof(evutil_addrinfo));
   // AF_INET, v4; AF_INT6, v6; AF_UNSPEC, both v4 & v6
-  hints_in.ai_family   = AF_UNSPEC;
-  hints_in.ai_socktype = SOCK_STREAM;
-  hints_in.ai_protocol = IPPROTO_TCP;
+  hints_in.ai_family   = (family == ADDR_FAMILY_IPV4 ? AF_INET :
+                          family == ADDR_FAMILY_IPV6 ? AF_INET6 : AF_UNSPEC);
+  hints_in.ai_socktype = socktype;
+  hints_in.ai_protocol = (socktype == SOCK_DGRAM ? IPPROTO_UDP : IPPROTO_TCP);
   hints_in.ai_flags    = EVUTIL_AI_ADDRCONFIG;
 
   // TODO: use non-blocking to resolve hostname
@@ -55,19 +83,244 @@ bool resolve(const string &host, struct	in_addr *sin_addr) {
     return false;
   }
 
-  // only get the first record, ignore ai = ai->ai_next
-  if (ai->ai_family == AF_INET) {
-    struct sockaddr_in *sin = (struct sockaddr_in*)ai->ai_addr;
-    *sin_addr = sin->sin_addr;
+  addrs->clear();
+  for (struct evutil_addrinfo *p = ai; p != NULL; p = p->ai_next) {
+    if (p->ai_family != AF_INET && p->ai_family != AF_INET6)
+      continue;
 
-    char ipStr[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(sin->sin_addr), ipStr, INET_ADDRSTRLEN);
-    LOG(INFO) << "resolve host: " << host << ", ip: " << ipStr;
-  } else if (ai->ai_family == AF_INET6) {
-    // not support yet
-    LOG(ERROR) << "not support ipv6 yet";
-    return false;
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    memcpy(&ss, p->ai_addr, p->ai_addrlen);
+    if (ss.ss_family == AF_INET) {
+      ((struct sockaddr_in *)&ss)->sin_port = htons(port);
+    } else {
+      ((struct sockaddr_in6 *)&ss)->sin6_port = htons(port);
+    }
+
+    bool dup = false;
+    for (const auto &a : *addrs) {
+      if (sockaddrEqual((struct sockaddr *)&a, (struct sockaddr *)&ss)) {
+        dup = true;
+        break;
+      }
+    }
+    if (!dup) {
+      addrs->push_back(ss);
+      LOG(INFO) << "resolve host: " << host << ", ip: "
+      << sockaddrToString((struct sockaddr *)&ss);
+    }
   }
   evutil_freeaddrinfo(ai);
+
+  if (addrs->empty()) {
+    LOG(ERROR) << "no " << addrFamilyName(family) << " address for host: " << host;
+    return false;
+  }
+  return true;
+}
+
+bool parseIPAddr(const string &ip, const uint16_t port,
+                 struct sockaddr_storage *addr) {
+  memset(addr, 0, sizeof(struct sockaddr_storage));
+
+  struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+  if (inet_pton(AF_INET, ip.c_str(), &sin->sin_addr) == 1) {
+    sin->sin_family = AF_INET;
+    sin->sin_port   = htons(port);
+    return true;
+  }
+
+  struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)addr;
+  if (inet_pton(AF_INET6, ip.c_str(), &sin6->sin6_addr) == 1) {
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port   = htons(port);
+    return true;
+  }
+
+  LOG(ERROR) << "invalid ip: " << ip;
+  return false;
+}
+
+socklen_t sockaddrLen(const struct sockaddr *addr) {
+  return addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6)
+                                     : sizeof(struct sockaddr_in);
+}
+
+bool sockaddrEqual(const struct sockaddr *a, const struct sockaddr *b) {
+  if (a->sa_family != b->sa_family)
+    return false;
+
+  if (a->sa_family == AF_INET) {
+    const struct sockaddr_in *x = (const struct sockaddr_in *)a;
+    const struct sockaddr_in *y = (const struct sockaddr_in *)b;
+    return x->sin_port == y->sin_port &&
+           x->sin_addr.s_addr == y->sin_addr.s_addr;
+  }
+  if (a->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *x = (const struct sockaddr_in6 *)a;
+    const struct sockaddr_in6 *y = (const struct sockaddr_in6 *)b;
+    return x->sin6_port == y->sin6_port &&
+           memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+  }
+  return false;
+}
+
+string sockaddrToString(const struct sockaddr *addr) {
+  char ipStr[INET6_ADDRSTRLEN];
+  char buf[INET6_ADDRSTRLEN + 16];
+
+  if (addr->sa_family == AF_INET) {
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+    inet_ntop(AF_INET, &sin->sin_addr, ipStr, sizeof(ipStr));
+    snprintf(buf, sizeof(buf), "%s:%u", ipStr, ntohs(sin->sin_port));
+  }
+  else if (addr->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+    inet_ntop(AF_INET6, &sin6->sin6_addr, ipStr, sizeof(ipStr));
+    snprintf(buf, sizeof(buf), "[%s]:%u", ipStr, ntohs(sin6->sin6_port));
+  }
+  else {
+    snprintf(buf, sizeof(buf), "<family %d>", addr->sa_family);
+  }
+  return string(buf);
+}
+
+void sockaddrToV4Mapped(const struct sockaddr_storage *in,
+                        struct sockaddr_storage *out) {
+  if (in->ss_family != AF_INET) {
+    *out = *in;
+    return;
+  }
+  const struct sockaddr_in *sin = (const struct sockaddr_in *)in;
+  struct sockaddr_in6 sin6;
+  memset(&sin6, 0, sizeof(sin6));
+  sin6.sin6_family = AF_INET6;
+  sin6.sin6_port   = sin->sin_port;
+  sin6.sin6_addr.s6_addr[10] = 0xff;
+  sin6.sin6_addr.s6_addr[11] = 0xff;
+  memcpy(&sin6.sin6_addr.s6_addr[12], &sin->sin_addr, 4);
+
+  memset(out, 0, sizeof(struct sockaddr_storage));
+  memcpy(out, &sin6, sizeof(sin6));
+}
+
+int backpressureLevel(const int waitsnd, const int sndWnd) {
+  if (waitsnd > sndWnd * 4)
+    return 2;
+  if (waitsnd > sndWnd)
+    return 1;
+  return 0;
+}
+
+bool parseStreamPrio(const string &str, int *prio) {
+  if (str == "high") {
+    *prio = STREAM_PRIO_HIGH;
+  } else if (str == "normal") {
+    *prio = STREAM_PRIO_NORMAL;
+  } else if (str == "low") {
+    *prio = STREAM_PRIO_LOW;
+  } else {
+    return false;
+  }
   return true;
 }
+
+const char *streamPrioName(const int prio) {
+  switch (prio) {
+    case STREAM_PRIO_HIGH:   return "high";
+    case STREAM_PRIO_NORMAL: return "normal";
+    case STREAM_PRIO_LOW:    return "low";
+  }
+  return "unknown";
+}
+
+const char *openFailReasonName(const int reason) {
+  switch (reason) {
+    case OPEN_FAIL_ROUTE:   return "unknown route";
+    case OPEN_FAIL_CONNECT: return "connect failure";
+    case OPEN_FAIL_TIMEOUT: return "connect timeout";
+  }
+  return "unknown";
+}
+
+void readKcpRecvQueue(ikcpcb *kcp, struct evbuffer *buf) {
+  while (1) {
+    const int size = ikcp_peeksize(kcp);
+    if (size < 0) break;
+
+    // recv straight into the evbuf, a message may be larger than any
+    // fixed buffer
+    struct evbuffer_iovec v;
+    if (evbuffer_reserve_space(buf, size, &v, 1) != 1)
+      break;
+    const int n = ikcp_recv(kcp, (char *)v.iov_base, size);
+    v.iov_len = n > 0 ? n : 0;
+    evbuffer_commit_space(buf, &v, 1);
+    if (n < 0) break;
+  }
+}
+
+string makeCtrlDatagram(const uint8_t type, const size_t size) {
+  assert(size >= KCP_CTRL_HEADER_LEN);
+  string msg;
+  msg.resize(size, 0);
+
+  uint8_t *p = (uint8_t *)msg.data();
+  *(uint32_t *)p = 0u;
+  p += 4;
+  *(uint32_t *)p = KCP_CTRL_MAGIC;
+  p += 4;
+  *(uint8_t *)p = type;
+
+  return msg;
+}
+
+int parseCtrlDatagram(const uint8_t *data, const size_t len) {
+  if (len < KCP_CTRL_HEADER_LEN ||
+      *(uint32_t *)data != 0u ||
+      *(uint32_t *)(data + 4) != KCP_CTRL_MAGIC) {
+    return -1;
+  }
+  return *(data + 8);
+}
+
+bool parseMiningNotify(const char *line, const size_t len, bool *clean) {
+  static const char kMethod[] = "\"mining.notify\"";
+  static const char kParams[] = "\"params\"";
+  const char *end = line + len;
+
+  if (memmem(line, len, kMethod, sizeof(kMethod) - 1) == nullptr)
+    return false;
+  const char *p = (const char *)memmem(line, len, kParams, sizeof(kParams) - 1);
+  if (p != nullptr)
+    p = (const char *)memchr(p, '[', end - p);
+  if (p == nullptr)
+    return false;
+
+  // the ']' of params, the strings may have brackets
+  const char *close = nullptr;
+  int depth = 0;
+  bool inStr = false;
+  for (; p < end && close == nullptr; p++) {
+    if (inStr) {
+      if (*p == '\\') p++;
+      else if (*p == '"') inStr = false;
+    }
+    else if (*p == '"') inStr = true;
+    else if (*p == '[') depth++;
+    else if (*p == ']' && --depth == 0) close = p;
+  }
+  if (close == nullptr)
+    return false;
+
+  while (close > line && isspace((unsigned char)close[-1]))
+    close--;
+  *clean = (close - line >= 4 && memcmp(close - 4, "true", 4) == 0);
+  return true;
+}
+
+IINT64 cachedClock64(struct event_base *base) {
+  struct timeval tv;
+  event_base_gettimeofday_cached(base, &tv);
+  return ((IINT64)tv.tv_sec) * 1000 + (tv.tv_usec / 1000);
+}
@@ -33,13 +33,14 @@
 
 #include <time.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 
 #include <string>
 #include <map>
+#include <vector>
 
-#include <glog/logging.h>
-
+#include "Log.h"
 #include "ikcp.h"
 
 #define MAX_MESSAGE_LEN 1500
@@ -48,12 +49,133 @@
 #define KCP_MSG_CONNIDX_NONE      0x0000u
 #define KCP_MSG_TYPE_CLOSE_CONN   0x01u     // close connection
 #define KCP_MSG_TYPE_KEEPALIVE    0x02u     // keep-alive
+#define KCP_MSG_TYPE_OPEN_CONN    0x03u     // | connIdx(2) | route(2) | early data |
+#define KCP_MSG_TYPE_OPEN_OK      0x04u     // | connIdx(2) | connect ms(2) |
+#define KCP_MSG_TYPE_OPEN_FAIL    0x05u     // | connIdx(2) | reason(1) |
+#define KCP_MSG_TYPE_NOTIFY       0x06u     // see NotifyDelta.h
+
+// reason of KCP_MSG_TYPE_OPEN_FAIL
+#define OPEN_FAIL_ROUTE    1  // unknown route
+#define OPEN_FAIL_CONNECT  2  // resolve, refused, unreachable
+#define OPEN_FAIL_TIMEOUT  3  // upstream_connect_timeout
+const char *openFailReasonName(const int reason);
+// the client keeps what it sends until the open is answered, up to this
+#define STREAM_REPLAY_MAX  (UINT16_MAX - 9)
+
+//
+// control datagram, sent beside kcp (not reliable):
+// | 0u(4) | KCP_CTRL_MAGIC(4) | type(1) | ... |
+//
+// a kcp segment never starts with conv 0, and the init kcp conv pkg is
+// | 0u(4) | conv(4) | conv+1(4) |
+//
+#define KCP_CTRL_MAGIC            0x4c525443u  // "CTRL"
+#define KCP_CTRL_HEADER_LEN       9
+#define KCP_CTRL_TYPE_PMTU_PROBE  0x01u  // | id(4) | size(2) | padding |, echoed
+#define KCP_CTRL_TYPE_PMTU_SET    0x02u  // | mtu(2) |, echoed
+#define KCP_CTRL_TYPE_PING        0x03u  // see TunnelPing.h
+#define KCP_CTRL_TYPE_PONG        0x04u
+
+//
+// hello, the init kcp conv pkg with features and key exchange:
+// | 0u(4) | conv(4) | conv+1(4) | features(4) | random(16) | time(8) | mac(16) |
+//
+// the client offers features, the server answers with the ones it took.
+// mac: HMAC-SHA256 of the rest (+ the client's random in the answer) with
+// a key from tunnel_key, zeros without one. a client with no feature to
+// offer sends the old 12 bytes pkg and gets it back, as old servers expect.
+// time: iclock64() of the sender. with a key, the server drops a hello off
+// its clock by more than HELLO_MAX_SKEW, or older than the one of its conv,
+// so a captured hello can't be replayed later.
+//
+#define HELLO_LEN         56
+#define HELLO_RANDOM_LEN  16
+#define HELLO_MAC_LEN     16
+#define LEGACY_HELLO_LEN  12
+#define HELLO_MAX_SKEW    120000  // ms
+
+#define TUNNEL_FEATURE_AES_128_GCM        0x00000001u
+#define TUNNEL_FEATURE_CHACHA20_POLY1305  0x00000002u
+#define TUNNEL_FEATURE_CRC32C             0x00000004u  // without a cipher
+#define TUNNEL_FEATURE_COMPACT_HEADER     0x00000008u  // see KcpCompact.h
+#define TUNNEL_FEATURE_STREAM_ROUTES      0x00000010u  // see Routes.h
+#define TUNNEL_FEATURE_OPEN_STATUS        0x00000020u  // see Routes.h
+#define TUNNEL_FEATURE_DATAGRAM_PING      0x00000040u  // see TunnelPing.h
+#define TUNNEL_FEATURE_NOTIFY_DELTA       0x00000080u  // see NotifyDelta.h
+
+// path mtu, as udp payload size
+#define KCP_MTU_DEFAULT   1400   // ikcp's, used until pmtu is known
+#define PMTU_MIN          548    // 576 - ip(20) - udp(8)
+#define PMTU_MAX_DEFAULT  1472   // 1500 - ip(20) - udp(8)
+#define PMTU_MAX_LIMIT    65507
+
+#define PMTU_PROBE_TIMEOUT        500      // ms
+#define PMTU_PROBE_MAX_TRIES      3
+#define PMTU_SEARCH_GRANULARITY   16       // bytes
+#define PMTU_REPROBE_INTERVAL     600000   // ms, RFC 8899 PMTU_RAISE_TIMER
 
 
 using std::string;
 using std::map;
-
-bool resolve(const string &host, struct	in_addr *sin_addr);
+using std::vector;
+
+struct evbuffer;
+
+//
+// stream priority. kcp is one ordered pipe, so priority is admission: when
+// kcp's send queue backs up, LOW streams stop being read first, then NORMAL,
+// HIGH streams are always read.
+//
+#define STREAM_PRIO_HIGH    0
+#define STREAM_PRIO_NORMAL  1
+#define STREAM_PRIO_LOW     2
+
+// backpressure level: 0 none, 1 LOW paused, 2 LOW & NORMAL paused
+#define BACKPRESSURE_LEVEL_MAX  2
+int backpressureLevel(const int waitsnd, const int sndWnd);
+inline bool isStreamPaused(const int prio, const int level) {
+  return prio + level > STREAM_PRIO_LOW;
+}
+bool parseStreamPrio(const string &str, int *prio);
+const char *streamPrioName(const int prio);
+
+// address family preference of an endpoint
+#define ADDR_FAMILY_ANY      0  // resolver's order
+#define ADDR_FAMILY_IPV4     1
+#define ADDR_FAMILY_IPV6     2
+#define ADDR_FAMILY_FASTEST  3  // all families, pick by measured RTT
+
+bool parseAddrFamily(const string &str, int *family);
+const char *addrFamilyName(const int family);
+
+//
+// resolve all addresses of host, filtered by family preference (FASTEST
+// returns both v4 & v6). `socktype`: SOCK_STREAM or SOCK_DGRAM.
+//
+bool resolve(const string &host, const uint16_t port, const int family,
+             const int socktype, vector<struct sockaddr_storage> *addrs);
+
+// ip literal (v4 or v6) and port to sockaddr
+bool parseIPAddr(const string &ip, const uint16_t port,
+                 struct sockaddr_storage *addr);
+socklen_t sockaddrLen(const struct sockaddr *addr);
+bool sockaddrEqual(const struct sockaddr *a, const struct sockaddr *b);
+string sockaddrToString(const struct sockaddr *addr);
+// v4 address to ::ffff:a.b.c.d, for sending v4 on a dual-stack v6 socket
+void sockaddrToV4Mapped(const struct sockaddr_storage *in,
+                        struct sockaddr_storage *out);
+
+// move all the received kcp messages to buf, whatever their size
+void readKcpRecvQueue(ikcpcb *kcp, struct evbuffer *buf);
+
+// control datagram of `size` bytes (zero padded), header filled
+string makeCtrlDatagram(const uint8_t type, const size_t size);
+// returns the type, or -1 if it's not a control datagram
+int parseCtrlDatagram(const uint8_t *data, const size_t len);
+
+// a stratum mining.notify line ('\n' excluded), clean: its clean_jobs, the
+// last of params
+bool parseMiningNotify(const char *line, const size_t len, bool *clean);
 
 /* get system time */
 static inline void itimeofday(long *sec, long *usec) {
@@ -74,4 +196,12 @@ inline IUINT32 iclock() {
   return (IUINT32)(iclock64() & 0xfffffffful);
 }
 
+// iclock64() of the loop's cached time, no syscall, for per read/write stamps
+struct event_base;
+IINT64 cachedClock64(struct event_base *base);
+
+// tcp idle timeouts of the sessions are checked on a TimerWheel of these
+#define IDLE_WHEEL_TICK   1000  // ms
+#define IDLE_WHEEL_SLOTS  1024  // longer timeouts take more than one lap
+
 #endif
@@ -0,0 +1,594 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "Config.h"
+
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <streambuf>
+
+/////////////////////////////////// ConfigValue ////////////////////////////////
+ConfigValue::ConfigValue(): type_(NUL), bool_(false), int_(0), double_(0.0) {
+}
+
+const ConfigValue *ConfigValue::find(const string &key) const {
+  for (const auto &m : members_) {
+    if (m.first == key)
+      return &m.second;
+  }
+  return nullptr;
+}
+
+bool ConfigValue::operator==(const ConfigValue &o) const {
+  if (type_ != o.type_)
+    return false;
+
+  switch (type_) {
+    case NUL:    return true;
+    case BOOL:   return bool_   == o.bool_;
+    case INT:    return int_    == o.int_;
+    case DOUBLE: return double_ == o.double_;
+    case STR:    return str_    == o.str_;
+    case ARRAY:  return items_  == o.items_;
+    case OBJECT: return members_ == o.members_;
+  }
+  return false;
+}
+
+static void appendJsonString(const string &s, string *out) {
+  out->push_back('"');
+  for (const char c : s) {
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+      out->append(buf);
+    } else {
+      out->push_back(c);
+    }
+  }
+  out->push_back('"');
+}
+
+string ConfigValue::toString() const {
+  switch (type_) {
+    case NUL:    return "null";
+    case BOOL:   return bool_ ? "true" : "false";
+    case INT:    return std::to_string(int_);
+    case DOUBLE: {
+      std::ostringstream ss;
+      ss << double_;
+      return ss.str();
+    }
+    case STR: {
+      string s;
+      appendJsonString(str_, &s);
+      return s;
+    }
+    case ARRAY: {
+      string s = "[";
+      for (size_t i = 0; i < items_.size(); i++) {
+        if (i > 0) s += ",";
+        s += items_[i].toString();
+      }
+      return s + "]";
+    }
+    case OBJECT: {
+      string s = "{";
+      for (size_t i = 0; i < members_.size(); i++) {
+        if (i > 0) s += ",";
+        appendJsonString(members_[i].first, &s);
+        s += ":" + members_[i].second.toString();
+      }
+      return s + "}";
+    }
+  }
+  return "";
+}
+
+const char *ConfigValue::typeName(const Type type) {
+  switch (type) {
+    case NUL:    return "null";
+    case BOOL:   return "bool";
+    case INT:    return "int";
+    case DOUBLE: return "number";
+    case STR:    return "string";
+    case ARRAY:  return "array";
+    case OBJECT: return "object";
+  }
+  return "unknown";
+}
+
+
+/////////////////////////////////// JsonParser /////////////////////////////////
+namespace {
+
+class JsonParser {
+  const char *begin_;
+  const char *end_;
+  const char *p_;
+  string error_;
+
+  static const int kMaxDepth = 64;
+
+  bool fail(const string &msg) {
+    int line = 1, col = 1;
+    for (const char *i = begin_; i < p_ && i < end_; i++) {
+      if (*i == '\n') { line++; col = 1; } else { col++; }
+    }
+    error_ = "line " + std::to_string(line) + ", column " +
+             std::to_string(col) + ": " + msg;
+    return false;
+  }
+
+  void skipSpace() {
+    while (p_ < end_ &&
+           (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+      p_++;
+    }
+  }
+
+  bool literal(const char *word) {
+    const size_t len = strlen(word);
+    if ((size_t)(end_ - p_) < len || memcmp(p_, word, len) != 0)
+      return fail("invalid literal");
+    p_ += len;
+    return true;
+  }
+
+  bool hex4(uint32_t *cp) {
+    if (end_ - p_ < 4)
+      return fail("truncated \\u escape");
+    *cp = 0;
+    for (int i = 0; i < 4; i++) {
+      const char c = *p_++;
+      *cp <<= 4;
+      if      (c >= '0' && c <= '9') *cp |= c - '0';
+      else if (c >= 'a' && c <= 'f') *cp |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') *cp |= c - 'A' + 10;
+      else return fail("invalid \\u escape");
+    }
+    return true;
+  }
+
+  static void appendUtf8(uint32_t cp, string *out) {
+    if (cp < 0x80) {
+      out->push_back((char)cp);
+    } else if (cp < 0x800) {
+      out->push_back((char)(0xc0 | (cp >> 6)));
+      out->push_back((char)(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+      out->push_back((char)(0xe0 | (cp >> 12)));
+      out->push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+      out->push_back((char)(0x80 | (cp & 0x3f)));
+    } else {
+      out->push_back((char)(0xf0 | (cp >> 18)));
+      out->push_back((char)(0x80 | ((cp >> 12) & 0x3f)));
+      out->push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+      out->push_back((char)(0x80 | (cp & 0x3f)));
+    }
+  }
+
+  bool parseString(string *out) {
+    p_++;  // '"'
+    while (p_ < end_) {
+      // copy the plain run at once
+      const char *run = p_;
+      while (p_ < end_ && *p_ != '"' && *p_ != '\\' && (unsigned char)*p_ >= 0x20)
+        p_++;
+      out->append(run, p_ - run);
+
+      if (p_ == end_)
+        break;
+      if (*p_ == '"') {
+        p_++;
+        return true;
+      }
+      if ((unsigned char)*p_ < 0x20)
+        return fail("control character in string");
+
+      // escape
+      if (++p_ == end_)
+        break;
+      const char c = *p_++;
+      switch (c) {
+        case '"':  out->push_back('"');  break;
+        case '\\': out->push_back('\\'); break;
+        case '/':  out->push_back('/');  break;
+        case 'b':  out->push_back('\b'); break;
+        case 'f':  out->push_back('\f'); break;
+        case 'n':  out->push_back('\n'); break;
+        case 'r':  out->push_back('\r'); break;
+        case 't':  out->push_back('\t'); break;
+        case 'u': {
+          uint32_t cp;
+          if (!hex4(&cp))
+            return false;
+          // surrogate pair
+          if (cp >= 0xd800 && cp <= 0xdbff) {
+            uint32_t lo;
+            if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u')
+              return fail("unpaired surrogate");
+            p_ += 2;
+            if (!hex4(&lo))
+              return false;
+            if (lo < 0xdc00 || lo > 0xdfff)
+              return fail("invalid surrogate pair");
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+          }
+          appendUtf8(cp, out);
+          break;
+        }
+        default:
+          p_--;
+          return fail("invalid escape");
+      }
+    }
+    return fail("unterminated string");
+  }
+
+  bool parseNumber(ConfigValue *v) {
+    const char *start = p_;
+    bool isInt = true;
+
+    if (p_ < end_ && *p_ == '-') p_++;
+    if (p_ == end_ || !isdigit((unsigned char)*p_))
+      return fail("invalid number");
+    while (p_ < end_ && isdigit((unsigned char)*p_)) p_++;
+    if (p_ < end_ && *p_ == '.') {
+      isInt = false;
+      p_++;
+      if (p_ == end_ || !isdigit((unsigned char)*p_))
+        return fail("invalid number");
+      while (p_ < end_ && isdigit((unsigned char)*p_)) p_++;
+    }
+    if (p_ < end_ && (*p_ == 'e' || *p_ == 'E')) {
+      isInt = false;
+      p_++;
+      if (p_ < end_ && (*p_ == '+' || *p_ == '-')) p_++;
+      if (p_ == end_ || !isdigit((unsigned char)*p_))
+        return fail("invalid number");
+      while (p_ < end_ && isdigit((unsigned char)*p_)) p_++;
+    }
+
+    // strtoll/strtod need a terminated string
+    const string s(start, p_ - start);
+    errno = 0;
+    if (isInt) {
+      v->type_ = ConfigValue::INT;
+      v->int_  = strtoll(s.c_str(), nullptr, 10);
+      v->double_ = (double)v->int_;
+    } else {
+      v->type_   = ConfigValue::DOUBLE;
+      v->double_ = strtod(s.c_str(), nullptr);
+    }
+    if (errno == ERANGE) {
+      p_ = start;
+      return fail("number out of range: " + s);
+    }
+    return true;
+  }
+
+  bool parseValue(ConfigValue *v, int depth) {
+    if (depth > kMaxDepth)
+      return fail("nested too deep");
+
+    skipSpace();
+    if (p_ == end_)
+      return fail("unexpected end of input");
+
+    switch (*p_) {
+      case '{': return parseObject(v, depth);
+      case '[': return parseArray(v, depth);
+      case '"':
+        v->type_ = ConfigValue::STR;
+        return parseString(&v->str_);
+      case 't':
+        v->type_ = ConfigValue::BOOL;
+        v->bool_ = true;
+        return literal("true");
+      case 'f':
+        v->type_ = ConfigValue::BOOL;
+        v->bool_ = false;
+        return literal("false");
+      case 'n':
+        v->type_ = ConfigValue::NUL;
+        return literal("null");
+      default:
+        return parseNumber(v);
+    }
+  }
+
+  bool parseArray(ConfigValue *v, int depth) {
+    v->type_ = ConfigValue::ARRAY;
+    p_++;  // '['
+
+    skipSpace();
+    if (p_ < end_ && *p_ == ']') {
+      p_++;
+      return true;
+    }
+    while (1) {
+      v->items_.push_back(ConfigValue());
+      if (!parseValue(&v->items_.back(), depth + 1))
+        return false;
+
+      skipSpace();
+      if (p_ == end_)
+        return fail("unterminated array");
+      if (*p_ == ']') {
+        p_++;
+        return true;
+      }
+      if (*p_ != ',')
+        return fail("expected ',' or ']'");
+      p_++;
+    }
+  }
+
+  bool parseObject(ConfigValue *v, int depth) {
+    v->type_ = ConfigValue::OBJECT;
+    p_++;  // '{'
+
+    skipSpace();
+    if (p_ < end_ && *p_ == '}') {
+      p_++;
+      return true;
+    }
+    while (1) {
+      skipSpace();
+      if (p_ == end_ || *p_ != '"')
+        return fail("expected a string key");
+
+      const char *keyPos = p_;
+      string key;
+      if (!parseString(&key))
+        return false;
+      if (v->find(key) != nullptr) {
+        p_ = keyPos;
+        return fail("duplicate key: " + key);
+      }
+
+      skipSpace();
+      if (p_ == end_ || *p_ != ':')
+        return fail("expected ':'");
+      p_++;
+
+      v->members_.push_back(std::make_pair(key, ConfigValue()));
+      if (!parseValue(&v->members_.back().second, depth + 1))
+        return false;
+
+      skipSpace();
+      if (p_ == end_)
+        return fail("unterminated object");
+      if (*p_ == '}') {
+        p_++;
+        return true;
+      }
+      if (*p_ != ',')
+        return fail("expected ',' or '}'");
+      p_++;
+    }
+  }
+
+public:
+  JsonParser(const char *begin, const char *end):
+  begin_(begin), end_(end), p_(begin) {}
+
+  bool parse(ConfigValue *root) {
+    if (!parseValue(root, 0))
+      return false;
+    skipSpace();
+    if (p_ != end_)
+      return fail("trailing characters");
+    return true;
+  }
+
+  const string &error() const { return error_; }
+};
+
+}  // namespace
+
+bool parseJson(const char *begin, const char *end, ConfigValue *root,
+               string *error) {
+  *root = ConfigValue();
+  JsonParser parser(begin, end);
+  if (!parser.parse(root)) {
+    if (error)
+      *error = parser.error();
+    return false;
+  }
+  return true;
+}
+
+
+////////////////////////////////////// Config //////////////////////////////////
+Config::Config() {
+}
+
+void Config::addSchema(const ConfigField *schema) {
+  schemas_.push_back(schema);
+}
+
+const ConfigField *Config::field(const string &key) const {
+  for (const ConfigField *schema : schemas_) {
+    for (const ConfigField *f = schema; f->key_ != nullptr; f++) {
+      if (key == f->key_)
+        return f;
+    }
+  }
+  return nullptr;
+}
+
+bool Config::check(const ConfigField *f, const ConfigValue &v,
+                   string *error) const {
+  static const ConfigValue::Type kJsonType[] = {
+    ConfigValue::BOOL, ConfigValue::INT, ConfigValue::STR, ConfigValue::STR,
+    ConfigValue::ARRAY, ConfigValue::OBJECT
+  };
+  const ConfigValue::Type expected = kJsonType[f->type_];
+
+  if (v.type_ != expected) {
+    *error = string(f->key_) + ": expected " + ConfigValue::typeName(expected) +
+             ", got " + ConfigValue::typeName(v.type_) + " " + v.toString();
+    return false;
+  }
+
+  if (f->type_ == CONF_INT && (f->min_ != 0 || f->max_ != 0) &&
+      (v.int_ < f->min_ || v.int_ > f->max_)) {
+    *error = string(f->key_) + ": " + std::to_string(v.int_) +
+             " out of range [" + std::to_string(f->min_) + ", " +
+             std::to_string(f->max_) + "]";
+    return false;
+  }
+
+  if (f->type_ == CONF_ENUM) {
+    const string all = f->enum_;
+    size_t pos = 0;
+    while (pos <= all.size()) {
+      size_t bar = all.find('|', pos);
+      if (bar == string::npos) bar = all.size();
+      if (all.compare(pos, bar - pos, v.str_) == 0 && v.str_.size() == bar - pos)
+        return true;
+      pos = bar + 1;
+    }
+    *error = string(f->key_) + ": \"" + v.str_ + "\" should be one of: " + all;
+    return false;
+  }
+
+  return true;
+}
+
+bool Config::load(const string &path) {
+  path_ = path;
+
+  std::ifstream in(path.c_str());
+  if (!in) {
+    errors_.assign(1, string("cannot open: ") + strerror(errno));
+    LOG(ERROR) << "config " << path << ": " << errors_[0];
+    return false;
+  }
+  const string json((std::istreambuf_iterator<char>(in)),
+                    std::istreambuf_iterator<char>());
+  return loadString(json);
+}
+
+bool Config::loadString(const string &json) {
+  ConfigValue root;
+  string error;
+  errors_.clear();
+
+  if (!parseJson(json.data(), json.data() + json.size(), &root, &error)) {
+    errors_.push_back(error);
+  } else if (root.type_ != ConfigValue::OBJECT) {
+    errors_.push_back("should be an object");
+  } else {
+    checkKeys(&root);
+  }
+
+  for (const auto &e : errors_) {
+    LOG(ERROR) << "config " << path_ << ": " << e;
+  }
+  if (!errors_.empty())
+    return false;
+
+  root_ = root;
+  return true;
+}
+
+void Config::checkKeys(ConfigValue *rootPtr) {
+  ConfigValue &root = *rootPtr;
+  string error;
+
+  // check every key, report all errors at once
+  for (const auto &m : root.members_) {
+    const ConfigField *f = field(m.first);
+    if (f == nullptr) {
+      errors_.push_back("unknown key: " + m.first);
+    } else if (!check(f, m.second, &error)) {
+      errors_.push_back(error);
+    }
+  }
+
+  // required & defaults
+  for (const ConfigField *schema : schemas_) {
+    for (const ConfigField *f = schema; f->key_ != nullptr; f++) {
+      if (root.find(f->key_) != nullptr)
+        continue;
+
+      if (f->flags_ & CONF_REQUIRED) {
+        errors_.push_back(string("missing key: ") + f->key_);
+        continue;
+      }
+      if (f->default_ == nullptr)
+        continue;
+
+      ConfigValue def;
+      const bool parsed = parseJson(f->default_, f->default_ + strlen(f->default_),
+                                    &def, &error);
+      assert(parsed && check(f, def, &error));  // a bug of the schema
+      (void)parsed;
+      root.members_.push_back(std::make_pair(string(f->key_), def));
+    }
+  }
+}
+
+bool Config::has(const char *key) const {
+  return root_.find(key) != nullptr;
+}
+
+const ConfigValue &Config::value(const char *key) const {
+  static const ConfigValue kNull;
+
+  assert(field(key) != nullptr);  // not in the schema, a typo in code
+  const ConfigValue *v = root_.find(key);
+  return v != nullptr ? *v : kNull;
+}
+
+bool Config::changed(const Config &running, const char *key) const {
+  return value(key) != running.value(key);
+}
+
+int Config::logDiff(const Config &running, vector<string> *ignored) const {
+  int n = 0;
+
+  for (const ConfigField *schema : schemas_) {
+    for (const ConfigField *f = schema; f->key_ != nullptr; f++) {
+      if (!changed(running, f->key_))
+        continue;
+      n++;
+
+      LOG(INFO) << "config " << f->key_ << ": "
+      << running.value(f->key_).toString() << " -> "
+      << value(f->key_).toString()
+      << ((f->flags_ & CONF_RELOADABLE) ? "" : " (ignored until restart)");
+      if (ignored && !(f->flags_ & CONF_RELOADABLE)) {
+        ignored->push_back(f->key_);
+      }
+    }
+  }
+  return n;
+}
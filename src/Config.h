@@ -0,0 +1,134 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_CONFIG_H_
+#define TUT_CONFIG_H_
+
+#include "Common.h"
+
+#include <utility>
+
+//
+// config file: json, checked against a schema of typed keys with defaults
+// and ranges, unknown keys are errors (a typo should not become zero).
+//
+
+/////////////////////////////////// ConfigValue ////////////////////////////////
+class ConfigValue {
+public:
+  enum Type { NUL = 0, BOOL, INT, DOUBLE, STR, ARRAY, OBJECT };
+
+  Type    type_;
+  bool    bool_;
+  int64_t int_;
+  double  double_;
+  string  str_;
+  vector<ConfigValue> items_;                         // ARRAY
+  vector<std::pair<string, ConfigValue> > members_;  // OBJECT, file order
+
+public:
+  ConfigValue();
+
+  // member of an object, nullptr if missing
+  const ConfigValue *find(const string &key) const;
+
+  bool operator==(const ConfigValue &o) const;
+  bool operator!=(const ConfigValue &o) const { return !(*this == o); }
+
+  // compact json
+  string toString() const;
+
+  static const char *typeName(const Type type);
+};
+
+// single pass, recursive descent. error message: "line L, column C: ..."
+bool parseJson(const char *begin, const char *end, ConfigValue *root,
+               string *error);
+
+
+/////////////////////////////////// ConfigField ////////////////////////////////
+enum ConfigFieldType {
+  CONF_BOOL = 0,
+  CONF_INT,
+  CONF_STR,
+  CONF_ENUM,    // string of enum_: "a|b|c"
+  CONF_ARRAY,
+  CONF_OBJECT
+};
+
+#define CONF_REQUIRED    0x01
+#define CONF_RELOADABLE  0x02  // applied on SIGHUP
+
+// a schema is an array of fields ended by {nullptr}
+struct ConfigField {
+  const char *key_;
+  int         type_;
+  int         flags_;
+  const char *default_;  // json text, nullptr: none
+  int64_t     min_;      // CONF_INT, min_ == max_ == 0: no range
+  int64_t     max_;
+  const char *enum_;
+};
+
+
+////////////////////////////////////// Config //////////////////////////////////
+class Config {
+  vector<const ConfigField *> schemas_;
+  string path_;
+  ConfigValue root_;  // checked, defaults filled
+  vector<string> errors_;  // of the last load
+
+  const ConfigField *field(const string &key) const;
+  bool check(const ConfigField *f, const ConfigValue &v, string *error) const;
+  void checkKeys(ConfigValue *root);  // to errors_, fills the defaults
+  const ConfigValue &value(const char *key) const;
+
+public:
+  Config();
+
+  void addSchema(const ConfigField *schema);
+
+  bool load(const string &path);
+  bool loadString(const string &json);
+
+  const string &path() const { return path_; }
+  const vector<string> &errors() const { return errors_; }
+
+  // explicitly set or has a default
+  bool has(const char *key) const;
+
+  bool    getBool(const char *key) const { return value(key).bool_; }
+  int64_t getInt (const char *key) const { return value(key).int_;  }
+  const string      &getStr  (const char *key) const { return value(key).str_; }
+  const ConfigValue &getValue(const char *key) const { return value(key); }
+
+  //
+  // log every key changed from `running`, keys not CONF_RELOADABLE are
+  // reported as ignored until restart (and added to `ignored` if given).
+  // returns the number of changes.
+  //
+  int logDiff(const Config &running, vector<string> *ignored = nullptr) const;
+  bool changed(const Config &running, const char *key) const;
+};
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "ControlServer.h"
+
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#define CONTROL_MAX_LINE_LEN  4096
+
+/////////////////////////////////// ControlConn ////////////////////////////////
+ControlConn::ControlConn(struct event_base *base, evutil_socket_t fd,
+                         ControlServer *server):
+bev_(nullptr), server_(server)
+{
+  bev_ = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
+  assert(bev_ != nullptr);
+
+  bufferevent_setcb(bev_, ControlServer::cb_read, nullptr,
+                    ControlServer::cb_event, this);
+  bufferevent_enable(bev_, EV_READ|EV_WRITE);
+}
+
+ControlConn::~ControlConn() {
+  bufferevent_free(bev_);
+}
+
+void ControlConn::readLines() {
+  struct evbuffer *in = bufferevent_get_input(bev_);
+
+  while (1) {
+    size_t len = 0;
+    char *line = evbuffer_readln(in, &len, EVBUFFER_EOL_CRLF);
+    if (line == nullptr)
+      break;
+
+    string response;
+    server_->execute(string(line, len), &response);
+    free(line);
+
+    bufferevent_write(bev_, response.data(), response.size());
+  }
+
+  if (evbuffer_get_length(in) > CONTROL_MAX_LINE_LEN) {
+    LOG(ERROR) << "control command line too long, close it";
+    server_->removeConn(this);
+  }
+}
+
+
+////////////////////////////////// ControlServer ///////////////////////////////
+ControlServer::ControlServer(struct event_base *base, ControlCommandCallback cb,
+                             void *ptr):
+base_(base), listener_(nullptr), cb_(cb), ptr_(ptr)
+{
+}
+
+ControlServer::~ControlServer() {
+  for (auto conn : conns_) {
+    delete conn;
+  }
+  conns_.clear();
+
+  if (listener_) {
+    evconnlistener_free(listener_);
+    unlink(path_.c_str());
+  }
+}
+
+bool ControlServer::listen(const string &path) {
+  struct sockaddr_un sun;
+  if (path.size() >= sizeof(sun.sun_path)) {
+    LOG(ERROR) << "control socket path too long: " << path;
+    return false;
+  }
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  memcpy(sun.sun_path, path.c_str(), path.size());
+
+  // left by a previous process
+  unlink(path.c_str());
+
+  listener_ = evconnlistener_new_bind(base_, ControlServer::cb_accept, this,
+                                      LEV_OPT_CLOSE_ON_FREE, -1,
+                                      (struct sockaddr *)&sun, sizeof(sun));
+  if (listener_ == nullptr) {
+    LOG(ERROR) << "cannot create control socket: " << path << ", "
+    << strerror(errno);
+    return false;
+  }
+  path_ = path;
+
+  // owner only, it can close any stream
+  chmod(path.c_str(), 0600);
+
+  LOG(INFO) << "control socket: " << path;
+  return true;
+}
+
+void ControlServer::execute(const string &line, string *response) {
+  vector<string> args;
+  std::istringstream ss(line);
+  string arg;
+  while (ss >> arg) {
+    args.push_back(arg);
+  }
+  if (args.empty()) {
+    return;
+  }
+
+  LOG(INFO) << "control command: " << line;
+
+  string out;
+  if (cb_(args, &out, ptr_)) {
+    *response = out + "OK\n";
+  } else {
+    *response = "ERR " + out + "\n";
+  }
+}
+
+void ControlServer::removeConn(ControlConn *conn) {
+  conns_.erase(conn);
+  delete conn;
+}
+
+void ControlServer::cb_accept(struct evconnlistener *listener,
+                              evutil_socket_t fd, struct sockaddr *addr,
+                              int socklen, void *ptr) {
+  ControlServer *server = static_cast<ControlServer *>(ptr);
+  server->conns_.insert(new ControlConn(server->base_, fd, server));
+}
+
+void ControlServer::cb_read(struct bufferevent *bev, void *ptr) {
+  static_cast<ControlConn *>(ptr)->readLines();
+}
+
+void ControlServer::cb_event(struct bufferevent *bev, short events, void *ptr) {
+  ControlConn *conn = static_cast<ControlConn *>(ptr);
+  if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+    conn->server_->removeConn(conn);
+  }
+}
+
+
+string dumpKcpState(const ikcpcb *kcp) {
+  char buf[1024];
+  snprintf(buf, sizeof(buf),
+           "conv: %u\n"
+           "mtu: %u, mss: %u, state: %u\n"
+           "snd_una: %u, snd_nxt: %u, rcv_nxt: %u\n"
+           "snd_wnd: %u, rcv_wnd: %u, rmt_wnd: %u, cwnd: %u, ssthresh: %u\n"
+           "srtt: %d, rttval: %d, rto: %d, minrto: %d\n"
+           "snd_queue: %u, snd_buf: %u, rcv_queue: %u, rcv_buf: %u, waitsnd: %d\n"
+           "nodelay: %u, interval: %u, fastresend: %d, nocwnd: %d\n"
+           "xmit: %u, rack_xmit: %u, tlp_xmit: %u, dead_link: %u\n"
+           "spurious fast: %u, rack: %u, rto: %u, "
+           "fastresend_adj: %u, reo_mult: %u\n",
+           kcp->conv,
+           kcp->mtu, kcp->mss, kcp->state,
+           kcp->snd_una, kcp->snd_nxt, kcp->rcv_nxt,
+           kcp->snd_wnd, kcp->rcv_wnd, kcp->rmt_wnd, kcp->cwnd, kcp->ssthresh,
+           kcp->rx_srtt, kcp->rx_rttval, kcp->rx_rto, kcp->rx_minrto,
+           kcp->nsnd_que, kcp->nsnd_buf, kcp->nrcv_que, kcp->nrcv_buf,
+           ikcp_waitsnd(kcp),
+           kcp->nodelay, kcp->interval, kcp->fastresend, kcp->nocwnd,
+           kcp->xmit, kcp->rack_xmit, kcp->tlp_xmit, kcp->dead_link,
+           kcp->spurious_fast, kcp->spurious_rack, kcp->spurious_rto,
+           kcp->fastresend_adj, kcp->reo_mult);
+  return string(buf);
+}
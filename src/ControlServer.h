@@ -0,0 +1,93 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_CONTROL_SERVER_H_
+#define TUT_CONTROL_SERVER_H_
+
+#include "Common.h"
+
+#include <set>
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/listener.h>
+
+//
+// unix domain control socket, one command per line, e.g.:
+//
+//   $ echo streams | socat - UNIX-CONNECT:/run/tclient.sock
+//
+// commands run on the event loop thread. a response is the output lines
+// followed by "OK" or "ERR <reason>".
+//
+// `args[0]` is the command. return false and put the reason in `out` on error.
+typedef bool (*ControlCommandCallback)(const vector<string> &args, string *out,
+                                       void *ptr);
+
+class ControlServer;
+
+/////////////////////////////////// ControlConn ////////////////////////////////
+class ControlConn {
+  struct bufferevent *bev_;
+
+public:
+  ControlServer *server_;
+
+public:
+  ControlConn(struct event_base *base, evutil_socket_t fd, ControlServer *server);
+  ~ControlConn();
+
+  void readLines();
+};
+
+////////////////////////////////// ControlServer ///////////////////////////////
+class ControlServer {
+  struct event_base *base_;
+  struct evconnlistener *listener_;
+  string path_;
+
+  ControlCommandCallback cb_;
+  void *ptr_;
+
+  std::set<ControlConn *> conns_;
+
+public:
+  ControlServer(struct event_base *base, ControlCommandCallback cb, void *ptr);
+  ~ControlServer();
+
+  bool listen(const string &path);
+
+  void execute(const string &line, string *response);
+  void removeConn(ControlConn *conn);
+
+  static void cb_accept(struct evconnlistener *listener, evutil_socket_t fd,
+                        struct sockaddr *addr, int socklen, void *ptr);
+  static void cb_read (struct bufferevent *bev, void *ptr);
+  static void cb_event(struct bufferevent *bev, short events, void *ptr);
+};
+
+// kcp internals, for the "kcp" command
+string dumpKcpState(const ikcpcb *kcp);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "Crc32c.h"
+
+#if defined(__x86_64__)
+# include <nmmintrin.h>
+#endif
+
+static uint32_t gCrc32cTable[256];
+
+static void initTable() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));  // reflected poly
+    }
+    gCrc32cTable[i] = crc;
+  }
+}
+
+static uint32_t crc32cTable(uint32_t crc, const uint8_t *p, size_t len) {
+  while (len--) {
+    crc = gCrc32cTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSse42(uint32_t crc, const uint8_t *p, size_t len) {
+  uint64_t crc64 = crc;
+  while (len >= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    crc64 = _mm_crc32_u64(crc64, v);
+    p   += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)crc64;
+  while (len--) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return crc;
+}
+#endif
+
+typedef uint32_t (*Crc32cFunc)(uint32_t crc, const uint8_t *p, size_t len);
+
+static Crc32cFunc pickCrc32c() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2"))
+    return crc32cSse42;
+#endif
+  initTable();
+  return crc32cTable;
+}
+
+static const Crc32cFunc gCrc32c = pickCrc32c();
+
+uint32_t crc32c(const uint8_t *data, size_t len) {
+  return ~gCrc32c(~0u, data, len);
+}
+
+bool crc32cHardware() {
+  return gCrc32c != crc32cTable;
+}
+
+
+/////////////////////////////// DatagramChecksum ///////////////////////////////
+const uint8_t *DatagramChecksum::append(const uint8_t *in, const size_t len,
+                                        size_t *outLen) {
+  if (buf_.size() < len + CRC32C_LEN) {
+    buf_.resize(len + CRC32C_LEN);
+  }
+  uint8_t *out = buf_.data();
+  memcpy(out, in, len);
+  *(uint32_t *)(out + len) = crc32c(in, len);
+
+  *outLen = len + CRC32C_LEN;
+  return out;
+}
+
+bool DatagramChecksum::verify(const uint8_t *in, const size_t len,
+                              size_t *outLen) {
+  if (len < CRC32C_LEN ||
+      *(uint32_t *)(in + len - CRC32C_LEN) != crc32c(in, len - CRC32C_LEN)) {
+    failures_++;
+    return false;
+  }
+  *outLen = len - CRC32C_LEN;
+  return true;
+}
@@ -0,0 +1,62 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_CRC32C_H_
+#define TUT_CRC32C_H_
+
+#include "Common.h"
+
+#define CRC32C_LEN  4
+
+// CRC-32C (Castagnoli), the SSE4.2 crc32 instruction when the cpu has it
+uint32_t crc32c(const uint8_t *data, size_t len);
+bool crc32cHardware();
+
+//
+// the CRC32C trailer of the datagrams when there is no AEAD tag:
+// | datagram | crc32c(4) |
+//
+// it keeps corrupted & stray datagrams out of ikcp_input(), a bogus ack of
+// one can trigger a storm of retransmissions.
+//
+class DatagramChecksum {
+  bool enabled_;
+  vector<uint8_t> buf_;
+
+public:
+  uint64_t failures_;
+
+public:
+  DatagramChecksum(): enabled_(false), failures_(0) {}
+
+  void setEnabled(const bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+  size_t overhead() const { return enabled_ ? CRC32C_LEN : 0; }
+
+  // the result is valid until the next call
+  const uint8_t *append(const uint8_t *in, const size_t len, size_t *outLen);
+  // false: short or mismatch. `*outLen` is the length without the trailer
+  bool verify(const uint8_t *in, const size_t len, size_t *outLen);
+};
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "IoEngine.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <event2/event.h>
+#include <event2/listener.h>
+
+
+//////////////////////////////////// UdpChannel ////////////////////////////////
+UdpChannel::UdpChannel(int fd, UdpReadCallback cb, void *ptr):
+fd_(fd), readCb_(cb), readPtr_(ptr)
+{
+}
+
+UdpChannel::~UdpChannel() {
+  if (fd_ != -1)
+    close(fd_);
+}
+
+
+///////////////////////////////// LibeventUdpChannel ///////////////////////////
+class LibeventUdpChannel : public UdpChannel {
+  static const int kBatchSize = 32;
+
+  LibeventIoEngine *engine_;
+  struct event *readEvent_;
+  const size_t maxSize_;
+
+  // recvmmsg()
+  vector<char> recvBufs_;
+  struct mmsghdr recvMsgs_[kBatchSize];
+  struct iovec   recvIovs_[kBatchSize];
+  struct sockaddr_storage recvAddrs_[kBatchSize];
+
+  // sendmmsg()
+  vector<char> sendBufs_;
+  struct mmsghdr sendMsgs_[kBatchSize];
+  struct iovec   sendIovs_[kBatchSize];
+  struct sockaddr_storage sendAddrs_[kBatchSize];
+  int sendCount_;
+
+  void handleRead();
+
+public:
+  LibeventUdpChannel(LibeventIoEngine *engine, struct event_base *base,
+                     int fd, size_t maxSize, UdpReadCallback cb, void *ptr);
+  ~LibeventUdpChannel();
+
+  void send(const char *buf, size_t len,
+            const struct sockaddr *addr, socklen_t addrLen);
+  void flush();
+
+  static void cb_read(evutil_socket_t fd, short events, void *ptr);
+};
+
+LibeventUdpChannel::LibeventUdpChannel(LibeventIoEngine *engine,
+                                       struct event_base *base,
+                                       int fd, size_t maxSize,
+                                       UdpReadCallback cb, void *ptr):
+UdpChannel(fd, cb, ptr), engine_(engine), readEvent_(nullptr),
+maxSize_(maxSize), sendCount_(0)
+{
+  recvBufs_.resize(kBatchSize * maxSize_);
+  sendBufs_.resize(kBatchSize * maxSize_);
+
+  memset(recvMsgs_, 0, sizeof(recvMsgs_));
+  memset(sendMsgs_, 0, sizeof(sendMsgs_));
+  for (int i = 0; i < kBatchSize; i++) {
+    recvIovs_[i].iov_base = &recvBufs_[i * maxSize_];
+    recvIovs_[i].iov_len  = maxSize_;
+    recvMsgs_[i].msg_hdr.msg_iov    = &recvIovs_[i];
+    recvMsgs_[i].msg_hdr.msg_iovlen = 1;
+    recvMsgs_[i].msg_hdr.msg_name   = &recvAddrs_[i];
+
+    sendIovs_[i].iov_base = &sendBufs_[i * maxSize_];
+    sendMsgs_[i].msg_hdr.msg_iov    = &sendIovs_[i];
+    sendMsgs_[i].msg_hdr.msg_iovlen = 1;
+    sendMsgs_[i].msg_hdr.msg_name   = &sendAddrs_[i];
+  }
+
+  readEvent_ = event_new(base, fd_, EV_READ|EV_PERSIST,
+                         LibeventUdpChannel::cb_read, this);
+  event_add(readEvent_, nullptr);
+}
+
+LibeventUdpChannel::~LibeventUdpChannel() {
+  flush();
+  event_del(readEvent_);
+  event_free(readEvent_);
+  engine_->removeChannel(this);
+}
+
+void LibeventUdpChannel::cb_read(evutil_socket_t fd, short events, void *ptr) {
+  static_cast<LibeventUdpChannel *>(ptr)->handleRead();
+}
+
+void LibeventUdpChannel::handleRead() {
+  for (int i = 0; i < kBatchSize; i++) {
+    recvMsgs_[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+  }
+
+  // one syscall for all datagrams that are already in the socket buffer
+  int n = recvmmsg(fd_, recvMsgs_, kBatchSize, MSG_DONTWAIT, nullptr);
+  if (n == -1) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      LOG_EVERY_MS(ERROR, 1000) << "recvmmsg error: " << strerror(errno);
+    }
+    return;
+  }
+
+  for (int i = 0; i < n; i++) {
+    const struct msghdr &hdr = recvMsgs_[i].msg_hdr;
+    if (hdr.msg_flags & MSG_TRUNC) {
+      LOG_EVERY_MS(ERROR, 1000) << "udp datagram truncated, max size: " << maxSize_;
+      continue;
+    }
+    readCb_((const uint8_t *)hdr.msg_iov->iov_base, recvMsgs_[i].msg_len,
+            (const struct sockaddr *)hdr.msg_name, hdr.msg_namelen, readPtr_);
+  }
+}
+
+void LibeventUdpChannel::send(const char *buf, size_t len,
+                              const struct sockaddr *addr, socklen_t addrLen) {
+  if (len > maxSize_) {
+    LOG_EVERY_MS(ERROR, 1000) << "udp datagram too large: " << len;
+    return;
+  }
+  if (sendCount_ == kBatchSize) {
+    flush();
+  }
+
+  const int i = sendCount_++;
+  memcpy(sendIovs_[i].iov_base, buf, len);
+  sendIovs_[i].iov_len = len;
+
+  struct msghdr &hdr = sendMsgs_[i].msg_hdr;
+  if (addr != nullptr) {
+    memcpy(&sendAddrs_[i], addr, addrLen);
+    hdr.msg_name    = &sendAddrs_[i];
+    hdr.msg_namelen = addrLen;
+  } else {
+    // connected socket
+    hdr.msg_name    = nullptr;
+    hdr.msg_namelen = 0;
+  }
+}
+
+void LibeventUdpChannel::flush() {
+  int sent = 0;
+  while (sent < sendCount_) {
+    // On success, sendmmsg() returns the number of messages sent from msgvec.
+    // On error, -1 is returned, and errno is set to indicate the error.
+    int r = sendmmsg(fd_, &sendMsgs_[sent], sendCount_ - sent, MSG_DONTWAIT);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+        // the socket buffer is full, so would be the rest: kcp resends them
+        LOG_EVERY_MS(ERROR, 1000) << "sendmmsg error: " << strerror(errno)
+        << ", dropped: " << sendCount_ - sent;
+        break;
+      }
+      // the error is of the first one only (EMSGSIZE, unreachable address),
+      // skip it and send the others
+      LOG_EVERY_MS(ERROR, 1000) << "sendmmsg error: " << strerror(errno)
+      << ", dropped one datagram of " << sendIovs_[sent].iov_len << " bytes";
+      sent++;
+      continue;
+    }
+    sent += r;
+  }
+  sendCount_ = 0;
+}
+
+
+//////////////////////////////// LibeventTcpListener ///////////////////////////
+class LibeventTcpListener : public TcpListener {
+  struct evconnlistener *listener_;
+  TcpAcceptCallback acceptCb_;
+  void *acceptPtr_;
+
+public:
+  LibeventTcpListener(TcpAcceptCallback cb, void *ptr):
+  listener_(nullptr), acceptCb_(cb), acceptPtr_(ptr) {}
+
+  ~LibeventTcpListener() {
+    if (listener_)
+      evconnlistener_free(listener_);
+  }
+
+  bool bind(struct event_base *base,
+            const struct sockaddr *addr, socklen_t addrLen) {
+    listener_ = evconnlistener_new_bind(base,
+                                        LibeventTcpListener::cb_accept,
+                                        (void*)this,
+                                        LEV_OPT_REUSEABLE|LEV_OPT_CLOSE_ON_FREE,
+                                        // backlog, Set to -1 for a reasonable default
+                                        -1,
+                                        addr, addrLen);
+    return listener_ != nullptr;
+  }
+
+  void disable() {
+    evconnlistener_disable(listener_);
+  }
+
+  static void cb_accept(struct evconnlistener *listener, evutil_socket_t fd,
+                        struct sockaddr *saddr, int socklen, void *ptr) {
+    LibeventTcpListener *l = static_cast<LibeventTcpListener *>(ptr);
+    l->acceptCb_(fd, l->acceptPtr_);
+  }
+};
+
+
+///////////////////////////////// LibeventIoEngine /////////////////////////////
+LibeventIoEngine::LibeventIoEngine(struct event_base *base): IoEngine(base) {
+}
+
+LibeventIoEngine::~LibeventIoEngine() {
+  // channels are owned by the caller
+}
+
+UdpChannel *LibeventIoEngine::openUdp(int fd, size_t maxDatagramSize,
+                                      UdpReadCallback cb, void *ptr) {
+  LibeventUdpChannel *c = new LibeventUdpChannel(this, base_, fd,
+                                                 maxDatagramSize, cb, ptr);
+  channels_.push_back(c);
+  return c;
+}
+
+void LibeventIoEngine::removeChannel(LibeventUdpChannel *channel) {
+  for (auto itr = channels_.begin(); itr != channels_.end(); itr++) {
+    if (*itr == channel) {
+      channels_.erase(itr);
+      return;
+    }
+  }
+}
+
+TcpListener *LibeventIoEngine::listen(const struct sockaddr *addr,
+                                      socklen_t addrLen,
+                                      TcpAcceptCallback cb, void *ptr) {
+  LibeventTcpListener *l = new LibeventTcpListener(cb, ptr);
+  if (!l->bind(base_, addr, addrLen)) {
+    delete l;
+    return nullptr;
+  }
+  return l;
+}
+
+void LibeventIoEngine::flush() {
+  for (auto c : channels_) {
+    c->flush();
+  }
+}
+
+
+///////////////////////////////////// IoEngine /////////////////////////////////
+IoEngine *IoEngine::create(const string &name, struct event_base *base) {
+  if (name == "io_uring") {
+#ifdef HAVE_LIBURING
+    IoEngine *e = createUringIoEngine(base);
+    if (e != nullptr) {
+      return e;
+    }
+    LOG(WARNING) << "io_uring setup failure, fall back to libevent";
+#else
+    LOG(WARNING) << "io_uring is not compiled in, fall back to libevent";
+#endif
+  }
+  else if (!name.empty() && name != "libevent") {
+    LOG(WARNING) << "unknown io engine: " << name << ", use libevent";
+  }
+  return new LibeventIoEngine(base);
+}
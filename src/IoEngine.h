@@ -0,0 +1,139 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_IO_ENGINE_H_
+#define TUT_IO_ENGINE_H_
+
+#include "Common.h"
+
+#include <sys/socket.h>
+
+#include <event2/event.h>
+#include <event2/listener.h>
+
+#include <vector>
+
+using std::vector;
+
+
+//
+// IoEngine: how the UDP tunnel socket and the TCP listener talk to the kernel.
+//
+// - libevent (default): readiness events, recvmmsg() per wakeup and one
+//   sendmmsg() per flush().
+// - io_uring (built with -DUSE_IO_URING=ON): multishot recvmsg on a provided
+//   buffer ring, sendmsg SQEs submitted together on flush(), multishot accept.
+//
+// Both run inside the same event_base, io_uring completions are signalled
+// through an eventfd, so callbacks always run on the event loop thread.
+//
+// Sends are queued, the owner must call flush() after ikcp_update() /
+// ikcp_flush() so that all datagrams of one KCP flush leave in one syscall.
+//
+
+typedef void (*UdpReadCallback)(const uint8_t *data, size_t len,
+                                const struct sockaddr *addr, socklen_t addrLen,
+                                void *ptr);
+typedef void (*TcpAcceptCallback)(evutil_socket_t fd, void *ptr);
+
+
+//////////////////////////////////// UdpChannel ////////////////////////////////
+class UdpChannel {
+protected:
+  int fd_;
+  UdpReadCallback readCb_;
+  void *readPtr_;
+
+public:
+  UdpChannel(int fd, UdpReadCallback cb, void *ptr);
+  virtual ~UdpChannel();  // closes fd
+
+  int fd() const { return fd_; }
+
+  // queue a datagram, it's sent by IoEngine::flush()
+  virtual void send(const char *buf, size_t len,
+                    const struct sockaddr *addr, socklen_t addrLen) = 0;
+};
+
+
+/////////////////////////////////// TcpListener ////////////////////////////////
+class TcpListener {
+public:
+  virtual ~TcpListener() {}
+  virtual void disable() = 0;
+};
+
+
+///////////////////////////////////// IoEngine /////////////////////////////////
+class IoEngine {
+protected:
+  struct event_base *base_;
+
+public:
+  explicit IoEngine(struct event_base *base): base_(base) {}
+  virtual ~IoEngine() {}
+
+  // name: "libevent" or "io_uring", falls back to libevent if io_uring is
+  // not compiled in or can't be set up on this kernel
+  static IoEngine *create(const string &name, struct event_base *base);
+
+  virtual const char *name() const = 0;
+
+  // the channel takes the ownership of `fd`, which must be non-blocking
+  virtual UdpChannel *openUdp(int fd, size_t maxDatagramSize,
+                              UdpReadCallback cb, void *ptr) = 0;
+
+  virtual TcpListener *listen(const struct sockaddr *addr, socklen_t addrLen,
+                              TcpAcceptCallback cb, void *ptr) = 0;
+
+  // send all queued datagrams
+  virtual void flush() = 0;
+};
+
+
+//////////////////////////////// LibeventIoEngine //////////////////////////////
+class LibeventUdpChannel;
+
+class LibeventIoEngine : public IoEngine {
+  vector<LibeventUdpChannel *> channels_;
+
+public:
+  explicit LibeventIoEngine(struct event_base *base);
+  ~LibeventIoEngine();
+
+  const char *name() const { return "libevent"; }
+
+  UdpChannel *openUdp(int fd, size_t maxDatagramSize,
+                      UdpReadCallback cb, void *ptr);
+  TcpListener *listen(const struct sockaddr *addr, socklen_t addrLen,
+                      TcpAcceptCallback cb, void *ptr);
+  void flush();
+
+  void removeChannel(LibeventUdpChannel *channel);
+};
+
+#ifdef HAVE_LIBURING
+IoEngine *createUringIoEngine(struct event_base *base);
+#endif
+
+#endif
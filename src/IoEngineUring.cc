@@ -0,0 +1,719 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifdef HAVE_LIBURING
+
+#include "IoEngine.h"
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <liburing.h>
+
+#include <event2/event.h>
+
+#include <set>
+
+using std::set;
+
+
+class UringIoEngine;
+class UringUdpSocket;
+class UringTcpAcceptor;
+
+// every SQE carries a pointer to one of these as user_data
+struct UringOp {
+  enum Type { RECV, SEND, ACCEPT };
+  Type  type_;
+  void *owner_;
+  int   slot_;
+};
+
+
+////////////////////////////////// UringUdpSocket //////////////////////////////
+//
+// The kernel keeps using the recv buffers and the send slots until the last
+// completion arrives, so this outlives UringUdpChannel: the channel cancels
+// the multishot recv on destruction and the socket frees itself when nothing
+// is in flight any more.
+//
+class UringUdpSocket {
+  static const int kRecvBufNum = 256;  // must be power of 2
+  static const int kSendSlotNum = 128;
+
+  struct SendSlot {
+    UringOp op_;
+    struct msghdr msg_;
+    struct iovec  iov_;
+    struct sockaddr_storage addr_;
+  };
+
+  UringIoEngine *engine_;
+  const int fd_;
+  const size_t maxSize_;
+  const int bgid_;
+  UdpReadCallback readCb_;
+  void *readPtr_;
+
+  // multishot recvmsg, kernel picks buffers from the ring
+  UringOp recvOp_;
+  struct msghdr recvMsg_;
+  struct io_uring_buf_ring *bufRing_;
+  vector<char> recvBufs_;
+  size_t recvBufSize_;
+  bool recvArmed_;
+  bool cancelSent_;
+
+  // sendmsg, slot buffers must live until the completion
+  vector<SendSlot> sendSlots_;
+  vector<char> sendBufs_;
+  vector<int> freeSlots_;
+
+  bool closed_;
+  bool inCallback_;
+
+  void maybeFree();
+  void cancelRecv();
+
+public:
+  UringUdpSocket(UringIoEngine *engine, int fd, int bgid, size_t maxSize,
+                 UdpReadCallback cb, void *ptr);
+  ~UringUdpSocket();
+
+  bool setup();
+  bool armRecv();
+  void close();
+  void retry();
+  void send(const char *buf, size_t len,
+            const struct sockaddr *addr, socklen_t addrLen);
+
+  void handleRecv(const struct io_uring_cqe *cqe);
+  void handleSend(const struct io_uring_cqe *cqe, int slot);
+};
+
+class UringUdpChannel : public UdpChannel {
+  UringUdpSocket *sock_;
+
+public:
+  UringUdpChannel(int fd, UringUdpSocket *sock):
+  UdpChannel(fd, nullptr, nullptr), sock_(sock) {}
+
+  ~UringUdpChannel() {
+    sock_->close();
+  }
+
+  void send(const char *buf, size_t len,
+            const struct sockaddr *addr, socklen_t addrLen) {
+    sock_->send(buf, len, addr, addrLen);
+  }
+};
+
+
+////////////////////////////////// UringTcpAcceptor ////////////////////////////
+//
+// Same as UringUdpSocket: the multishot accept holds a pointer to acceptOp_
+// until its terminal completion, so this outlives UringTcpListener and frees
+// itself after that completion.
+//
+class UringTcpAcceptor {
+  UringIoEngine *engine_;
+  UringOp acceptOp_;
+  TcpAcceptCallback acceptCb_;
+  void *acceptPtr_;
+  int  fd_;
+  bool enabled_;
+  bool acceptArmed_;
+  bool cancelSent_;
+  bool closed_;
+  bool inCallback_;
+
+  void maybeFree();
+  void cancelAccept();
+
+public:
+  UringTcpAcceptor(UringIoEngine *engine, TcpAcceptCallback cb, void *ptr);
+  ~UringTcpAcceptor();
+
+  bool bind(const struct sockaddr *addr, socklen_t addrLen);
+  bool armAccept();
+  void disable();
+  void close();
+  void retry();
+
+  void handleAccept(const struct io_uring_cqe *cqe);
+};
+
+class UringTcpListener : public TcpListener {
+  UringTcpAcceptor *acceptor_;
+
+public:
+  explicit UringTcpListener(UringTcpAcceptor *acceptor): acceptor_(acceptor) {}
+
+  ~UringTcpListener() {
+    acceptor_->close();
+  }
+
+  void disable() {
+    acceptor_->disable();
+  }
+};
+
+
+/////////////////////////////////// UringIoEngine //////////////////////////////
+class UringIoEngine : public IoEngine {
+  int eventFd_;
+  struct event *cqEvent_;
+  int nextBgid_;
+
+  // alive until their last completion, see UringUdpSocket
+  set<UringUdpSocket *> sockets_;
+  set<UringTcpAcceptor *> acceptors_;
+
+  void reap();
+  void retryPending();
+  void drain();
+
+public:
+  struct io_uring ring_;
+
+  explicit UringIoEngine(struct event_base *base);
+  ~UringIoEngine();
+
+  bool setup();
+  const char *name() const { return "io_uring"; }
+
+  struct io_uring_sqe *getSqe();
+
+  UdpChannel *openUdp(int fd, size_t maxDatagramSize,
+                      UdpReadCallback cb, void *ptr);
+  TcpListener *listen(const struct sockaddr *addr, socklen_t addrLen,
+                      TcpAcceptCallback cb, void *ptr);
+  void flush();
+
+  void addSocket(UringUdpSocket *sock) { sockets_.insert(sock); }
+  void removeSocket(UringUdpSocket *sock) { sockets_.erase(sock); }
+  void addAcceptor(UringTcpAcceptor *a) { acceptors_.insert(a); }
+  void removeAcceptor(UringTcpAcceptor *a) { acceptors_.erase(a); }
+
+  static void cb_completion(evutil_socket_t fd, short events, void *ptr);
+};
+
+
+////////////////////////////////// UringUdpSocket /////////////////////////////
+UringUdpSocket::UringUdpSocket(UringIoEngine *engine, int fd, int bgid,
+                               size_t maxSize,
+                               UdpReadCallback cb, void *ptr):
+engine_(engine), fd_(fd), maxSize_(maxSize), bgid_(bgid),
+readCb_(cb), readPtr_(ptr), bufRing_(nullptr), recvBufSize_(0),
+recvArmed_(false), cancelSent_(false), closed_(false), inCallback_(false)
+{
+  recvOp_.type_  = UringOp::RECV;
+  recvOp_.owner_ = this;
+  recvOp_.slot_  = -1;
+
+  memset(&recvMsg_, 0, sizeof(recvMsg_));
+  recvMsg_.msg_namelen = sizeof(struct sockaddr_storage);
+
+  // | io_uring_recvmsg_out | name | payload |
+  recvBufSize_ = sizeof(struct io_uring_recvmsg_out) +
+                 sizeof(struct sockaddr_storage) + maxSize_;
+  engine_->addSocket(this);
+}
+
+UringUdpSocket::~UringUdpSocket() {
+  engine_->removeSocket(this);
+  if (bufRing_)
+    io_uring_free_buf_ring(&engine_->ring_, bufRing_, kRecvBufNum, bgid_);
+}
+
+bool UringUdpSocket::setup() {
+  int ret = 0;
+  bufRing_ = io_uring_setup_buf_ring(&engine_->ring_, kRecvBufNum, bgid_, 0, &ret);
+  if (bufRing_ == nullptr) {
+    LOG(ERROR) << "io_uring_setup_buf_ring failure: " << strerror(-ret);
+    return false;
+  }
+
+  recvBufs_.resize(kRecvBufNum * recvBufSize_);
+  const int mask = io_uring_buf_ring_mask(kRecvBufNum);
+  for (int i = 0; i < kRecvBufNum; i++) {
+    io_uring_buf_ring_add(bufRing_, &recvBufs_[i * recvBufSize_],
+                          recvBufSize_, i, mask, i);
+  }
+  io_uring_buf_ring_advance(bufRing_, kRecvBufNum);
+
+  sendSlots_.resize(kSendSlotNum);
+  sendBufs_.resize(kSendSlotNum * maxSize_);
+  for (int i = 0; i < kSendSlotNum; i++) {
+    SendSlot &s = sendSlots_[i];
+    s.op_.type_  = UringOp::SEND;
+    s.op_.owner_ = this;
+    s.op_.slot_  = i;
+    memset(&s.msg_, 0, sizeof(s.msg_));
+    s.iov_.iov_base = &sendBufs_[i * maxSize_];
+    s.msg_.msg_iov    = &s.iov_;
+    s.msg_.msg_iovlen = 1;
+    freeSlots_.push_back(i);
+  }
+
+  return armRecv();
+}
+
+bool UringUdpSocket::armRecv() {
+  struct io_uring_sqe *sqe = engine_->getSqe();
+  if (sqe == nullptr)
+    return false;  // retried after the next reap
+
+  io_uring_prep_recvmsg_multishot(sqe, fd_, &recvMsg_, 0);
+  sqe->flags    |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = bgid_;
+  io_uring_sqe_set_data(sqe, &recvOp_);
+  recvArmed_ = true;
+  return true;
+}
+
+void UringUdpSocket::cancelRecv() {
+  struct io_uring_sqe *sqe = engine_->getSqe();
+  if (sqe == nullptr)
+    return;  // retried after the next reap
+
+  io_uring_prep_cancel(sqe, &recvOp_, 0);
+  io_uring_sqe_set_data(sqe, nullptr);
+  cancelSent_ = true;
+  engine_->flush();
+}
+
+void UringUdpSocket::close() {
+  closed_ = true;
+  if (recvArmed_) {
+    cancelRecv();
+  }
+  maybeFree();
+}
+
+void UringUdpSocket::retry() {
+  if (closed_) {
+    if (recvArmed_ && !cancelSent_)
+      cancelRecv();
+  } else if (!recvArmed_) {
+    armRecv();
+  }
+}
+
+void UringUdpSocket::maybeFree() {
+  if (closed_ && !recvArmed_ && !inCallback_ &&
+      freeSlots_.size() == sendSlots_.size()) {
+    delete this;
+  }
+}
+
+void UringUdpSocket::handleRecv(const struct io_uring_cqe *cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    recvArmed_  = false;
+    cancelSent_ = false;
+  }
+
+  if (cqe->res < 0) {
+    // -ENOBUFS: all provided buffers are in use, just re-arm
+    if (cqe->res != -ENOBUFS) {
+      LOG_EVERY_MS(ERROR, 1000) << "io_uring recvmsg error: " << strerror(-cqe->res);
+    }
+  }
+  else if (cqe->flags & IORING_CQE_F_BUFFER) {
+    const int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    char *buf = &recvBufs_[bid * recvBufSize_];
+
+    struct io_uring_recvmsg_out *out;
+    out = io_uring_recvmsg_validate(buf, cqe->res, &recvMsg_);
+    if (closed_) {
+      // drop it
+    }
+    else if (out != nullptr && !(out->flags & MSG_TRUNC)) {
+      const uint8_t *payload = (const uint8_t *)io_uring_recvmsg_payload(out, &recvMsg_);
+      const size_t len = io_uring_recvmsg_payload_length(out, cqe->res, &recvMsg_);
+      inCallback_ = true;  // the owner may close the channel in the callback
+      readCb_(payload, len, io_uring_recvmsg_name(out), out->namelen, readPtr_);
+      inCallback_ = false;
+    } else {
+      LOG_EVERY_MS(ERROR, 1000) << "io_uring recvmsg invalid or truncated datagram";
+    }
+
+    // give the buffer back to the kernel
+    io_uring_buf_ring_add(bufRing_, buf, recvBufSize_, bid,
+                          io_uring_buf_ring_mask(kRecvBufNum), 0);
+    io_uring_buf_ring_advance(bufRing_, 1);
+  }
+
+  if (closed_) {
+    maybeFree();
+  } else if (!recvArmed_) {
+    // multishot request terminated, arm a new one
+    armRecv();
+  }
+}
+
+void UringUdpSocket::send(const char *buf, size_t len,
+                          const struct sockaddr *addr, socklen_t addrLen) {
+  if (len > maxSize_) {
+    LOG_EVERY_MS(ERROR, 1000) << "udp datagram too large: " << len;
+    return;
+  }
+  if (freeSlots_.empty()) {
+    // every slot is in flight, kcp will resend it
+    LOG_EVERY_MS(ERROR, 1000) << "io_uring send slots exhausted, drop datagram";
+    return;
+  }
+
+  const int i = freeSlots_.back();
+  freeSlots_.pop_back();
+
+  SendSlot &s = sendSlots_[i];
+  memcpy(s.iov_.iov_base, buf, len);
+  s.iov_.iov_len = len;
+  if (addr != nullptr) {
+    memcpy(&s.addr_, addr, addrLen);
+    s.msg_.msg_name    = &s.addr_;
+    s.msg_.msg_namelen = addrLen;
+  } else {
+    s.msg_.msg_name    = nullptr;
+    s.msg_.msg_namelen = 0;
+  }
+
+  // submitted by IoEngine::flush()
+  struct io_uring_sqe *sqe = engine_->getSqe();
+  if (sqe == nullptr) {
+    freeSlots_.push_back(i);  // kcp will resend it
+    return;
+  }
+  io_uring_prep_sendmsg(sqe, fd_, &s.msg_, MSG_DONTWAIT);
+  io_uring_sqe_set_data(sqe, &s.op_);
+}
+
+void UringUdpSocket::handleSend(const struct io_uring_cqe *cqe, int slot) {
+  if (cqe->res < 0) {
+    LOG_EVERY_MS(ERROR, 1000) << "io_uring sendmsg error: " << strerror(-cqe->res);
+  }
+  freeSlots_.push_back(slot);
+  maybeFree();
+}
+
+
+////////////////////////////////// UringTcpAcceptor ////////////////////////////
+UringTcpAcceptor::UringTcpAcceptor(UringIoEngine *engine,
+                                   TcpAcceptCallback cb, void *ptr):
+engine_(engine), acceptCb_(cb), acceptPtr_(ptr), fd_(-1), enabled_(false),
+acceptArmed_(false), cancelSent_(false), closed_(false), inCallback_(false)
+{
+  acceptOp_.type_  = UringOp::ACCEPT;
+  acceptOp_.owner_ = this;
+  acceptOp_.slot_  = -1;
+  engine_->addAcceptor(this);
+}
+
+UringTcpAcceptor::~UringTcpAcceptor() {
+  engine_->removeAcceptor(this);
+  if (fd_ != -1)
+    ::close(fd_);
+}
+
+bool UringTcpAcceptor::bind(const struct sockaddr *addr, socklen_t addrLen) {
+  fd_ = socket(addr->sa_family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+  if (fd_ == -1) {
+    LOG(ERROR) << "create tcp socket failure: " << strerror(errno);
+    return false;
+  }
+
+  int on = 1;
+  setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  if (::bind(fd_, addr, addrLen) == -1 || ::listen(fd_, SOMAXCONN) == -1) {
+    LOG(ERROR) << "bind/listen tcp socket failure: " << strerror(errno);
+    return false;
+  }
+
+  enabled_ = true;
+  if (!armAccept())
+    return false;
+  engine_->flush();
+  return true;
+}
+
+bool UringTcpAcceptor::armAccept() {
+  struct io_uring_sqe *sqe = engine_->getSqe();
+  if (sqe == nullptr)
+    return false;  // retried after the next reap
+
+  // accepted sockets are non-blocking, as evconnlistener does
+  io_uring_prep_multishot_accept(sqe, fd_, nullptr, nullptr,
+                                 SOCK_NONBLOCK|SOCK_CLOEXEC);
+  io_uring_sqe_set_data(sqe, &acceptOp_);
+  acceptArmed_ = true;
+  return true;
+}
+
+void UringTcpAcceptor::cancelAccept() {
+  struct io_uring_sqe *sqe = engine_->getSqe();
+  if (sqe == nullptr)
+    return;  // retried after the next reap
+
+  io_uring_prep_cancel(sqe, &acceptOp_, 0);
+  io_uring_sqe_set_data(sqe, nullptr);
+  cancelSent_ = true;
+  engine_->flush();
+}
+
+void UringTcpAcceptor::disable() {
+  if (!enabled_)
+    return;
+  enabled_ = false;
+
+  if (acceptArmed_ && !cancelSent_)
+    cancelAccept();
+}
+
+void UringTcpAcceptor::close() {
+  closed_ = true;
+  disable();
+  maybeFree();
+}
+
+void UringTcpAcceptor::retry() {
+  if (enabled_) {
+    if (!acceptArmed_)
+      armAccept();
+  } else if (acceptArmed_ && !cancelSent_) {
+    cancelAccept();
+  }
+}
+
+void UringTcpAcceptor::maybeFree() {
+  if (closed_ && !acceptArmed_ && !inCallback_) {
+    delete this;
+  }
+}
+
+void UringTcpAcceptor::handleAccept(const struct io_uring_cqe *cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    acceptArmed_ = false;
+    cancelSent_  = false;
+  }
+
+  if (cqe->res >= 0) {
+    if (enabled_) {
+      inCallback_ = true;  // the owner may delete the listener in the callback
+      acceptCb_(cqe->res, acceptPtr_);
+      inCallback_ = false;
+    } else {
+      ::close(cqe->res);
+    }
+  }
+  else if (cqe->res != -ECANCELED) {
+    LOG_EVERY_MS(ERROR, 1000) << "io_uring accept error: " << strerror(-cqe->res);
+  }
+
+  if (closed_) {
+    maybeFree();
+  } else if (enabled_ && !acceptArmed_) {
+    armAccept();
+  }
+}
+
+
+/////////////////////////////////// UringIoEngine //////////////////////////////
+UringIoEngine::UringIoEngine(struct event_base *base):
+IoEngine(base), eventFd_(-1), cqEvent_(nullptr), nextBgid_(0)
+{
+  memset(&ring_, 0, sizeof(ring_));
+}
+
+UringIoEngine::~UringIoEngine() {
+  if (cqEvent_) {
+    event_del(cqEvent_);
+    event_free(cqEvent_);
+  }
+  if (eventFd_ != -1) {
+    drain();
+    io_uring_queue_exit(&ring_);
+    close(eventFd_);
+  }
+}
+
+void UringIoEngine::drain() {
+  // channels and listeners are gone by now, but their sockets live until
+  // the cancelled requests complete, wait a bit for that
+  for (int i = 0; i < 100 && !(sockets_.empty() && acceptors_.empty()); i++) {
+    retryPending();
+    flush();
+
+    struct io_uring_cqe *cqe = nullptr;
+    struct __kernel_timespec ts;
+    ts.tv_sec  = 0;
+    ts.tv_nsec = 10 * 1000 * 1000;
+    if (io_uring_wait_cqe_timeout(&ring_, &cqe, &ts) == 0) {
+      reap();
+    }
+  }
+
+  // still in flight, free them while the ring and its buffer groups exist
+  if (!sockets_.empty() || !acceptors_.empty()) {
+    LOG(ERROR) << "io_uring: " << sockets_.size() << " udp sockets and "
+    << acceptors_.size() << " listeners still in flight at exit";
+  }
+  while (!sockets_.empty()) {
+    delete *sockets_.begin();
+  }
+  while (!acceptors_.empty()) {
+    delete *acceptors_.begin();
+  }
+}
+
+bool UringIoEngine::setup() {
+  int ret = io_uring_queue_init(1024, &ring_, 0);
+  if (ret < 0) {
+    LOG(ERROR) << "io_uring_queue_init failure: " << strerror(-ret);
+    return false;
+  }
+
+  eventFd_ = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  if (eventFd_ == -1 || io_uring_register_eventfd(&ring_, eventFd_) < 0) {
+    LOG(ERROR) << "io_uring eventfd failure: " << strerror(errno);
+    if (eventFd_ != -1)
+      close(eventFd_);
+    eventFd_ = -1;
+    io_uring_queue_exit(&ring_);
+    return false;
+  }
+
+  cqEvent_ = event_new(base_, eventFd_, EV_READ|EV_PERSIST,
+                       UringIoEngine::cb_completion, this);
+  event_add(cqEvent_, nullptr);
+  return true;
+}
+
+struct io_uring_sqe *UringIoEngine::getSqe() {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+  if (sqe == nullptr) {
+    // submission queue is full, push it to the kernel and try again
+    io_uring_submit(&ring_);
+    sqe = io_uring_get_sqe(&ring_);
+  }
+  if (sqe == nullptr) {
+    // the kernel refused the submit (e.g. -EBUSY on a full completion queue),
+    // the caller backs off and the request is retried after the next reap
+    LOG_EVERY_MS(ERROR, 1000) << "io_uring submission queue full";
+  }
+  return sqe;
+}
+
+UdpChannel *UringIoEngine::openUdp(int fd, size_t maxDatagramSize,
+                                   UdpReadCallback cb, void *ptr) {
+  UringUdpSocket *sock = new UringUdpSocket(this, fd, nextBgid_++,
+                                            maxDatagramSize, cb, ptr);
+  if (!sock->setup()) {
+    delete sock;
+    ::close(fd);
+    return nullptr;
+  }
+  flush();
+  return new UringUdpChannel(fd, sock);
+}
+
+TcpListener *UringIoEngine::listen(const struct sockaddr *addr,
+                                   socklen_t addrLen,
+                                   TcpAcceptCallback cb, void *ptr) {
+  UringTcpAcceptor *a = new UringTcpAcceptor(this, cb, ptr);
+  if (!a->bind(addr, addrLen)) {
+    delete a;  // nothing armed yet
+    return nullptr;
+  }
+  return new UringTcpListener(a);
+}
+
+void UringIoEngine::flush() {
+  if (io_uring_sq_ready(&ring_) > 0) {
+    io_uring_submit(&ring_);
+  }
+}
+
+void UringIoEngine::cb_completion(evutil_socket_t fd, short events, void *ptr) {
+  uint64_t n;
+  if (read(fd, &n, sizeof(n)) == -1 && errno != EAGAIN) {
+    LOG(ERROR) << "read eventfd failure: " << strerror(errno);
+  }
+  static_cast<UringIoEngine *>(ptr)->reap();
+}
+
+void UringIoEngine::reap() {
+  struct io_uring_cqe *cqes[64];
+  unsigned n;
+
+  while ((n = io_uring_peek_batch_cqe(&ring_, cqes, 64)) > 0) {
+    for (unsigned i = 0; i < n; i++) {
+      const struct io_uring_cqe *cqe = cqes[i];
+      UringOp *op = (UringOp *)io_uring_cqe_get_data(cqe);
+      if (op == nullptr)  // cancel requests
+        continue;
+
+      switch (op->type_) {
+        case UringOp::RECV:
+          static_cast<UringUdpSocket *>(op->owner_)->handleRecv(cqe);
+          break;
+        case UringOp::SEND:
+          static_cast<UringUdpSocket *>(op->owner_)->handleSend(cqe, op->slot_);
+          break;
+        case UringOp::ACCEPT:
+          static_cast<UringTcpAcceptor *>(op->owner_)->handleAccept(cqe);
+          break;
+      }
+    }
+    io_uring_cq_advance(&ring_, n);
+  }
+
+  // requests that couldn't get an sqe before, the queue is drained now
+  retryPending();
+
+  // re-armed requests and datagrams queued by the callbacks
+  flush();
+}
+
+void UringIoEngine::retryPending() {
+  for (auto sock : sockets_) {
+    sock->retry();
+  }
+  for (auto a : acceptors_) {
+    a->retry();
+  }
+}
+
+IoEngine *createUringIoEngine(struct event_base *base) {
+  UringIoEngine *e = new UringIoEngine(base);
+  if (!e->setup()) {
+    delete e;
+    return nullptr;
+  }
+  LOG(INFO) << "io engine: io_uring";
+  return e;
+}
+
+#endif  // HAVE_LIBURING
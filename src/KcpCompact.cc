@@ -0,0 +1,217 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "KcpCompact.h"
+
+// ikcp.c
+#define IKCP_CMD_PUSH  81
+#define IKCP_CMD_WINS  84
+#define IKCP_OVERHEAD  24
+
+#define COMPACT_CMD_MASK   0x07u
+#define COMPACT_WITH_WND   0x08u
+#define COMPACT_WITH_FRG   0x10u
+#define COMPACT_WITH_LEN   0x20u
+
+static inline uint8_t *putVarint(uint8_t *p, uint32_t v) {
+  while (v >= 0x80u) {
+    *p++ = (uint8_t)(v | 0x80u);
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static inline bool getVarint(const uint8_t **p, const uint8_t *end,
+                             uint32_t *v) {
+  uint32_t r = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (*p >= end)
+      return false;
+    const uint8_t b = *(*p)++;
+    r |= (uint32_t)(b & 0x7fu) << shift;
+    if ((b & 0x80u) == 0) {
+      *v = r;
+      return true;
+    }
+  }
+  return false;
+}
+
+// small deltas either way to small varints
+static inline uint32_t zigzag(const uint32_t delta) {
+  return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+static inline uint32_t unzigzag(const uint32_t v) {
+  return (v >> 1) ^ (0u - (v & 1u));
+}
+
+const uint8_t *KcpCompactCodec::compress(const uint8_t *in, const size_t len,
+                                         size_t *outLen) {
+  // never longer, see KcpCompact.h
+  if (compressBuf_.size() < len) {
+    compressBuf_.resize(len);
+  }
+  const uint8_t *p   = in;
+  const uint8_t *end = in + len;
+  uint8_t *out = compressBuf_.data();
+  uint32_t ts = 0, sn = 0, una = 0, wnd = 0;
+  bool first = true;
+
+  while (p < end) {
+    if (end - p < IKCP_OVERHEAD)
+      return nullptr;
+    const uint8_t  cmd    = p[4];
+    const uint8_t  frg    = p[5];
+    const uint32_t segWnd = *(uint16_t *)(p + 6);
+    const uint32_t segTs  = *(uint32_t *)(p + 8);
+    const uint32_t segSn  = *(uint32_t *)(p + 12);
+    const uint32_t segUna = *(uint32_t *)(p + 16);
+    const uint32_t segLen = *(uint32_t *)(p + 20);
+    p += IKCP_OVERHEAD;
+    if (cmd < IKCP_CMD_PUSH || cmd > IKCP_CMD_WINS || segLen > (size_t)(end - p))
+      return nullptr;
+
+    uint8_t *flags = out++;
+    *flags = (uint8_t)(cmd - IKCP_CMD_PUSH + 1);
+    if (first) {
+      out = putVarint(out, segTs);
+      out = putVarint(out, segSn);
+      out = putVarint(out, zigzag(segUna - segSn));
+    } else {
+      out = putVarint(out, zigzag(segTs - ts));
+      out = putVarint(out, zigzag(segSn - sn));
+      out = putVarint(out, zigzag(segUna - una));
+    }
+    if (first || segWnd != wnd) {
+      *flags |= COMPACT_WITH_WND;
+      out = putVarint(out, segWnd);
+    }
+    if (frg != 0) {
+      *flags |= COMPACT_WITH_FRG;
+      *out++ = frg;
+    }
+    if (segLen != 0) {
+      *flags |= COMPACT_WITH_LEN;
+      out = putVarint(out, segLen);
+      memcpy(out, p, segLen);
+      out += segLen;
+      p   += segLen;
+    }
+
+    ts    = segTs;
+    sn    = segSn;
+    una   = segUna;
+    wnd   = segWnd;
+    first = false;
+  }
+
+  *outLen = out - compressBuf_.data();
+  assert(*outLen <= len);
+  inBytes_  += len;
+  outBytes_ += *outLen;
+  return compressBuf_.data();
+}
+
+const uint8_t *KcpCompactCodec::expand(const uint8_t *in, const size_t len,
+                                       const uint32_t conv, size_t *outLen) {
+  // every compact header is at least 4 bytes
+  if (expandBuf_.size() < len / 4 * IKCP_OVERHEAD + len) {
+    expandBuf_.resize(len / 4 * IKCP_OVERHEAD + len);
+  }
+  const uint8_t *p   = in;
+  const uint8_t *end = in + len;
+  uint8_t *out = expandBuf_.data();
+  uint32_t ts = 0, sn = 0, una = 0, wnd = 0;
+  bool first = true;
+
+  while (p < end) {
+    const uint8_t flags = *p++;
+    const uint32_t cmd  = (flags & COMPACT_CMD_MASK) + IKCP_CMD_PUSH - 1;
+    uint32_t v1, v2, v3, segLen = 0;
+    uint8_t  frg = 0;
+    if (cmd < IKCP_CMD_PUSH || cmd > IKCP_CMD_WINS ||
+        !getVarint(&p, end, &v1) || !getVarint(&p, end, &v2) ||
+        !getVarint(&p, end, &v3)) {
+      failures_++;
+      return nullptr;
+    }
+    if (first) {
+      ts  = v1;
+      sn  = v2;
+      una = sn + unzigzag(v3);
+    } else {
+      ts  += unzigzag(v1);
+      sn  += unzigzag(v2);
+      una += unzigzag(v3);
+    }
+    if (flags & COMPACT_WITH_WND) {
+      if (!getVarint(&p, end, &wnd) || wnd > UINT16_MAX) {
+        failures_++;
+        return nullptr;
+      }
+    } else if (first) {
+      failures_++;
+      return nullptr;
+    }
+    if (flags & COMPACT_WITH_FRG) {
+      if (p >= end) {
+        failures_++;
+        return nullptr;
+      }
+      frg = *p++;
+    }
+    if ((flags & COMPACT_WITH_LEN) &&
+        (!getVarint(&p, end, &segLen) || segLen > (size_t)(end - p))) {
+      failures_++;
+      return nullptr;
+    }
+
+    *(uint32_t *)out = conv;
+    out[4] = (uint8_t)cmd;
+    out[5] = frg;
+    *(uint16_t *)(out + 6)  = (uint16_t)wnd;
+    *(uint32_t *)(out + 8)  = ts;
+    *(uint32_t *)(out + 12) = sn;
+    *(uint32_t *)(out + 16) = una;
+    *(uint32_t *)(out + 20) = segLen;
+    out += IKCP_OVERHEAD;
+    memcpy(out, p, segLen);
+    out += segLen;
+    p   += segLen;
+    first = false;
+  }
+
+  *outLen = out - expandBuf_.data();
+  return expandBuf_.data();
+}
+
+string KcpCompactCodec::stats() const {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "in: %llu, out: %llu (%.1f%%), failures: %llu",
+           (unsigned long long)inBytes_, (unsigned long long)outBytes_,
+           inBytes_ ? 100.0 * outBytes_ / inBytes_ : 100.0,
+           (unsigned long long)failures_);
+  return string(buf);
+}
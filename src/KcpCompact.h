@@ -0,0 +1,71 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_KCP_COMPACT_H_
+#define TUT_KCP_COMPACT_H_
+
+#include "Common.h"
+
+//
+// compact kcp segment header, negotiated with TUNNEL_FEATURE_COMPACT_HEADER.
+// kcp's own header is 24 bytes: | conv(4) | cmd(1) | frg(1) | wnd(2) |
+// ts(4) | sn(4) | una(4) | len(4) |, this one is:
+//
+// | flags(1) | ts | sn | una | [wnd] | [frg(1)] | [len] | data |
+//
+// flags: cmd - IKCP_CMD_PUSH + 1 (bits 0-2), with wnd 0x08, with frg 0x10,
+// with len 0x20. ts, sn, una, wnd, len are varints. the conv is the
+// tunnel's. the first segment of a datagram has ts & sn as they are, una as
+// the zigzag delta of sn, and wnd. the next ones have zigzag deltas of the
+// previous segment's ts, sn & una, and wnd only when it changed.
+//
+// it's never longer than kcp's header, so the kcp mtu stays. flags is never
+// 0, so a control datagram (| 0u(4) | magic(4) | ...) can't be taken for
+// one.
+//
+class KcpCompactCodec {
+  bool enabled_;
+  // separate, a datagram being handled may be answered
+  vector<uint8_t> compressBuf_;
+  vector<uint8_t> expandBuf_;
+
+public:
+  uint64_t inBytes_;     // kcp datagrams compressed
+  uint64_t outBytes_;    // and the result
+  uint64_t failures_;    // malformed ones expand() dropped
+
+public:
+  KcpCompactCodec(): enabled_(false), inBytes_(0), outBytes_(0), failures_(0) {}
+
+  void setEnabled(const bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+
+  // the results are valid until the next call, nullptr: malformed
+  const uint8_t *compress(const uint8_t *in, const size_t len, size_t *outLen);
+  const uint8_t *expand(const uint8_t *in, const size_t len,
+                        const uint32_t conv, size_t *outLen);
+
+  string stats() const;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "KcpParams.h"
+
+const ConfigField kKcpParamsSchema[] = {
+  {"kcp_snd_wnd",      CONF_INT,  CONF_RELOADABLE, "256",  1,  65535, nullptr},
+  {"kcp_rcv_wnd",      CONF_INT,  CONF_RELOADABLE, "256",  1,  65535, nullptr},
+  {"kcp_nodelay",      CONF_BOOL, CONF_RELOADABLE, "true", 0,  0,     nullptr},
+  {"kcp_interval",     CONF_INT,  CONF_RELOADABLE, "10",   10, 5000,  nullptr},
+  {"kcp_resend",       CONF_INT,  CONF_RELOADABLE, "2",    0,  100,   nullptr},
+  {"kcp_nc",           CONF_BOOL, CONF_RELOADABLE, "true", 0,  0,     nullptr},
+  {"kcp_min_rto",      CONF_INT,  CONF_RELOADABLE, "0",    0,  60000, nullptr},
+  {"kcp_ack_delay",    CONF_INT,  CONF_RELOADABLE, "0",    0,  5000,  nullptr},
+  {"kcp_ack_every",    CONF_INT,  CONF_RELOADABLE, "2",    0,  65535, nullptr},
+  {"kcp_ack_implicit", CONF_BOOL, CONF_RELOADABLE, "true", 0,  0,     nullptr},
+  {"kcp_rack",         CONF_BOOL, CONF_RELOADABLE, "true", 0,  0,     nullptr},
+  {"kcp_tlp",          CONF_BOOL, CONF_RELOADABLE, "true", 0,  0,     nullptr},
+  {nullptr}
+};
+
+KcpParams::KcpParams():
+sndWnd_(256), rcvWnd_(256), nodelay_(true), interval_(10), resend_(2),
+nc_(true), minRto_(0), ackDelay_(0), ackEvery_(2), ackImplicit_(true),
+rack_(true), tlp_(true)
+{
+}
+
+void KcpParams::load(const Config &conf) {
+  sndWnd_      = (int32_t)conf.getInt("kcp_snd_wnd");
+  rcvWnd_      = (int32_t)conf.getInt("kcp_rcv_wnd");
+  nodelay_     = conf.getBool("kcp_nodelay");
+  interval_    = (int32_t)conf.getInt("kcp_interval");
+  resend_      = (int32_t)conf.getInt("kcp_resend");
+  nc_          = conf.getBool("kcp_nc");
+  minRto_      = (int32_t)conf.getInt("kcp_min_rto");
+  ackDelay_    = (int32_t)conf.getInt("kcp_ack_delay");
+  ackEvery_    = (int32_t)conf.getInt("kcp_ack_every");
+  ackImplicit_ = conf.getBool("kcp_ack_implicit");
+  rack_        = conf.getBool("kcp_rack");
+  tlp_         = conf.getBool("kcp_tlp");
+}
+
+void KcpParams::apply(ikcpcb *kcp) const {
+  ikcp_wndsize(kcp, sndWnd_, rcvWnd_);
+  ikcp_nodelay(kcp, nodelay_ ? 1 : 0, interval_, resend_, nc_ ? 1 : 0);
+  ikcp_ackpolicy(kcp, ackDelay_, ackEvery_, ackImplicit_ ? 1 : 0);
+  ikcp_lossdetect(kcp, rack_ ? 1 : 0, tlp_ ? 1 : 0);
+
+  // ikcp_nodelay() has set the mode's default
+  if (minRto_ > 0) {
+    kcp->rx_minrto = minRto_;
+  }
+}
+
+struct timeval KcpParams::updateInterval() const {
+  struct timeval tv = {interval_ / 1000, (interval_ % 1000) * 1000};
+  return tv;
+}
+
+string KcpParams::effective(const ikcpcb *kcp) {
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "snd_wnd: %u, rcv_wnd: %u, nodelay: %u, interval: %u, "
+           "resend: %d, nc: %d, min_rto: %d, ack_delay: %u, ack_every: %u, "
+           "ack_implicit: %u, rack: %u, tlp: %u",
+           kcp->snd_wnd, kcp->rcv_wnd, kcp->nodelay, kcp->interval,
+           kcp->fastresend, kcp->nocwnd, kcp->rx_minrto, kcp->ack_delay,
+           kcp->ack_every, kcp->ack_implicit, kcp->rack, kcp->tlp);
+  return string(buf);
+}
@@ -0,0 +1,67 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_KCP_PARAMS_H_
+#define TUT_KCP_PARAMS_H_
+
+#include "Common.h"
+#include "Config.h"
+
+//
+// kcp tuning, the same keys on both sides, all of them can be changed on a
+// running ikcpcb (SIGHUP)
+//
+struct KcpParams {
+  int32_t sndWnd_;     // segments
+  int32_t rcvWnd_;
+  bool    nodelay_;
+  int32_t interval_;   // ms, ikcp_update() interval
+  int32_t resend_;     // fast resend after N duplicated acks, 0: off
+  bool    nc_;         // no congestion window
+  int32_t minRto_;     // ms, 0: kcp's default of the nodelay mode
+  int32_t ackDelay_;   // ms, hold acks up to it, 0: ack on each flush
+  int32_t ackEvery_;   // ack once N are pending, 0: by the delay only
+  bool    ackImplicit_;  // leave out the acks una covers
+  bool    rack_;       // time based loss detection
+  bool    tlp_;        // tail loss probe
+
+  KcpParams();
+
+  // keys of kKcpParamsSchema
+  void load(const Config &conf);
+
+  void apply(ikcpcb *kcp) const;
+
+  // interval of the ikcp_update() timer
+  struct timeval updateInterval() const;
+
+  // the values in use by kcp, for logging
+  static string effective(const ikcpcb *kcp);
+};
+
+// kcp_snd_wnd, kcp_rcv_wnd, kcp_nodelay, kcp_interval, kcp_resend, kcp_nc,
+// kcp_min_rto, kcp_ack_delay, kcp_ack_every, kcp_ack_implicit, kcp_rack,
+// kcp_tlp
+extern const ConfigField kKcpParamsSchema[];
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "Log.h"
+
+#include <sys/time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+uint32_t gLogPayloadSample = 0;
+
+bool logPayloadSampled() {
+  static uint32_t n = 0;
+  return (++n % gLogPayloadSample) == 0;
+}
+
+std::string logPayloadStr(const char *data, size_t len) {
+  static const char kHex[] = "0123456789abcdef";
+  const size_t kMaxLen = 256;
+
+  std::string s;
+  s.reserve(std::min(len, kMaxLen) + 16);
+  for (size_t i = 0; i < len && i < kMaxLen; i++) {
+    const uint8_t c = (uint8_t)data[i];
+    if (c >= 0x20 && c < 0x7f && c != '\\') {
+      s.push_back((char)c);
+    } else {
+      s.append("\\x");
+      s.push_back(kHex[c >> 4]);
+      s.push_back(kHex[c & 0xf]);
+    }
+  }
+  if (len > kMaxLen)
+    s.append("...");
+  return s;
+}
+
+static int64_t nowMs() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+LogRateLimit::LogRateLimit(int64_t intervalMs):
+intervalMs_(intervalMs), nextMs_(0), suppressed_(0), lastSuppressed_(0)
+{
+}
+
+bool LogRateLimit::allow() {
+  const int64_t now = nowMs();
+  if (now < nextMs_) {
+    suppressed_++;
+    return false;
+  }
+  nextMs_ = now + intervalMs_;
+  lastSuppressed_ = suppressed_;
+  suppressed_ = 0;
+  return true;
+}
+
+
+///////////////////////////////// AsyncLogger //////////////////////////////////
+//
+// glog calls base::Logger::Write() with its global log mutex held, so there
+// is only ever one producer at a time and a single-producer single-consumer
+// ring is enough. The event loop never blocks here: when the ring is full the
+// line is dropped and counted.
+//
+class AsyncLogger {
+  static const int      kSeverityNum = google::GLOG_ERROR + 1;
+  static const uint32_t kRingSize    = 4096;  // must be power of 2
+  static const uint32_t kMaxLineLen  = 1024;
+
+  struct Entry {
+    int      severity;
+    bool     forceFlush;
+    time_t   timestamp;
+    uint32_t len;
+    char     line[kMaxLineLen];
+  };
+
+  // front end for one severity, forwards to the shared ring
+  class SeverityLogger : public google::base::Logger {
+  public:
+    AsyncLogger *owner_;
+    int severity_;
+    google::base::Logger *wrapped_;
+
+    void Write(bool forceFlush, time_t timestamp,
+               const char *message, int len) {
+      if (forceFlush && len == 0) {
+        // glog sends an empty forced write to every logger right before it
+        // aborts on FATAL, write out what is queued while we still can
+        owner_->drain();
+        wrapped_->Write(forceFlush, timestamp, message, len);
+        return;
+      }
+      owner_->push(severity_, forceFlush, timestamp, message, len);
+    }
+    void Flush() {
+      owner_->drain();
+      wrapped_->Flush();
+    }
+    google::uint32 LogSize() {
+      return wrapped_->LogSize();
+    }
+  };
+
+  SeverityLogger loggers_[kSeverityNum];
+  Entry *ring_;
+  std::atomic<uint64_t> head_;  // written by producer
+  std::atomic<uint64_t> tail_;  // written by consumer
+  std::atomic<uint64_t> dropped_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+
+  void push(int severity, bool forceFlush, time_t timestamp,
+            const char *message, int len);
+  void drain();
+  bool consume();
+  void threadLoop();
+
+public:
+  AsyncLogger();
+  ~AsyncLogger();
+
+  void start();
+  void stop();
+};
+
+const uint32_t AsyncLogger::kMaxLineLen;
+
+AsyncLogger::AsyncLogger():
+ring_(new Entry[kRingSize]), head_(0), tail_(0), dropped_(0), running_(false)
+{
+  for (int i = 0; i < kSeverityNum; i++) {
+    loggers_[i].owner_    = this;
+    loggers_[i].severity_ = i;
+    loggers_[i].wrapped_  = nullptr;
+  }
+}
+
+AsyncLogger::~AsyncLogger() {
+  stop();
+  delete [] ring_;
+}
+
+void AsyncLogger::start() {
+  for (int i = 0; i < kSeverityNum; i++) {
+    loggers_[i].wrapped_ = google::base::GetLogger(i);
+  }
+  running_ = true;
+  thread_ = std::thread(&AsyncLogger::threadLoop, this);
+
+  for (int i = 0; i < kSeverityNum; i++) {
+    google::base::SetLogger(i, &loggers_[i]);
+  }
+}
+
+void AsyncLogger::stop() {
+  if (!running_)
+    return;
+
+  // give glog back its own loggers first, nothing will be pushed after this
+  for (int i = 0; i < kSeverityNum; i++) {
+    google::base::SetLogger(i, loggers_[i].wrapped_);
+  }
+  running_ = false;
+  thread_.join();
+
+  while (consume()) {
+  }
+  for (int i = 0; i < kSeverityNum; i++) {
+    loggers_[i].wrapped_->Flush();
+  }
+}
+
+void AsyncLogger::push(int severity, bool forceFlush, time_t timestamp,
+                       const char *message, int len) {
+  const uint64_t head = head_.load(std::memory_order_relaxed);
+  if (head - tail_.load(std::memory_order_acquire) >= kRingSize) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  Entry &e = ring_[head & (kRingSize - 1)];
+  e.severity   = severity;
+  e.forceFlush = forceFlush;
+  e.timestamp  = timestamp;
+  e.len        = std::min((uint32_t)len, kMaxLineLen);
+  memcpy(e.line, message, e.len);
+  if (e.len < (uint32_t)len) {
+    e.line[e.len - 1] = '\n';  // truncated, keep line ending
+  }
+
+  head_.store(head + 1, std::memory_order_release);
+}
+
+bool AsyncLogger::consume() {
+  const uint64_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail == head_.load(std::memory_order_acquire))
+    return false;
+
+  Entry &e = ring_[tail & (kRingSize - 1)];
+  loggers_[e.severity].wrapped_->Write(e.forceFlush, e.timestamp,
+                                       e.line, (int)e.len);
+
+  tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+void AsyncLogger::drain() {
+  // called with glog's mutex held, wait for the consumer to catch up
+  while (running_ &&
+         tail_.load(std::memory_order_acquire) != head_.load(std::memory_order_acquire)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void AsyncLogger::threadLoop() {
+  while (running_) {
+    bool busy = false;
+    while (consume()) {
+      busy = true;
+    }
+
+    const uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      char line[128];
+      int len = snprintf(line, sizeof(line),
+                         "async logger ring full, dropped %lu lines\n",
+                         (unsigned long)dropped);
+      loggers_[google::GLOG_INFO].wrapped_->Write(true, time(nullptr),
+                                                  line, len);
+    }
+
+    if (!busy) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  }
+}
+
+static AsyncLogger *gAsyncLogger = nullptr;
+
+void installAsyncLogger() {
+  if (gAsyncLogger)
+    return;
+  gAsyncLogger = new AsyncLogger();
+  gAsyncLogger->start();
+}
+
+void shutdownAsyncLogger() {
+  if (!gAsyncLogger)
+    return;
+  gAsyncLogger->stop();
+  delete gAsyncLogger;
+  gAsyncLogger = nullptr;
+}
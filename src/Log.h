@@ -0,0 +1,88 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_LOG_H_
+#define TUT_LOG_H_
+
+#include <cstdint>
+#include <string>
+
+#include <glog/logging.h>
+
+//
+// Logging helpers for the data path.
+//
+// - compile-time: release builds define NDEBUG so DLOG() vanishes, and
+//   GOOGLE_STRIP_LOG (see CMakeLists.txt) can strip LOG() below a level.
+// - run-time: installAsyncLogger() moves glog's file writes and flushes to a
+//   background thread, the event loop only copies the line into a ring.
+// - hot paths use LOG_EVERY_MS() and LOG_PAYLOAD() instead of plain LOG().
+//
+
+// log 1 out of N payloads, 0: never log payloads
+extern uint32_t gLogPayloadSample;
+
+bool logPayloadSampled();
+std::string logPayloadStr(const char *data, size_t len);
+
+//
+// LOG_PAYLOAD: the payload is only copied and formatted when sampled,
+// otherwise the cost is one compare.
+//
+#define LOG_PAYLOAD(tag, connIdx, data, len) \
+  if (gLogPayloadSample == 0 || !logPayloadSampled()) {} else \
+    LOG(INFO) << tag << "(" << (connIdx) << "), len: " << (len) << ", " \
+              << logPayloadStr((const char *)(data), (len))
+
+class LogRateLimit {
+  const int64_t intervalMs_;
+  int64_t  nextMs_;
+  uint32_t suppressed_;
+  uint32_t lastSuppressed_;
+
+public:
+  explicit LogRateLimit(int64_t intervalMs);
+  bool allow();
+  uint32_t suppressed() const { return lastSuppressed_; }
+};
+
+#define LOG_RATE_LIMIT_CONCAT_(a, b) a##b
+#define LOG_RATE_LIMIT_NAME_(line) LOG_RATE_LIMIT_CONCAT_(logRateLimit_, line)
+
+//
+// LOG_EVERY_MS: at most one line per `ms` from this call site, the number of
+// suppressed lines is appended. Like LOG_EVERY_N() it expands to more than
+// one statement, always use it inside braces.
+//
+#define LOG_EVERY_MS(severity, ms) \
+  static LogRateLimit LOG_RATE_LIMIT_NAME_(__LINE__)(ms); \
+  if (!LOG_RATE_LIMIT_NAME_(__LINE__).allow()) {} else \
+    LOG(severity) << "[suppressed: " \
+                  << LOG_RATE_LIMIT_NAME_(__LINE__).suppressed() << "] "
+
+// replace glog's file loggers (INFO ~ ERROR) with the async ones
+void installAsyncLogger();
+// drain the ring and restore glog's file loggers
+void shutdownAsyncLogger();
+
+#endif
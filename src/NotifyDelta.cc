@@ -0,0 +1,153 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "NotifyDelta.h"
+
+#include <unordered_map>
+
+// shorter matches cost more as a copy than as literals
+#define NOTIFY_DELTA_MIN_MATCH  8
+
+static inline void putVarint(string *out, uint32_t v) {
+  while (v >= 0x80u) {
+    out->push_back((char)(uint8_t)(v | 0x80u));
+    v >>= 7;
+  }
+  out->push_back((char)(uint8_t)v);
+}
+
+static inline bool getVarint(const uint8_t **p, const uint8_t *end,
+                             uint32_t *v) {
+  uint32_t r = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (*p >= end)
+      return false;
+    const uint8_t b = *(*p)++;
+    r |= (uint32_t)(b & 0x7fu) << shift;
+    if ((b & 0x80u) == 0) {
+      *v = r;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline uint64_t load64(const char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static void putLiteral(const char *data, const size_t len, string *out) {
+  if (len == 0)
+    return;
+  putVarint(out, (uint32_t)(len << 1));
+  out->append(data, len);
+}
+
+void NotifyDelta::encode(const string &ref, const char *line, const size_t len,
+                         string *out) {
+  const size_t start = out->size();
+
+  // the first position of each 8 bytes of the reference
+  std::unordered_map<uint64_t, uint32_t> index;
+  if (ref.size() >= NOTIFY_DELTA_MIN_MATCH) {
+    index.reserve(ref.size());
+    for (size_t i = 0; i + NOTIFY_DELTA_MIN_MATCH <= ref.size(); i++) {
+      index.emplace(load64(ref.data() + i), (uint32_t)i);
+    }
+  }
+
+  size_t literal = 0;  // not written yet
+  size_t expect  = 0;  // where the last copy ended, fields keep their order
+  size_t i = 0;
+  while (i + NOTIFY_DELTA_MIN_MATCH <= len) {
+    const uint64_t key = load64(line + i);
+    size_t from = ref.size();
+    if (expect + NOTIFY_DELTA_MIN_MATCH <= ref.size() &&
+        load64(ref.data() + expect) == key) {
+      from = expect;
+    } else {
+      auto itr = index.find(key);
+      if (itr != index.end())
+        from = itr->second;
+    }
+    if (from == ref.size()) {
+      i++;
+      continue;
+    }
+
+    size_t n = NOTIFY_DELTA_MIN_MATCH;
+    while (i + n < len && from + n < ref.size() && line[i + n] == ref[from + n])
+      n++;
+
+    putLiteral(line + literal, i - literal, out);
+    putVarint(out, (uint32_t)(n << 1 | 1));
+    putVarint(out, (uint32_t)from);
+    i += n;
+    literal = i;
+    expect  = from + n;
+  }
+  putLiteral(line + literal, len - literal, out);
+
+  notifies_++;
+  inBytes_  += len;
+  outBytes_ += out->size() - start;
+}
+
+bool NotifyDelta::decode(const string &ref, const uint8_t *ops,
+                         const size_t len, string *out) {
+  const uint8_t *p   = ops;
+  const uint8_t *end = ops + len;
+  out->clear();
+
+  while (p < end) {
+    uint32_t op, from;
+    if (!getVarint(&p, end, &op))
+      return false;
+    const size_t n = op >> 1;
+    if (n == 0 || out->size() + n > NOTIFY_DELTA_MAX_LINE)
+      return false;
+
+    if (op & 1) {
+      if (!getVarint(&p, end, &from) || from + n > ref.size())
+        return false;
+      out->append(ref, from, n);
+    } else {
+      if ((size_t)(end - p) < n)
+        return false;
+      out->append((const char *)p, n);
+      p += n;
+    }
+  }
+  return true;
+}
+
+string NotifyDelta::stats() const {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "notifies: %llu, in: %llu, out: %llu (%.1f%%)",
+           (unsigned long long)notifies_, (unsigned long long)inBytes_,
+           (unsigned long long)outBytes_,
+           inBytes_ ? 100.0 * outBytes_ / inBytes_ : 100.0);
+  return string(buf);
+}
@@ -0,0 +1,65 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_NOTIFY_DELTA_H_
+#define TUT_NOTIFY_DELTA_H_
+
+#include "Common.h"
+
+//
+// mining.notify as a delta of the previous one of its stream, negotiated
+// with TUNNEL_FEATURE_NOTIFY_DELTA. the server sends a whole notify line as:
+//
+// KCP_MSG_TYPE_NOTIFY
+// | len(2) | 0x0000(2) | 0x06 | connIdx(2) | flags(1) | crc32c(4) | ops |
+//
+// ops rebuild the line from the previous one (the reference), one after
+// another: varint(n << 1) + n literal bytes, or varint(n << 1 | 1) +
+// varint(offset) to copy n bytes of the reference. crc32c is of the line.
+// NOTIFY_DELTA_FULL: an empty reference, after kcp dropped or emptied one
+// (stream_supersede_notify) both ends start over.
+//
+#define NOTIFY_DELTA_FULL      0x01u
+#define NOTIFY_DELTA_HEADER    12     // up to ops
+#define NOTIFY_DELTA_MAX_LINE  16384  // longer ones are sent as they are
+
+class NotifyDelta {
+public:
+  uint64_t notifies_;
+  uint64_t inBytes_;   // the lines
+  uint64_t outBytes_;  // the ops
+
+public:
+  NotifyDelta(): notifies_(0), inBytes_(0), outBytes_(0) {}
+
+  // appends the ops of `line` against `ref` to out
+  void encode(const string &ref, const char *line, const size_t len,
+              string *out);
+  // false: malformed
+  static bool decode(const string &ref, const uint8_t *ops, const size_t len,
+                     string *out);
+
+  string stats() const;
+};
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "PacketCapture.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+
+// pcapng block types
+#define PCAPNG_SHB          0x0A0D0D0Au
+#define PCAPNG_IDB          0x00000001u
+#define PCAPNG_EPB          0x00000006u
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4Du
+#define PCAPNG_LINKTYPE_RAW 101
+
+PacketCapture::PacketCapture(const size_t maxPackets, const uint16_t snaplen):
+count_(0), next_(0), snaplen_(snaplen), recorded_(0)
+{
+  records_.resize(maxPackets);
+  data_.resize(maxPackets * snaplen);
+}
+
+void PacketCapture::record(const uint8_t dir, const uint8_t *data,
+                           const size_t len, const struct sockaddr *peer) {
+  if (records_.empty())
+    return;
+
+  Record &r = records_[next_];
+  long sec, usec;
+  itimeofday(&sec, &usec);
+  r.timeUs_ = (IINT64)sec * 1000000 + usec;
+  r.len_    = (uint32_t)len;
+  r.capLen_ = (uint16_t)std::min(len, (size_t)snaplen_);
+  r.dir_    = dir;
+  if (peer != nullptr) {
+    memcpy(&r.peer_, peer, sockaddrLen(peer));
+  } else {
+    r.peer_.sa_.sa_family = AF_UNSPEC;
+  }
+  memcpy(&data_[next_ * snaplen_], data, r.capLen_);
+
+  next_ = (next_ + 1) % records_.size();
+  if (count_ < records_.size())
+    count_++;
+  recorded_++;
+}
+
+// v4-mapped v6 addresses of a dual-stack socket are written as v4
+static void normalizeAddr(const struct sockaddr *in, struct sockaddr_storage *out) {
+  memset(out, 0, sizeof(*out));
+  if (in->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)in;
+    if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+      struct sockaddr_in *sin = (struct sockaddr_in *)out;
+      sin->sin_family = AF_INET;
+      sin->sin_port   = sin6->sin6_port;
+      memcpy(&sin->sin_addr, &sin6->sin6_addr.s6_addr[12], 4);
+      return;
+    }
+    memcpy(out, sin6, sizeof(*sin6));
+  } else if (in->sa_family == AF_INET) {
+    memcpy(out, in, sizeof(struct sockaddr_in));
+  }
+}
+
+static uint16_t ipv4Checksum(const uint8_t *p, size_t len) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i + 1 < len; i += 2) {
+    sum += (p[i] << 8) | p[i + 1];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return htons((uint16_t)~sum);
+}
+
+//
+// ip + udp header in front of the payload, returns the header size. src/dst
+// follow the direction, families mixed (shouldn't happen) fall back to v4
+// with zero addresses.
+//
+static size_t buildHeaders(const struct sockaddr_storage &src,
+                           const struct sockaddr_storage &dst,
+                           const uint32_t payloadLen, uint8_t *out) {
+  struct udphdr udp;
+  memset(&udp, 0, sizeof(udp));
+  udp.uh_ulen = htons((uint16_t)(sizeof(udp) + payloadLen));  // checksum: 0
+
+  if (src.ss_family == AF_INET6 && dst.ss_family == AF_INET6) {
+    const struct sockaddr_in6 *s = (const struct sockaddr_in6 *)&src;
+    const struct sockaddr_in6 *d = (const struct sockaddr_in6 *)&dst;
+    struct ip6_hdr ip6;
+    memset(&ip6, 0, sizeof(ip6));
+    ip6.ip6_flow = htonl(6u << 28);
+    ip6.ip6_plen = udp.uh_ulen;
+    ip6.ip6_nxt  = IPPROTO_UDP;
+    ip6.ip6_hlim = 64;
+    ip6.ip6_src  = s->sin6_addr;
+    ip6.ip6_dst  = d->sin6_addr;
+    udp.uh_sport = s->sin6_port;
+    udp.uh_dport = d->sin6_port;
+
+    memcpy(out, &ip6, sizeof(ip6));
+    memcpy(out + sizeof(ip6), &udp, sizeof(udp));
+    return sizeof(ip6) + sizeof(udp);
+  }
+
+  struct ip ip4;
+  memset(&ip4, 0, sizeof(ip4));
+  ip4.ip_v   = 4;
+  ip4.ip_hl  = 5;
+  ip4.ip_len = htons((uint16_t)(sizeof(ip4) + sizeof(udp) + payloadLen));
+  ip4.ip_ttl = 64;
+  ip4.ip_p   = IPPROTO_UDP;
+  if (src.ss_family == AF_INET && dst.ss_family == AF_INET) {
+    const struct sockaddr_in *s = (const struct sockaddr_in *)&src;
+    const struct sockaddr_in *d = (const struct sockaddr_in *)&dst;
+    ip4.ip_src = s->sin_addr;
+    ip4.ip_dst = d->sin_addr;
+    udp.uh_sport = s->sin_port;
+    udp.uh_dport = d->sin_port;
+  }
+  ip4.ip_sum = ipv4Checksum((const uint8_t *)&ip4, sizeof(ip4));
+
+  memcpy(out, &ip4, sizeof(ip4));
+  memcpy(out + sizeof(ip4), &udp, sizeof(udp));
+  return sizeof(ip4) + sizeof(udp);
+}
+
+static void writeU32(FILE *f, uint32_t v) { fwrite(&v, 4, 1, f); }
+static void writeU16(FILE *f, uint16_t v) { fwrite(&v, 2, 1, f); }
+
+bool PacketCapture::dump(const string &path, const struct sockaddr *local) const {
+  FILE *f = fopen(path.c_str(), "wb");
+  if (f == nullptr) {
+    LOG(ERROR) << "open capture file failure: " << path << ", " << strerror(errno);
+    return false;
+  }
+
+  // section header block
+  writeU32(f, PCAPNG_SHB);
+  writeU32(f, 28);
+  writeU32(f, PCAPNG_BYTE_ORDER);
+  writeU16(f, 1);  // major
+  writeU16(f, 0);  // minor
+  writeU32(f, 0xffffffffu);  // section length: unknown
+  writeU32(f, 0xffffffffu);
+  writeU32(f, 28);
+
+  // interface description block, µs timestamps (default)
+  writeU32(f, PCAPNG_IDB);
+  writeU32(f, 20);
+  writeU16(f, PCAPNG_LINKTYPE_RAW);
+  writeU16(f, 0);
+  writeU32(f, 0);  // snaplen: no limit
+  writeU32(f, 20);
+
+  struct sockaddr_storage localAddr;
+  normalizeAddr(local, &localAddr);
+
+  // oldest first
+  const size_t first = (next_ + records_.size() - count_) % std::max((size_t)1, records_.size());
+  uint8_t pkt[sizeof(struct ip6_hdr) + sizeof(struct udphdr) + UINT16_MAX + 4];
+
+  for (size_t n = 0; n < count_; n++) {
+    const size_t i = (first + n) % records_.size();
+    const Record &r = records_[i];
+
+    struct sockaddr_storage peerAddr;
+    normalizeAddr(&r.peer_.sa_, &peerAddr);
+
+    const size_t hdrLen = (r.dir_ == CAPTURE_DIR_OUT ?
+                           buildHeaders(localAddr, peerAddr, r.len_, pkt) :
+                           buildHeaders(peerAddr, localAddr, r.len_, pkt));
+    memcpy(pkt + hdrLen, &data_[i * snaplen_], r.capLen_);
+
+    const uint32_t capLen  = (uint32_t)(hdrLen + r.capLen_);
+    const uint32_t origLen = (uint32_t)(hdrLen + r.len_);
+    const uint32_t padded  = (capLen + 3) & ~3u;
+    const uint32_t blockLen = 32 + padded;
+
+    // enhanced packet block
+    writeU32(f, PCAPNG_EPB);
+    writeU32(f, blockLen);
+    writeU32(f, 0);  // interface id
+    writeU32(f, (uint32_t)((uint64_t)r.timeUs_ >> 32));
+    writeU32(f, (uint32_t)((uint64_t)r.timeUs_ & 0xffffffffu));
+    writeU32(f, capLen);
+    writeU32(f, origLen);
+    memset(pkt + capLen, 0, padded - capLen);
+    fwrite(pkt, 1, padded, f);
+    writeU32(f, blockLen);
+  }
+
+  const bool ok = (ferror(f) == 0);
+  fclose(f);
+
+  if (!ok) {
+    LOG(ERROR) << "write capture file failure: " << path;
+    return false;
+  }
+  LOG(INFO) << "dump " << count_ << " packets to " << path
+  << ", recorded since start: " << recorded_;
+  return true;
+}
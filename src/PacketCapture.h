@@ -0,0 +1,72 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_PACKET_CAPTURE_H_
+#define TUT_PACKET_CAPTURE_H_
+
+#include "Common.h"
+
+//
+// in-memory ring of the last N tunnel datagrams, for post-mortem debugging.
+// recording is a memcpy of at most `snaplen` bytes into a preallocated slot,
+// no allocation. dump() writes a pcapng file (LINKTYPE_RAW, with synthesized
+// ip/udp headers) that wireshark or src/kcpdump can read.
+//
+#define CAPTURE_DIR_IN   0
+#define CAPTURE_DIR_OUT  1
+
+class PacketCapture {
+  struct Record {
+    IINT64   timeUs_;
+    uint32_t len_;      // original length
+    uint16_t capLen_;
+    uint8_t  dir_;
+    union {
+      struct sockaddr     sa_;
+      struct sockaddr_in  v4_;
+      struct sockaddr_in6 v6_;
+    } peer_;
+  };
+
+  size_t   count_;    // records in the ring
+  size_t   next_;     // slot of the next record
+  uint16_t snaplen_;
+  vector<Record>  records_;
+  vector<uint8_t> data_;  // slot i: [i * snaplen_, (i + 1) * snaplen_)
+
+  uint64_t recorded_;  // since start
+
+public:
+  PacketCapture(const size_t maxPackets, const uint16_t snaplen);
+
+  void record(const uint8_t dir, const uint8_t *data, const size_t len,
+              const struct sockaddr *peer);
+
+  // `local`: the address of our udp socket, for the synthesized headers
+  bool dump(const string &path, const struct sockaddr *local) const;
+
+  size_t count() const { return count_; }
+  uint64_t recorded() const { return recorded_; }
+};
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "RateLimit.h"
+
+#include <algorithm>
+
+#include <event2/bufferevent.h>
+
+// libevent refills the buckets on this tick
+#define RATE_LIMIT_TICK_MS  50
+
+const ConfigField kRateLimitSchema[] = {
+  {"stream_rate_limit",   CONF_INT, CONF_RELOADABLE, "0", 0, UINT32_MAX, nullptr},
+  {"stream_rate_burst",   CONF_INT, CONF_RELOADABLE, "0", 0, UINT32_MAX, nullptr},
+  {"listener_rate_limit", CONF_INT, CONF_RELOADABLE, "0", 0, UINT32_MAX, nullptr},
+  {"listener_rate_burst", CONF_INT, CONF_RELOADABLE, "0", 0, UINT32_MAX, nullptr},
+  {"tunnel_rate_limit",   CONF_INT, CONF_RELOADABLE, "0", 0, UINT32_MAX, nullptr},
+  {"tunnel_rate_burst",   CONF_INT, CONF_RELOADABLE, "0", 0, UINT32_MAX, nullptr},
+  {nullptr}
+};
+
+//////////////////////////////////// RateLimit /////////////////////////////////
+struct ev_token_bucket_cfg *RateLimit::newBucketCfg() const {
+  if (!enabled())
+    return nullptr;
+
+  // libevent's rate is per tick, the burst can't be less than it
+  const size_t perTick = std::max<size_t>(1, (size_t)rate_ * RATE_LIMIT_TICK_MS / 1000);
+  const size_t burst   = std::max<size_t>(perTick, this->burst());
+  struct timeval tick  = {0, RATE_LIMIT_TICK_MS * 1000};
+
+  struct ev_token_bucket_cfg *cfg =
+  ev_token_bucket_cfg_new(perTick, burst, EV_RATE_LIMIT_MAX, EV_RATE_LIMIT_MAX,
+                          &tick);
+  assert(cfg != nullptr);
+  return cfg;
+}
+
+string RateLimit::toString() const {
+  if (!enabled())
+    return "unlimited";
+  return std::to_string(rate_) + " B/s, burst " + std::to_string(burst());
+}
+
+void RateLimits::load(const Config &conf) {
+  stream_.rate_    = (uint32_t)conf.getInt("stream_rate_limit");
+  stream_.burst_   = (uint32_t)conf.getInt("stream_rate_burst");
+  listener_.rate_  = (uint32_t)conf.getInt("listener_rate_limit");
+  listener_.burst_ = (uint32_t)conf.getInt("listener_rate_burst");
+  tunnel_.rate_    = (uint32_t)conf.getInt("tunnel_rate_limit");
+  tunnel_.burst_   = (uint32_t)conf.getInt("tunnel_rate_burst");
+}
+
+
+/////////////////////////////////// TokenBucket ////////////////////////////////
+TokenBucket::TokenBucket(): tokens_(0), lastRefill_(0) {
+}
+
+void TokenBucket::setLimit(const RateLimit &limit, const IINT64 now) {
+  limit_      = limit;
+  tokens_     = limit_.burst();
+  lastRefill_ = now;
+}
+
+void TokenBucket::refill(const IINT64 now) {
+  if (now <= lastRefill_)
+    return;
+
+  const int64_t add = (int64_t)limit_.rate_ * (now - lastRefill_) / 1000;
+  if (add <= 0)
+    return;  // less than a byte, keep accumulating the time
+
+  tokens_     = std::min<int64_t>(tokens_ + add, limit_.burst());
+  lastRefill_ = now;
+}
+
+void TokenBucket::consume(const size_t bytes, const IINT64 now) {
+  if (!enabled())
+    return;
+  refill(now);
+  tokens_ -= (int64_t)bytes;
+}
+
+bool TokenBucket::isEmpty(const IINT64 now, const int64_t reserved) {
+  if (!enabled())
+    return false;
+  refill(now);
+  return tokens_ - reserved <= 0;
+}
@@ -0,0 +1,96 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_RATE_LIMIT_H_
+#define TUT_RATE_LIMIT_H_
+
+#include "Common.h"
+#include "Config.h"
+
+struct ev_token_bucket_cfg;
+
+// bytes per second with a burst, rate 0: unlimited
+struct RateLimit {
+  uint32_t rate_;
+  uint32_t burst_;  // 0: one second of rate_
+
+  RateLimit(): rate_(0), burst_(0) {}
+
+  bool enabled() const { return rate_ > 0; }
+  uint32_t burst() const { return burst_ > 0 ? burst_ : rate_; }
+
+  // read side only, nullptr if disabled. bufferevents keep a pointer to it,
+  // free it with ev_token_bucket_cfg_free() after they have stopped using it
+  struct ev_token_bucket_cfg *newBucketCfg() const;
+
+  string toString() const;
+  bool operator!=(const RateLimit &r) const {
+    return rate_ != r.rate_ || burst_ != r.burst_;
+  }
+};
+
+//
+// shaping of the data read from tcp into the tunnel. a stream or listener
+// over its budget stops being read (libevent's rate limiting), the tunnel
+// ceiling counts udp bytes on the wire, retransmits included.
+//
+struct RateLimits {
+  RateLimit stream_;    // each tcp session
+  RateLimit listener_;  // all tcp sessions of the listener (client) / of the
+                        // upstream pool (server)
+  RateLimit tunnel_;    // udp datagrams sent, keep it below the link rate
+
+  // keys of kRateLimitSchema
+  void load(const Config &conf);
+};
+
+// stream_rate_limit, stream_rate_burst, listener_rate_limit,
+// listener_rate_burst, tunnel_rate_limit, tunnel_rate_burst
+extern const ConfigField kRateLimitSchema[];
+
+
+//
+// token bucket on the ms clock. tokens may go negative: the bytes are sent
+// already, the debt delays the next ones.
+//
+class TokenBucket {
+  RateLimit limit_;
+  int64_t   tokens_;
+  IINT64    lastRefill_;
+
+  void refill(const IINT64 now);
+
+public:
+  TokenBucket();
+
+  void setLimit(const RateLimit &limit, const IINT64 now);
+  bool enabled() const { return limit_.enabled(); }
+
+  void consume(const size_t bytes, const IINT64 now);
+  // no tokens left after `reserved` bytes about to be sent, the sender
+  // should wait
+  bool isEmpty(const IINT64 now, const int64_t reserved);
+  int64_t tokens() const { return tokens_; }
+};
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "Routes.h"
+
+#include <algorithm>
+
+// unknown members are errors, as unknown keys of the config are
+static bool checkMembers(const ConfigValue &entry, const vector<string> &keys,
+                         const char *what) {
+  for (const auto &m : entry.members_) {
+    if (std::find(keys.begin(), keys.end(), m.first) == keys.end()) {
+      LOG(ERROR) << what << ": unknown key \"" << m.first << "\": "
+      << entry.toString();
+      return false;
+    }
+  }
+  return true;
+}
+
+// an int member in [min, max]
+static bool getIntMember(const ConfigValue &entry, const char *key,
+                         const int64_t min, const int64_t max,
+                         const char *what, int64_t *out) {
+  const ConfigValue *v = entry.find(key);
+  if (v == nullptr || v->type_ != ConfigValue::INT ||
+      v->int_ < min || v->int_ > max) {
+    LOG(ERROR) << what << ": \"" << key << "\" should be an int in ["
+    << min << ", " << max << "]: " << entry.toString();
+    return false;
+  }
+  *out = v->int_;
+  return true;
+}
+
+static bool getStrMember(const ConfigValue &entry, const char *key,
+                         const char *what, string *out) {
+  const ConfigValue *v = entry.find(key);
+  if (v == nullptr || v->type_ != ConfigValue::STR || v->str_.empty()) {
+    LOG(ERROR) << what << ": \"" << key << "\" should be a string: "
+    << entry.toString();
+    return false;
+  }
+  *out = v->str_;
+  return true;
+}
+
+bool parseRouteListeners(const ConfigValue &value,
+                         vector<RouteListener> *listeners) {
+  for (const auto &entry : value.items_) {
+    if (entry.type_ != ConfigValue::OBJECT) {
+      LOG(ERROR) << "tcp_listeners: expected objects, got " << entry.toString();
+      return false;
+    }
+    RouteListener l;
+    int64_t port, route;
+    if (!checkMembers(entry, {"ip", "port", "route"}, "tcp_listeners") ||
+        !getStrMember(entry, "ip", "tcp_listeners", &l.ip_) ||
+        !getIntMember(entry, "port", 1, 65535, "tcp_listeners", &port) ||
+        !getIntMember(entry, "route", 0, UINT16_MAX, "tcp_listeners", &route)) {
+      return false;
+    }
+    l.port_  = (uint16_t)port;
+    l.route_ = (uint16_t)route;
+    listeners->push_back(l);
+  }
+  return true;
+}
+
+bool parseRouteUpstreams(const ConfigValue &value, RouteTable *routes) {
+  for (const auto &entry : value.items_) {
+    if (entry.type_ != ConfigValue::OBJECT) {
+      LOG(ERROR) << "tcp_routes: expected objects, got " << entry.toString();
+      return false;
+    }
+    RouteUpstream r;
+    int64_t route, port;
+    if (!checkMembers(entry, {"route", "host", "port", "family"},
+                      "tcp_routes") ||
+        !getIntMember(entry, "route", 0, UINT16_MAX, "tcp_routes", &route) ||
+        !getStrMember(entry, "host", "tcp_routes", &r.host_) ||
+        !getIntMember(entry, "port", 1, 65535, "tcp_routes", &port)) {
+      return false;
+    }
+    r.port_   = (uint16_t)port;
+    r.family_ = ADDR_FAMILY_ANY;
+
+    const ConfigValue *family = entry.find("family");
+    if (family != nullptr &&
+        (family->type_ != ConfigValue::STR ||
+         !parseAddrFamily(family->str_, &r.family_))) {
+      LOG(ERROR) << "tcp_routes: \"family\" should be one of: "
+      << "any, ipv4, ipv6, fastest: " << entry.toString();
+      return false;
+    }
+    vector<RouteUpstream> &pool = (*routes)[(uint16_t)route];
+    for (const auto &e : pool) {
+      if (e.name() == r.name()) {
+        LOG(ERROR) << "tcp_routes: duplicated endpoint " << r.name()
+        << " of route " << route;
+        return false;
+      }
+    }
+    pool.push_back(r);
+  }
+  return true;
+}
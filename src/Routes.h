@@ -0,0 +1,75 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_ROUTES_H_
+#define TUT_ROUTES_H_
+
+#include "Common.h"
+#include "Config.h"
+
+//
+// several services over one tunnel: each client listener tags its streams
+// with a route id, the server connects them to the upstream of that route.
+// route 0 is listen_tcp_ip/port & upstream_tcp_host/port.
+//
+// with TUNNEL_FEATURE_STREAM_ROUTES every stream starts with a
+// KCP_MSG_TYPE_OPEN_CONN of its route, the server connects it right away.
+// without it a stream is opened by its first data, to route 0.
+//
+// with TUNNEL_FEATURE_OPEN_STATUS every stream starts with an open too, and
+// the server answers it: KCP_MSG_TYPE_OPEN_OK once the upstream is
+// connected, KCP_MSG_TYPE_OPEN_FAIL instead of a close if it can't be. the
+// data of a failed conn is dropped until the client opens it again (with
+// what it has sent so far as early data) or closes it. the client may also
+// open streams ahead of the accepts of its listeners.
+//
+#define ROUTE_DEFAULT  0
+
+// "tcp_listeners": [{"ip": "0.0.0.0", "port": 3333, "route": 1}, ...]
+struct RouteListener {
+  string   ip_;
+  uint16_t port_;
+  uint16_t route_;
+};
+
+// "tcp_routes": [{"route": 1, "host": "bch.ss.btc.com", "port": 1800,
+//                 "family": "any"}, ...]
+// entries of the same route are the endpoints of its pool, entries of route 0
+// join upstream_tcp_host/port.
+struct RouteUpstream {
+  string   host_;
+  uint16_t port_;
+  int      family_;  // ADDR_FAMILY_*
+
+  string name() const { return host_ + ":" + std::to_string(port_); }
+};
+
+// route -> endpoints, in file order
+typedef map<uint16_t, vector<RouteUpstream> > RouteTable;
+
+// false on a malformed entry, the error is logged
+bool parseRouteListeners(const ConfigValue &value,
+                         vector<RouteListener> *listeners);
+bool parseRouteUpstreams(const ConfigValue &value, RouteTable *routes);
+
+#endif
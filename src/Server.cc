@@ -25,6 +25,7 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <signal.h>
 #include <sys/fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -36,56 +37,77 @@
 
 
 
+// seconds a retired session has to write out its output
+#define RETIRE_DRAIN_TIMEOUT  5
+
 //////////////////////////////// ServerTCPSession //////////////////////////////
-ServerTCPSession::ServerTCPSession(const uint16_t connIdx, struct event_base *base,
-                                   Server *server):
-bev_(nullptr), server_(server), connIdx_(connIdx)
+ServerTCPSession::ServerTCPSession(const uint16_t connIdx,
+                                   const uint16_t route,
+                                   struct event_base *base, Server *server):
+bev_(nullptr), server_(server), connIdx_(connIdx), route_(route),
+connectStartTime_(0), connected_(false), openStatus_(false),
+recvBytes_(0), sentBytes_(0),
+prio_(STREAM_PRIO_NORMAL), readPaused_(false), atLineStart_(true),
+idleNode_(this),
+lastReadTime_(cachedClock64(base)), lastWriteTime_(lastReadTime_)
 {
+  memset(&upstreamAddr_, 0, sizeof(upstreamAddr_));
   bev_ = bufferevent_socket_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
   assert(bev_ != nullptr);
 
   bufferevent_setcb(bev_,
                     Server::cb_tcpRead, nullptr,
                     Server::cb_tcpEvent, this);
+  evbuffer_add_cb(bufferevent_get_output(bev_), ServerTCPSession::cb_output, this);
   bufferevent_enable(bev_, EV_READ|EV_WRITE);
 }
 
 ServerTCPSession::~ServerTCPSession() {
+  evbuffer_remove_cb(bufferevent_get_output(bev_), ServerTCPSession::cb_output, this);
   bufferevent_free(bev_);
 }
 
-bool ServerTCPSession::connect(struct sockaddr_in &sin) {
+bool ServerTCPSession::connect(const struct sockaddr *addr, socklen_t addrLen) {
+  memcpy(&upstreamAddr_, addr, addrLen);
+  connectStartTime_ = iclock64();
+
   // bufferevent_socket_connect(): This function returns 0 if the connect
   // was successfully launched, and -1 if an error occurred.
-  int res = bufferevent_socket_connect(bev_, (struct sockaddr *)&sin, sizeof(sin));
+  int res = bufferevent_socket_connect(bev_, (struct sockaddr *)addr, addrLen);
   if (res == 0) {
+    setTcpSocketOptions(bufferevent_getfd(bev_), server_->socketOptions());
     return true;
   }
 
   return false;
 }
 
-void ServerTCPSession::setTimeout(const int32_t readTimeout,
-                                  const int32_t writeTimeout) {
-  // clear it
-  bufferevent_set_timeouts(bev_, NULL, NULL);
+bool ServerTCPSession::retire(const int32_t timeout) {
+  idleNode_.unlink();
+  if (outputQueued() == 0)
+    return false;
 
-  // set a new one
-  struct timeval readtv  = {readTimeout, 0};
-  struct timeval writetv = {writeTimeout, 0};
-  bufferevent_set_timeouts(bev_,
-                           readTimeout  > 0 ? &readtv  : nullptr,
-                           writeTimeout > 0 ? &writetv : nullptr);
+  bufferevent_disable(bev_, EV_READ);
+  bufferevent_setcb(bev_, nullptr, Server::cb_retiredWrite,
+                    Server::cb_retiredEvent, this);
+  // covers a connect still running too
+  struct timeval tv = {timeout, 0};
+  bufferevent_set_timeouts(bev_, nullptr, &tv);
+  return true;
 }
 
 void ServerTCPSession::recvData(struct evbuffer *buf) {
+  lastReadTime_ = cachedClock64(bufferevent_get_base(bev_));
+
   string msg;
   msg.resize(evbuffer_get_length(buf));
 
   // copies and removes the first datlen bytes from the front of buf
   // into the memory at data
   evbuffer_remove(buf, (uint8_t *)msg.data(), msg.size());
-  DLOG(INFO) << "tcp recv(" << connIdx_ << "): " << msg;
+  LOG_PAYLOAD("tcp recv", connIdx_, msg.data(), msg.size());
+  recvBytes_ += msg.size();
+  rearmTcpQuickAck(bufferevent_getfd(bev_), server_->socketOptions());
 
   server_->handleIncomingTCPMesasge(this, msg);
 }
@@ -93,7 +115,83 @@ void ServerTCPSession::recvData(struct evbuffer *buf) {
 void ServerTCPSession::sendData(const char *data, size_t len) {
   // add data to a bufferevent’s output buffer
   bufferevent_write(bev_, data, len);
-  DLOG(INFO) << "tcp send(" << connIdx_ << "): " << string(data, len);
+  LOG_PAYLOAD("tcp send", connIdx_, data, len);
+  sentBytes_ += len;
+}
+
+void ServerTCPSession::setReadPaused(const bool paused) {
+  if (paused == readPaused_)
+    return;
+  readPaused_ = paused;
+
+  // the kernel buffer fills up, tcp flow control pushes back on the pool
+  if (paused) {
+    bufferevent_disable(bev_, EV_READ);
+  } else {
+    bufferevent_enable(bev_, EV_READ);
+    // the read timeout restarts, as it does in bufferevent
+    lastReadTime_ = cachedClock64(bufferevent_get_base(bev_));
+  }
+}
+
+void ServerTCPSession::setRateLimit(struct ev_token_bucket_cfg *cfg,
+                                    struct bufferevent_rate_limit_group *group) {
+  // nullptr removes the limit
+  bufferevent_set_rate_limit(bev_, cfg);
+  if (group) {
+    bufferevent_add_to_rate_limit_group(bev_, group);
+  } else {
+    bufferevent_remove_from_rate_limit_group(bev_);
+  }
+}
+
+size_t ServerTCPSession::inputQueued() const {
+  return evbuffer_get_length(bufferevent_get_input(bev_));
+}
+
+size_t ServerTCPSession::outputQueued() const {
+  return evbuffer_get_length(bufferevent_get_output(bev_));
+}
+
+IINT64 ServerTCPSession::idleDeadline(const int32_t readTimeout,
+                                      const int32_t writeTimeout,
+                                      const int32_t connectTimeout,
+                                      const IINT64 now, short *what) const {
+  IINT64 deadline = 0;
+  *what = 0;
+
+  // as bufferevent does: the read timeout runs while reading is enabled,
+  // the write timeout while there is something to write
+  if (readTimeout > 0) {
+    const bool running = !readPaused_;
+    deadline = (running ? lastReadTime_ : now) + (IINT64)readTimeout * 1000;
+    *what    = running ? BEV_EVENT_READING : 0;
+  }
+  if (writeTimeout > 0) {
+    const bool running = outputQueued() > 0;
+    const IINT64 t = (running ? lastWriteTime_ : now) + (IINT64)writeTimeout * 1000;
+    if (deadline == 0 || t < deadline) {
+      deadline = t;
+      *what    = running ? BEV_EVENT_WRITING : 0;
+    }
+  }
+  if (connectTimeout > 0 && !connected_) {
+    const IINT64 t = connectStartTime_ + connectTimeout;
+    if (deadline == 0 || t < deadline) {
+      deadline = t;
+      *what    = BEV_EVENT_WRITING;
+    }
+  }
+  return deadline;
+}
+
+void ServerTCPSession::cb_output(struct evbuffer *buf,
+                                 const struct evbuffer_cb_info *info, void *ptr) {
+  // written to the socket, or the first bytes to write after a while
+  if (info->n_deleted > 0 || info->orig_size == 0) {
+    ServerTCPSession *session = static_cast<ServerTCPSession *>(ptr);
+    session->lastWriteTime_ = cachedClock64(bufferevent_get_base(session->bev_));
+  }
 }
 
 
@@ -103,18 +201,41 @@ Server::Server(const string &udpIP, const uint16_t udpPort,
                const string &tcpUpstreamHost, const uint16_t tcpUpstreamPort,
                const int32_t tcpReadTimeout, const int32_t tcpWriteTimeout):
 running_(true), base_(nullptr), exitEvTimer_(nullptr), kcpUpdateTimer_(nullptr),
-udpIP_(udpIP), udpPort_(udpPort), udpSockFd_(-1), udpReadEvent_(nullptr),
+reloadEvent_(nullptr),
+captureEvent_(nullptr), control_(nullptr), capture_(nullptr),
+captureMaxPackets_(0), captureSnaplen_(0),
+ioEngine_(nullptr),
+udpIP_(udpIP), udpPort_(udpPort), udpSockFd_(-1), udpChannel_(nullptr),
+peerChannel_(nullptr),
+pmtuMax_(PMTU_MAX_DEFAULT), pmtu_(0),
 kcpConv_(KCP_CONV_DEFAULT_VALUE), kcpInBuf_(nullptr),
+tunnelCipher_(AEAD_AUTO), helloFeatures_(0), helloTime_(0),
+isLegacyHello_(true),
+checksumAllowed_(false), compactAllowed_(false),
+supersedeNotify_(false), notifyTagged_(0), notifyDropped_(0),
+notifyRefilled_(0), notifyDeltaAllowed_(false), streamRateCfg_(nullptr),
+upstreamRateGroup_(nullptr), backpressureLevel_(0),
 tcpUpstreamHost_(tcpUpstreamHost), tcpUpstreamPort_(tcpUpstreamPort),
-tcpReadTimeout_(tcpReadTimeout), tcpWriteTimeout_(tcpWriteTimeout), kcp_(nullptr)
+tcpUpstreamFamily_(ADDR_FAMILY_ANY), tcpReadTimeout_(tcpReadTimeout), tcpWriteTimeout_(tcpWriteTimeout),
+idleWheel_(IDLE_WHEEL_SLOTS, IDLE_WHEEL_TICK, iclock64()), idleTimer_(nullptr),
+udpSent_(0), udpRecv_(0), pingTime_(0), clientSrtt_(0), kcp_(nullptr)
 {
   base_ = event_base_new();
   assert(base_ != nullptr);
 
+  memset(&targetAddr_, 0, sizeof(targetAddr_));
+  targetAddrsize_ = 0;
+  memset(&udpListenAddr_, 0, sizeof(udpListenAddr_));
+  memset(&peerAddr_, 0, sizeof(peerAddr_));
+  memset(clientRandom_, 0, sizeof(clientRandom_));
+  memset(serverRandom_, 0, sizeof(serverRandom_));
+
   resetKCP();
 }
 
 Server::~Server() {
+  if (control_)
+    delete control_;
   if (kcp_)
     ikcp_release(kcp_);
 
@@ -126,20 +247,47 @@ Server::~Server() {
     event_del(kcpUpdateTimer_);
     event_free(kcpUpdateTimer_);
   }
-  if (udpReadEvent_) {
-    event_del(udpReadEvent_);
-    event_free(udpReadEvent_);
+  if (reloadEvent_) {
+    event_del(reloadEvent_);
+    event_free(reloadEvent_);
+  }
+  if (idleTimer_) {
+    event_del(idleTimer_);
+    event_free(idleTimer_);
   }
+  if (captureEvent_) {
+    event_del(captureEvent_);
+    event_free(captureEvent_);
+  }
+  if (capture_)
+    delete capture_;
+  for (auto session : retired_) {
+    delete session;
+  }
+  for (auto pool : pools_) {
+    delete pool.second;
+  }
+  if (peerChannel_)
+    closedChannels_.push_back(peerChannel_);
+  freeClosedChannels();
+  if (udpChannel_)
+    delete udpChannel_;  // fd will auto close
 
   if (kcpInBuf_)
     evbuffer_free(kcpInBuf_);
 
+  if (upstreamRateGroup_)
+    bufferevent_rate_limit_group_free(upstreamRateGroup_);
+  if (streamRateCfg_)
+    ev_token_bucket_cfg_free(streamRateCfg_);
+
+  if (ioEngine_)
+    delete ioEngine_;
   event_base_free(base_);
 }
 
 void Server::resetKCP() {
-  event_base_loopbreak(base_);
-
+  // in place, on the running loop
   if (kcpUpdateTimer_) {
     event_del(kcpUpdateTimer_);
     event_free(kcpUpdateTimer_);
@@ -153,27 +301,29 @@ void Server::resetKCP() {
   if (kcp_)
     ikcp_release(kcp_);
 
-  // close all conns
+  // the streams of the old conv are gone with its client, what they have
+  // for the upstream (a share just submitted) is still written out
+  vector<ServerTCPSession *> sessions;
   for (auto conn : conns_) {
-    removeUpConnection(conn.second, false);
+    sessions.push_back(conn.second);
+  }
+  for (auto session : sessions) {
+    retireUpConnection(session);
   }
+  failedOpens_.clear();
 
   kcp_ = ikcp_create(kcpConv_, this);
   kcp_->output = cb_kcpOutput;
-  ikcp_wndsize(kcp_, 256, 256);  // set kcp windown size
-  ikcp_nodelay(kcp_,
-               1,  // enable nodelay
-               10, // interval ms
-               2,  // fastresend: 2
-               1); // no traffic control
+  pmtu_ = 0;  // a new client probes it again
+  kcpParams_.apply(kcp_);
 
   //
   // KCP interval update
   //
   kcpUpdateTimer_ = event_new(base_, -1, EV_PERSIST,
                               Server::cb_kcpUpdate, this);
-  struct timeval timer_10ms = {0, 10000};  // 10ms
-  event_add(kcpUpdateTimer_, &timer_10ms);
+  struct timeval interval = kcpParams_.updateInterval();
+  event_add(kcpUpdateTimer_, &interval);
 }
 
 void Server::stop() {
@@ -183,8 +333,12 @@ void Server::stop() {
   running_ = false;
 
   LOG(INFO) << "remove all tcp connections...";
+  vector<ServerTCPSession *> sessions;
   for (auto conn : conns_) {
-    removeUpConnection(conn.second, true);
+    sessions.push_back(conn.second);
+  }
+  for (auto session : sessions) {
+    removeUpConnection(session, true);
   }
 
   // stop server in N seconds, let it send close kcp msg to server
@@ -205,64 +359,300 @@ void Server::exitLoop() {
 }
 
 bool Server::setup() {
-  // serer udp listen address
-  struct sockaddr_in sin;
-  memset(&sin, 0, sizeof(sin));
-  sin.sin_family      = AF_INET;
-  sin.sin_port        = htons(udpPort_);
-  sin.sin_addr.s_addr = htonl(INADDR_ANY);
-  if (inet_pton(AF_INET, udpIP_.c_str(), &sin.sin_addr) == 0) {
-    LOG(ERROR) << "invalid ip: " << udpIP_;
+  ioEngine_ = IoEngine::create(ioEngineName_, base_);
+  LOG(INFO) << "io engine: " << ioEngine_->name();
+
+  // reload config on SIGHUP, handled on the loop
+  reloadEvent_ = evsignal_new(base_, SIGHUP, Server::cb_reload, this);
+  event_add(reloadEvent_, nullptr);
+
+  // packet capture ring, SIGUSR1 dumps it
+  if (captureMaxPackets_ > 0) {
+    capture_ = new PacketCapture(captureMaxPackets_, captureSnaplen_);
+    captureEvent_ = evsignal_new(base_, SIGUSR1, Server::cb_dumpCapture, this);
+    event_add(captureEvent_, nullptr);
+    LOG(INFO) << "packet capture: " << captureMaxPackets_ << " packets, snaplen: "
+    << captureSnaplen_;
+  }
+
+  applyRateLimits();
+
+  // one timer for the idle timeouts of all the sessions
+  idleTimer_ = event_new(base_, -1, EV_PERSIST, Server::cb_idleTick, this);
+  struct timeval idleTick = {IDLE_WHEEL_TICK / 1000, (IDLE_WHEEL_TICK % 1000) * 1000};
+  event_add(idleTimer_, &idleTick);
+
+  // serer udp listen address, v4 or v6
+  struct sockaddr_storage sin;
+  if (!parseIPAddr(udpIP_, udpPort_, &sin)) {
     return false;
   }
 
   // create socket
-  udpSockFd_ = socket(AF_INET, SOCK_DGRAM, 0);
+  udpSockFd_ = socket(sin.ss_family, SOCK_DGRAM, 0);
   if (udpSockFd_ == -1) {
     LOG(ERROR) << "create udp socket failure: " << strerror(errno);
     return false;
   }
 
+  // "::" accepts both v4 and v6 clients
+  if (sin.ss_family == AF_INET6 &&
+      IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *)&sin)->sin6_addr)) {
+    int off = 0;
+    setsockopt(udpSockFd_, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  }
+  if (sockOpts_.udpPmtuDisc_ < 0) {
+    // DF on every datagram, the client probes the path mtu
+    sockOpts_.udpPmtuDisc_ = IP_PMTUDISC_PROBE;
+  }
+  setUdpSocketOptions(udpSockFd_, sockOpts_);
+  sockOpts_.log();
+
   // make non-blocking
   fcntl(udpSockFd_, F_SETFL, O_NONBLOCK);
 
+  // the connected peer sockets bind the same address
+  if (sockOpts_.udpConnected_) {
+    int on = 1;
+    if (setsockopt(udpSockFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+        setsockopt(udpSockFd_, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+      LOG(ERROR) << "set SO_REUSEPORT failure: " << strerror(errno)
+      << ", udp_connected is off";
+      sockOpts_.udpConnected_ = false;
+    }
+  }
+  memcpy(&udpListenAddr_, &sin, sizeof(sin));
+
   // bind address
-  if (bind(udpSockFd_, (struct sockaddr *) &sin, sizeof(sin)) == -1) {
+  if (bind(udpSockFd_, (struct sockaddr *) &sin,
+           sockaddrLen((struct sockaddr *)&sin)) == -1) {
     LOG(ERROR) << "bind udp socket failure: " << strerror(errno);
     return false;
   }
 
   // add event
-  udpReadEvent_ = event_new(base_, udpSockFd_, EV_READ|EV_PERSIST,
-                            cb_udpRead, this);
-  event_add(udpReadEvent_, nullptr);
+  // large enough for the biggest pmtu probe
+  udpChannel_ = ioEngine_->openUdp(udpSockFd_,
+                                   std::max((size_t)MAX_MESSAGE_LEN, (size_t)pmtuMax_),
+                                   cb_udpRead, this);
+  if (udpChannel_ == nullptr) {
+    return false;
+  }
+
+  // control socket
+  if (!controlPath_.empty()) {
+    control_ = new ControlServer(base_, Server::cb_control, this);
+    if (!control_->listen(controlPath_)) {
+      return false;
+    }
+  }
+
+  applyRoutes();
 
-  LOG(INFO) << "listen on udp: " << udpIP_ << ":" << udpPort_;
+  LOG(INFO) << "listen on udp: " << sockaddrToString((struct sockaddr *)&sin)
+  << ", upstream tcp family: " << addrFamilyName(tcpUpstreamFamily_)
+  << ", routes: " << pools_.size()
+  << ", upstreams of route 0: " << pools_[ROUTE_DEFAULT]->size();
   return true;
 }
 
 void Server::run() {
   assert(base_ != NULL);
-  while (running_) {
-    event_base_dispatch(base_);
-    sleep(1);
+  event_base_dispatch(base_);
+}
+
+void Server::cb_reload(evutil_socket_t fd, short events, void *ptr) {
+  static_cast<Server *>(ptr)->reloadConfig();
+}
+
+void Server::reloadConfig() {
+  if (config_.path().empty())
+    return;
+
+  Config conf = config_;
+  if (!conf.load(config_.path())) {
+    LOG(ERROR) << "reload config failure, keep the running one";
+    return;
+  }
+  LOG(INFO) << "reload config: " << conf.path() << ", changed keys: "
+  << conf.logDiff(config_);
+
+  if (conf.changed(config_, "tcp_read_timeout") ||
+      conf.changed(config_, "tcp_write_timeout")) {
+    tcpReadTimeout_  = (int32_t)conf.getInt("tcp_read_timeout");
+    tcpWriteTimeout_ = (int32_t)conf.getInt("tcp_write_timeout");
+    // against the new values, it may remove some
+    vector<ServerTCPSession *> sessions;
+    for (auto conn : conns_) {
+      sessions.push_back(conn.second);
+    }
+    const IINT64 now = iclock64();
+    for (auto session : sessions) {
+      checkIdleTimeout(session, now);
+    }
+  }
+  gLogPayloadSample = (uint32_t)conf.getInt("log_payload_sample");
+  supersedeNotify_ = conf.getBool("stream_supersede_notify");
+
+  // new streams take the new table, the open ones stay where they are
+  {
+    UpstreamPoolParams params;
+    params.load(conf);
+    const bool paramsChanged = (params != poolParams_);
+    poolParams_ = params;
+
+    RouteTable routes;
+    if (!conf.changed(config_, "tcp_routes")) {
+      if (paramsChanged)
+        applyRoutes();
+    } else if (parseRouteUpstreams(conf.getValue("tcp_routes"), &routes)) {
+      routes_ = routes;
+      applyRoutes();
+      LOG(INFO) << "tcp routes: " << pools_.size();
+    } else {
+      LOG(ERROR) << "invalid tcp_routes, keep the running ones";
+      if (paramsChanged)
+        applyRoutes();
+    }
+  }
+
+  {
+    RateLimits limits;
+    limits.load(conf);
+    if (limits.stream_ != rateLimits_.stream_ ||
+        limits.listener_ != rateLimits_.listener_ ||
+        limits.tunnel_ != rateLimits_.tunnel_) {
+      rateLimits_ = limits;
+      applyRateLimits();
+    }
+  }
+
+  // kcp, in place
+  {
+    const string before = KcpParams::effective(kcp_);
+    kcpParams_.load(conf);
+    kcpParams_.apply(kcp_);
+
+    const string after = KcpParams::effective(kcp_);
+    if (after != before) {
+      LOG(INFO) << "kcp params: " << before << " -> " << after;
+    }
+
+    // the update timer follows the interval
+    if (kcpUpdateTimer_) {
+      event_del(kcpUpdateTimer_);
+      struct timeval interval = kcpParams_.updateInterval();
+      event_add(kcpUpdateTimer_, &interval);
+    }
   }
+
+  config_ = conf;
 }
 
 void Server::cb_kcpUpdate(evutil_socket_t fd,
                           short events, void *ptr) {
   Server *server = static_cast<Server *>(ptr);
   ikcp_update(server->kcp_, iclock());
+  server->ioEngine_->flush();
+  server->checkBackpressure();
+  server->freeClosedChannels();
+}
+
+void Server::checkBackpressure() {
+  int level = backpressureLevel(ikcp_waitsnd(kcp_), kcpParams_.sndWnd_);
+  // over the tunnel ceiling, counting what's queued in kcp but not sent yet:
+  // only HIGH streams are read until it refills
+  if (tunnelBucket_.isEmpty(iclock64(), (int64_t)kcp_->nsnd_que * kcp_->mss)) {
+    level = BACKPRESSURE_LEVEL_MAX;
+  }
+  if (level == backpressureLevel_)
+    return;
+
+  DLOG(INFO) << "kcp backpressure level: " << backpressureLevel_ << " -> " << level;
+  backpressureLevel_ = level;
+  for (auto conn : conns_) {
+    conn.second->setReadPaused(isStreamPaused(conn.second->prio_, level));
+  }
+}
+
+void Server::cb_idleTick(evutil_socket_t fd, short events, void *ptr) {
+  Server *server = static_cast<Server *>(ptr);
+  server->idleWheel_.advance(iclock64(), Server::cb_idleTimeout, server);
+}
+
+void Server::cb_idleTimeout(TimerWheelNode *node, void *ptr) {
+  static_cast<Server *>(ptr)->checkIdleTimeout(
+    static_cast<ServerTCPSession *>(node->owner_), iclock64());
+}
+
+void Server::checkIdleTimeout(ServerTCPSession *session, const IINT64 now) {
+  short what;
+  const IINT64 deadline = session->idleDeadline(tcpReadTimeout_,
+                                                tcpWriteTimeout_,
+                                                poolParams_.connectTimeout_,
+                                                now, &what);
+  if (what != 0 && deadline <= now) {
+    // the same as bufferevent's own timeout event
+    cb_tcpEvent(nullptr, BEV_EVENT_TIMEOUT | what, session);
+    return;
+  }
+
+  if (deadline == 0) {
+    session->idleNode_.unlink();  // timeouts are off
+    return;
+  }
+  // activity only moves the stamps, the wheel brings it back here
+  idleWheel_.schedule(&session->idleNode_, deadline);
+}
+
+void Server::applyRateLimits() {
+  // the sessions keep a pointer to the cfg, free the old one after them
+  struct ev_token_bucket_cfg *oldCfg = streamRateCfg_;
+  streamRateCfg_ = rateLimits_.stream_.newBucketCfg();
+
+  struct bufferevent_rate_limit_group *oldGroup = nullptr;
+  struct ev_token_bucket_cfg *groupCfg = rateLimits_.listener_.newBucketCfg();
+  if (groupCfg == nullptr) {
+    oldGroup = upstreamRateGroup_;
+    upstreamRateGroup_ = nullptr;
+  } else {
+    // the group copies the cfg
+    if (upstreamRateGroup_ == nullptr) {
+      upstreamRateGroup_ = bufferevent_rate_limit_group_new(base_, groupCfg);
+    } else {
+      bufferevent_rate_limit_group_set_cfg(upstreamRateGroup_, groupCfg);
+    }
+    ev_token_bucket_cfg_free(groupCfg);
+  }
+
+  for (auto conn : conns_) {
+    conn.second->setRateLimit(streamRateCfg_, upstreamRateGroup_);
+  }
+  // still writing out their output, on the same cfg and group
+  for (auto session : retired_) {
+    session->setRateLimit(streamRateCfg_, upstreamRateGroup_);
+  }
+  if (oldCfg)
+    ev_token_bucket_cfg_free(oldCfg);
+  if (oldGroup)
+    bufferevent_rate_limit_group_free(oldGroup);  // no members left
+
+  tunnelBucket_.setLimit(rateLimits_.tunnel_, iclock64());
+
+  LOG(INFO) << "rate limit, stream: " << rateLimits_.stream_.toString()
+  << ", upstream: " << rateLimits_.listener_.toString()
+  << ", tunnel: " << rateLimits_.tunnel_.toString();
 }
 
 void Server::kcpUpdateManually() {
   event_del(kcpUpdateTimer_);
 
   ikcp_update(kcp_, iclock());
+  ioEngine_->flush();
 
   // set agagin
-  struct timeval timer_10ms = {0, 10000};  // 10ms
-  event_add(kcpUpdateTimer_, &timer_10ms);
+  struct timeval interval = kcpParams_.updateInterval();
+  event_add(kcpUpdateTimer_, &interval);
 }
 
 void Server::removeUpConnection(ServerTCPSession *session,
@@ -270,44 +660,107 @@ void Server::removeUpConnection(ServerTCPSession *session,
   if (isNeedSendCloseMsg)
     sendKcpCloseMsg(session->connIdx_);
 
+  auto pool = pools_.find(session->route_);
+  if (pool != pools_.end())
+    pool->second->release(session->upstreamName_);
+
+  LOG(INFO) << "remove up conn: " << session->connIdx_;
+
   conns_.erase(session->connIdx_);
   delete session;
+}
 
-  LOG(INFO) << "remove up conn: " << session->connIdx_;
+void Server::retireUpConnection(ServerTCPSession *session) {
+  auto pool = pools_.find(session->route_);
+  if (pool != pools_.end())
+    pool->second->release(session->upstreamName_);
+  conns_.erase(session->connIdx_);
+
+  if (!session->retire(RETIRE_DRAIN_TIMEOUT)) {
+    delete session;
+    return;
+  }
+  retired_.insert(session);
+  LOG(INFO) << "retire up conn: " << session->connIdx_ << ", flushing "
+  << session->outputQueued() << " bytes";
 }
 
-void Server::handleIncomingUDPMesasge(struct sockaddr_in *sin,
+void Server::cb_retiredWrite(struct bufferevent *bev, void *ptr) {
+  // written out
+  ServerTCPSession *session = static_cast<ServerTCPSession *>(ptr);
+  session->server_->retired_.erase(session);
+  delete session;
+}
+
+void Server::cb_retiredEvent(struct bufferevent *bev, short events, void *ptr) {
+  if (events & BEV_EVENT_CONNECTED)
+    return;  // the write callback follows
+
+  ServerTCPSession *session = static_cast<ServerTCPSession *>(ptr);
+  LOG(INFO) << "retired up conn: " << session->connIdx_ << " closed, events: "
+  << events << ", unsent: " << session->outputQueued();
+  session->server_->retired_.erase(session);
+  delete session;
+}
+
+void Server::handleIncomingUDPMesasge(const struct sockaddr *addr,
                                       socklen_t addrSize,
-                                      uint8_t *inData, size_t inDataSize) {
-  // copy the latest client address
-  if (memcmp(&targetAddr_, sin, sizeof(struct sockaddr_in)) != 0) {
-    targetAddr_     = *sin;
-    targetAddrsize_ = addrSize;
-    LOG(INFO) << "reset target udp address: "
-    << inet_ntoa(sin->sin_addr) << ":" << ntohs(sin->sin_port);
+                                      const uint8_t *inData, size_t inDataSize) {
+  // check if it's init kcp conv pkg, it's never sealed
+  const bool isHello = recvInitKCPConvPkg(inData, inDataSize, addr, addrSize);
+
+  if (!isHello && codec_.enabled()) {
+    inData = codec_.open(inData, inDataSize, &inDataSize);
+    if (inData == nullptr) {
+      LOG_EVERY_MS(WARNING, 1000) << "drop unauthenticated datagram from: "
+      << sockaddrToString(addr) << ", " << codec_.stats();
+      return;
+    }
+  } else if (!isHello && checksum_.enabled()) {
+    if (!checksum_.verify(inData, inDataSize, &inDataSize)) {
+      LOG_EVERY_MS(WARNING, 1000) << "drop corrupted datagram from: "
+      << sockaddrToString(addr) << ", checksum failures: "
+      << checksum_.failures_;
+      return;
+    }
+  } else if (!isHello && !tunnelKey_.empty()) {
+    return;  // no keyed conv yet
   }
 
-  // check if it's init kcp conv pkg
-  if (inDataSize == 12 && recvInitKCPConvPkg(inData)) {
-    return;
+  if (!isHello && compact_.enabled() &&
+      parseCtrlDatagram(inData, inDataSize) < 0) {
+    inData = compact_.expand(inData, inDataSize, kcpConv_, &inDataSize);
+    if (inData == nullptr) {
+      LOG_EVERY_MS(WARNING, 1000) << "drop malformed compact datagram from: "
+      << sockaddrToString(addr) << ", " << compact_.stats();
+      return;
+    }
   }
 
-  if (ikcp_input(kcp_, (const char *)inData, inDataSize) < 0) {
-    LOG(ERROR) << "ikcp_input failure";
+  if (capture_) {
+    capture_->record(CAPTURE_DIR_IN, inData, inDataSize, addr);
+  }
+  if (isHello) {
     return;
   }
 
-  char buf[2048];
-  const int kLen = sizeof(buf);
+  // copy the latest client address, only from an authentic datagram
+  setTargetAddr(addr, addrSize);
+  udpRecv_++;
 
-  while (1) {
-    int size = ikcp_recv(kcp_, buf, kLen);
-    if (size < 0) break;
+  const int ctrlType = parseCtrlDatagram(inData, inDataSize);
+  if (ctrlType >= 0) {
+    handleCtrlDatagram(ctrlType, inData, inDataSize);
+    return;
+  }
 
-    // add to kcp coming evbuf
-    evbuffer_add(kcpInBuf_, buf, size);
+  if (ikcp_input(kcp_, (const char *)inData, inDataSize) < 0) {
+    LOG_EVERY_MS(ERROR, 1000) << "ikcp_input failure";
+    return;
   }
 
+  readKcpRecvQueue(kcp_, kcpInBuf_);
+
   while (readKcpMsg()) {
   }
 
@@ -359,6 +812,9 @@ bool Server::readKcpMsg() {
     else if (type == KCP_MSG_TYPE_KEEPALIVE) {
       // keep-alive pkg, do nothing
     }
+    else if (type == KCP_MSG_TYPE_OPEN_CONN) {
+      handleKcpMsg_openConn(kcpMsg);
+    }
     else {
       LOG(ERROR) << "unkown kcp msg type: " << type;
     }
@@ -369,14 +825,14 @@ bool Server::readKcpMsg() {
     // data message
     //
     handleKcpMsg(connIdx, kcpMsg.data() + 4, kcpMsg.size() - 4);
-    DLOG(INFO) << "kcp recv: " << string(kcpMsg.data() + 4, kcpMsg.size() - 4);
+    LOG_PAYLOAD("kcp recv", connIdx, kcpMsg.data() + 4, kcpMsg.size() - 4);
   }
 
   return true;  // read message success, return true
 }
 
-void Server::sendKcpMsg(const string &msg) {
-  int res = ikcp_send(kcp_, msg.data(), (int)msg.size());
+void Server::sendKcpMsg(const string &msg, const uint32_t tag) {
+  int res = ikcp_send_tag(kcp_, msg.data(), (int)msg.size(), tag);
   if (res < 0) {
     // should not happen
     LOG(FATAL) << "kcp send error: " << res;
@@ -389,37 +845,157 @@ void Server::handleKcpMsg(const uint16_t connIdx, const char *data, size_t len)
   auto itr = conns_.find(connIdx);
 
   if (itr == conns_.end()) {
-    // resolue upstream host
-    struct sockaddr_in sin;
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;
-    sin.sin_port   = htons(tcpUpstreamPort_);
-    if (!resolve(tcpUpstreamHost_, &sin.sin_addr)) {
-      goto error;
-    }
-
-    LOG(INFO) << "create server tcp session, connIdx: " << connIdx;
-    ServerTCPSession *s = new ServerTCPSession(connIdx, base_, this);
-    if (s->connect(sin) == false) {
-      LOG(INFO) << "tcp session connect fail, connIdx: " << connIdx;
-      delete s;
-      goto error;
-    }
-    // set timout
-    s->setTimeout(tcpReadTimeout_, tcpWriteTimeout_);
-
-    // connect success
-    conns_.insert(std::make_pair(connIdx, s));
+    // the client opens it again or closes it, after our OPEN_FAIL
+    if (failedOpens_.count(connIdx)) {
+      DLOG(INFO) << "drop kcp msg of a failed open: " << connIdx;
+      return;
+    }
+    // opened by KCP_MSG_TYPE_OPEN_CONN, it has been closed
+    if (helloFeatures_ & (TUNNEL_FEATURE_STREAM_ROUTES |
+                          TUNNEL_FEATURE_OPEN_STATUS)) {
+      DLOG(INFO) << "drop kcp msg of a closed conn: " << connIdx;
+      sendKcpCloseMsg(connIdx);
+      return;
+    }
+
+    int failReason;
+    ServerTCPSession *s = openUpConnection(connIdx, ROUTE_DEFAULT, "",
+                                           &failReason);
+    if (s == nullptr) {
+      // send kcp msg to tell Client close the conn
+      sendKcpCloseMsg(connIdx);
+      return;
+    }
     itr = conns_.find(connIdx);
   }
   assert(itr != conns_.end());
 
   itr->second->sendData(data, len);
-  return;
+}
 
-error:
-  // send kcp msg to tell Client close the conn
-  sendKcpCloseMsg(connIdx);
+ServerTCPSession *Server::openUpConnection(const uint16_t connIdx,
+                                           const uint16_t route,
+                                           const string &early,
+                                           int *failReason) {
+  // resolue upstream host
+  struct sockaddr_storage sin;
+  string name;
+  if (!pickUpstreamAddr(route, &sin, &name)) {
+    *failReason = pools_.count(route) ? OPEN_FAIL_CONNECT : OPEN_FAIL_ROUTE;
+    return nullptr;
+  }
+
+  LOG(INFO) << "create server tcp session, connIdx: " << connIdx
+  << ", route: " << route << ", upstream: " << name << " "
+  << sockaddrToString((struct sockaddr *)&sin);
+  ServerTCPSession *s = new ServerTCPSession(connIdx, route, base_, this);
+  s->upstreamName_ = name;
+  if (s->connect((struct sockaddr *)&sin,
+                 sockaddrLen((struct sockaddr *)&sin)) == false) {
+    LOG(INFO) << "tcp session connect fail, connIdx: " << connIdx;
+    upstreamConnectDone(s, false);
+    pools_[route]->release(name);
+    delete s;
+    *failReason = OPEN_FAIL_CONNECT;
+    return nullptr;
+  }
+  if (!early.empty()) {
+    s->sendData(early.data(), early.size());  // written once connected
+  }
+  s->setRateLimit(streamRateCfg_, upstreamRateGroup_);
+  s->setReadPaused(isStreamPaused(s->prio_, backpressureLevel_));
+
+  // connect success
+  conns_.insert(std::make_pair(connIdx, s));
+  checkIdleTimeout(s, iclock64());
+  return s;
+}
+
+bool Server::pickUpstreamAddr(const uint16_t route,
+                              struct sockaddr_storage *addr, string *name) {
+  auto pool = pools_.find(route);
+  if (pool == pools_.end()) {
+    LOG(WARNING) << "unknown route: " << route << ", see tcp_routes";
+    return false;
+  }
+  UpstreamEndpoint *ep = pool->second->pick(iclock64());
+  assert(ep != nullptr);  // a pool has one endpoint at least
+  const int family = ep->conf_.family_;
+
+  vector<struct sockaddr_storage> addrs;
+  if (!resolve(ep->conf_.host_, ep->conf_.port_, family, SOCK_STREAM, &addrs)) {
+    pool->second->connectDone(ep->name_, false, 0);
+    pool->second->release(ep->name_);
+    return false;
+  }
+  *name = ep->name_;
+
+  if (family != ADDR_FAMILY_FASTEST || addrs.size() == 1) {
+    *addr = addrs[0];
+    return true;
+  }
+
+  // the lowest connect rtt, an address never tried goes first
+  IINT64 best = -1;
+  for (const auto &a : addrs) {
+    auto itr = upstreamConnectRtt_.find(sockaddrToString((struct sockaddr *)&a));
+    IINT64 rtt = (itr == upstreamConnectRtt_.end()) ? 0 : itr->second;
+    if (best == -1 || rtt < best) {
+      best  = rtt;
+      *addr = a;
+    }
+  }
+  return true;
+}
+
+void Server::applyRoutes() {
+  RouteTable table = routes_;
+  RouteUpstream def;
+  def.host_   = tcpUpstreamHost_;
+  def.port_   = tcpUpstreamPort_;
+  def.family_ = tcpUpstreamFamily_;
+  vector<RouteUpstream> &defaults = table[ROUTE_DEFAULT];
+  for (auto itr = defaults.begin(); itr != defaults.end(); itr++) {
+    if (itr->name() == def.name()) {
+      defaults.erase(itr);
+      break;
+    }
+  }
+  defaults.insert(defaults.begin(), def);
+
+  for (auto itr = pools_.begin(); itr != pools_.end(); ) {
+    if (table.count(itr->first) == 0) {
+      delete itr->second;  // its streams stay open
+      itr = pools_.erase(itr);
+    } else {
+      itr++;
+    }
+  }
+  for (const auto &route : table) {
+    UpstreamPool *&pool = pools_[route.first];
+    if (pool == nullptr)
+      pool = new UpstreamPool(base_, route.first);
+    pool->setParams(poolParams_);
+    pool->setEndpoints(route.second);
+  }
+}
+
+void Server::upstreamConnectDone(ServerTCPSession *session, const bool ok) {
+  auto pool = pools_.find(session->route_);
+  if (pool == pools_.end())
+    return;
+  pool->second->connectDone(session->upstreamName_, ok,
+                            iclock64() - session->connectStartTime_);
+}
+
+void Server::updateUpstreamRtt(const struct sockaddr *addr, IINT64 rtt) {
+  const string key = sockaddrToString(addr);
+  auto itr = upstreamConnectRtt_.find(key);
+  if (itr == upstreamConnectRtt_.end()) {
+    upstreamConnectRtt_[key] = rtt;
+  } else {
+    itr->second = (itr->second * 7 + rtt) / 8;
+  }
 }
 
 void Server::handleKcpMsg_closeConn(const string &msg) {
@@ -432,6 +1008,8 @@ void Server::handleKcpMsg_closeConn(const string &msg) {
 
   auto itr = conns_.find(connIdx);
   if (itr == conns_.end()) {
+    if (failedOpens_.erase(connIdx))
+      return;  // the client gave up after our OPEN_FAIL
     LOG(ERROR) << "handle close msg fail, can't find conn by Idx: " << connIdx;
     return;
   }
@@ -439,16 +1017,167 @@ void Server::handleKcpMsg_closeConn(const string &msg) {
   removeUpConnection(itr->second, false);
 }
 
+void Server::handleKcpMsg_openConn(const string &msg) {
+  //
+  // KCP_MSG_TYPE_OPEN_CONN
+  // | len(2) | 0x0000(2) | 0x03 | connIdx(2) | route(2) | early data |
+  //
+  if (msg.size() < 9) {
+    LOG(ERROR) << "invalid open conn msg, size: " << msg.size();
+    return;
+  }
+  const uint8_t *p = (uint8_t *)msg.data();
+  const uint16_t connIdx = *(uint16_t *)(p + 5);
+  const uint16_t route   = *(uint16_t *)(p + 7);
+  const bool openStatus  = (helloFeatures_ & TUNNEL_FEATURE_OPEN_STATUS) != 0;
+
+  if (conns_.find(connIdx) != conns_.end()) {
+    LOG(ERROR) << "open conn msg of an open conn: " << connIdx;
+    return;
+  }
+  failedOpens_.erase(connIdx);  // opened again
+
+  int failReason;
+  ServerTCPSession *s = openUpConnection(connIdx, route,
+                                         openStatus ? msg.substr(9) : "",
+                                         &failReason);
+  if (s != nullptr) {
+    s->openStatus_ = openStatus;
+  } else if (openStatus) {
+    failedOpens_.insert(connIdx);
+    sendKcpOpenFailMsg(connIdx, failReason);
+  } else {
+    sendKcpCloseMsg(connIdx);
+  }
+}
+
+void Server::failUpConnection(ServerTCPSession *session, const int reason) {
+  const uint16_t connIdx = session->connIdx_;
+  LOG(INFO) << "open conn failure, connIdx: " << connIdx << ", "
+  << openFailReasonName(reason);
+  removeUpConnection(session, false);
+  failedOpens_.insert(connIdx);
+  sendKcpOpenFailMsg(connIdx, reason);
+}
+
 void Server::handleIncomingTCPMesasge(ServerTCPSession *session,
                                       string &msg) {
+  const bool delta = (helloFeatures_ & TUNNEL_FEATURE_NOTIFY_DELTA) != 0;
+  if (!supersedeNotify_ && !delta) {
+    sendStreamData(session, msg.data(), msg.size(), 0);
+    checkBackpressure();
+    return;
+  }
+  const uint32_t tag = supersedeNotify_ ? session->connIdx_ : 0;
+
+  // whole notify lines only, a line across two reads is sent as it is
+  const char *p   = msg.data();
+  const char *end = p + msg.size();
+  const char *pending = p;
+  bool atLineStart = session->atLineStart_;
+  bool clean;
+
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (eol == nullptr)
+      break;
+
+    if (atLineStart && parseMiningNotify(p, eol - p, &clean)) {
+      sendStreamData(session, pending, p - pending, 0);
+      if (clean && supersedeNotify_) {
+        supersedeNotify(session);
+      }
+      if (delta) {
+        sendNotifyDelta(session, p, eol + 1 - p, tag);
+      } else {
+        sendStreamData(session, p, eol + 1 - p, tag);
+      }
+      notifyTagged_ += (tag != 0);
+      pending = eol + 1;
+    }
+    atLineStart = true;
+    p = eol + 1;
+  }
+  sendStreamData(session, pending, end - pending, 0);
+  if (!msg.empty()) {
+    session->atLineStart_ = (end[-1] == '\n');
+  }
+
+  checkBackpressure();
+}
+
+void Server::supersedeNotify(ServerTCPSession *session) {
+  //
+  // the filler of the unacked ones, an empty data message of the stream:
+  // | len(2) | connIdx(2) |
+  //
+  char filler[4];
+  *(uint16_t *)filler       = (uint16_t)sizeof(filler);
+  *(uint16_t *)(filler + 2) = session->connIdx_;
+
+  int refilled = 0;
+  const int dropped = ikcp_supersede(kcp_, session->connIdx_,
+                                     filler, (int)sizeof(filler), &refilled);
+  if (dropped + refilled > 0) {
+    DLOG(INFO) << "clean notify of conn: " << session->connIdx_
+    << ", superseded queued: " << dropped << ", unacked: " << refilled;
+    // the client may miss the reference, the next notify delta is full
+    session->lastNotify_.clear();
+  }
+  notifyDropped_  += dropped;
+  notifyRefilled_ += refilled;
+}
+
+void Server::sendNotifyDelta(ServerTCPSession *session,
+                             const char *line, size_t len,
+                             const uint32_t tag) {
+  if (len > NOTIFY_DELTA_MAX_LINE) {
+    sendStreamData(session, line, len, tag);
+    return;
+  }
+
+  // a reference that supersession may still cancel isn't one, the client
+  // could get the filler in its place
+  if (tag != 0 && ikcp_tagged(kcp_, tag) > 0) {
+    session->lastNotify_.clear();
+  }
+
+  //
+  // KCP_MSG_TYPE_NOTIFY
+  // | len(2) | 0x0000(2) | 0x06 | connIdx(2) | flags(1) | crc32c(4) | ops |
+  //
+  string kcpMsg;
+  kcpMsg.resize(NOTIFY_DELTA_HEADER);
+  notifyDelta_.encode(session->lastNotify_, line, len, &kcpMsg);
+  assert(kcpMsg.size() <= UINT16_MAX);
+
+  uint8_t *p = (uint8_t *)kcpMsg.data();
+  *(uint16_t *)p = (uint16_t)kcpMsg.size();
+  p += 2;
+  *(uint16_t *)p = (uint16_t)KCP_MSG_CONNIDX_NONE;
+  p += 2;
+  *(uint8_t *)p++ = KCP_MSG_TYPE_NOTIFY;
+  *(uint16_t *)p = session->connIdx_;
+  p += 2;
+  *(uint8_t *)p++ = session->lastNotify_.empty() ? NOTIFY_DELTA_FULL : 0;
+  *(uint32_t *)p = crc32c((const uint8_t *)line, len);
+
+  LOG_PAYLOAD("kcp send", session->connIdx_, line, len);
+  session->lastNotify_.assign(line, len);
+  sendKcpMsg(kcpMsg, tag);
+}
+
+void Server::sendStreamData(ServerTCPSession *session,
+                            const char *data, size_t size,
+                            const uint32_t tag) {
   //
   // cause we use uint16_t as the kcp message length, so we can't send message
   // which over than 65535
   //
   const size_t maxMsgLen = UINT16_MAX - 4;
 
-  while (msg.size() > 0) {
-    size_t len = std::min(maxMsgLen, msg.size());
+  while (size > 0) {
+    size_t len = std::min(maxMsgLen, size);
     assert(len < UINT16_MAX);
 
     //
@@ -472,14 +1201,14 @@ void Server::handleIncomingTCPMesasge(ServerTCPSession *session,
     p += 2;
 
     // content
-    memcpy(p, msg.data(), len);
-    DLOG(INFO) << "kcp send: " << string(msg.begin(), msg.begin() + len);
+    memcpy(p, data, len);
+    LOG_PAYLOAD("kcp send", session->connIdx_, data, len);
 
     // send
-    sendKcpMsg(kcpMsg);
+    sendKcpMsg(kcpMsg, tag);
 
-    // remove the first `len` bytes from string
-    msg.erase(msg.begin(), msg.begin() + len);
+    data += len;
+    size -= len;
   } /* /while */
 }
 
@@ -522,59 +1251,312 @@ void Server::sendKcpCloseMsg(const uint16_t connIdx) {
   DLOG(INFO) << "send kcp msg, close conn: " << connIdx;
 }
 
+void Server::sendKcpOpenOkMsg(const uint16_t connIdx, const IINT64 connectMs) {
+  //
+  // KCP_MSG_TYPE_OPEN_OK
+  // | len(2) | 0x0000(2) | 0x04 | connIdx(2) | connect ms(2) |
+  //
+  string kcpMsg;
+  kcpMsg.resize(2 + 2 + 1 + 2 + 2);
+  uint8_t *p = (uint8_t *)kcpMsg.data();
+
+  *(uint16_t *)p = (uint16_t)kcpMsg.size();
+  p += 2;
+  *(uint16_t *)p = (uint16_t)KCP_MSG_CONNIDX_NONE;
+  p += 2;
+  *(uint8_t *)p++ = KCP_MSG_TYPE_OPEN_OK;
+  *(uint16_t *)p = connIdx;
+  p += 2;
+  *(uint16_t *)p = (uint16_t)std::min<IINT64>(std::max<IINT64>(connectMs, 0),
+                                             UINT16_MAX);
+  p += 2;
+
+  sendKcpMsg(kcpMsg);
+
+  DLOG(INFO) << "send kcp msg, open ok: " << connIdx;
+}
+
+void Server::sendKcpOpenFailMsg(const uint16_t connIdx, const int reason) {
+  //
+  // KCP_MSG_TYPE_OPEN_FAIL
+  // | len(2) | 0x0000(2) | 0x05 | connIdx(2) | reason(1) |
+  //
+  string kcpMsg;
+  kcpMsg.resize(2 + 2 + 1 + 2 + 1);
+  uint8_t *p = (uint8_t *)kcpMsg.data();
+
+  *(uint16_t *)p = (uint16_t)kcpMsg.size();
+  p += 2;
+  *(uint16_t *)p = (uint16_t)KCP_MSG_CONNIDX_NONE;
+  p += 2;
+  *(uint8_t *)p++ = KCP_MSG_TYPE_OPEN_FAIL;
+  *(uint16_t *)p = connIdx;
+  p += 2;
+  *(uint8_t *)p++ = (uint8_t)reason;
+
+  sendKcpMsg(kcpMsg);
+
+  DLOG(INFO) << "send kcp msg, open fail: " << connIdx << ", "
+  << openFailReasonName(reason);
+}
+
 int Server::cb_kcpOutput(const char *buf, int len, ikcpcb *kcp, void *ptr) {
   Server *server = static_cast<Server *>(ptr);
   return server->sendKcpDataLowLevel(buf, len, kcp);
 }
 
-int Server::sendKcpDataLowLevel(const char *buf, int len, ikcpcb *kcp) {
-  // On success, these calls return the number of characters sent.
-  // On error, -1 is returned, and errno is set appropriately.
-  ssize_t r = sendto(udpSockFd_, buf, (size_t)len, MSG_DONTWAIT,
-                     (struct sockaddr *)&targetAddr_, targetAddrsize_);
-  if (r == -1) {
-    LOG(ERROR) << "sendto error: " << strerror(errno);
+void Server::sendDatagram(const char *buf, size_t len,
+                          const struct sockaddr *addr, socklen_t addrLen) {
+  udpSent_++;  // not the hellos
+  if (!codec_.enabled() && !checksum_.enabled() && !compact_.enabled()) {
+    sendPlainDatagram(buf, len, addr, addrLen);
+    return;
+  }
+
+  // the capture keeps kcp's plaintext, kcpdump can't decode it otherwise
+  if (capture_) {
+    capture_->record(CAPTURE_DIR_OUT, (const uint8_t *)buf, len, addr);
   }
-  return (int)r;
+
+  const uint8_t *out = (const uint8_t *)buf;
+  size_t outLen = len;
+  if (compact_.enabled() && parseCtrlDatagram(out, outLen) < 0) {
+    out = compact_.compress(out, outLen, &outLen);
+    if (out == nullptr) {
+      LOG_EVERY_MS(ERROR, 1000) << "malformed kcp datagram, len: " << len;
+      return;
+    }
+  }
+  if (codec_.enabled()) {
+    out = codec_.seal(out, outLen, &outLen);
+  } else if (checksum_.enabled()) {
+    out = checksum_.append(out, outLen, &outLen);
+  }
+  tunnelBucket_.consume(outLen, iclock64());
+  UdpChannel *channel = udpChannelFor(&addr, &addrLen);
+  channel->send((const char *)out, outLen, addr, addrLen);
 }
 
-void Server::cb_udpRead(evutil_socket_t fd, short events, void *ptr) {
-  Server *server = static_cast<Server *>(ptr);
+void Server::sendPlainDatagram(const char *buf, size_t len,
+                               const struct sockaddr *addr, socklen_t addrLen) {
+  if (capture_) {
+    capture_->record(CAPTURE_DIR_OUT, (const uint8_t *)buf, len, addr);
+  }
+  tunnelBucket_.consume(len, iclock64());
+  UdpChannel *channel = udpChannelFor(&addr, &addrLen);
+  channel->send(buf, len, addr, addrLen);
+}
 
-  // client's address
-  struct sockaddr_in sin;
-  socklen_t size = sizeof(sin);
-  ssize_t res;
-  char buf[MAX_MESSAGE_LEN];
-
-  // These calls return the number of bytes received, or -1 if an error occurred.
-  // The return value will be 0 when the peer has performed an orderly shutdown.
-  res = recvfrom(fd, &buf, sizeof(buf), 0, (struct sockaddr *)&sin, &size);
-  if (res == -1) {
-    LOG(ERROR) << "recvfrom error, return: " << res;
+UdpChannel *Server::udpChannelFor(const struct sockaddr **addr,
+                                  socklen_t *addrLen) {
+  if (peerChannel_ == nullptr ||
+      !sockaddrEqual((struct sockaddr *)&peerAddr_, *addr)) {
+    return udpChannel_;
+  }
+  // connected, no address: the kernel uses the cached route
+  *addr    = nullptr;
+  *addrLen = 0;
+  return peerChannel_;
+}
+
+void Server::setTargetAddr(const struct sockaddr *addr, socklen_t addrSize) {
+  if (sockaddrEqual((struct sockaddr *)&targetAddr_, addr)) {
     return;
   }
-  DLOG(INFO) << "udp source: " << inet_ntoa(sin.sin_addr) << ":" << ntohs(sin.sin_port);
+  memcpy(&targetAddr_, addr, addrSize);
+  targetAddrsize_ = addrSize;
+  LOG(INFO) << "reset target udp address: " << sockaddrToString(addr);
 
-  server->handleIncomingUDPMesasge(&sin, size, (uint8_t *)buf, res);
+  if (sockOpts_.udpConnected_) {
+    connectPeerChannel();
+  }
 }
 
-bool Server::recvInitKCPConvPkg(const uint8_t *p) {
-  uint32_t conv = 0u;
-  if (*(uint32_t *)p != 0u) {
-    return false;
+void Server::connectPeerChannel() {
+  //
+  // A second socket bound to the listen address and connect()ed to the
+  // client's 4-tuple. The kernel prefers a connected socket of the
+  // SO_REUSEPORT group for its peer, the listen socket keeps the hellos of
+  // new clients and a roaming client's first datagrams, which land here again.
+  //
+  const struct sockaddr *target = (struct sockaddr *)&targetAddr_;
+  int fd = socket(udpListenAddr_.ss_family, SOCK_DGRAM, 0);
+  if (fd == -1) {
+    LOG(ERROR) << "create peer udp socket failure: " << strerror(errno);
+    return;
+  }
+  int on = 1, off = 0;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+  if (udpListenAddr_.ss_family == AF_INET6 &&
+      IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *)&udpListenAddr_)->sin6_addr)) {
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+
+  if (bind(fd, (struct sockaddr *)&udpListenAddr_,
+           sockaddrLen((struct sockaddr *)&udpListenAddr_)) == -1 ||
+      connect(fd, target, targetAddrsize_) == -1) {
+    LOG(ERROR) << "connect peer udp socket to " << sockaddrToString(target)
+    << " failure: " << strerror(errno) << ", use the listen socket";
+    close(fd);
+    return;
+  }
+  setUdpSocketOptions(fd, sockOpts_);
+
+  // datagrams of others queued before connect() are read by the same callback
+  UdpChannel *channel = ioEngine_->openUdp(fd,
+                                           std::max((size_t)MAX_MESSAGE_LEN, (size_t)pmtuMax_),
+                                           cb_udpRead, this);
+  if (channel == nullptr) {
+    return;
+  }
+
+  // we may be in the read callback of the old one
+  if (peerChannel_) {
+    closedChannels_.push_back(peerChannel_);
   }
-  conv = *(uint32_t *)(p + 4);
-  if (*(uint32_t *)(p + 8) != conv + 1) {
+  peerChannel_ = channel;
+  memcpy(&peerAddr_, &targetAddr_, sizeof(peerAddr_));
+  LOG(INFO) << "connected peer udp socket: " << sockaddrToString(target);
+}
+
+void Server::freeClosedChannels() {
+  for (auto channel : closedChannels_) {
+    delete channel;  // fd will auto close
+  }
+  closedChannels_.clear();
+}
+
+int Server::sendKcpDataLowLevel(const char *buf, int len, ikcpcb *kcp) {
+  // queued, it will be sent with the others of this flush by ioEngine_->flush()
+  sendDatagram(buf, (size_t)len,
+               (struct sockaddr *)&targetAddr_, targetAddrsize_);
+  return len;
+}
+
+void Server::cb_udpRead(const uint8_t *data, size_t len,
+                        const struct sockaddr *addr, socklen_t addrLen,
+                        void *ptr) {
+  Server *server = static_cast<Server *>(ptr);
+
+  // client's address
+  server->handleIncomingUDPMesasge(addr, addrLen, data, len);
+}
+
+bool Server::recvInitKCPConvPkg(const uint8_t *p, size_t len,
+                                const struct sockaddr *addr,
+                                socklen_t addrSize) {
+  Hello hello;
+  memset(&hello, 0, sizeof(hello));
+  const bool isLegacy = (len == LEGACY_HELLO_LEN);
+
+  if ((len != LEGACY_HELLO_LEN && len != HELLO_LEN) ||
+      *(uint32_t *)p != 0u || *(uint32_t *)(p + 8) != *(uint32_t *)(p + 4) + 1) {
     return false;
   }
 
-  if (kcpConv_ != conv) {
-    LOG(INFO) << "receive new KCP conv: " << conv;
-    kcpConv_ = conv;
+  if (isLegacy) {
+    if (!tunnelKey_.empty()) {
+      LOG_EVERY_MS(WARNING, 1000) << "reject init kcp conv pkg without "
+      << "tunnel_key from: " << sockaddrToString(addr);
+      return true;
+    }
+    hello.conv_ = *(uint32_t *)(p + 4);
+  }
+  else if (!tunnelKey_.parseHello(p, len, nullptr, &hello)) {
+    LOG_EVERY_MS(WARNING, 1000) << "hello authentication failure from: "
+    << sockaddrToString(addr) << ", tunnel_key mismatch?";
+    return true;
+  }
+
+  // a keyed hello is authentic but could be a captured one sent again
+  const bool keyed = !isLegacy && !tunnelKey_.empty();
+  if (keyed) {
+    const int64_t skew = (int64_t)(hello.time_ - (uint64_t)iclock64());
+    if (skew > HELLO_MAX_SKEW || skew < -HELLO_MAX_SKEW) {
+      LOG_EVERY_MS(WARNING, 1000) << "drop hello off our clock by "
+      << skew << "ms from: " << sockaddrToString(addr)
+      << ", replayed or clocks out of sync?";
+      return true;
+    }
+  }
+
+  const bool isNewConv = (kcpConv_ != hello.conv_ ||
+                          memcmp(clientRandom_, hello.random_,
+                                 HELLO_RANDOM_LEN) != 0);
+  if (isNewConv && keyed && hello.time_ <= helloTime_) {
+    LOG_EVERY_MS(WARNING, 1000) << "drop replayed hello of an old conv: "
+    << hello.conv_ << " from: " << sockaddrToString(addr);
+    return true;
+  }
+
+  if (isNewConv) {
+    int cipher = AEAD_NONE;
+    if (!tunnelKey_.empty()) {
+      cipher = aeadSelect(tunnelCipher_, hello.features_);
+      if (cipher == AEAD_NONE) {
+        LOG_EVERY_MS(ERROR, 1000) << "no common cipher with: "
+        << sockaddrToString(addr) << ", offered features: " << hello.features_;
+        return true;
+      }
+    }
+    // the tag of a cipher covers it already
+    const bool checksum = (cipher == AEAD_NONE && checksumAllowed_ &&
+                           (hello.features_ & TUNNEL_FEATURE_CRC32C));
+    const bool compact = (compactAllowed_ &&
+                          (hello.features_ & TUNNEL_FEATURE_COMPACT_HEADER));
+    LOG(INFO) << "receive new KCP conv: " << hello.conv_
+    << ", cipher: " << aeadCipherName(cipher)
+    << ", checksum: " << (checksum ? "crc32c" : "off")
+    << ", compact header: " << (compact ? "on" : "off")
+    << ", stream routes: "
+    << ((hello.features_ & TUNNEL_FEATURE_STREAM_ROUTES) ? "on" : "off")
+    << ", open status: "
+    << ((hello.features_ & TUNNEL_FEATURE_OPEN_STATUS) ? "on" : "off")
+    << ", datagram ping: "
+    << ((hello.features_ & TUNNEL_FEATURE_DATAGRAM_PING) ? "on" : "off")
+    << ", notify delta: "
+    << ((notifyDeltaAllowed_ &&
+         (hello.features_ & TUNNEL_FEATURE_NOTIFY_DELTA)) ? "on" : "off");
+
+    kcpConv_ = hello.conv_;
+    memcpy(clientRandom_, hello.random_, HELLO_RANDOM_LEN);
+    helloTime_ = hello.time_;
+    randomBytes(serverRandom_, HELLO_RANDOM_LEN);
+    isLegacyHello_ = isLegacy;
     resetKCP();
+
+    codec_.clear();
+    checksum_.setEnabled(checksum);
+    compact_.setEnabled(compact);
+    helloFeatures_ = (checksum ? TUNNEL_FEATURE_CRC32C : 0) |
+                     (compact ? TUNNEL_FEATURE_COMPACT_HEADER : 0) |
+                     (hello.features_ & (TUNNEL_FEATURE_STREAM_ROUTES |
+                                         TUNNEL_FEATURE_OPEN_STATUS |
+                                         TUNNEL_FEATURE_DATAGRAM_PING)) |
+                     ((notifyDeltaAllowed_ &&
+                       (hello.features_ & TUNNEL_FEATURE_NOTIFY_DELTA)) ?
+                      TUNNEL_FEATURE_NOTIFY_DELTA : 0);
+    // with deltas an acked notify pins the earlier ones of its stream, they
+    // go out even if stale, but the next notify can be a delta sooner
+    kcp_->tag_pin = (helloFeatures_ & TUNNEL_FEATURE_NOTIFY_DELTA) ? 1 : 0;
+    if (cipher != AEAD_NONE) {
+      if (!tunnelKey_.setSessionKeys(&codec_, cipher, false /* server */,
+                                     clientRandom_, serverRandom_, kcpConv_)) {
+        return true;
+      }
+      helloFeatures_ |= aeadOfferedFeatures(cipher);
+    }
+    applyKcpMtu();
   } else {
-    LOG(INFO) << "receive same KCP conv: " << conv;
+    LOG(INFO) << "receive same KCP conv: " << hello.conv_;
+  }
+
+  // a resent hello of the current conv may be a copy from anyone, it's
+  // answered to the address we have, which moves only with a sealed datagram
+  if (isNewConv || !keyed) {
+    setTargetAddr(addr, addrSize);
   }
 
   sendBackInitKCPConvPkg();
@@ -584,17 +1566,252 @@ bool Server::recvInitKCPConvPkg(const uint8_t *p) {
 void Server::sendBackInitKCPConvPkg() {
   // send init kcp conv pkg
   string msg;
-  msg.resize(12);
+  if (isLegacyHello_) {
+    msg.resize(LEGACY_HELLO_LEN);
+
+    uint8_t *p = (uint8_t *)msg.data();
+    *(uint32_t *)p = 0u;
+    p += 4;
+    *(uint32_t *)p = kcpConv_;
+    p += 4;
+    *(uint32_t *)p = kcpConv_ + 1;
+  } else {
+    Hello hello;
+    hello.conv_     = kcpConv_;
+    hello.features_ = helloFeatures_;
+    memcpy(hello.random_, serverRandom_, HELLO_RANDOM_LEN);
+    hello.time_     = (uint64_t)iclock64();
+    msg = tunnelKey_.makeHello(hello, clientRandom_);
+  }
+
+  sendPlainDatagram(msg.data(), msg.size(),
+                    (struct sockaddr *)&targetAddr_, targetAddrsize_);
+  ioEngine_->flush();
+}
+
+void Server::applyKcpMtu() {
+  // pmtu_ is the datagram size, the seal overhead is outside of kcp
+  ikcp_setmtu(kcp_, (pmtu_ ? pmtu_ : KCP_MTU_DEFAULT) - datagramOverhead());
+}
+
+void Server::handleCtrlDatagram(const int type,
+                                const uint8_t *data, size_t len) {
+  if (type == KCP_CTRL_TYPE_PMTU_PROBE) {
+    //
+    // KCP_CTRL_TYPE_PMTU_PROBE
+    // | 0u(4) | magic(4) | 0x01 | id(4) | size(2) | padding |
+    //
+    // echo it as it is, the padding probes the way back too. one above our
+    // pmtu_max is not, the client's search stays within what we take
+    if (len + datagramOverhead() > pmtuMax_)
+      return;
+    sendDatagram((const char *)data, len,
+                 (struct sockaddr *)&targetAddr_, targetAddrsize_);
+    ioEngine_->flush();
+  }
+  else if (type == KCP_CTRL_TYPE_PMTU_SET) {
+    //
+    // KCP_CTRL_TYPE_PMTU_SET
+    // | 0u(4) | magic(4) | 0x02 | mtu(2) |
+    //
+    if (len < KCP_CTRL_HEADER_LEN + 2)
+      return;
+    uint16_t mtu = *(uint16_t *)(data + KCP_CTRL_HEADER_LEN);
+    if (mtu < PMTU_MIN) {
+      LOG_EVERY_MS(ERROR, 1000) << "invalid path mtu: " << mtu;
+      return;
+    }
+    // a client with a larger pmtu_max, it takes the value of the ack
+    mtu = std::min(mtu, pmtuMax_);
+
+    if (mtu != pmtu_) {
+      LOG(INFO) << "path mtu: " << mtu << ", was: " << pmtu_;
+      pmtu_ = mtu;
+      applyKcpMtu();
+    }
+
+    // ack, with the mtu we applied
+    string ack((const char *)data, len);
+    *(uint16_t *)(&ack[0] + KCP_CTRL_HEADER_LEN) = mtu;
+    sendDatagram(ack.data(), ack.size(),
+                 (struct sockaddr *)&targetAddr_, targetAddrsize_);
+    ioEngine_->flush();
+  }
+  else if (type == KCP_CTRL_TYPE_PING) {
+    //
+    // KCP_CTRL_TYPE_PING, the keepalive of the client: answer at once, the
+    // pong is never queued behind kcp
+    //
+    if (!parsePing(data, len, &clientSrtt_))
+      return;
+    pingTime_ = iclock64();
+
+    const string pong = makePong(data, udpSent_, udpRecv_, pingTime_);
+    sendDatagram(pong.data(), pong.size(),
+                 (struct sockaddr *)&targetAddr_, targetAddrsize_);
+    ioEngine_->flush();
+  }
+  else {
+    LOG_EVERY_MS(ERROR, 1000) << "unknown control datagram type: " << type;
+  }
+}
+
+void Server::cb_dumpCapture(evutil_socket_t fd, short events, void *ptr) {
+  static_cast<Server *>(ptr)->dumpCapture("");
+}
+
+bool Server::dumpCapture(const string &path) {
+  if (capture_ == nullptr)
+    return false;
+
+  string file = path;
+  if (file.empty()) {
+    file = capturePath_ + "-" + std::to_string(time(nullptr)) + ".pcapng";
+  }
+
+  struct sockaddr_storage local;
+  socklen_t localLen = sizeof(local);
+  memset(&local, 0, sizeof(local));
+  getsockname(udpSockFd_, (struct sockaddr *)&local, &localLen);
+
+  return capture_->dump(file, (struct sockaddr *)&local);
+}
+
+bool Server::cb_control(const vector<string> &args, string *out, void *ptr) {
+  return static_cast<Server *>(ptr)->handleControlCommand(args, out);
+}
+
+bool Server::handleControlCommand(const vector<string> &args, string *out) {
+  const string &cmd = args[0];
+
+  if (cmd == "help") {
+    *out = "streams                       list streams with stats\n"
+           "kcp                           dump kcp state\n"
+           "upstreams                     list upstream endpoints\n"
+           "close <connIdx>               close a stream\n"
+           "prio <connIdx> <high|normal|low>  set stream priority\n"
+           "flush                         flush kcp now\n"
+           "reload                        reload config\n"
+           "capture [file]                dump the packet capture ring\n";
+    return true;
+  }
+
+  if (cmd == "streams") {
+    const IINT64 now = iclock64();
+    char line[256];
+    snprintf(line, sizeof(line), "%-7s %-5s %-46s %-6s %8s %12s %12s %8s %8s %s\n",
+             "connIdx", "route", "upstream", "prio", "age_s", "recv", "sent",
+             "in_q", "out_q", "paused");
+    *out = line;
+    for (auto conn : conns_) {
+      const ServerTCPSession *s = conn.second;
+      snprintf(line, sizeof(line),
+               "%-7u %-5u %-46s %-6s %8lld %12llu %12llu %8zu %8zu %d\n",
+               s->connIdx_, s->route_, sockaddrToString((struct sockaddr *)&s->upstreamAddr_).c_str(), streamPrioName(s->prio_),
+               (long long)(now - s->connectStartTime_) / 1000,
+               (unsigned long long)s->recvBytes_,
+               (unsigned long long)s->sentBytes_,
+               s->inputQueued(), s->outputQueued(), s->readPaused_ ? 1 : 0);
+      *out += line;
+    }
+    return true;
+  }
+
+  if (cmd == "upstreams") {
+    const IINT64 now = iclock64();
+    char line[256];
+    snprintf(line, sizeof(line), "%-5s %-40s %-8s %6s %7s %10s %8s %8s\n",
+             "route", "endpoint", "state", "active", "rtt_ms", "picks",
+             "conn_err", "chk_err");
+    *out = line;
+    for (auto pool : pools_) {
+      *out += pool.second->stats(now);
+    }
+    return true;
+  }
+
+  if (cmd == "kcp") {
+    *out = dumpKcpState(kcp_);
+    *out += "tunnel tokens: " + std::to_string(tunnelBucket_.tokens()) +
+            " (" + rateLimits_.tunnel_.toString() + ")\n";
+    *out += "crypto: " + (codec_.enabled() ? codec_.stats() : "off") + "\n";
+    *out += "checksum: " + (checksum_.enabled() ?
+            string(crc32cHardware() ? "crc32c (sse4.2)" : "crc32c (table)") +
+            ", failures: " + std::to_string(checksum_.failures_) : "off") + "\n";
+    *out += "compact header: " +
+            (compact_.enabled() ? compact_.stats() : "off") + "\n";
+    *out += "backpressure: " + std::to_string(backpressureLevel_) +
+            ", streams: " + std::to_string(conns_.size()) +
+            ", retired: " + std::to_string(retired_.size()) + "\n";
+    *out += "supersede notify: " + (supersedeNotify_ ?
+            "tagged: " + std::to_string(notifyTagged_) +
+            ", dropped: " + std::to_string(notifyDropped_) +
+            ", emptied: " + std::to_string(notifyRefilled_) : string("off")) + "\n";
+    *out += "notify delta: " + ((helloFeatures_ & TUNNEL_FEATURE_NOTIFY_DELTA) ?
+            notifyDelta_.stats() : string("off")) + "\n";
+    *out += "udp datagrams, sent: " + std::to_string(udpSent_) +
+            ", recv: " + std::to_string(udpRecv_) + "\n";
+    *out += "ping: " + (pingTime_ ? "last " +
+            std::to_string(iclock64() - pingTime_) + " ms ago, client srtt: " +
+            std::to_string(clientSrtt_) + " ms" : string("none")) + "\n";
+    *out += "udp peer socket: " + (peerChannel_ ?
+            "connected to " + sockaddrToString((struct sockaddr *)&peerAddr_) :
+            string(sockOpts_.udpConnected_ ? "none" : "off")) + "\n";
+    return true;
+  }
 
-  uint8_t *p = (uint8_t *)msg.data();
-  *(uint32_t *)p = 0u;
-  p += 4;
-  *(uint32_t *)p = kcpConv_;
-  p += 4;
-  *(uint32_t *)p = kcpConv_ + 1;
+  if (cmd == "close" || cmd == "prio") {
+    if (args.size() < 2) {
+      *out = "missing connIdx";
+      return false;
+    }
+    auto itr = conns_.find((uint16_t)strtoul(args[1].c_str(), nullptr, 10));
+    if (itr == conns_.end()) {
+      *out = "no such stream: " + args[1];
+      return false;
+    }
+    ServerTCPSession *session = itr->second;
+
+    if (cmd == "close") {
+      removeUpConnection(session, true);
+      return true;
+    }
+
+    int prio;
+    if (args.size() < 3 || !parseStreamPrio(args[2], &prio)) {
+      *out = "prio should be one of: high, normal, low";
+      return false;
+    }
+    session->prio_ = prio;
+    session->setReadPaused(isStreamPaused(prio, backpressureLevel_));
+    return true;
+  }
+
+  if (cmd == "flush") {
+    ikcp_flush(kcp_);
+    ioEngine_->flush();
+    return true;
+  }
+
+  if (cmd == "reload") {
+    reloadConfig();
+    return true;
+  }
+
+  if (cmd == "capture") {
+    if (capture_ == nullptr) {
+      *out = "packet capture is off, see capture_packets";
+      return false;
+    }
+    if (!dumpCapture(args.size() > 1 ? args[1] : "")) {
+      *out = "dump failure, see the log";
+      return false;
+    }
+    return true;
+  }
 
-  sendto(udpSockFd_, msg.data(), msg.size(), MSG_DONTWAIT,
-         (struct sockaddr *)&targetAddr_, sizeof(targetAddr_));
+  *out = "unknown command: " + cmd + ", try help";
+  return false;
 }
 
 void Server::cb_tcpRead(struct bufferevent *bev, void *ptr) {
@@ -606,9 +1823,32 @@ void Server::cb_tcpEvent(struct bufferevent *bev, short events, void *ptr) {
   Server *server = session->server_;
 
   if (events & BEV_EVENT_CONNECTED) {
+    session->connected_ = true;
+    server->updateUpstreamRtt((struct sockaddr *)&session->upstreamAddr_,
+                              iclock64() - session->connectStartTime_);
+    server->upstreamConnectDone(session, true);
+    if (session->openStatus_) {
+      server->sendKcpOpenOkMsg(session->connIdx_,
+                               iclock64() - session->connectStartTime_);
+    }
     return;
   }
 
+  if (!session->connected_) {
+    // connect failure, push this address to the back for a while
+    const IINT64 kConnectFailurePenalty = 10000;  // ms
+    server->updateUpstreamRtt((struct sockaddr *)&session->upstreamAddr_,
+                              kConnectFailurePenalty);
+    // and count it against the endpoint, it may get ejected
+    server->upstreamConnectDone(session, false);
+
+    if (session->openStatus_) {
+      server->failUpConnection(session, (events & BEV_EVENT_TIMEOUT) ?
+                               OPEN_FAIL_TIMEOUT : OPEN_FAIL_CONNECT);
+      return;
+    }
+  }
+
   if (events & BEV_EVENT_EOF) {
     LOG(INFO) << "tcp upsession closed";
   }
@@ -26,12 +26,29 @@
 
 #include "Common.h"
 
+#include <set>
+
 #include <event2/event.h>
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
 #include <event2/listener.h>
 
 #include "ikcp.h"
+#include "IoEngine.h"
+#include "SocketOptions.h"
+#include "Config.h"
+#include "KcpParams.h"
+#include "RateLimit.h"
+#include "TimerWheel.h"
+#include "ControlServer.h"
+#include "PacketCapture.h"
+#include "TunnelCrypto.h"
+#include "Crc32c.h"
+#include "KcpCompact.h"
+#include "Routes.h"
+#include "UpstreamPool.h"
+#include "TunnelPing.h"
+#include "NotifyDelta.h"
 
 
 class ServerTCPSession;
@@ -45,16 +62,60 @@ class ServerTCPSession {
 public:
   Server *server_;
   uint16_t connIdx_;  // connection index
+  uint16_t route_;
+
+  // upstream address and when the connect was launched
+  string upstreamName_;  // endpoint of the route's pool
+  struct sockaddr_storage upstreamAddr_;
+  IINT64 connectStartTime_;
+  bool   connected_;
+  bool   openStatus_;  // answer the open once connected
+
+  // for the control socket
+  uint64_t recvBytes_;  // read from tcp
+  uint64_t sentBytes_;  // written to tcp
+  int      prio_;
+  bool     readPaused_;
+  bool     atLineStart_;  // the last read ended a line
+  string   lastNotify_;   // reference of the next notify delta
+
+  // idle timeouts: stamped on activity, checked lazily on the Server's wheel
+  TimerWheelNode idleNode_;
+  IINT64 lastReadTime_;
+  IINT64 lastWriteTime_;  // last write progress, or when output got pending
 
 public:
-  ServerTCPSession(const uint16_t connIdx, struct event_base *base, Server *server);
+  ServerTCPSession(const uint16_t connIdx, const uint16_t route,
+                   struct event_base *base, Server *server);
   ~ServerTCPSession();
 
-  bool connect(struct sockaddr_in &sin);
-  void setTimeout(const int32_t readTimeout, const int32_t writeTimeout);
+  bool connect(const struct sockaddr *addr, socklen_t addrLen);
+  // off its conv: stop reading, write out what's queued for the upstream
+  // within `timeout` seconds, then Server::cb_retired* free it.
+  // false: nothing queued, free it now
+  bool retire(const int32_t timeout);
+  void setReadPaused(const bool paused);
+  void setRateLimit(struct ev_token_bucket_cfg *cfg,
+                    struct bufferevent_rate_limit_group *group);
+  size_t inputQueued() const;
+  size_t outputQueued() const;
+
+  //
+  // the earliest time a timeout can fire: the deadline of a running one
+  // (`*what`: BEV_EVENT_READING or BEV_EVENT_WRITING), or now + the timeout
+  // of one that isn't running (`*what`: 0), it may start any time.
+  // the connect timeout (ms) runs until connected, as a write timeout.
+  // 0: no timeouts.
+  //
+  IINT64 idleDeadline(const int32_t readTimeout, const int32_t writeTimeout,
+                      const int32_t connectTimeout,
+                      const IINT64 now, short *what) const;
 
   void recvData(struct evbuffer *buf);
   void sendData(const char *data, size_t len);
+
+  static void cb_output(struct evbuffer *buf,
+                        const struct evbuffer_cb_info *info, void *ptr);
 };
 
 
@@ -67,39 +128,178 @@ class Server {
   struct event_base *base_;
   struct event *exitEvTimer_;     // deley to stop server when exit
   struct event *kcpUpdateTimer_;  // call ikcp_update() interval
+  struct event *reloadEvent_;     // SIGHUP
+  struct event *captureEvent_;    // SIGUSR1: dump the capture ring
+
+  // the loaded config, SIGHUP reloads it
+  Config config_;
+
+  // runtime control
+  string controlPath_;
+  ControlServer *control_;
+
+  // the last udp datagrams, nullptr: off
+  PacketCapture *capture_;
+  size_t   captureMaxPackets_;
+  uint16_t captureSnaplen_;
+  string   capturePath_;  // prefix of the dump files
+
+  bool dumpCapture(const string &path);
+
+  // io backend
+  string      ioEngineName_;
+  IoEngine   *ioEngine_;
+
+  // socket tuning
+  SocketOptions sockOpts_;
 
   // listen udp
   string   udpIP_;
   uint16_t udpPort_;
   int      udpSockFd_;
-  struct event *udpReadEvent_;
+  UdpChannel *udpChannel_;
+  struct sockaddr_storage udpListenAddr_;
+
+  // udp_connected: a socket connect()ed to targetAddr_, shares the port with
+  // the listen one (SO_REUSEPORT), the kernel gives it the peer's datagrams
+  UdpChannel *peerChannel_;
+  struct sockaddr_storage peerAddr_;
+  vector<UdpChannel *> closedChannels_;  // freed by the next kcp update
+  void connectPeerChannel();
+  void freeClosedChannels();
+  UdpChannel *udpChannelFor(const struct sockaddr **addr, socklen_t *addrLen);
+
+  // path mtu, the client probes it and tells us the result
+  uint16_t pmtuMax_;  // the largest datagram we accept (udp recv buffer size)
+  uint16_t pmtu_;     // current kcp mtu, 0: kcp's default
 
   // KDP connection
+  KcpParams kcpParams_;
   uint32_t kcpConv_;
   struct evbuffer *kcpInBuf_;
 
+  // encryption, keyed by the hello of each new conv when tunnel_key is set
+  TunnelKey tunnelKey_;
+  int       tunnelCipher_;  // configured, AEAD_AUTO: by our cpu
+  uint8_t   clientRandom_[HELLO_RANDOM_LEN];
+  uint8_t   serverRandom_[HELLO_RANDOM_LEN];
+  uint32_t  helloFeatures_;  // answered
+  uint64_t  helloTime_;      // of the hello that set up this conv
+  bool      isLegacyHello_;  // the client sent the old 12 bytes pkg
+  AeadCodec codec_;
+
+  // crc32c trailer, when the client offers it and there is no cipher
+  bool checksumAllowed_;
+  DatagramChecksum checksum_;
+  size_t datagramOverhead() const {
+    return codec_.overhead() + checksum_.overhead();
+  }
+
+  // compact kcp headers, when the client offers them
+  bool compactAllowed_;
+  KcpCompactCodec compact_;
+
+  // stream_supersede_notify: each mining.notify line is a kcp message
+  // tagged with its stream, one with clean_jobs cancels the older ones still
+  // in kcp (ikcp_supersede). the unacked ones are resent as empty messages.
+  bool supersedeNotify_;
+  uint64_t notifyTagged_;
+  uint64_t notifyDropped_;   // never sent
+  uint64_t notifyRefilled_;  // unacked, emptied
+  void sendStreamData(ServerTCPSession *session, const char *data, size_t len,
+                      const uint32_t tag);
+  void supersedeNotify(ServerTCPSession *session);
+
+  // notify lines as deltas of the previous one, when the client offers it
+  bool notifyDeltaAllowed_;
+  NotifyDelta notifyDelta_;
+  void sendNotifyDelta(ServerTCPSession *session, const char *line, size_t len,
+                       const uint32_t tag);
+
   // idx -> conn
   map<uint16_t, ServerTCPSession *> conns_;
 
+  // sessions of a replaced conv, flushing their output to the upstream
+  std::set<ServerTCPSession *> retired_;
+  void retireUpConnection(ServerTCPSession *session);
+
+  // bandwidth shaping
+  RateLimits rateLimits_;
+  struct ev_token_bucket_cfg *streamRateCfg_;  // shared by all sessions
+  struct bufferevent_rate_limit_group *upstreamRateGroup_;
+  TokenBucket tunnelBucket_;  // udp bytes sent
+  void applyRateLimits();
+
+  // current backpressure level of kcp's send queue
+  int backpressureLevel_;
+  void checkBackpressure();
+
+  bool handleControlCommand(const vector<string> &args, string *out);
+
+  // route 0
   string   tcpUpstreamHost_;
   uint16_t tcpUpstreamPort_;
+  int      tcpUpstreamFamily_;
+
+  // tcp_routes, route -> endpoints
+  RouteTable routes_;
+
+  // route -> its endpoints, route 0 has upstream_tcp_host/port first
+  map<uint16_t, UpstreamPool *> pools_;
+  UpstreamPoolParams poolParams_;
+  void applyRoutes();
+  void upstreamConnectDone(ServerTCPSession *session, const bool ok);
+
+  // upstream address -> connect rtt (ms, EWMA), for ADDR_FAMILY_FASTEST
+  map<string, IINT64> upstreamConnectRtt_;
 
   // timeout
   int32_t  tcpReadTimeout_;
   int32_t  tcpWriteTimeout_;
+  TimerWheel idleWheel_;     // idle timeouts of all sessions
+  struct event *idleTimer_;  // ticks idleWheel_
+  void checkIdleTimeout(ServerTCPSession *session, const IINT64 now);
+
+  // udp datagrams of the tunnel, for the client's loss of each direction
+  uint32_t udpSent_;
+  uint32_t udpRecv_;
+  // the client's pings, see TunnelPing.h
+  IINT64   pingTime_;    // the last one, 0: none
+  uint16_t clientSrtt_;  // ms, as the client measures it
 
   // target addr
-  struct sockaddr_in targetAddr_;
+  struct sockaddr_storage targetAddr_;
   socklen_t targetAddrsize_;
+  void setTargetAddr(const struct sockaddr *addr, socklen_t addrSize);
 
   bool readKcpMsg();
-  void sendKcpMsg(const string &msg);
+  void sendKcpMsg(const string &msg, const uint32_t tag = 0);
   void sendKcpCloseMsg(const uint16_t connIdx);
 
   void handleKcpMsg(const uint16_t connIdx, const char *data, size_t len);
   void handleKcpMsg_closeConn(const string &msg);
+  void handleKcpMsg_openConn(const string &msg);
+
+  // nullptr: unknown route or the connect failed, `*failReason`:
+  // OPEN_FAIL_*. `early`: the first data of the stream
+  ServerTCPSession *openUpConnection(const uint16_t connIdx,
+                                     const uint16_t route,
+                                     const string &early, int *failReason);
+
+  // TUNNEL_FEATURE_OPEN_STATUS: conns whose open failed, their data is
+  // dropped until the client opens or closes them
+  std::set<uint16_t> failedOpens_;
+  void sendKcpOpenOkMsg(const uint16_t connIdx, const IINT64 connectMs);
+  void sendKcpOpenFailMsg(const uint16_t connIdx, const int reason);
 
   void sendBackInitKCPConvPkg();
+  void applyKcpMtu();
+  void handleCtrlDatagram(const int type, const uint8_t *data, size_t len);
+
+  // the address of the endpoint picked from the route's pool, counted open
+  // until the session is removed
+  bool pickUpstreamAddr(const uint16_t route, struct sockaddr_storage *addr,
+                        string *name);
 
 public:
   ikcpcb *kcp_;
@@ -110,34 +310,86 @@ public:
          const int32_t tcpReadTimeout, const int32_t tcpWriteTimeout);
   ~Server();
 
+  void setIoEngine(const string &name) { ioEngineName_ = name; }
+  void setSocketOptions(const SocketOptions &opts) { sockOpts_ = opts; }
+  const SocketOptions &socketOptions() const { return sockOpts_; }
+  void setConfig(const Config &conf) { config_ = conf; }
+  void setControlSocket(const string &path) { controlPath_ = path; }
+  void setCapture(const size_t maxPackets, const uint16_t snaplen,
+                  const string &path) {
+    captureMaxPackets_ = maxPackets;
+    captureSnaplen_    = snaplen;
+    capturePath_       = path;
+  }
+  void setRateLimits(const RateLimits &limits) { rateLimits_ = limits; }
+  void setTunnelKey(const string &psk, const int cipher) {
+    tunnelKey_    = TunnelKey(psk);
+    tunnelCipher_ = cipher;
+  }
+  void setUdpChecksum(const bool enabled) { checksumAllowed_ = enabled; }
+  void setCompactHeader(const bool enabled) { compactAllowed_ = enabled; }
+  void setSupersedeNotify(const bool enabled) { supersedeNotify_ = enabled; }
+  void setNotifyDelta(const bool enabled) { notifyDeltaAllowed_ = enabled; }
+  void setKcpParams(const KcpParams &params) {
+    kcpParams_ = params;
+    kcpParams_.apply(kcp_);
+  }
+  void setUpstreamFamily(const int family) { tcpUpstreamFamily_ = family; }
+  void setRoutes(const RouteTable &routes) { routes_ = routes; }
+  void setUpstreamPoolParams(const UpstreamPoolParams &params) {
+    poolParams_ = params;
+  }
+  void setPmtuMax(const uint16_t pmtuMax) { pmtuMax_ = pmtuMax; }
+
   bool setup();
   void run();
   void stop();
   void exitLoop();
 
   void resetKCP();
-  bool recvInitKCPConvPkg(const uint8_t *p);
+  bool recvInitKCPConvPkg(const uint8_t *p, size_t len,
+                          const struct sockaddr *addr, socklen_t addrSize);
 
   void kcpUpdateManually();
+  void reloadConfig();
 
   void removeUpConnection(ServerTCPSession *session, bool isNeedSendCloseMsg);
+  // the upstream connect of an answered open failed, OPEN_FAIL_*
+  void failUpConnection(ServerTCPSession *session, const int reason);
+  void updateUpstreamRtt(const struct sockaddr *addr, IINT64 rtt);
 
-  void handleIncomingUDPMesasge(struct sockaddr_in *sin, socklen_t addrSize,
-                                uint8_t *inData, size_t inDataSize);
+  void handleIncomingUDPMesasge(const struct sockaddr *addr, socklen_t addrSize,
+                                const uint8_t *inData, size_t inDataSize);
   void handleIncomingTCPMesasge(ServerTCPSession *session, string &msg);
 
   int sendKcpDataLowLevel(const char *buf, int len, ikcpcb *kcp);
+  void sendDatagram(const char *buf, size_t len,
+                    const struct sockaddr *addr, socklen_t addrLen);
+  void sendPlainDatagram(const char *buf, size_t len,
+                         const struct sockaddr *addr, socklen_t addrLen);
 
   static int  cb_kcpOutput(const char *buf, int len, ikcpcb *kcp, void *ptr);
-  static void cb_udpRead  (evutil_socket_t fd, short events, void *ptr);
+  static void cb_udpRead  (const uint8_t *data, size_t len,
+                           const struct sockaddr *addr, socklen_t addrLen,
+                           void *ptr);
   static void cb_tcpRead  (struct bufferevent *bev, void *ptr);
   static void cb_tcpEvent (struct bufferevent *bev,
                            short events, void *ptr);
+  static void cb_retiredWrite(struct bufferevent *bev, void *ptr);
+  static void cb_retiredEvent(struct bufferevent *bev,
+                              short events, void *ptr);
 
   static void cb_exitLoop(evutil_socket_t fd,
                           short events, void *ptr);
   static void cb_kcpUpdate(evutil_socket_t fd,
                            short events, void *ptr);
+  static void cb_reload(evutil_socket_t fd,
+                        short events, void *ptr);
+  static void cb_idleTick(evutil_socket_t fd, short events, void *ptr);
+  static void cb_idleTimeout(TimerWheelNode *node, void *ptr);
+  static bool cb_control(const vector<string> &args, string *out, void *ptr);
+  static void cb_dumpCapture(evutil_socket_t fd,
+                             short events, void *ptr);
 };
 
 #endif
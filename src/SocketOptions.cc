@@ -0,0 +1,170 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "SocketOptions.h"
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+SocketOptions::SocketOptions():
+udpRcvBuf_(0), udpSndBuf_(0), udpBusyPoll_(0), udpDscp_(-1), udpPmtuDisc_(-1),
+udpConnected_(false), tcpNoDelay_(true), tcpQuickAck_(false)
+{
+}
+
+const ConfigField kSocketOptionsSchema[] = {
+  {"udp_rcvbuf",        CONF_INT,  0, "0",  0, INT32_MAX, nullptr},
+  {"udp_sndbuf",        CONF_INT,  0, "0",  0, INT32_MAX, nullptr},
+  {"udp_busy_poll",     CONF_INT,  0, "0",  0, INT32_MAX, nullptr},
+  {"udp_dscp",          CONF_INT,  0, "-1", -1, 63,       nullptr},
+  {"udp_pmtu_discover", CONF_ENUM, 0, "\"default\"", 0, 0,
+    "default|dont|want|do|probe"},
+  {"udp_connected",     CONF_BOOL, 0, "false", 0, 0, nullptr},
+  {"tcp_nodelay",       CONF_BOOL, 0, "true",  0, 0, nullptr},
+  {"tcp_quickack",      CONF_BOOL, 0, "false", 0, 0, nullptr},
+  {nullptr}
+};
+
+void SocketOptions::load(const Config &conf) {
+  udpRcvBuf_   = (int)conf.getInt("udp_rcvbuf");
+  udpSndBuf_   = (int)conf.getInt("udp_sndbuf");
+  udpBusyPoll_ = (int)conf.getInt("udp_busy_poll");
+  udpDscp_     = (int)conf.getInt("udp_dscp");
+
+  const string &pmtu = conf.getStr("udp_pmtu_discover");
+  if      (pmtu == "dont")  udpPmtuDisc_ = IP_PMTUDISC_DONT;
+  else if (pmtu == "want")  udpPmtuDisc_ = IP_PMTUDISC_WANT;
+  else if (pmtu == "do")    udpPmtuDisc_ = IP_PMTUDISC_DO;
+  else if (pmtu == "probe") udpPmtuDisc_ = IP_PMTUDISC_PROBE;
+  else                      udpPmtuDisc_ = -1;
+
+  udpConnected_ = conf.getBool("udp_connected");
+
+  tcpNoDelay_  = conf.getBool("tcp_nodelay");
+  tcpQuickAck_ = conf.getBool("tcp_quickack");
+}
+
+void SocketOptions::log() const {
+  LOG(INFO) << "udp connected socket: " << udpConnected_
+  << ", tcp socket options, nodelay: " << tcpNoDelay_
+  << ", quickack: " << tcpQuickAck_;
+}
+
+static void setBufSize(int fd, int forceOpt, int opt, int size,
+                       const char *name) {
+  if (size <= 0)
+    return;
+
+  // *FORCE ignores rmem_max/wmem_max, needs CAP_NET_ADMIN
+  if (setsockopt(fd, SOL_SOCKET, forceOpt, &size, sizeof(size)) == 0)
+    return;
+
+  if (setsockopt(fd, SOL_SOCKET, opt, &size, sizeof(size)) == -1) {
+    LOG(ERROR) << "set " << name << " failure: " << strerror(errno);
+  }
+}
+
+static int getIntOpt(int fd, int level, int opt) {
+  int v = -1;
+  socklen_t len = sizeof(v);
+  if (getsockopt(fd, level, opt, &v, &len) == -1)
+    return -1;
+  return v;
+}
+
+void setUdpSocketOptions(int fd, const SocketOptions &opts) {
+  struct sockaddr_storage ss;
+  socklen_t ssLen = sizeof(ss);
+  int family = AF_INET;
+  if (getsockname(fd, (struct sockaddr *)&ss, &ssLen) == 0)
+    family = ss.ss_family;
+
+  setBufSize(fd, SO_RCVBUFFORCE, SO_RCVBUF, opts.udpRcvBuf_, "SO_RCVBUF");
+  setBufSize(fd, SO_SNDBUFFORCE, SO_SNDBUF, opts.udpSndBuf_, "SO_SNDBUF");
+
+  if (opts.udpBusyPoll_ > 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+                   &opts.udpBusyPoll_, sizeof(opts.udpBusyPoll_)) == -1) {
+      LOG(ERROR) << "set SO_BUSY_POLL failure: " << strerror(errno);
+    }
+  }
+
+  if (opts.udpDscp_ >= 0) {
+    int tos = opts.udpDscp_ << 2;
+    // a dual-stack v6 socket sends v4 packets too, set both
+    if (setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) == -1 &&
+        family == AF_INET) {
+      LOG(ERROR) << "set IP_TOS failure: " << strerror(errno);
+    }
+    if (family == AF_INET6 &&
+        setsockopt(fd, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos)) == -1) {
+      LOG(ERROR) << "set IPV6_TCLASS failure: " << strerror(errno);
+    }
+  }
+
+  if (opts.udpPmtuDisc_ >= 0) {
+    int v = opts.udpPmtuDisc_;
+    if (setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &v, sizeof(v)) == -1 &&
+        family == AF_INET) {
+      LOG(ERROR) << "set IP_MTU_DISCOVER failure: " << strerror(errno);
+    }
+    // IPV6_PMTUDISC_* has the same values as IP_PMTUDISC_*
+    if (family == AF_INET6 &&
+        setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &v, sizeof(v)) == -1) {
+      LOG(ERROR) << "set IPV6_MTU_DISCOVER failure: " << strerror(errno);
+    }
+  }
+
+  // report what the kernel really uses
+  LOG(INFO) << "udp socket options, rcvbuf: " << getIntOpt(fd, SOL_SOCKET, SO_RCVBUF)
+  << ", sndbuf: "    << getIntOpt(fd, SOL_SOCKET, SO_SNDBUF)
+  << ", busy_poll: " << getIntOpt(fd, SOL_SOCKET, SO_BUSY_POLL)
+  << ", tos: " << (family == AF_INET6 ? getIntOpt(fd, IPPROTO_IPV6, IPV6_TCLASS)
+                                      : getIntOpt(fd, IPPROTO_IP, IP_TOS))
+  << ", mtu_discover: " << (family == AF_INET6 ? getIntOpt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER)
+                                               : getIntOpt(fd, IPPROTO_IP, IP_MTU_DISCOVER));
+}
+
+void setTcpSocketOptions(int fd, const SocketOptions &opts) {
+  if (fd < 0)
+    return;
+
+  if (opts.tcpNoDelay_) {
+    int on = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1) {
+      LOG_EVERY_MS(ERROR, 1000) << "set TCP_NODELAY failure: " << strerror(errno);
+    }
+  }
+  rearmTcpQuickAck(fd, opts);
+}
+
+void rearmTcpQuickAck(int fd, const SocketOptions &opts) {
+  if (!opts.tcpQuickAck_ || fd < 0)
+    return;
+
+  // not permanent, the kernel may leave quickack mode after any ack
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+}
@@ -0,0 +1,66 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_SOCKET_OPTIONS_H_
+#define TUT_SOCKET_OPTIONS_H_
+
+#include "Common.h"
+
+#include "Config.h"
+
+//
+// Socket tuning of the udp tunnel socket and the tcp sessions (accepted
+// miner connections on the client, upstream connections on the server).
+// Zero / -1 keep the system default.
+//
+struct SocketOptions {
+  // udp tunnel
+  int udpRcvBuf_;     // SO_RCVBUF(FORCE), bytes
+  int udpSndBuf_;     // SO_SNDBUF(FORCE), bytes
+  int udpBusyPoll_;   // SO_BUSY_POLL, usec
+  int udpDscp_;       // IP_TOS / IPV6_TCLASS = dscp << 2, -1: default
+  int udpPmtuDisc_;   // IP_MTU_DISCOVER: IP_PMTUDISC_*, -1: default
+  bool udpConnected_; // connect() a socket to the peer after the handshake
+
+  // tcp sessions
+  bool tcpNoDelay_;   // TCP_NODELAY
+  bool tcpQuickAck_;  // TCP_QUICKACK, re-armed after every read
+
+  SocketOptions();
+
+  // keys of kSocketOptionsSchema
+  void load(const Config &conf);
+
+  void log() const;
+};
+
+// udp_rcvbuf, udp_sndbuf, udp_busy_poll, udp_dscp, udp_pmtu_discover,
+// udp_connected, tcp_nodelay, tcp_quickack
+extern const ConfigField kSocketOptionsSchema[];
+
+// apply to the udp socket and log the effective values
+void setUdpSocketOptions(int fd, const SocketOptions &opts);
+void setTcpSocketOptions(int fd, const SocketOptions &opts);
+void rearmTcpQuickAck(int fd, const SocketOptions &opts);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "TimerWheel.h"
+
+//////////////////////////////// TimerWheelNode ////////////////////////////////
+void TimerWheelNode::unlink() {
+  if (!isLinked())
+    return;
+  prev_->next_ = next_;
+  next_->prev_ = prev_;
+  prev_ = next_ = nullptr;
+}
+
+static void linkBefore(TimerWheelNode *head, TimerWheelNode *node) {
+  node->prev_ = head->prev_;
+  node->next_ = head;
+  head->prev_->next_ = node;
+  head->prev_ = node;
+}
+
+
+////////////////////////////////// TimerWheel //////////////////////////////////
+TimerWheel::TimerWheel(const size_t slots, const IINT64 tickMs,
+                       const IINT64 now):
+slots_(slots), tickMs_(tickMs), currentTick_(now / tickMs)
+{
+  assert(slots > 1 && tickMs > 0);
+  // empty circular lists
+  for (auto &head : slots_) {
+    head.prev_ = head.next_ = &head;
+  }
+}
+
+void TimerWheel::schedule(TimerWheelNode *node, const IINT64 when) {
+  node->unlink();
+
+  // never into a slot that has run, never more than a lap ahead
+  IINT64 tick = when / tickMs_;
+  const IINT64 lap = (IINT64)slots_.size();
+  if (tick <= currentTick_) {
+    tick = currentTick_ + 1;
+  } else if (tick > currentTick_ + lap) {
+    tick = currentTick_ + lap;
+  }
+  linkBefore(&slots_[tick % lap], node);
+}
+
+void TimerWheel::advance(const IINT64 now, TimerWheelCallback cb, void *ptr) {
+  const IINT64 target = now / tickMs_;
+  const IINT64 lap    = (IINT64)slots_.size();
+
+  // after a long stall every slot is due once, that's all of them
+  if (target - currentTick_ > lap) {
+    currentTick_ = target - lap;
+  }
+
+  while (currentTick_ < target) {
+    currentTick_++;
+    TimerWheelNode *head = &slots_[currentTick_ % lap];
+    if (head->next_ == head)
+      continue;
+
+    // move the slot to a local list first, callbacks may schedule nodes
+    // back into the wheel
+    TimerWheelNode due;
+    due.next_ = head->next_;
+    due.prev_ = head->prev_;
+    due.next_->prev_ = &due;
+    due.prev_->next_ = &due;
+    head->prev_ = head->next_ = head;
+
+    while (due.next_ != &due) {
+      TimerWheelNode *node = due.next_;
+      node->unlink();
+      cb(node, ptr);
+    }
+    due.prev_ = due.next_ = nullptr;
+  }
+}
@@ -0,0 +1,75 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_TIMER_WHEEL_H_
+#define TUT_TIMER_WHEEL_H_
+
+#include "Common.h"
+
+// intrusive list node, embed it in the object to be timed
+struct TimerWheelNode {
+  TimerWheelNode *prev_;
+  TimerWheelNode *next_;
+  void *owner_;
+
+  explicit TimerWheelNode(void *owner = nullptr):
+  prev_(nullptr), next_(nullptr), owner_(owner) {}
+  ~TimerWheelNode() { unlink(); }
+
+  bool isLinked() const { return next_ != nullptr; }
+  void unlink();
+
+private:
+  TimerWheelNode(const TimerWheelNode &);
+  TimerWheelNode &operator=(const TimerWheelNode &);
+};
+
+typedef void (*TimerWheelCallback)(TimerWheelNode *node, void *ptr);
+
+//
+// hashed timing wheel: a slot per tick, O(1) schedule & cancel. it's meant
+// for lazy timeouts: the owner only bumps a timestamp on activity, the
+// callback of a due node checks the real deadline and schedules it again if
+// it has moved. deadlines beyond the span of the wheel are filed at its far
+// end and come back early for the same check.
+//
+class TimerWheel {
+  vector<TimerWheelNode> slots_;  // list heads
+  IINT64 tickMs_;
+  IINT64 currentTick_;            // the last tick advance() has run
+
+  TimerWheel(const TimerWheel &);
+  TimerWheel &operator=(const TimerWheel &);
+
+public:
+  TimerWheel(const size_t slots, const IINT64 tickMs, const IINT64 now);
+
+  // (re)schedule the node at `when` (ms)
+  void schedule(TimerWheelNode *node, const IINT64 when);
+
+  // run every slot up to `now`, each due node is unlinked before its
+  // callback, which may schedule or free it
+  void advance(const IINT64 now, TimerWheelCallback cb, void *ptr);
+};
+
+#endif
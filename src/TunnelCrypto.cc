@@ -0,0 +1,398 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "TunnelCrypto.h"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+const ConfigField kTunnelCryptoSchema[] = {
+  {"tunnel_key",    CONF_STR,  0, "\"\"",     0, 0, nullptr},
+  {"tunnel_cipher", CONF_ENUM, 0, "\"auto\"", 0, 0,
+    "auto|aes-128-gcm|chacha20-poly1305"},
+  {nullptr}
+};
+
+bool parseAeadCipher(const string &str, int *cipher) {
+  if (str.empty() || str == "auto") {
+    *cipher = AEAD_AUTO;
+  } else if (str == "aes-128-gcm") {
+    *cipher = AEAD_AES_128_GCM;
+  } else if (str == "chacha20-poly1305") {
+    *cipher = AEAD_CHACHA20_POLY1305;
+  } else {
+    LOG(ERROR) << "invalid cipher: " << str
+    << ", should be one of: auto, aes-128-gcm, chacha20-poly1305";
+    return false;
+  }
+  return true;
+}
+
+const char *aeadCipherName(const int cipher) {
+  switch (cipher) {
+    case AEAD_AES_128_GCM:       return "aes-128-gcm";
+    case AEAD_CHACHA20_POLY1305: return "chacha20-poly1305";
+    case AEAD_AUTO:              return "auto";
+  }
+  return "none";
+}
+
+int aeadKeyLen(const int cipher) {
+  return cipher == AEAD_AES_128_GCM ? 16 : 32;
+}
+
+static const EVP_CIPHER *aeadEvpCipher(const int cipher) {
+  return cipher == AEAD_AES_128_GCM ? EVP_aes_128_gcm() : EVP_chacha20_poly1305();
+}
+
+bool cpuHasAesGcm() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+#elif defined(__aarch64__)
+  return true;  // ARMv8 crypto extensions, on every core we run on
+#else
+  return false;
+#endif
+}
+
+static uint32_t aeadFeature(const int cipher) {
+  switch (cipher) {
+    case AEAD_AES_128_GCM:       return TUNNEL_FEATURE_AES_128_GCM;
+    case AEAD_CHACHA20_POLY1305: return TUNNEL_FEATURE_CHACHA20_POLY1305;
+  }
+  return 0;
+}
+
+uint32_t aeadOfferedFeatures(const int configured) {
+  if (configured == AEAD_AUTO) {
+    return TUNNEL_FEATURE_AES_128_GCM | TUNNEL_FEATURE_CHACHA20_POLY1305;
+  }
+  return aeadFeature(configured);
+}
+
+int aeadSelect(const int configured, const uint32_t offered) {
+  if (configured != AEAD_AUTO) {
+    return (offered & aeadFeature(configured)) ? configured : AEAD_NONE;
+  }
+
+  // our cpu decides, the client offers what it can do
+  const int preferred[2] = {
+    cpuHasAesGcm() ? AEAD_AES_128_GCM : AEAD_CHACHA20_POLY1305,
+    cpuHasAesGcm() ? AEAD_CHACHA20_POLY1305 : AEAD_AES_128_GCM
+  };
+  for (int cipher : preferred) {
+    if (offered & aeadFeature(cipher))
+      return cipher;
+  }
+  return AEAD_NONE;
+}
+
+int aeadFromFeatures(const uint32_t features) {
+  const uint32_t ciphers = features & (TUNNEL_FEATURE_AES_128_GCM |
+                                       TUNNEL_FEATURE_CHACHA20_POLY1305);
+  if (ciphers == 0)
+    return AEAD_NONE;
+  if (ciphers == TUNNEL_FEATURE_AES_128_GCM)
+    return AEAD_AES_128_GCM;
+  if (ciphers == TUNNEL_FEATURE_CHACHA20_POLY1305)
+    return AEAD_CHACHA20_POLY1305;
+  return -1;
+}
+
+void randomBytes(uint8_t *buf, const size_t len) {
+  if (RAND_bytes(buf, (int)len) != 1) {
+    LOG(FATAL) << "RAND_bytes failure";
+  }
+}
+
+static void hmacSha256(const string &key, const string &data, uint8_t out[32]) {
+  unsigned int outLen = 32;
+  HMAC(EVP_sha256(), key.data(), (int)key.size(),
+       (const uint8_t *)data.data(), data.size(), out, &outLen);
+}
+
+// RFC 5869
+static string hkdfSha256(const string &salt, const string &ikm,
+                         const string &info, const size_t len) {
+  uint8_t prk[32];
+  hmacSha256(salt, ikm, prk);
+
+  string okm, t;
+  for (uint8_t i = 1; okm.size() < len; i++) {
+    uint8_t block[32];
+    hmacSha256(string((char *)prk, sizeof(prk)), t + info + (char)i, block);
+    t.assign((char *)block, sizeof(block));
+    okm += t;
+  }
+  okm.resize(len);
+  return okm;
+}
+
+
+/////////////////////////////////// AeadCodec //////////////////////////////////
+AeadCodec::AeadCodec():
+cipher_(AEAD_NONE), sealCtx_(nullptr), openCtx_(nullptr), sealCounter_(0),
+openMax_(0), sealed_(0), opened_(0), authFailures_(0), replays_(0)
+{
+  memset(sealSalt_, 0, sizeof(sealSalt_));
+  memset(openSalt_, 0, sizeof(openSalt_));
+  memset(window_, 0, sizeof(window_));
+}
+
+AeadCodec::~AeadCodec() {
+  clear();
+}
+
+void AeadCodec::clear() {
+  if (sealCtx_)
+    EVP_CIPHER_CTX_free(sealCtx_);
+  if (openCtx_)
+    EVP_CIPHER_CTX_free(openCtx_);
+  sealCtx_ = openCtx_ = nullptr;
+  cipher_  = AEAD_NONE;
+}
+
+bool AeadCodec::setKeys(const int cipher,
+                        const uint8_t *sealKey, const uint8_t *sealSalt,
+                        const uint8_t *openKey, const uint8_t *openSalt) {
+  clear();
+  if (cipher != AEAD_AES_128_GCM && cipher != AEAD_CHACHA20_POLY1305)
+    return false;
+
+  sealCtx_ = EVP_CIPHER_CTX_new();
+  openCtx_ = EVP_CIPHER_CTX_new();
+  if (!sealCtx_ || !openCtx_ ||
+      EVP_EncryptInit_ex(sealCtx_, aeadEvpCipher(cipher), nullptr, sealKey, nullptr) != 1 ||
+      EVP_DecryptInit_ex(openCtx_, aeadEvpCipher(cipher), nullptr, openKey, nullptr) != 1) {
+    LOG(ERROR) << "init cipher failure: " << aeadCipherName(cipher);
+    clear();
+    return false;
+  }
+
+  cipher_ = cipher;
+  memcpy(sealSalt_, sealSalt, AEAD_SALT_LEN);
+  memcpy(openSalt_, openSalt, AEAD_SALT_LEN);
+  sealCounter_ = 0;
+  openMax_     = 0;
+  memset(window_, 0, sizeof(window_));
+  return true;
+}
+
+bool AeadCodec::isReplay(const uint64_t counter) const {
+  if (counter == 0)
+    return true;
+  if (counter > openMax_)
+    return false;
+  if (openMax_ - counter >= AEAD_REPLAY_WINDOW)
+    return true;  // too old to tell
+  const uint64_t bit = counter % AEAD_REPLAY_WINDOW;
+  return (window_[bit / 64] >> (bit % 64)) & 1;
+}
+
+void AeadCodec::markOpened(const uint64_t counter) {
+  if (counter > openMax_) {
+    // forget the slots the window slides over
+    if (counter - openMax_ >= AEAD_REPLAY_WINDOW) {
+      memset(window_, 0, sizeof(window_));
+    } else {
+      for (uint64_t c = openMax_ + 1; c < counter; c++) {
+        const uint64_t bit = c % AEAD_REPLAY_WINDOW;
+        window_[bit / 64] &= ~(1ull << (bit % 64));
+      }
+    }
+    openMax_ = counter;
+  }
+  const uint64_t bit = counter % AEAD_REPLAY_WINDOW;
+  window_[bit / 64] |= 1ull << (bit % 64);
+}
+
+const uint8_t *AeadCodec::seal(const uint8_t *in, const size_t len,
+                               size_t *outLen) {
+  assert(enabled());
+  if (sealBuf_.size() < len + AEAD_OVERHEAD) {
+    sealBuf_.resize(len + AEAD_OVERHEAD);
+  }
+  uint8_t *out = sealBuf_.data();
+
+  const uint64_t counter = ++sealCounter_;
+  uint8_t nonce[AEAD_SALT_LEN + AEAD_COUNTER_LEN];
+  memcpy(nonce, sealSalt_, AEAD_SALT_LEN);
+  memcpy(nonce + AEAD_SALT_LEN, &counter, AEAD_COUNTER_LEN);
+  memcpy(out, &counter, AEAD_COUNTER_LEN);
+
+  int n = 0, m = 0;
+  if (EVP_EncryptInit_ex(sealCtx_, nullptr, nullptr, nullptr, nonce) != 1 ||
+      EVP_EncryptUpdate(sealCtx_, out + AEAD_COUNTER_LEN, &n, in, (int)len) != 1 ||
+      EVP_EncryptFinal_ex(sealCtx_, out + AEAD_COUNTER_LEN + n, &m) != 1 ||
+      EVP_CIPHER_CTX_ctrl(sealCtx_, EVP_CTRL_AEAD_GET_TAG, AEAD_TAG_LEN,
+                          out + AEAD_COUNTER_LEN + len) != 1) {
+    LOG(FATAL) << "seal failure";
+  }
+
+  sealed_++;
+  *outLen = len + AEAD_OVERHEAD;
+  return out;
+}
+
+const uint8_t *AeadCodec::open(const uint8_t *in, const size_t len,
+                               size_t *outLen) {
+  assert(enabled());
+  if (len < AEAD_OVERHEAD) {
+    authFailures_++;
+    return nullptr;
+  }
+
+  uint64_t counter;
+  memcpy(&counter, in, AEAD_COUNTER_LEN);
+  if (isReplay(counter)) {
+    replays_++;
+    return nullptr;
+  }
+
+  const size_t plainLen = len - AEAD_OVERHEAD;
+  if (openBuf_.size() < plainLen + 1) {
+    openBuf_.resize(plainLen + 1);
+  }
+  uint8_t *out = openBuf_.data();
+
+  uint8_t nonce[AEAD_SALT_LEN + AEAD_COUNTER_LEN];
+  memcpy(nonce, openSalt_, AEAD_SALT_LEN);
+  memcpy(nonce + AEAD_SALT_LEN, &counter, AEAD_COUNTER_LEN);
+
+  int n = 0, m = 0;
+  if (EVP_DecryptInit_ex(openCtx_, nullptr, nullptr, nullptr, nonce) != 1 ||
+      EVP_DecryptUpdate(openCtx_, out, &n, in + AEAD_COUNTER_LEN, (int)plainLen) != 1 ||
+      EVP_CIPHER_CTX_ctrl(openCtx_, EVP_CTRL_AEAD_SET_TAG, AEAD_TAG_LEN,
+                          (void *)(in + AEAD_COUNTER_LEN + plainLen)) != 1 ||
+      EVP_DecryptFinal_ex(openCtx_, out + n, &m) != 1) {
+    authFailures_++;
+    return nullptr;
+  }
+
+  markOpened(counter);
+  opened_++;
+  *outLen = plainLen;
+  return out;
+}
+
+string AeadCodec::stats() const {
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "cipher: %s, sealed: %llu, opened: %llu, auth failures: %llu, "
+           "replays: %llu", aeadCipherName(cipher_),
+           (unsigned long long)sealed_, (unsigned long long)opened_,
+           (unsigned long long)authFailures_, (unsigned long long)replays_);
+  return string(buf);
+}
+
+
+/////////////////////////////////// TunnelKey //////////////////////////////////
+TunnelKey::TunnelKey(const string &psk): psk_(psk) {
+  if (!psk_.empty()) {
+    macKey_ = hkdfSha256("btctunnel hello", psk_, "hello mac", 32);
+  }
+}
+
+string TunnelKey::makeHello(const Hello &hello,
+                            const uint8_t *peerRandom) const {
+  string msg;
+  msg.resize(HELLO_LEN, 0);
+
+  uint8_t *p = (uint8_t *)msg.data();
+  *(uint32_t *)p = 0u;
+  p += 4;
+  *(uint32_t *)p = hello.conv_;
+  p += 4;
+  *(uint32_t *)p = hello.conv_ + 1;
+  p += 4;
+  *(uint32_t *)p = hello.features_;
+  p += 4;
+  memcpy(p, hello.random_, HELLO_RANDOM_LEN);
+  p += HELLO_RANDOM_LEN;
+  *(uint64_t *)p = hello.time_;
+  p += 8;
+
+  if (!empty()) {
+    string data = msg.substr(0, HELLO_LEN - HELLO_MAC_LEN);
+    if (peerRandom) {
+      data.append((const char *)peerRandom, HELLO_RANDOM_LEN);
+    }
+    uint8_t mac[32];
+    hmacSha256(macKey_, data, mac);
+    memcpy(p, mac, HELLO_MAC_LEN);
+  }
+  return msg;
+}
+
+bool TunnelKey::parseHello(const uint8_t *p, const size_t len,
+                           const uint8_t *peerRandom, Hello *hello) const {
+  if (len != HELLO_LEN ||
+      *(uint32_t *)p != 0u ||
+      *(uint32_t *)(p + 8) != *(uint32_t *)(p + 4) + 1) {
+    return false;
+  }
+
+  if (!empty()) {
+    string data((const char *)p, HELLO_LEN - HELLO_MAC_LEN);
+    if (peerRandom) {
+      data.append((const char *)peerRandom, HELLO_RANDOM_LEN);
+    }
+    uint8_t mac[32];
+    hmacSha256(macKey_, data, mac);
+    if (CRYPTO_memcmp(mac, p + HELLO_LEN - HELLO_MAC_LEN, HELLO_MAC_LEN) != 0) {
+      return false;
+    }
+  }
+
+  hello->conv_     = *(uint32_t *)(p + 4);
+  hello->features_ = *(uint32_t *)(p + 12);
+  memcpy(hello->random_, p + 16, HELLO_RANDOM_LEN);
+  hello->time_     = *(uint64_t *)(p + 16 + HELLO_RANDOM_LEN);
+  return true;
+}
+
+bool TunnelKey::setSessionKeys(AeadCodec *codec, const int cipher,
+                               const bool isClient,
+                               const uint8_t *clientRandom,
+                               const uint8_t *serverRandom,
+                               const uint32_t conv) const {
+  string salt;
+  salt.append((const char *)clientRandom, HELLO_RANDOM_LEN);
+  salt.append((const char *)serverRandom, HELLO_RANDOM_LEN);
+  salt.append((const char *)&conv, sizeof(conv));
+
+  const size_t keyLen = aeadKeyLen(cipher);
+  const string name   = aeadCipherName(cipher);
+  const string c2s = hkdfSha256(salt, psk_, "c2s " + name, keyLen + AEAD_SALT_LEN);
+  const string s2c = hkdfSha256(salt, psk_, "s2c " + name, keyLen + AEAD_SALT_LEN);
+
+  const string &seal = isClient ? c2s : s2c;
+  const string &open = isClient ? s2c : c2s;
+  return codec->setKeys(cipher,
+                        (const uint8_t *)seal.data(),
+                        (const uint8_t *)seal.data() + keyLen,
+                        (const uint8_t *)open.data(),
+                        (const uint8_t *)open.data() + keyLen);
+}
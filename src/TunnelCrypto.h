@@ -0,0 +1,159 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_TUNNEL_CRYPTO_H_
+#define TUT_TUNNEL_CRYPTO_H_
+
+#include "Common.h"
+#include "Config.h"
+
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
+
+#define AEAD_NONE               0
+#define AEAD_AES_128_GCM        1
+#define AEAD_CHACHA20_POLY1305  2
+#define AEAD_AUTO               3  // config only: gcm with AES-NI, or chacha
+
+//
+// sealed datagram:
+// | counter(8) | ciphertext | tag(16) |
+//
+// nonce: | salt(4) | counter(8) |, the salt is derived per direction with
+// the keys. counters start at 1 and are checked against a replay window.
+//
+#define AEAD_COUNTER_LEN    8
+#define AEAD_TAG_LEN        16
+#define AEAD_OVERHEAD       (AEAD_COUNTER_LEN + AEAD_TAG_LEN)
+#define AEAD_SALT_LEN       4
+#define AEAD_MAX_KEY_LEN    32
+#define AEAD_REPLAY_WINDOW  1024  // datagrams, a multiple of 64
+
+bool parseAeadCipher(const string &str, int *cipher);
+const char *aeadCipherName(const int cipher);
+int aeadKeyLen(const int cipher);
+
+// AES-NI & PCLMUL, gcm is the fast one with them, chacha without
+bool cpuHasAesGcm();
+
+// TUNNEL_FEATURE_* bits offered for a configured cipher
+uint32_t aeadOfferedFeatures(const int configured);
+// the server's pick of the offered ones, AEAD_NONE if nothing fits
+int aeadSelect(const int configured, const uint32_t offered);
+// the cipher of an answer's features, -1 if it's not exactly one
+int aeadFromFeatures(const uint32_t features);
+
+
+//
+// seals & opens datagrams of one direction each. the contexts are keyed
+// once, a datagram only sets the nonce, so all the datagrams of a kcp flush
+// go through the same pre-keyed context back to back.
+//
+class AeadCodec {
+  int cipher_;
+  EVP_CIPHER_CTX *sealCtx_;
+  EVP_CIPHER_CTX *openCtx_;
+  uint8_t  sealSalt_[AEAD_SALT_LEN];
+  uint8_t  openSalt_[AEAD_SALT_LEN];
+  uint64_t sealCounter_;
+
+  // the highest counter opened and a bitmap of the ones below it
+  uint64_t openMax_;
+  uint64_t window_[AEAD_REPLAY_WINDOW / 64];
+
+  // separate, a datagram being handled may be echoed
+  vector<uint8_t> sealBuf_;
+  vector<uint8_t> openBuf_;
+
+  bool isReplay(const uint64_t counter) const;
+  void markOpened(const uint64_t counter);
+
+  AeadCodec(const AeadCodec &);
+  AeadCodec &operator=(const AeadCodec &);
+
+public:
+  uint64_t sealed_;
+  uint64_t opened_;
+  uint64_t authFailures_;
+  uint64_t replays_;
+
+public:
+  AeadCodec();
+  ~AeadCodec();
+
+  bool setKeys(const int cipher,
+               const uint8_t *sealKey, const uint8_t *sealSalt,
+               const uint8_t *openKey, const uint8_t *openSalt);
+  void clear();  // back to plaintext
+
+  bool enabled() const { return cipher_ != AEAD_NONE; }
+  int cipher() const { return cipher_; }
+  size_t overhead() const { return enabled() ? AEAD_OVERHEAD : 0; }
+
+  // the result is valid until the next call
+  const uint8_t *seal(const uint8_t *in, const size_t len, size_t *outLen);
+  // nullptr: short, forged, corrupted or replayed
+  const uint8_t *open(const uint8_t *in, const size_t len, size_t *outLen);
+
+  string stats() const;
+};
+
+
+struct Hello {
+  uint32_t conv_;
+  uint32_t features_;
+  uint8_t  random_[HELLO_RANDOM_LEN];
+  uint64_t time_;  // iclock64() of the sender
+};
+
+//
+// tunnel_key, the pre-shared key, and what's derived from it: the mac key
+// of the hellos and the keys of a session.
+//
+class TunnelKey {
+  string psk_;
+  string macKey_;
+
+public:
+  TunnelKey() {}
+  explicit TunnelKey(const string &psk);
+
+  bool empty() const { return psk_.empty(); }
+
+  // `peerRandom`: the client's random in the server's answer, else nullptr
+  string makeHello(const Hello &hello, const uint8_t *peerRandom) const;
+  // the mac is checked only with a key
+  bool parseHello(const uint8_t *p, const size_t len,
+                  const uint8_t *peerRandom, Hello *hello) const;
+
+  // HKDF of the psk, both randoms and the conv, one key & salt each way
+  bool setSessionKeys(AeadCodec *codec, const int cipher, const bool isClient,
+                      const uint8_t *clientRandom, const uint8_t *serverRandom,
+                      const uint32_t conv) const;
+};
+
+void randomBytes(uint8_t *buf, const size_t len);
+
+// tunnel_key, tunnel_cipher
+extern const ConfigField kTunnelCryptoSchema[];
+
+#endif
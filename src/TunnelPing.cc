@@ -0,0 +1,137 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "TunnelPing.h"
+
+#include <algorithm>
+
+bool parsePing(const uint8_t *data, const size_t len, uint16_t *srtt) {
+  if (len < PING_LEN)
+    return false;
+  *srtt = *(uint16_t *)(data + KCP_CTRL_HEADER_LEN + 20);
+  return true;
+}
+
+string makePong(const uint8_t *ping, const uint32_t sent, const uint32_t recv,
+                const IINT64 now) {
+  string msg = makeCtrlDatagram(KCP_CTRL_TYPE_PONG, PONG_LEN);
+  uint8_t *p = (uint8_t *)msg.data() + KCP_CTRL_HEADER_LEN;
+
+  // the ping as it is
+  memcpy(p, ping + KCP_CTRL_HEADER_LEN, PING_LEN - KCP_CTRL_HEADER_LEN);
+  p += PING_LEN - KCP_CTRL_HEADER_LEN;
+
+  *(int64_t *)p = now;
+  p += 8;
+  *(uint32_t *)p = sent;
+  p += 4;
+  *(uint32_t *)p = recv;
+  return msg;
+}
+
+
+////////////////////////////////// TunnelPing //////////////////////////////////
+TunnelPing::TunnelPing():
+id_(0), hasLast_(false), lastSent_(0), lastRecv_(0), lastPeerSent_(0),
+lastPeerRecv_(0), pings_(0), pongs_(0), pongTime_(0), rtt_(-1), srtt_(-1),
+minRtt_(-1), clockOffset_(0), lossUp_(-1), lossDown_(-1)
+{
+}
+
+string TunnelPing::makePing(const uint32_t sent, const uint32_t recv,
+                            const IINT64 now) {
+  string msg = makeCtrlDatagram(KCP_CTRL_TYPE_PING, PING_LEN);
+  uint8_t *p = (uint8_t *)msg.data() + KCP_CTRL_HEADER_LEN;
+
+  *(uint32_t *)p = ++id_;
+  p += 4;
+  *(int64_t *)p = now;
+  p += 8;
+  *(uint32_t *)p = sent;
+  p += 4;
+  *(uint32_t *)p = recv;
+  p += 4;
+  *(uint16_t *)p = (uint16_t)std::min(std::max(srtt_, 0), (int32_t)UINT16_MAX);
+
+  pings_++;
+  return msg;
+}
+
+// the loss of the datagrams sent between two samples
+static int32_t lossPercent(const uint32_t sent, const uint32_t recv) {
+  if (sent == 0 || recv >= sent)
+    return 0;
+  return (int32_t)(100ull * (sent - recv) / sent);
+}
+
+bool TunnelPing::handlePong(const uint8_t *data, const size_t len,
+                            const uint32_t recv, const IINT64 now) {
+  if (len < PONG_LEN)
+    return false;
+
+  const uint8_t *p = data + KCP_CTRL_HEADER_LEN;
+  const uint32_t id       = *(uint32_t *)p;
+  const IINT64   sendTime = *(int64_t  *)(p + 4);
+  const uint32_t sent     = *(uint32_t *)(p + 12);
+  const IINT64   peerTime = *(int64_t  *)(p + 22);
+  const uint32_t peerSent = *(uint32_t *)(p + 30);
+  const uint32_t peerRecv = *(uint32_t *)(p + 34);
+
+  const IINT64 rtt = now - sendTime;
+  if (id == 0 || id > id_ || rtt < 0) {
+    return false;
+  }
+  // a late one, a newer pong has the counters already
+  if (hasLast_ && (int32_t)(sent - lastSent_) <= 0) {
+    return true;
+  }
+
+  pongs_++;
+  pongTime_ = now;
+  rtt_      = (int32_t)std::min(rtt, (IINT64)INT32_MAX);
+  srtt_     = (srtt_ < 0) ? rtt_ : (srtt_ * 7 + rtt_) / 8;
+  minRtt_   = (minRtt_ < 0) ? rtt_ : std::min(minRtt_, rtt_);
+  // the pong was made halfway
+  clockOffset_ = peerTime - (sendTime + rtt / 2);
+
+  if (hasLast_) {
+    lossUp_   = lossPercent(sent - lastSent_, peerRecv - lastPeerRecv_);
+    lossDown_ = lossPercent(peerSent - lastPeerSent_, recv - lastRecv_);
+  }
+  hasLast_      = true;
+  lastSent_     = sent;
+  lastRecv_     = recv;
+  lastPeerSent_ = peerSent;
+  lastPeerRecv_ = peerRecv;
+  return true;
+}
+
+string TunnelPing::stats(const IINT64 now) const {
+  char buf[256];
+  snprintf(buf, sizeof(buf), "rtt: %d ms, srtt: %d ms, min: %d ms, "
+           "clock offset: %lld ms, loss up: %d%%, down: %d%%, "
+           "last pong: %lld ms ago, pings: %u, pongs: %u",
+           rtt_, srtt_, minRtt_, (long long)clockOffset_, lossUp_, lossDown_,
+           pongTime_ ? (long long)(now - pongTime_) : -1LL, pings_, pongs_);
+  return string(buf);
+}
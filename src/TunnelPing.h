@@ -0,0 +1,87 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_TUNNEL_PING_H_
+#define TUT_TUNNEL_PING_H_
+
+#include "Common.h"
+
+//
+// ping beside kcp, negotiated with TUNNEL_FEATURE_DATAGRAM_PING. keepalive,
+// rtt, clock offset and both ends' datagram counters (loss of each
+// direction), as control datagrams: a lost one is a missing sample, it is
+// never resent nor queued behind the streams.
+//
+// KCP_CTRL_TYPE_PING, the client's:
+// | 0u(4) | magic(4) | 0x03 | id(4) | time(8) | sent(4) | recv(4) | srtt(2) |
+//
+// KCP_CTRL_TYPE_PONG, the ping as it is with the server's:
+// | 0u(4) | magic(4) | 0x04 | ping(22) | time(8) | sent(4) | recv(4) |
+//
+// time: ms of iclock64(), sent / recv: udp datagrams of the tunnel so far.
+//
+#define PING_LEN  (KCP_CTRL_HEADER_LEN + 22)
+#define PONG_LEN  (PING_LEN + 16)
+
+// no pong for this many intervals: the tunnel is silent
+#define PING_SILENT_INTERVALS  3
+
+// the server's side
+bool parsePing(const uint8_t *data, const size_t len, uint16_t *srtt);
+string makePong(const uint8_t *ping, const uint32_t sent, const uint32_t recv,
+                const IINT64 now);
+
+// the client's side
+class TunnelPing {
+  uint32_t id_;
+
+  // counters of the last pong, the loss is of the interval since
+  bool     hasLast_;
+  uint32_t lastSent_;        // ours, when the ping was sent
+  uint32_t lastRecv_;        // ours, when the pong arrived
+  uint32_t lastPeerSent_;
+  uint32_t lastPeerRecv_;
+
+public:
+  uint32_t pings_;
+  uint32_t pongs_;
+  IINT64 pongTime_;     // the last one, 0: none yet
+  int32_t rtt_;         // ms, -1: unknown
+  int32_t srtt_;
+  int32_t minRtt_;
+  IINT64 clockOffset_;  // server's clock - ours, ms
+  int32_t lossUp_;      // %, -1: unknown
+  int32_t lossDown_;
+
+public:
+  TunnelPing();
+
+  string makePing(const uint32_t sent, const uint32_t recv, const IINT64 now);
+  // false: malformed or not ours
+  bool handlePong(const uint8_t *data, const size_t len,
+                  const uint32_t recv, const IINT64 now);
+
+  string stats(const IINT64 now) const;
+};
+
+#endif
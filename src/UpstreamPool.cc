@@ -0,0 +1,355 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "UpstreamPool.h"
+
+#include <algorithm>
+
+#include <event2/buffer.h>
+
+#include "Log.h"
+
+// the ejection doubles up to this many times
+#define UPSTREAM_EJECT_BACKOFF_MAX  3
+// a failure is a slow connect for the latency balance, as for the addresses
+// of ADDR_FAMILY_FASTEST
+#define UPSTREAM_FAILURE_RTT  10000  // ms
+
+// the request of UPSTREAM_PROBE_STRATUM, any json line answers it
+static const char kStratumProbe[] =
+"{\"id\":1,\"method\":\"mining.subscribe\",\"params\":[\"tserver-check\"]}\n";
+
+const ConfigField kUpstreamPoolSchema[] = {
+  {"upstream_balance",         CONF_ENUM, CONF_RELOADABLE, "\"latency\"", 0, 0,
+   "least_conn|latency"},
+  {"upstream_connect_timeout", CONF_INT,  CONF_RELOADABLE, "5000",  0, 600000, nullptr},
+  {"upstream_check_interval",  CONF_INT,  CONF_RELOADABLE, "10000", 0, 3600000, nullptr},
+  {"upstream_check_timeout",   CONF_INT,  CONF_RELOADABLE, "3000",  100, 600000, nullptr},
+  {"upstream_check_probe",     CONF_ENUM, CONF_RELOADABLE, "\"tcp\"", 0, 0,
+   "tcp|stratum"},
+  {"upstream_eject_failures",  CONF_INT,  CONF_RELOADABLE, "3",     1, 1000, nullptr},
+  {"upstream_eject_time",      CONF_INT,  CONF_RELOADABLE, "30000", 1000, 3600000, nullptr},
+  {nullptr}
+};
+
+/////////////////////////////// UpstreamPoolParams /////////////////////////////
+UpstreamPoolParams::UpstreamPoolParams():
+balance_(UPSTREAM_BALANCE_LATENCY), connectTimeout_(5000),
+checkInterval_(10000), checkTimeout_(3000), checkProbe_(UPSTREAM_PROBE_TCP),
+ejectFailures_(3), ejectTime_(30000)
+{
+}
+
+void UpstreamPoolParams::load(const Config &conf) {
+  balance_ = (conf.getStr("upstream_balance") == "least_conn") ?
+             UPSTREAM_BALANCE_LEAST_CONN : UPSTREAM_BALANCE_LATENCY;
+  connectTimeout_ = (int32_t)conf.getInt("upstream_connect_timeout");
+  checkInterval_  = (int32_t)conf.getInt("upstream_check_interval");
+  checkTimeout_   = (int32_t)conf.getInt("upstream_check_timeout");
+  checkProbe_ = (conf.getStr("upstream_check_probe") == "stratum") ?
+                UPSTREAM_PROBE_STRATUM : UPSTREAM_PROBE_TCP;
+  ejectFailures_  = (int)conf.getInt("upstream_eject_failures");
+  ejectTime_      = (int32_t)conf.getInt("upstream_eject_time");
+}
+
+bool UpstreamPoolParams::operator!=(const UpstreamPoolParams &p) const {
+  return balance_ != p.balance_ || connectTimeout_ != p.connectTimeout_ ||
+         checkInterval_ != p.checkInterval_ || checkTimeout_ != p.checkTimeout_ ||
+         checkProbe_ != p.checkProbe_ || ejectFailures_ != p.ejectFailures_ ||
+         ejectTime_ != p.ejectTime_;
+}
+
+
+//////////////////////////////// UpstreamEndpoint //////////////////////////////
+UpstreamEndpoint::UpstreamEndpoint(UpstreamPool *pool,
+                                   const RouteUpstream &conf):
+pool_(pool), conf_(conf), name_(conf.name()), active_(0), connectRtt_(-1),
+failures_(0), ejections_(0), ejectedUntil_(0), picks_(0), connectFailures_(0),
+checkFailures_(0), check_(nullptr), checkStart_(0), checkRtt_(0)
+{
+}
+
+UpstreamEndpoint::~UpstreamEndpoint() {
+  if (check_)
+    bufferevent_free(check_);
+}
+
+
+////////////////////////////////// UpstreamPool ////////////////////////////////
+UpstreamPool::UpstreamPool(struct event_base *base, const uint16_t route):
+base_(base), route_(route), next_(0), checkTimer_(nullptr)
+{
+}
+
+UpstreamPool::~UpstreamPool() {
+  if (checkTimer_) {
+    event_del(checkTimer_);
+    event_free(checkTimer_);
+  }
+  for (auto ep : endpoints_) {
+    delete ep;
+  }
+}
+
+void UpstreamPool::setParams(const UpstreamPoolParams &params) {
+  params_ = params;
+  resetCheckTimer();
+}
+
+void UpstreamPool::setEndpoints(const vector<RouteUpstream> &endpoints) {
+  vector<UpstreamEndpoint *> kept;
+  for (const auto &conf : endpoints) {
+    UpstreamEndpoint *ep = find(conf.name());
+    if (ep == nullptr) {
+      ep = new UpstreamEndpoint(this, conf);
+    } else {
+      ep->conf_ = conf;
+      endpoints_.erase(std::find(endpoints_.begin(), endpoints_.end(), ep));
+    }
+    kept.push_back(ep);
+  }
+  // gone from the config, their streams stay open
+  for (auto ep : endpoints_) {
+    delete ep;
+  }
+  endpoints_.swap(kept);
+  next_ = 0;
+  resetCheckTimer();
+}
+
+UpstreamEndpoint *UpstreamPool::find(const string &name) const {
+  for (auto ep : endpoints_) {
+    if (ep->name_ == name)
+      return ep;
+  }
+  return nullptr;
+}
+
+UpstreamEndpoint *UpstreamPool::pick(const IINT64 now) {
+  const size_t n = endpoints_.size();
+  UpstreamEndpoint *best = nullptr;
+  IINT64 bestScore = 0;
+  size_t bestIdx   = 0;
+
+  // equal scores go round robin, from next_
+  for (size_t i = 0; i < n; i++) {
+    const size_t idx = (next_ + i) % n;
+    UpstreamEndpoint *ep = endpoints_[idx];
+    if (ep->isEjected(now))
+      continue;
+
+    // failing ones last, an open tried again goes elsewhere
+    IINT64 score = ((IINT64)ep->failures_ << 32) + ep->active_;
+    if (params_.balance_ == UPSTREAM_BALANCE_LATENCY) {
+      // not measured yet: as fast as it gets, it gets tried
+      score = (std::max<IINT64>(ep->connectRtt_, 0) + 1) * (ep->active_ + 1);
+    }
+    if (best == nullptr || score < bestScore) {
+      best      = ep;
+      bestScore = score;
+      bestIdx   = idx;
+    }
+  }
+
+  if (best == nullptr) {
+    // all ejected, better a try than a refused stream
+    for (size_t i = 0; i < n; i++) {
+      if (best == nullptr || endpoints_[i]->ejectedUntil_ < best->ejectedUntil_) {
+        best    = endpoints_[i];
+        bestIdx = i;
+      }
+    }
+    if (best == nullptr)
+      return nullptr;
+    LOG_EVERY_MS(WARNING, 1000) << "all upstreams of route " << route_
+    << " are ejected, try: " << best->name_;
+  }
+
+  next_ = (bestIdx + 1) % n;
+  best->active_++;
+  best->picks_++;
+  return best;
+}
+
+void UpstreamPool::connectDone(const string &name, const bool ok,
+                               const IINT64 rtt) {
+  UpstreamEndpoint *ep = find(name);
+  if (ep == nullptr)
+    return;
+
+  if (ok) {
+    onSuccess(ep, rtt);
+  } else {
+    ep->connectFailures_++;
+    onFailure(ep, iclock64());
+  }
+}
+
+void UpstreamPool::release(const string &name) {
+  UpstreamEndpoint *ep = find(name);
+  if (ep != nullptr && ep->active_ > 0)
+    ep->active_--;
+}
+
+static void updateRtt(UpstreamEndpoint *ep, const IINT64 rtt) {
+  ep->connectRtt_ = (ep->connectRtt_ < 0) ? rtt : (ep->connectRtt_ * 7 + rtt) / 8;
+}
+
+void UpstreamPool::onSuccess(UpstreamEndpoint *ep, const IINT64 rtt) {
+  updateRtt(ep, rtt);
+  ep->failures_   = 0;
+  ep->ejections_  = 0;
+  if (ep->ejectedUntil_ != 0) {
+    ep->ejectedUntil_ = 0;
+    LOG(INFO) << "upstream back in rotation, route: " << route_
+    << ", endpoint: " << ep->name_;
+  }
+}
+
+void UpstreamPool::onFailure(UpstreamEndpoint *ep, const IINT64 now) {
+  updateRtt(ep, UPSTREAM_FAILURE_RTT);
+  // out until its time is up or a check passes
+  if (ep->isEjected(now) || ++ep->failures_ < params_.ejectFailures_)
+    return;
+
+  const int backoff = std::min(ep->ejections_, UPSTREAM_EJECT_BACKOFF_MAX);
+  const IINT64 duration = (IINT64)params_.ejectTime_ << backoff;
+  ep->ejectedUntil_ = now + duration;
+  ep->ejections_++;
+  ep->failures_ = 0;
+  LOG(WARNING) << "eject upstream, route: " << route_ << ", endpoint: "
+  << ep->name_ << ", for " << duration << " ms";
+}
+
+void UpstreamPool::resetCheckTimer() {
+  if (checkTimer_) {
+    event_del(checkTimer_);
+    event_free(checkTimer_);
+    checkTimer_ = nullptr;
+  }
+  // nothing to choose from with one endpoint
+  if (params_.checkInterval_ <= 0 || endpoints_.size() < 2)
+    return;
+
+  checkTimer_ = event_new(base_, -1, EV_PERSIST, UpstreamPool::cb_checkTimer, this);
+  struct timeval interval = {params_.checkInterval_ / 1000,
+                             (params_.checkInterval_ % 1000) * 1000};
+  event_add(checkTimer_, &interval);
+  // the first round now, the rtts are known before the first streams
+  event_active(checkTimer_, EV_TIMEOUT, 0);
+}
+
+void UpstreamPool::cb_checkTimer(evutil_socket_t fd, short events, void *ptr) {
+  UpstreamPool *pool = static_cast<UpstreamPool *>(ptr);
+  for (auto ep : pool->endpoints_) {
+    if (ep->check_ == nullptr)
+      pool->startCheck(ep);
+  }
+}
+
+void UpstreamPool::startCheck(UpstreamEndpoint *ep) {
+  vector<struct sockaddr_storage> addrs;
+  if (!resolve(ep->conf_.host_, ep->conf_.port_, ep->conf_.family_,
+               SOCK_STREAM, &addrs)) {
+    ep->checkFailures_++;
+    onFailure(ep, iclock64());
+    return;
+  }
+
+  ep->check_ = bufferevent_socket_new(base_, -1, BEV_OPT_CLOSE_ON_FREE);
+  assert(ep->check_ != nullptr);
+  bufferevent_setcb(ep->check_, UpstreamPool::cb_checkRead, nullptr,
+                    UpstreamPool::cb_checkEvent, ep);
+  // the write timeout covers the connect
+  struct timeval timeout = {params_.checkTimeout_ / 1000,
+                            (params_.checkTimeout_ % 1000) * 1000};
+  bufferevent_set_timeouts(ep->check_, &timeout, &timeout);
+  ep->checkStart_ = iclock64();
+
+  if (bufferevent_socket_connect(ep->check_, (struct sockaddr *)&addrs[0],
+                                 sockaddrLen((struct sockaddr *)&addrs[0])) != 0) {
+    finishCheck(ep, false, "connect failure");
+  }
+}
+
+void UpstreamPool::finishCheck(UpstreamEndpoint *ep, const bool ok,
+                               const char *why) {
+  bufferevent_free(ep->check_);
+  ep->check_ = nullptr;
+
+  if (ok) {
+    onSuccess(ep, ep->checkRtt_);
+    return;
+  }
+  LOG_EVERY_MS(WARNING, 1000) << "upstream check failure, route: " << route_
+  << ", endpoint: " << ep->name_ << ", " << why;
+  ep->checkFailures_++;
+  onFailure(ep, iclock64());
+}
+
+void UpstreamPool::cb_checkRead(struct bufferevent *bev, void *ptr) {
+  UpstreamEndpoint *ep = static_cast<UpstreamEndpoint *>(ptr);
+  size_t len = 0;
+  char *line = evbuffer_readln(bufferevent_get_input(bev), &len,
+                               EVBUFFER_EOL_CRLF);
+  if (line == nullptr)
+    return;  // not a whole line yet
+  const bool ok = (len > 0 && line[0] == '{');
+  free(line);
+  ep->pool_->finishCheck(ep, ok, "not a stratum answer");
+}
+
+void UpstreamPool::cb_checkEvent(struct bufferevent *bev, short events,
+                                 void *ptr) {
+  UpstreamEndpoint *ep = static_cast<UpstreamEndpoint *>(ptr);
+  UpstreamPool *pool = ep->pool_;
+
+  if (events & BEV_EVENT_CONNECTED) {
+    ep->checkRtt_ = iclock64() - ep->checkStart_;
+    if (pool->params_.checkProbe_ == UPSTREAM_PROBE_TCP) {
+      pool->finishCheck(ep, true, "");
+      return;
+    }
+    bufferevent_write(bev, kStratumProbe, sizeof(kStratumProbe) - 1);
+    bufferevent_enable(bev, EV_READ);
+    return;
+  }
+
+  pool->finishCheck(ep, false, (events & BEV_EVENT_TIMEOUT) ? "timeout" :
+                    (events & BEV_EVENT_EOF) ? "closed" : "error");
+}
+
+string UpstreamPool::stats(const IINT64 now) const {
+  string out;
+  char line[256];
+  for (auto ep : endpoints_) {
+    snprintf(line, sizeof(line), "%-5u %-40s %-8s %6d %7lld %10llu %8llu %8llu\n",
+             route_, ep->name_.c_str(),
+             ep->isEjected(now) ? "ejected" : "up", ep->active_,
+             (long long)ep->connectRtt_, (unsigned long long)ep->picks_,
+             (unsigned long long)ep->connectFailures_,
+             (unsigned long long)ep->checkFailures_);
+    out += line;
+  }
+  return out;
+}
@@ -0,0 +1,146 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TUT_UPSTREAM_POOL_H_
+#define TUT_UPSTREAM_POOL_H_
+
+#include "Common.h"
+
+#include <event2/event.h>
+#include <event2/bufferevent.h>
+
+#include "Config.h"
+#include "Routes.h"
+
+//
+// the endpoints of a route. a new stream goes to the endpoint picked by the
+// balance policy among the ones in rotation; an endpoint whose connects keep
+// failing or timing out is ejected for a while, twice as long each time in a
+// row. with more than one endpoint, each is also checked in the background:
+// a tcp connect, optionally a stratum request answered, a passed check puts
+// an ejected endpoint back.
+//
+#define UPSTREAM_BALANCE_LEAST_CONN  0  // fewest open streams
+#define UPSTREAM_BALANCE_LATENCY     1  // connect rtt x (open streams + 1)
+
+#define UPSTREAM_PROBE_TCP      0  // the connect
+#define UPSTREAM_PROBE_STRATUM  1  // mining.subscribe answered with json
+
+struct UpstreamPoolParams {
+  int     balance_;
+  int32_t connectTimeout_;  // ms, of the streams, 0: none
+  int32_t checkInterval_;   // ms, 0: no active checks
+  int32_t checkTimeout_;    // ms
+  int     checkProbe_;
+  int     ejectFailures_;   // in a row
+  int32_t ejectTime_;       // ms, the first time
+
+  UpstreamPoolParams();
+
+  // keys of kUpstreamPoolSchema
+  void load(const Config &conf);
+  bool operator!=(const UpstreamPoolParams &p) const;
+};
+
+// upstream_balance, upstream_connect_timeout, upstream_check_interval,
+// upstream_check_timeout, upstream_check_probe, upstream_eject_failures,
+// upstream_eject_time
+extern const ConfigField kUpstreamPoolSchema[];
+
+
+class UpstreamPool;
+
+////////////////////////////// UpstreamEndpoint ///////////////////////////////
+struct UpstreamEndpoint {
+  UpstreamPool  *pool_;
+  RouteUpstream  conf_;
+  string         name_;  // host:port
+
+  int      active_;        // open streams
+  IINT64   connectRtt_;    // ms, EWMA of connects & checks, -1: unknown
+  int      failures_;      // in a row
+  int      ejections_;     // in a row
+  IINT64   ejectedUntil_;  // 0: in rotation
+  uint64_t picks_;
+  uint64_t connectFailures_;
+  uint64_t checkFailures_;
+
+  // the running check, nullptr: none
+  struct bufferevent *check_;
+  IINT64 checkStart_;
+  IINT64 checkRtt_;  // of its connect
+
+  UpstreamEndpoint(UpstreamPool *pool, const RouteUpstream &conf);
+  ~UpstreamEndpoint();
+
+  bool isEjected(const IINT64 now) const { return ejectedUntil_ > now; }
+};
+
+
+//////////////////////////////// UpstreamPool //////////////////////////////////
+class UpstreamPool {
+  struct event_base *base_;
+  uint16_t route_;
+  UpstreamPoolParams params_;
+  vector<UpstreamEndpoint *> endpoints_;
+  size_t next_;                // round robin among equals
+  struct event *checkTimer_;
+
+  UpstreamEndpoint *find(const string &name) const;
+  void resetCheckTimer();
+  void startCheck(UpstreamEndpoint *ep);
+  void finishCheck(UpstreamEndpoint *ep, const bool ok, const char *why);
+  void onSuccess(UpstreamEndpoint *ep, const IINT64 rtt);
+  void onFailure(UpstreamEndpoint *ep, const IINT64 now);
+
+  UpstreamPool(const UpstreamPool &);
+  UpstreamPool &operator=(const UpstreamPool &);
+
+public:
+  UpstreamPool(struct event_base *base, const uint16_t route);
+  ~UpstreamPool();
+
+  void setParams(const UpstreamPoolParams &params);
+  // endpoints of the same name keep their state & open streams
+  void setEndpoints(const vector<RouteUpstream> &endpoints);
+  size_t size() const { return endpoints_.size(); }
+
+  //
+  // the endpoint of a new stream, counted as open until release().
+  // all ejected: the one back first. nullptr: no endpoints.
+  //
+  UpstreamEndpoint *pick(const IINT64 now);
+  // the connect of a stream, by the endpoint name (it may be gone after a
+  // reload)
+  void connectDone(const string &name, const bool ok, const IINT64 rtt);
+  void release(const string &name);
+
+  // a line per endpoint, for the control socket
+  string stats(const IINT64 now) const;
+
+  static void cb_checkTimer(evutil_socket_t fd, short events, void *ptr);
+  static void cb_checkRead(struct bufferevent *bev, void *ptr);
+  static void cb_checkEvent(struct bufferevent *bev, short events, void *ptr);
+};
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+//
+// tbench aead: cost of sealing & opening the tunnel's datagrams.
+//
+//   tbench aead [-n packets]
+//
+// for datagrams of 64 (acks), 512 and 1400 (full kcp segments) bytes:
+//
+//   memcpy        the copy into the send batch, the floor
+//   seal / open   AeadCodec, keyed once, a nonce per datagram
+//   seal rekeyed  a new context & key schedule per datagram, what the
+//                 pre-keyed contexts save
+//
+// cycles are TSC ticks (constant rate on modern x86), ns elsewhere.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+#include "Common.h"
+#include "TunnelCrypto.h"
+#include "Bench.h"
+
+static const size_t kBatch = 256;  // datagrams sealed ahead of an open pass
+
+static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static double nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct Result {
+  double ns_;
+  uint64_t cycles_;
+};
+
+static void report(const char *cipher, const char *op, const size_t size,
+                   const size_t n, const Result &r) {
+  printf("%-18s %-13s %5zu  %8.1f ns/pkt  %6.2f cycles/byte  %8.1f MB/s\n",
+         cipher, op, size, r.ns_ / n, (double)r.cycles_ / (n * size),
+         n * size / (r.ns_ / 1e9) / 1e6);
+}
+
+// both directions of one side, the peer's codec opens what this one seals
+static void setKeys(AeadCodec *sealer, AeadCodec *opener, const int cipher) {
+  uint8_t key[AEAD_MAX_KEY_LEN], salt[AEAD_SALT_LEN];
+  randomBytes(key, sizeof(key));
+  randomBytes(salt, sizeof(salt));
+  sealer->setKeys(cipher, key, salt, key, salt);
+  opener->setKeys(cipher, key, salt, key, salt);
+}
+
+static Result runMemcpy(const uint8_t *in, const size_t size, const size_t n) {
+  vector<uint8_t> out(size + AEAD_OVERHEAD);
+  const double t0 = nowNs();
+  const uint64_t c0 = cycles();
+  for (size_t i = 0; i < n; i++) {
+    memcpy(out.data(), in, size);
+    // keep the copy
+    __asm__ __volatile__("" : : "r"(out.data()) : "memory");
+  }
+  Result r = {nowNs() - t0, cycles() - c0};
+  return r;
+}
+
+static Result runSeal(const int cipher, const uint8_t *in, const size_t size,
+                      const size_t n) {
+  AeadCodec sealer, opener;
+  setKeys(&sealer, &opener, cipher);
+
+  size_t outLen;
+  const double t0 = nowNs();
+  const uint64_t c0 = cycles();
+  for (size_t i = 0; i < n; i++) {
+    sealer.seal(in, size, &outLen);
+  }
+  Result r = {nowNs() - t0, cycles() - c0};
+  return r;
+}
+
+static Result runSealRekeyed(const int cipher, const uint8_t *in,
+                             const size_t size, const size_t n) {
+  uint8_t key[AEAD_MAX_KEY_LEN], salt[AEAD_SALT_LEN];
+  randomBytes(key, sizeof(key));
+  randomBytes(salt, sizeof(salt));
+
+  AeadCodec codec;
+  size_t outLen;
+  const double t0 = nowNs();
+  const uint64_t c0 = cycles();
+  for (size_t i = 0; i < n; i++) {
+    codec.setKeys(cipher, key, salt, key, salt);
+    codec.seal(in, size, &outLen);
+  }
+  Result r = {nowNs() - t0, cycles() - c0};
+  return r;
+}
+
+static Result runOpen(const int cipher, const uint8_t *in, const size_t size,
+                      const size_t n) {
+  AeadCodec sealer, opener;
+  setKeys(&sealer, &opener, cipher);
+
+  const size_t sealedLen = size + AEAD_OVERHEAD;
+  vector<uint8_t> batch(kBatch * sealedLen);
+  Result r = {0, 0};
+  size_t outLen;
+  for (size_t done = 0; done < n; done += kBatch) {
+    const size_t cnt = std::min(kBatch, n - done);
+    for (size_t i = 0; i < cnt; i++) {
+      memcpy(batch.data() + i * sealedLen, sealer.seal(in, size, &outLen),
+             sealedLen);
+    }
+
+    const double t0 = nowNs();
+    const uint64_t c0 = cycles();
+    for (size_t i = 0; i < cnt; i++) {
+      if (opener.open(batch.data() + i * sealedLen, sealedLen,
+                      &outLen) == nullptr) {
+        fprintf(stderr, "open failure\n");
+        exit(1);
+      }
+    }
+    r.ns_     += nowNs() - t0;
+    r.cycles_ += cycles() - c0;
+  }
+  return r;
+}
+
+int benchAead(int argc, char **argv) {
+  size_t n = 200000;
+  int c;
+  while ((c = getopt(argc, argv, "n:h")) != -1) {
+    switch (c) {
+      case 'n':
+        n = strtoul(optarg, nullptr, 10);
+        break;
+      case 'h': default:
+        fprintf(stderr, "Usage:\n\ttbench aead [-n packets]\n");
+        return 1;
+    }
+  }
+  if (n == 0) {
+    fprintf(stderr, "packets should be > 0\n");
+    return 1;
+  }
+
+  printf("AES-NI & PCLMUL: %s, auto picks: %s\n",
+         cpuHasAesGcm() ? "yes" : "no",
+         aeadCipherName(aeadSelect(AEAD_AUTO, aeadOfferedFeatures(AEAD_AUTO))));
+
+  const size_t sizes[] = {64, 512, 1400};
+  const int ciphers[]  = {AEAD_AES_128_GCM, AEAD_CHACHA20_POLY1305};
+  for (size_t size : sizes) {
+    vector<uint8_t> in(size);
+    randomBytes(in.data(), size);
+
+    report("-", "memcpy", size, n, runMemcpy(in.data(), size, n));
+    for (int cipher : ciphers) {
+      const char *name = aeadCipherName(cipher);
+      report(name, "seal", size, n, runSeal(cipher, in.data(), size, n));
+      report(name, "open", size, n, runOpen(cipher, in.data(), size, n));
+      report(name, "seal rekeyed", size, n,
+             runSealRekeyed(cipher, in.data(), size, n));
+    }
+  }
+  return 0;
+}
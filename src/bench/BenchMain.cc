@@ -0,0 +1,46 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+//
+// tbench: micro benchmarks of the tunnel's hot paths.
+//
+//   tbench idle [-n sessions] [-o ops]   idle timeouts, see IdleTimeoutBench.cc
+//   tbench aead [-n packets]             datagram sealing, see AeadBench.cc
+//
+#include <stdio.h>
+#include <string.h>
+
+#include "Bench.h"
+
+int main(int argc, char **argv) {
+  if (argc >= 2) {
+    // the bench sees its name as argv[0]
+    if (strcmp(argv[1], "idle") == 0)
+      return benchIdle(argc - 1, argv + 1);
+    if (strcmp(argv[1], "aead") == 0)
+      return benchAead(argc - 1, argv + 1);
+  }
+  fprintf(stderr, "Usage:\n\ttbench idle [-n sessions] [-o ops]\n"
+          "\ttbench aead [-n packets]\n");
+  return 1;
+}
@@ -0,0 +1,238 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+//
+// tbench idle: cost of the tcp sessions' idle timeouts at scale.
+//
+//   tbench idle [-n sessions] [-o ops]
+//
+// every read or write of a session moves its idle timeout. bufferevent does
+// that with an event_add() of its read/write event, a min-heap update each
+// time; the tunnel stamps the session and re-checks it on a TimerWheel. this
+// runs the same random activity over N sessions with:
+//
+//   heap    two timers per session re-added on each read/write (bufferevent)
+//   common  the same on libevent's common timeouts (a queue per duration)
+//   wheel   cached time stamps, a TimerWheel re-check per session & period
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <event2/event.h>
+
+#include "Common.h"
+#include "TimerWheel.h"
+#include "Bench.h"
+
+static const int32_t kReadTimeout  = 900;  // s, the tclient/tserver defaults
+static const int32_t kWriteTimeout = 120;
+
+struct BenchSession {
+  struct event *readEv_;
+  struct event *writeEv_;
+  TimerWheelNode node_;
+  IINT64 lastRead_;
+  IINT64 lastWrite_;
+
+  BenchSession(): readEv_(nullptr), writeEv_(nullptr), node_(this),
+  lastRead_(0), lastWrite_(0) {}
+};
+
+struct Bench {
+  struct event_base *base_;
+  vector<BenchSession> sessions_;
+  size_t ops_;
+  // the wheel's re-check pass
+  TimerWheel *wheel_;
+  IINT64 virtualNow_;
+  uint64_t rechecks_;
+
+  Bench(const size_t n, const size_t ops):
+  base_(nullptr), sessions_(n), ops_(ops), wheel_(nullptr), virtualNow_(0),
+  rechecks_(0) {}
+};
+
+static double nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint32_t xorshift32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static void cb_noop(evutil_socket_t fd, short events, void *ptr) {
+}
+
+// timers, `common`: on common timeouts
+static void runTimers(Bench *b, const bool common, double *armNs, double *opNs) {
+  struct timeval readTv  = {kReadTimeout, 0};
+  struct timeval writeTv = {kWriteTimeout, 0};
+  const struct timeval *rtv = &readTv;
+  const struct timeval *wtv = &writeTv;
+  if (common) {
+    rtv = event_base_init_common_timeout(b->base_, &readTv);
+    wtv = event_base_init_common_timeout(b->base_, &writeTv);
+  }
+
+  double t0 = nowNs();
+  for (auto &s : b->sessions_) {
+    s.readEv_  = evtimer_new(b->base_, cb_noop, &s);
+    s.writeEv_ = evtimer_new(b->base_, cb_noop, &s);
+    event_add(s.readEv_,  rtv);
+    event_add(s.writeEv_, wtv);
+  }
+  *armNs = (nowNs() - t0) / b->sessions_.size();
+
+  uint32_t rnd = 2463534242u;
+  t0 = nowNs();
+  for (size_t i = 0; i < b->ops_; i++) {
+    const uint32_t r = xorshift32(&rnd);
+    BenchSession &s = b->sessions_[r % b->sessions_.size()];
+    if (r & 0x80000000u) {
+      event_add(s.readEv_, rtv);
+    } else {
+      event_add(s.writeEv_, wtv);
+    }
+  }
+  *opNs = (nowNs() - t0) / b->ops_;
+
+  for (auto &s : b->sessions_) {
+    event_free(s.readEv_);
+    event_free(s.writeEv_);
+    s.readEv_ = s.writeEv_ = nullptr;
+  }
+}
+
+// a re-check finds the session active: its stamp moved, schedule it again
+static void cb_recheck(TimerWheelNode *node, void *ptr) {
+  Bench *b = static_cast<Bench *>(ptr);
+  BenchSession *s = static_cast<BenchSession *>(node->owner_);
+  b->rechecks_++;
+
+  s->lastRead_ = s->lastWrite_ = b->virtualNow_;
+  b->wheel_->schedule(node, s->lastWrite_ + (IINT64)kWriteTimeout * 1000);
+}
+
+static void runWheel(Bench *b, double *armNs, double *opNs, double *recheckNs) {
+  const IINT64 start = cachedClock64(b->base_);
+  TimerWheel wheel(IDLE_WHEEL_SLOTS, IDLE_WHEEL_TICK, start);
+  b->wheel_ = &wheel;
+
+  double t0 = nowNs();
+  for (auto &s : b->sessions_) {
+    s.lastRead_ = s.lastWrite_ = start;
+    wheel.schedule(&s.node_, start + (IINT64)kWriteTimeout * 1000);
+  }
+  *armNs = (nowNs() - t0) / b->sessions_.size();
+
+  uint32_t rnd = 2463534242u;
+  t0 = nowNs();
+  for (size_t i = 0; i < b->ops_; i++) {
+    const uint32_t r = xorshift32(&rnd);
+    BenchSession &s = b->sessions_[r % b->sessions_.size()];
+    if (r & 0x80000000u) {
+      s.lastRead_ = cachedClock64(b->base_);
+    } else {
+      s.lastWrite_ = cachedClock64(b->base_);
+    }
+  }
+  *opNs = (nowNs() - t0) / b->ops_;
+
+  //
+  // the price of the laziness: every active session comes back once per
+  // timeout period. run the wheel through two periods tick by tick, each
+  // re-check schedules the session again.
+  //
+  b->rechecks_ = 0;
+  t0 = nowNs();
+  for (IINT64 t = start; t <= start + 2 * (IINT64)kWriteTimeout * 1000;
+       t += IDLE_WHEEL_TICK) {
+    b->virtualNow_ = t;
+    wheel.advance(t, cb_recheck, b);
+  }
+  *recheckNs = b->rechecks_ ? (nowNs() - t0) / b->rechecks_ : 0;
+  b->wheel_ = nullptr;
+}
+
+static void cb_run(evutil_socket_t fd, short events, void *ptr) {
+  Bench *b = static_cast<Bench *>(ptr);
+  double arm, op, recheck;
+
+  printf("sessions: %zu, ops: %zu (random reads/writes), timeouts: %ds/%ds\n\n",
+         b->sessions_.size(), b->ops_, kReadTimeout, kWriteTimeout);
+  printf("%-8s %16s %16s\n", "mode", "arm ns/session", "activity ns/op");
+
+  runTimers(b, false, &arm, &op);
+  printf("%-8s %16.1f %16.1f\n", "heap", arm, op);
+
+  runTimers(b, true, &arm, &op);
+  printf("%-8s %16.1f %16.1f\n", "common", arm, op);
+
+  runWheel(b, &arm, &op, &recheck);
+  printf("%-8s %16.1f %16.1f   + %.1f ns per re-check, one per session & %ds\n",
+         "wheel", arm, op, recheck, kWriteTimeout);
+
+  event_base_loopbreak(b->base_);
+}
+
+int benchIdle(int argc, char **argv) {
+  size_t n   = 50000;
+  size_t ops = 5000000;
+  int c;
+  while ((c = getopt(argc, argv, "n:o:h")) != -1) {
+    switch (c) {
+      case 'n':
+        n = strtoul(optarg, nullptr, 10);
+        break;
+      case 'o':
+        ops = strtoul(optarg, nullptr, 10);
+        break;
+      case 'h': default:
+        fprintf(stderr, "Usage:\n\ttbench idle [-n sessions] [-o ops]\n");
+        return 1;
+    }
+  }
+  if (n == 0 || ops == 0) {
+    fprintf(stderr, "sessions and ops should be > 0\n");
+    return 1;
+  }
+
+  Bench b(n, ops);
+  b.base_ = event_base_new();
+
+  // run inside the loop, so both sides see the cached time as in the tunnel
+  struct timeval zero = {0, 0};
+  event_base_once(b.base_, -1, EV_TIMEOUT, cb_run, &b, &zero);
+  event_base_dispatch(b.base_);
+
+  event_base_free(b.base_);
+  return 0;
+}
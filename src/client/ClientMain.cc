@@ -28,16 +28,43 @@
 #include <errno.h>
 #include <unistd.h>
 
-#include <fstream>
-#include <streambuf>
-
 #include <glog/logging.h>
 
 #include "Client.h"
-#include "utilities_js.hpp"
+#include "Config.h"
 
 Client *gClient = nullptr;
 
+// keys of tclient_conf.json, also see kSocketOptionsSchema, kKcpParamsSchema
+// & kRateLimitSchema
+static const ConfigField kClientConfSchema[] = {
+  {"upstream_udp_host",   CONF_STR,  CONF_REQUIRED, nullptr, 0, 0, nullptr},
+  {"upstream_udp_port",   CONF_INT,  CONF_REQUIRED, nullptr, 1, 65535, nullptr},
+  {"upstream_udp_family", CONF_ENUM, 0, "\"any\"", 0, 0, "any|ipv4|ipv6|fastest"},
+  {"listen_tcp_ip",       CONF_STR,  CONF_REQUIRED, nullptr, 0, 0, nullptr},
+  {"listen_tcp_port",     CONF_INT,  CONF_REQUIRED, nullptr, 1, 65535, nullptr},
+  {"tcp_listeners",       CONF_ARRAY, 0, "[]", 0, 0, nullptr},
+  {"stream_open_status",  CONF_BOOL, 0, "false", 0, 0, nullptr},
+  {"stream_open_retries", CONF_INT,  0, "1", 0, 10, nullptr},
+  {"stream_preopen",      CONF_INT,  0, "0", 0, 64, nullptr},
+  {"tcp_read_timeout",    CONF_INT,  CONF_RELOADABLE, "900", 0, 86400, nullptr},
+  {"tcp_write_timeout",   CONF_INT,  CONF_RELOADABLE, "120", 0, 86400, nullptr},
+  {"io_engine",           CONF_ENUM, 0, "\"libevent\"", 0, 0, "libevent|io_uring"},
+  {"log_async",           CONF_BOOL, 0, "true", 0, 0, nullptr},
+  {"log_payload_sample",  CONF_INT,  CONF_RELOADABLE, "0", 0, UINT32_MAX, nullptr},
+  {"control_socket",      CONF_STR,  0, "\"\"", 0, 0, nullptr},
+  {"capture_packets",     CONF_INT,  0, "0", 0, 1048576, nullptr},
+  {"capture_snaplen",     CONF_INT,  0, "64", 24, PMTU_MAX_LIMIT, nullptr},
+  {"capture_path",        CONF_STR,  0, "\"/tmp/tclient\"", 0, 0, nullptr},
+  {"pmtu_discovery",      CONF_BOOL, 0, "true", 0, 0, nullptr},
+  {"pmtu_max",            CONF_INT,  0, "1472", PMTU_MIN, PMTU_MAX_LIMIT, nullptr},
+  {"udp_checksum",        CONF_BOOL, 0, "false", 0, 0, nullptr},
+  {"kcp_compact_header",  CONF_BOOL, 0, "false", 0, 0, nullptr},
+  {"tunnel_ping_interval", CONF_INT, 0, "0", 0, 600000, nullptr},
+  {"stream_notify_delta", CONF_BOOL, 0, "false", 0, 0, nullptr},
+  {nullptr}
+};
+
 void handler(int sig) {
   if (gClient) {
     gClient->stop();
@@ -85,20 +112,92 @@ int main(int argc, char **argv) {
   signal(SIGINT,  handler);
 
   try {
-    JsonNode j;  // conf json
-    // parse xxxx.json
-    std::ifstream agentConf(optConf);
-    string agentJsonStr((std::istreambuf_iterator<char>(agentConf)),
-                        std::istreambuf_iterator<char>());
-    if (!JsonNode::parse(agentJsonStr.c_str(),
-                         agentJsonStr.c_str() + agentJsonStr.length(), j)) {
-      LOG(ERROR) << "json decode failure";
+    Config conf;
+    conf.addSchema(kClientConfSchema);
+    conf.addSchema(kSocketOptionsSchema);
+    conf.addSchema(kKcpParamsSchema);
+    conf.addSchema(kRateLimitSchema);
+    conf.addSchema(kTunnelCryptoSchema);
+    if (!conf.load(optConf)) {
+      LOG(ERROR) << "load config failure: " << optConf;
       exit(EXIT_FAILURE);
     }
 
-    gClient = new Client(j["upstream_udp_host"].str(),  j["upstream_udp_port"].uint16(),
-                         j["listen_tcp_ip"].str(),      j["listen_tcp_port"].uint16(),
-                         j["tcp_read_timeout"].int32(), j["tcp_write_timeout"].int32());
+    // payload logging is off unless sampled, it's expensive on hot paths
+    gLogPayloadSample = (uint32_t)conf.getInt("log_payload_sample");
+    // write & flush log files in a background thread
+    if (conf.getBool("log_async")) {
+      FLAGS_logbuflevel = 0;  // buffer INFO, the flushing is not on the loop
+      installAsyncLogger();
+    }
+
+    gClient = new Client(conf.getStr("upstream_udp_host"),
+                         (uint16_t)conf.getInt("upstream_udp_port"),
+                         conf.getStr("listen_tcp_ip"),
+                         (uint16_t)conf.getInt("listen_tcp_port"),
+                         (int32_t)conf.getInt("tcp_read_timeout"),
+                         (int32_t)conf.getInt("tcp_write_timeout"));
+
+    int family;
+    parseAddrFamily(conf.getStr("upstream_udp_family"), &family);
+    gClient->setUpstreamFamily(family);
+    gClient->setIoEngine(conf.getStr("io_engine"));
+
+    // more listeners, their streams go to the upstream of their route
+    vector<RouteListener> listeners;
+    if (!parseRouteListeners(conf.getValue("tcp_listeners"), &listeners)) {
+      exit(EXIT_FAILURE);
+    }
+    gClient->addListeners(listeners);
+
+    // the server answers each open, failed ones are opened again or the
+    // miner is closed right away. streams may be opened ahead of accepts.
+    const int preopen = (int)conf.getInt("stream_preopen");
+    gClient->setStreamOpen(conf.getBool("stream_open_status") || preopen > 0,
+                           (int)conf.getInt("stream_open_retries"), preopen);
+
+    SocketOptions opts;
+    opts.load(conf);
+    gClient->setSocketOptions(opts);
+
+    KcpParams kcpParams;
+    kcpParams.load(conf);
+    gClient->setKcpParams(kcpParams);
+
+    // bytes/s, 0: unlimited
+    RateLimits rateLimits;
+    rateLimits.load(conf);
+    gClient->setRateLimits(rateLimits);
+
+    // pre-shared key of the hello & the session keys, empty: plaintext
+    int cipher;
+    if (!parseAeadCipher(conf.getStr("tunnel_cipher"), &cipher)) {
+      exit(EXIT_FAILURE);
+    }
+    gClient->setTunnelKey(conf.getStr("tunnel_key"), cipher);
+    // crc32c trailer on the datagrams without a cipher, new servers only
+    gClient->setUdpChecksum(conf.getBool("udp_checksum"));
+    // varint kcp headers without the conv, when both sides have it
+    gClient->setCompactHeader(conf.getBool("kcp_compact_header"));
+    // keep-alive, rtt & loss by datagrams beside kcp (ms, 0: kcp keep-alive)
+    gClient->setPingInterval((int32_t)conf.getInt("tunnel_ping_interval"));
+    // mining.notify as deltas of the previous one, new servers only
+    gClient->setNotifyDelta(conf.getBool("stream_notify_delta"));
+
+    gClient->setPmtuDiscovery(conf.getBool("pmtu_discovery"),
+                              (uint16_t)conf.getInt("pmtu_max"));
+
+    // unix socket path of runtime commands, empty: off
+    gClient->setControlSocket(conf.getStr("control_socket"));
+
+    // ring of the last udp datagrams, dumped to <capture_path>-<time>.pcapng
+    // on SIGUSR1 or the control command "capture"
+    gClient->setCapture((size_t)conf.getInt("capture_packets"),
+                        (uint16_t)conf.getInt("capture_snaplen"),
+                        conf.getStr("capture_path"));
+
+    // SIGHUP reloads the CONF_RELOADABLE keys
+    gClient->setConfig(conf);
 
     if (!gClient->setup()) {
       LOG(ERROR) << "setup failure";
@@ -106,6 +205,7 @@ int main(int argc, char **argv) {
       gClient->run();
     }
     delete gClient;
+    shutdownAsyncLogger();
   }
   catch (std::exception & e) {
     LOG(FATAL) << "exception: " << e.what();
@@ -43,6 +43,13 @@ const IUINT32 IKCP_THRESH_INIT = 2;
 const IUINT32 IKCP_THRESH_MIN = 2;
 const IUINT32 IKCP_PROBE_INIT = 7000;		// 7 secs to probe window size
 const IUINT32 IKCP_PROBE_LIMIT = 120000;	// up to 120 secs to probe window
+const IUINT32 IKCP_RESEND_RTO = 1;		// seg cause: resent by rto
+const IUINT32 IKCP_RESEND_FAST = 2;		// seg cause: duplicated acks
+const IUINT32 IKCP_RESEND_RACK = 3;		// seg cause: rack
+const IUINT32 IKCP_RESEND_TLP = 4;		// seg cause: tail loss probe
+const IUINT32 IKCP_FASTRESEND_MAX = 16;	// adaptive fast resend limit
+const IUINT32 IKCP_REO_MULT_MAX = 4;	// reordering window: srtt/4 * mult
+const IUINT32 IKCP_REO_PERSIST = 16;	// real losses before stepping back
 
 
 //---------------------------------------------------------------------
@@ -252,6 +259,7 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
 	kcp->mtu = IKCP_MTU_DEF;
 	kcp->mss = kcp->mtu - IKCP_OVERHEAD;
 	kcp->stream = 0;
+	kcp->tag_pin = 0;
 
 	kcp->buffer = (char*)ikcp_malloc((kcp->mtu + IKCP_OVERHEAD) * 3);
 	if (kcp->buffer == NULL) {
@@ -271,6 +279,26 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
 	kcp->acklist = NULL;
 	kcp->ackblock = 0;
 	kcp->ackcount = 0;
+	kcp->ack_delay = 0;
+	kcp->ack_every = 0;
+	kcp->ack_implicit = 0;
+	kcp->ts_ack = 0;
+	kcp->rack = 0;
+	kcp->rack_ok = 0;
+	kcp->rack_ts = 0;
+	kcp->rack_sn = 0;
+	kcp->rack_rtt = 0;
+	kcp->tlp = 0;
+	kcp->tlp_armed = 0;
+	kcp->ts_tlp = 0;
+	kcp->rack_xmit = 0;
+	kcp->tlp_xmit = 0;
+	kcp->fastresend_adj = 0;
+	kcp->reo_mult = 1;
+	kcp->reo_persist = 0;
+	kcp->spurious_fast = 0;
+	kcp->spurious_rack = 0;
+	kcp->spurious_rto = 0;
 	kcp->rx_srtt = 0;
 	kcp->rx_rttval = 0;
 	kcp->rx_rto = IKCP_RTO_DEF;
@@ -456,6 +484,11 @@ int ikcp_peeksize(const ikcpcb *kcp)
 // user/upper level send, returns below zero for error
 //---------------------------------------------------------------------
 int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
+{
+	return ikcp_send_tag(kcp, buffer, len, 0);
+}
+
+int ikcp_send_tag(ikcpcb *kcp, const char *buffer, int len, IUINT32 tag)
 {
 	IKCPSEG *seg;
 	int count, i;
@@ -483,6 +516,7 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 				}
 				seg->len = old->len + extend;
 				seg->frg = 0;
+				seg->tag = 0;
 				len -= extend;
 				iqueue_del_init(&old->node);
 				ikcp_segment_delete(kcp, old);
@@ -513,6 +547,7 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 		}
 		seg->len = size;
 		seg->frg = (kcp->stream == 0)? (count - i - 1) : 0;
+		seg->tag = (kcp->stream == 0 && count == 1)? tag : 0;
 		iqueue_init(&seg->node);
 		iqueue_add_tail(&seg->node, &kcp->snd_queue);
 		kcp->nsnd_que++;
@@ -526,6 +561,60 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 }
 
 
+//---------------------------------------------------------------------
+// supersede tagged messages
+//---------------------------------------------------------------------
+int ikcp_supersede(ikcpcb *kcp, IUINT32 tag, const char *filler, int len,
+	int *replaced)
+{
+	struct IQUEUEHEAD *p, *next;
+	int dropped = 0, refilled = 0;
+
+	if (replaced) *replaced = 0;
+	if (tag == 0 || len < 0) return 0;
+
+	// no sn yet, nothing to fill
+	for (p = kcp->snd_queue.next; p != &kcp->snd_queue; p = next) {
+		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
+		next = p->next;
+		if (seg->tag == tag) {
+			iqueue_del(p);
+			ikcp_segment_delete(kcp, seg);
+			kcp->nsnd_que--;
+			dropped++;
+		}
+	}
+
+	// sent, the receiver may have it already: same sn, smaller payload
+	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
+		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
+		if (seg->tag == tag && len <= (int)seg->len) {
+			if (len > 0) memcpy(seg->data, filler, len);
+			seg->len = len;
+			seg->tag = 0;
+			refilled++;
+		}
+	}
+
+	if (replaced) *replaced = refilled;
+	return dropped;
+}
+
+int ikcp_tagged(const ikcpcb *kcp, IUINT32 tag)
+{
+	const struct IQUEUEHEAD *p;
+	int count = 0;
+	if (tag == 0) return 0;
+	for (p = kcp->snd_queue.next; p != &kcp->snd_queue; p = p->next) {
+		if (iqueue_entry(p, IKCPSEG, node)->tag == tag) count++;
+	}
+	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
+		if (iqueue_entry(p, IKCPSEG, node)->tag == tag) count++;
+	}
+	return count;
+}
+
+
 //---------------------------------------------------------------------
 // parse ack
 //---------------------------------------------------------------------
@@ -557,7 +646,102 @@ static void ikcp_shrink_buf(ikcpcb *kcp)
 	}
 }
 
-static void ikcp_parse_ack(ikcpcb *kcp, IUINT32 sn)
+//---------------------------------------------------------------------
+// rack: remember the latest sent segment known delivered, 'ts' is when
+// it was sent (the ack echoes the one of the transmission it acks)
+//---------------------------------------------------------------------
+static void ikcp_rack_deliver(ikcpcb *kcp, IUINT32 sn, IUINT32 ts)
+{
+	if (_itimediff(kcp->current, ts) < 0) return;
+	if (kcp->rack_ok) {
+		if (_itimediff(ts, kcp->rack_ts) < 0) return;
+		if (ts == kcp->rack_ts && _itimediff(sn, kcp->rack_sn) <= 0) return;
+	}
+	kcp->rack_ok = 1;
+	kcp->rack_ts = ts;
+	kcp->rack_sn = sn;
+	kcp->rack_rtt = _itimediff(kcp->current, ts);
+}
+
+// sent no later than the rack segment: lost once its deadline has passed.
+// ts is in millisec, the segments of one flush share it, so the tail of
+// a flush is caught as well as the ones before the acked segment
+static int ikcp_rack_before(const ikcpcb *kcp, const IKCPSEG *seg)
+{
+	if (kcp->rack == 0 || kcp->rack_ok == 0 || seg->xmit == 0) return 0;
+	return _itimediff(seg->ts, kcp->rack_ts) <= 0;
+}
+
+static IUINT32 ikcp_rack_deadline(const ikcpcb *kcp, const IKCPSEG *seg)
+{
+	IUINT32 reo_wnd = _imax_(kcp->rx_srtt / 4 * kcp->reo_mult, kcp->rx_rttval);
+	reo_wnd = _ibound_(1, reo_wnd, kcp->rx_srtt);
+	return seg->ts + kcp->rack_rtt + reo_wnd;
+}
+
+// tlp: probe timeout. like max_ack_delay of RFC 8985 it covers how long
+// the peer may hold an ack: until its next flush, plus its ack delay for
+// a lone segment. the peer is assumed to run our interval and ack policy
+static IUINT32 ikcp_tlp_timeout(const ikcpcb *kcp)
+{
+	IUINT32 pto = 2 * kcp->rx_srtt + kcp->interval;
+	pto += kcp->interval;
+	if (kcp->nsnd_buf == 1) pto += kcp->ack_delay;
+	return pto;
+}
+
+//---------------------------------------------------------------------
+// spurious resend: the ack echoes the ts of an earlier sending than the
+// last one, that earlier one made it and the resend was not needed
+//---------------------------------------------------------------------
+static void ikcp_spurious(ikcpcb *kcp, const IKCPSEG *seg, IUINT32 ts)
+{
+	if (seg->xmit < 2 || seg->cause == IKCP_RESEND_TLP) return;
+
+	if (_itimediff(ts, seg->ts) >= 0) {
+		// a real loss, the thresholds step back after a run of them
+		if (seg->cause != IKCP_RESEND_RTO &&
+			++kcp->reo_persist >= IKCP_REO_PERSIST) {
+			kcp->reo_persist = 0;
+			if (kcp->fastresend_adj > 0) kcp->fastresend_adj--;
+			if (kcp->reo_mult > 1) kcp->reo_mult--;
+		}
+		return;
+	}
+
+	kcp->reo_persist = 0;
+	if (seg->cause == IKCP_RESEND_FAST) {
+		// reordered deeper than fastresend
+		kcp->spurious_fast++;
+		if (kcp->fastresend + kcp->fastresend_adj < IKCP_FASTRESEND_MAX)
+			kcp->fastresend_adj++;
+	}
+	else if (seg->cause == IKCP_RESEND_RACK) {
+		kcp->spurious_rack++;
+		if (kcp->reo_mult < IKCP_REO_MULT_MAX) kcp->reo_mult++;
+	}
+	else if (seg->cause == IKCP_RESEND_RTO) {
+		// the rto was too short, take this delay as the deviation
+		IINT32 rtt = _itimediff(kcp->current, ts);
+		kcp->spurious_rto++;
+		if (rtt > kcp->rx_srtt && rtt - kcp->rx_srtt > kcp->rx_rttval) {
+			kcp->rx_rttval = rtt - kcp->rx_srtt;
+			kcp->rx_rto = _ibound_(kcp->rx_minrto,
+				kcp->rx_srtt + 4 * kcp->rx_rttval, IKCP_RTO_MAX);
+		}
+	}
+}
+
+static void ikcp_untag_before(ikcpcb *kcp, struct IQUEUEHEAD *end, IUINT32 tag)
+{
+	struct IQUEUEHEAD *p;
+	for (p = kcp->snd_buf.next; p != end; p = p->next) {
+		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
+		if (seg->tag == tag) seg->tag = 0;
+	}
+}
+
+static void ikcp_parse_ack(ikcpcb *kcp, IUINT32 sn, IUINT32 ts)
 {
 	struct IQUEUEHEAD *p, *next;
 
@@ -568,6 +752,10 @@ static void ikcp_parse_ack(ikcpcb *kcp, IUINT32 sn)
 		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
 		next = p->next;
 		if (sn == seg->sn) {
+			ikcp_spurious(kcp, seg, ts);
+			// the receiver may rely on the earlier ones of its tag now
+			if (seg->tag != 0 && kcp->tag_pin)
+				ikcp_untag_before(kcp, p, seg->tag);
 			iqueue_del(p);
 			ikcp_segment_delete(kcp, seg);
 			kcp->nsnd_buf--;
@@ -586,6 +774,8 @@ static void ikcp_parse_una(ikcpcb *kcp, IUINT32 una)
 		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
 		next = p->next;
 		if (_itimediff(una, seg->sn) > 0) {
+			// a resent one is ambiguous, its ts is of the last sending
+			if (seg->xmit == 1) ikcp_rack_deliver(kcp, seg->sn, seg->ts);
 			iqueue_del(p);
 			ikcp_segment_delete(kcp, seg);
 			kcp->nsnd_buf--;
@@ -651,6 +841,9 @@ static void ikcp_ack_push(ikcpcb *kcp, IUINT32 sn, IUINT32 ts)
 	ptr = &kcp->acklist[kcp->ackcount * 2];
 	ptr[0] = sn;
 	ptr[1] = ts;
+	if (kcp->ackcount == 0) {
+		kcp->ts_ack = kcp->current + kcp->ack_delay;
+	}
 	kcp->ackcount++;
 }
 
@@ -733,6 +926,7 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 int ikcp_input(ikcpcb *kcp, const char *data, long size)
 {
 	IUINT32 una = kcp->snd_una;
+	IUINT32 nsnd_buf = kcp->nsnd_buf;
 	IUINT32 maxack = 0;
 	int flag = 0;
 
@@ -770,6 +964,17 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 			return -3;
 
 		kcp->rmt_wnd = wnd;
+
+		// the ack before una, which may cover it too: the segment still
+		// tells which of its sendings is acked
+		if (cmd == IKCP_CMD_ACK) {
+			if (_itimediff(sn, kcp->snd_una) >= 0 &&
+				_itimediff(sn, kcp->snd_nxt) < 0) {
+				ikcp_rack_deliver(kcp, sn, ts);
+			}
+			ikcp_parse_ack(kcp, sn, ts);
+		}
+
 		ikcp_parse_una(kcp, una);
 		ikcp_shrink_buf(kcp);
 
@@ -777,8 +982,6 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 			if (_itimediff(kcp->current, ts) >= 0) {
 				ikcp_update_ack(kcp, _itimediff(kcp->current, ts));
 			}
-			ikcp_parse_ack(kcp, sn);
-			ikcp_shrink_buf(kcp);
 			if (flag == 0) {
 				flag = 1;
 				maxack = sn;
@@ -847,6 +1050,12 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 		ikcp_parse_fastack(kcp, maxack);
 	}
 
+	// something got acked, allow one more tail loss probe
+	if (kcp->nsnd_buf < nsnd_buf) {
+		kcp->tlp_armed = 1;
+		kcp->ts_tlp = kcp->current + ikcp_tlp_timeout(kcp);
+	}
+
 	if (_itimediff(kcp->snd_una, una) > 0) {
 		if (kcp->cwnd < kcp->rmt_wnd) {
 			IUINT32 mss = kcp->mss;
@@ -895,6 +1104,41 @@ static int ikcp_wnd_unused(const ikcpcb *kcp)
 	return 0;
 }
 
+//---------------------------------------------------------------------
+// ikcp_ack_due: flush the pending acks now, or hold them (delayed ack)
+//---------------------------------------------------------------------
+static int ikcp_ack_due(const ikcpcb *kcp, IUINT32 cwnd)
+{
+	struct IQUEUEHEAD *p;
+	IUINT32 i;
+
+	if (kcp->ackcount == 0) return 0;
+	if (kcp->ack_delay == 0) return 1;
+	if (_itimediff(kcp->current, kcp->ts_ack) >= 0) return 1;
+	if (kcp->ack_every > 0 && kcp->ackcount >= kcp->ack_every) return 1;
+
+	// a hole: the sender needs them for fast resend
+	for (i = 0; i < kcp->ackcount; i++) {
+		if (_itimediff(kcp->acklist[i * 2], kcp->rcv_nxt) >= 0) return 1;
+	}
+
+	// data goes out in this flush, they ride along
+	if (kcp->nsnd_que > 0 && _itimediff(kcp->snd_nxt, kcp->snd_una + cwnd) < 0)
+		return 1;
+	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
+		const IKCPSEG *seg = iqueue_entry(p, const IKCPSEG, node);
+		if (seg->xmit == 0 || _itimediff(kcp->current, seg->resendts) >= 0)
+			return 1;
+		if (kcp->fastresend > 0 &&
+			seg->fastack >= kcp->fastresend + kcp->fastresend_adj)
+			return 1;
+		if (ikcp_rack_before(kcp, seg) &&
+			_itimediff(kcp->current, ikcp_rack_deadline(kcp, seg)) >= 0)
+			return 1;
+	}
+	return 0;
+}
+
 
 //---------------------------------------------------------------------
 // ikcp_flush
@@ -910,7 +1154,9 @@ void ikcp_flush(ikcpcb *kcp)
 	struct IQUEUEHEAD *p;
 	int change = 0;
 	int lost = 0;
-	IKCPSEG seg;
+	IKCPSEG seg, *probe = NULL;
+	int keep = -1;
+	int sent = 0;
 
 	// 'ikcp_update' haven't been called. 
 	if (kcp->updated == 0) return;
@@ -924,19 +1170,41 @@ void ikcp_flush(ikcpcb *kcp)
 	seg.sn = 0;
 	seg.ts = 0;
 
-	// flush acknowledges
-	count = kcp->ackcount;
+	// calculate window size
+	cwnd = _imin_(kcp->snd_wnd, kcp->rmt_wnd);
+	if (kcp->nocwnd == 0) cwnd = _imin_(kcp->cwnd, cwnd);
+
+	// flush acknowledges, unless they are delayed
+	count = ikcp_ack_due(kcp, cwnd)? (int)kcp->ackcount : 0;
+
+	// una of every segment acks the ones below rcv_nxt, keep the newest
+	// of them for the sender's rtt
+	if (kcp->ack_implicit) {
+		for (i = 0; i < count; i++) {
+			IUINT32 sn, ts;
+			ikcp_ack_get(kcp, i, &sn, &ts);
+			if (_itimediff(sn, kcp->rcv_nxt) >= 0) continue;
+			if (keep < 0 || _itimediff(ts, kcp->acklist[keep * 2 + 1]) > 0)
+				keep = i;
+		}
+	}
+
 	for (i = 0; i < count; i++) {
+		ikcp_ack_get(kcp, i, &seg.sn, &seg.ts);
+		if (kcp->ack_implicit && i != keep &&
+			_itimediff(seg.sn, kcp->rcv_nxt) < 0)
+			continue;
 		size = (int)(ptr - buffer);
 		if (size + (int)IKCP_OVERHEAD > (int)kcp->mtu) {
 			ikcp_output(kcp, buffer, size);
 			ptr = buffer;
 		}
-		ikcp_ack_get(kcp, i, &seg.sn, &seg.ts);
 		ptr = ikcp_encode_seg(ptr, &seg);
 	}
 
-	kcp->ackcount = 0;
+	if (count > 0) {
+		kcp->ackcount = 0;
+	}
 
 	// probe window size (if remote window size equals zero)
 	if (kcp->rmt_wnd == 0) {
@@ -984,10 +1252,6 @@ void ikcp_flush(ikcpcb *kcp)
 
 	kcp->probe = 0;
 
-	// calculate window size
-	cwnd = _imin_(kcp->snd_wnd, kcp->rmt_wnd);
-	if (kcp->nocwnd == 0) cwnd = _imin_(kcp->cwnd, cwnd);
-
 	// move data from snd_queue to snd_buf
 	while (_itimediff(kcp->snd_nxt, kcp->snd_una + cwnd) < 0) {
 		IKCPSEG *newseg;
@@ -1010,12 +1274,24 @@ void ikcp_flush(ikcpcb *kcp)
 		newseg->rto = kcp->rx_rto;
 		newseg->fastack = 0;
 		newseg->xmit = 0;
+		newseg->cause = 0;
 	}
 
 	// calculate resent
-	resent = (kcp->fastresend > 0)? (IUINT32)kcp->fastresend : 0xffffffff;
+	resent = (kcp->fastresend > 0)?
+		(IUINT32)kcp->fastresend + kcp->fastresend_adj : 0xffffffff;
 	rtomin = (kcp->nodelay == 0)? (kcp->rx_rto >> 3) : 0;
 
+	// tail loss probe: nothing acked for a while, resend the last segment
+	// unless its rto is due anyway
+	if (kcp->tlp && kcp->tlp_armed && !iqueue_is_empty(&kcp->snd_buf) &&
+		_itimediff(current, kcp->ts_tlp) >= 0) {
+		probe = iqueue_entry(kcp->snd_buf.prev, IKCPSEG, node);
+		if (probe->xmit == 0 || _itimediff(current, probe->resendts) >= 0)
+			probe = NULL;
+		kcp->tlp_armed = 0;
+	}
+
 	// flush data segments
 	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
 		IKCPSEG *segment = iqueue_entry(p, IKCPSEG, node);
@@ -1025,6 +1301,7 @@ void ikcp_flush(ikcpcb *kcp)
 			segment->xmit++;
 			segment->rto = kcp->rx_rto;
 			segment->resendts = current + segment->rto + rtomin;
+			sent = 1;
 		}
 		else if (_itimediff(current, segment->resendts) >= 0) {
 			needsend = 1;
@@ -1036,6 +1313,7 @@ void ikcp_flush(ikcpcb *kcp)
 				segment->rto += kcp->rx_rto / 2;
 			}
 			segment->resendts = current + segment->rto;
+			segment->cause = IKCP_RESEND_RTO;
 			lost = 1;
 		}
 		else if (segment->fastack >= resent) {
@@ -1043,8 +1321,26 @@ void ikcp_flush(ikcpcb *kcp)
 			segment->xmit++;
 			segment->fastack = 0;
 			segment->resendts = current + segment->rto;
+			segment->cause = IKCP_RESEND_FAST;
+			change++;
+		}
+		else if (ikcp_rack_before(kcp, segment) &&
+			_itimediff(current, ikcp_rack_deadline(kcp, segment)) >= 0) {
+			needsend = 1;
+			segment->xmit++;
+			segment->fastack = 0;
+			segment->resendts = current + segment->rto;
+			segment->cause = IKCP_RESEND_RACK;
+			kcp->rack_xmit++;
 			change++;
 		}
+		else if (segment == probe) {
+			needsend = 1;
+			segment->xmit++;
+			segment->resendts = current + segment->rto;
+			segment->cause = IKCP_RESEND_TLP;
+			kcp->tlp_xmit++;
+		}
 
 		if (needsend) {
 			int size, need;
@@ -1079,13 +1375,19 @@ void ikcp_flush(ikcpcb *kcp)
 		ikcp_output(kcp, buffer, size);
 	}
 
+	// new data went out, it is the tail now
+	if (sent) {
+		kcp->tlp_armed = 1;
+		kcp->ts_tlp = current + ikcp_tlp_timeout(kcp);
+	}
+
 	// update ssthresh
 	if (change) {
 		IUINT32 inflight = kcp->snd_nxt - kcp->snd_una;
 		kcp->ssthresh = inflight / 2;
 		if (kcp->ssthresh < IKCP_THRESH_MIN)
 			kcp->ssthresh = IKCP_THRESH_MIN;
-		kcp->cwnd = kcp->ssthresh + resent;
+		kcp->cwnd = kcp->ssthresh + ((kcp->fastresend > 0)? resent : 0);
 		kcp->incr = kcp->cwnd * kcp->mss;
 	}
 
@@ -1169,9 +1471,29 @@ IUINT32 ikcp_check(const ikcpcb *kcp, IUINT32 current)
 
 	tm_flush = _itimediff(ts_flush, current);
 
+	if (kcp->ackcount > 0 && kcp->ack_delay > 0) {
+		IINT32 diff = _itimediff(kcp->ts_ack, current);
+		if (diff <= 0) {
+			return current;
+		}
+		tm_packet = diff;
+	}
+
+	if (kcp->tlp && kcp->tlp_armed && !iqueue_is_empty(&kcp->snd_buf)) {
+		IINT32 diff = _itimediff(kcp->ts_tlp, current);
+		if (diff <= 0) {
+			return current;
+		}
+		if (diff < tm_packet) tm_packet = diff;
+	}
+
 	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
 		const IKCPSEG *seg = iqueue_entry(p, const IKCPSEG, node);
 		IINT32 diff = _itimediff(seg->resendts, current);
+		if (ikcp_rack_before(kcp, seg)) {
+			IINT32 lost = _itimediff(ikcp_rack_deadline(kcp, seg), current);
+			if (lost < diff) diff = lost;
+		}
 		if (diff <= 0) {
 			return current;
 		}
@@ -1235,6 +1557,34 @@ int ikcp_nodelay(ikcpcb *kcp, int nodelay, int interval, int resend, int nc)
 }
 
 
+int ikcp_ackpolicy(ikcpcb *kcp, int delay, int every, int implicit)
+{
+	if (delay >= 0) {
+		if (delay > 5000) delay = 5000;
+		kcp->ack_delay = delay;
+	}
+	if (every >= 0) {
+		kcp->ack_every = every;
+	}
+	if (implicit >= 0) {
+		kcp->ack_implicit = implicit;
+	}
+	return 0;
+}
+
+
+int ikcp_lossdetect(ikcpcb *kcp, int rack, int tlp)
+{
+	if (rack >= 0) {
+		kcp->rack = rack;
+	}
+	if (tlp >= 0) {
+		kcp->tlp = tlp;
+	}
+	return 0;
+}
+
+
 int ikcp_wndsize(ikcpcb *kcp, int sndwnd, int rcvwnd)
 {
 	if (kcp) {
@@ -268,6 +268,8 @@ struct IKCPSEG
 	IUINT32 rto;
 	IUINT32 fastack;
 	IUINT32 xmit;
+	IUINT32 cause;
+	IUINT32 tag;
 	char data[1];
 };
 
@@ -295,10 +297,16 @@ struct IKCPCB
 	IUINT32 *acklist;
 	IUINT32 ackcount;
 	IUINT32 ackblock;
+	IUINT32 ack_delay, ack_every, ack_implicit, ts_ack;
+	IUINT32 rack, rack_ok, rack_ts, rack_sn, rack_rtt;
+	IUINT32 tlp, tlp_armed, ts_tlp;
+	IUINT32 rack_xmit, tlp_xmit;
+	IUINT32 fastresend_adj, reo_mult, reo_persist;
+	IUINT32 spurious_fast, spurious_rack, spurious_rto;
 	void *user;
 	char *buffer;
 	int fastresend;
-	int nocwnd, stream;
+	int nocwnd, stream, tag_pin;
 	int logmask;
 	int (*output)(const char *buf, int len, struct IKCPCB *kcp, void *user);
 	void (*writelog)(const char *log, struct IKCPCB *kcp, void *user);
@@ -342,6 +350,22 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len);
 // user/upper level send, returns below zero for error
 int ikcp_send(ikcpcb *kcp, const char *buffer, int len);
 
+// send with a supersession tag (0: none), kept only when the message fits
+// in one segment and not in stream mode
+int ikcp_send_tag(ikcpcb *kcp, const char *buffer, int len, IUINT32 tag);
+
+// cancel the messages of tag: the ones in snd_queue are dropped, the unacked
+// ones in snd_buf keep their sn and are resent with 'filler' as payload (not
+// longer than theirs), the receiver must take either. returns the dropped,
+// 'replaced' (may be NULL) gets the refilled. with kcp->tag_pin set, a
+// message is no longer cancelled once a later one of its tag is acked, for
+// a receiver that may have used that one along with it (0: default)
+int ikcp_supersede(ikcpcb *kcp, IUINT32 tag, const char *filler, int len,
+	int *replaced);
+
+// segments of tag that ikcp_supersede could still cancel
+int ikcp_tagged(const ikcpcb *kcp, IUINT32 tag);
+
 // update state (call it repeatedly, every 10ms-100ms), or you can ask 
 // ikcp_check when to call it again (without ikcp_input/_send calling).
 // 'current' - current timestamp in millisec. 
@@ -381,6 +405,28 @@ int ikcp_waitsnd(const ikcpcb *kcp);
 // nc: 0:normal congestion control(default), 1:disable congestion control
 int ikcp_nodelay(ikcpcb *kcp, int nodelay, int interval, int resend, int nc);
 
+// delayed ack: ikcp_ackpolicy(kcp, 20, 2, 1)
+// delay: hold acks up to delay millisec, 0:send them on each flush(default)
+// every: send them once every-th is pending, 0:only the delay counts
+// implicit: 1:drop the acks below rcv_nxt that una covers, but the newest
+// (rtt), 0:send them all(default)
+// acks of a hole, or along with data of the same flush, are never held
+int ikcp_ackpolicy(ikcpcb *kcp, int delay, int every, int implicit);
+
+// time based loss detection: ikcp_lossdetect(kcp, 1, 1)
+// rack: 1:resend a segment once one sent with or after it is acked and
+// rtt plus a reordering window has passed since it was sent, 0:disable
+// (default)
+// tlp: 1:resend the last segment once ~2*srtt, plus the time the peer may
+// hold the ack, pass without an ack, one probe each time data is acked,
+// 0:disable(default)
+int ikcp_lossdetect(ikcpcb *kcp, int rack, int tlp);
+
+// a resend turns out spurious when the ack echoes the ts of an earlier
+// sending, kcp counts them (spurious_fast/_rack/_rto) and backs off: the
+// fast resend threshold (fastresend_adj), the rack reordering window
+// (reo_mult) or the rto, stepping back after 16 real losses
+
 int ikcp_rcvbuf_count(const ikcpcb *kcp);
 int ikcp_sndbuf_count(const ikcpcb *kcp);
 
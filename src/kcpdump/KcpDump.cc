@@ -0,0 +1,380 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+//
+// kcpdump: decode the tunnel's kcp traffic in a capture file, offline.
+//
+//   kcpdump [-q] <file>
+//
+// the file: a pcapng written by the capture ring (SIGUSR1 / control command
+// "capture") or a pcap/pcapng taken by tcpdump on the udp port. every kcp
+// segment is printed with its header, the tunnel connIdx when it's the first
+// fragment of a message, retransmissions and the rtt of acks; -q prints the
+// per flow summary only.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+using std::map;
+using std::string;
+using std::vector;
+
+// ikcp.c
+#define IKCP_CMD_PUSH  81
+#define IKCP_CMD_ACK   82
+#define IKCP_CMD_WASK  83
+#define IKCP_CMD_WINS  84
+#define IKCP_OVERHEAD  24
+
+// Common.h
+#define KCP_CTRL_MAGIC    0x4c525443u
+#define HELLO_LEN         56
+#define LEGACY_HELLO_LEN  12
+
+#define LINKTYPE_ETHERNET  1
+#define LINKTYPE_RAW       101
+
+struct Packet {
+  uint64_t timeUs_;
+  const uint8_t *data_;  // link layer
+  uint32_t capLen_;
+  uint32_t origLen_;
+  int linkType_;
+};
+
+struct FlowStats {
+  uint64_t packets_;
+  uint64_t push_;
+  uint64_t retrans_;
+  uint64_t acks_;
+  uint64_t rttCount_;
+  uint64_t rttSumUs_;
+  uint64_t rttMaxUs_;
+
+  // sn -> (first send time, transmissions, frg)
+  struct Seg {
+    uint64_t lastSendUs_;
+    uint32_t xmit_;
+    uint8_t  frg_;
+  };
+  map<uint32_t, Seg> segs_;
+
+  FlowStats(): packets_(0), push_(0), retrans_(0), acks_(0),
+  rttCount_(0), rttSumUs_(0), rttMaxUs_(0) {}
+};
+
+static bool gQuiet = false;
+static map<string, FlowStats> gFlows;  // "src > dst" -> stats
+
+static uint32_t le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static uint16_t le16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static string addrString(int family, const uint8_t *ip, uint16_t port) {
+  char buf[INET6_ADDRSTRLEN];
+  inet_ntop(family, ip, buf, sizeof(buf));
+  char out[INET6_ADDRSTRLEN + 16];
+  snprintf(out, sizeof(out), family == AF_INET6 ? "[%s]:%u" : "%s:%u",
+           buf, port);
+  return string(out);
+}
+
+static const char *cmdName(uint8_t cmd) {
+  switch (cmd) {
+    case IKCP_CMD_PUSH: return "push";
+    case IKCP_CMD_ACK:  return "ack";
+    case IKCP_CMD_WASK: return "wask";
+    case IKCP_CMD_WINS: return "wins";
+  }
+  return "?";
+}
+
+static void decodeKcp(const Packet &pkt, const string &src, const string &dst,
+                      const uint8_t *p, uint32_t capLen, uint32_t len) {
+  const string flow    = src + " > " + dst;
+  const string reverse = dst + " > " + src;
+  FlowStats &fs = gFlows[flow];
+  fs.packets_++;
+
+  if (!gQuiet) {
+    printf("%llu.%06llu %s len %u\n",
+           (unsigned long long)(pkt.timeUs_ / 1000000),
+           (unsigned long long)(pkt.timeUs_ % 1000000), flow.c_str(), len);
+  }
+
+  // control datagrams
+  if (capLen >= 4 && le32(p) == 0) {
+    if (!gQuiet) {
+      if (capLen >= 9 && le32(p + 4) == KCP_CTRL_MAGIC) {
+        printf("  ctrl type %u\n", p[8]);
+      } else if (len == LEGACY_HELLO_LEN && capLen >= 12) {
+        printf("  init conv %u\n", le32(p + 4));
+      } else if (len == HELLO_LEN && capLen >= 16) {
+        printf("  hello conv %u features 0x%x\n", le32(p + 4), le32(p + 12));
+      } else {
+        printf("  unknown\n");
+      }
+    }
+    return;
+  }
+
+  uint32_t off = 0;
+  while (off + IKCP_OVERHEAD <= len) {
+    if (off + IKCP_OVERHEAD > capLen) {
+      if (!gQuiet) printf("  ... truncated\n");
+      return;
+    }
+    const uint8_t *s = p + off;
+    const uint32_t conv = le32(s);
+    const uint8_t  cmd  = s[4];
+    const uint8_t  frg  = s[5];
+    const uint16_t wnd  = le16(s + 6);
+    const uint32_t ts   = le32(s + 8);
+    const uint32_t sn   = le32(s + 12);
+    const uint32_t una  = le32(s + 16);
+    const uint32_t dlen = le32(s + 20);
+
+    string extra;
+    char buf[128];
+
+    if (cmd == IKCP_CMD_PUSH) {
+      fs.push_++;
+      FlowStats::Seg &seg = fs.segs_[sn];
+      seg.xmit_++;
+      seg.lastSendUs_ = pkt.timeUs_;
+      seg.frg_ = frg;
+      if (seg.xmit_ > 1) {
+        fs.retrans_++;
+        snprintf(buf, sizeof(buf), " RETRANS #%u", seg.xmit_ - 1);
+        extra += buf;
+      }
+
+      // the first fragment of a tunnel message: | len(2) | connIdx(2) |
+      auto prev = fs.segs_.find(sn - 1);
+      const bool first = (sn == 0 || (prev != fs.segs_.end() && prev->second.frg_ == 0));
+      const uint32_t dataOff = off + IKCP_OVERHEAD;
+      if (first && dlen >= 4 && dataOff + 4 <= capLen) {
+        const uint16_t connIdx = le16(p + dataOff + 2);
+        if (connIdx == 0) {
+          snprintf(buf, sizeof(buf), " option %u", dataOff + 4 < capLen ? p[dataOff + 4] : 0);
+        } else {
+          snprintf(buf, sizeof(buf), " conn %u msglen %u", connIdx, le16(p + dataOff));
+        }
+        extra += buf;
+      }
+    }
+    else if (cmd == IKCP_CMD_ACK) {
+      fs.acks_++;
+      // the acked segment went the other way
+      auto rf = gFlows.find(reverse);
+      if (rf != gFlows.end()) {
+        auto seg = rf->second.segs_.find(sn);
+        if (seg != rf->second.segs_.end() && pkt.timeUs_ >= seg->second.lastSendUs_) {
+          const uint64_t rtt = pkt.timeUs_ - seg->second.lastSendUs_;
+          fs.rttCount_++;
+          fs.rttSumUs_ += rtt;
+          if (rtt > fs.rttMaxUs_) fs.rttMaxUs_ = rtt;
+          snprintf(buf, sizeof(buf), " rtt %.3fms%s", rtt / 1000.0,
+                   seg->second.xmit_ > 1 ? " (of a retransmitted one)" : "");
+          extra += buf;
+        }
+      }
+    }
+
+    if (!gQuiet) {
+      printf("  conv %u %s sn %u una %u frg %u wnd %u ts %u len %u%s\n",
+             conv, cmdName(cmd), sn, una, frg, wnd, ts, dlen, extra.c_str());
+    }
+    off += IKCP_OVERHEAD + dlen;
+  }
+}
+
+static void handlePacket(const Packet &pkt) {
+  const uint8_t *p = pkt.data_;
+  uint32_t capLen  = pkt.capLen_;
+  uint32_t origLen = pkt.origLen_;
+
+  if (pkt.linkType_ == LINKTYPE_ETHERNET) {
+    if (capLen < 14) return;
+    uint16_t etherType = (p[12] << 8) | p[13];
+    p += 14; capLen -= 14; origLen -= 14;
+    if (etherType != 0x0800 && etherType != 0x86dd) return;
+  } else if (pkt.linkType_ != LINKTYPE_RAW) {
+    return;
+  }
+  if (capLen < 1) return;
+
+  string src, dst;
+  uint32_t hdrLen;
+  const int version = p[0] >> 4;
+  if (version == 4) {
+    if (capLen < 20) return;
+    hdrLen = (p[0] & 0x0f) * 4;
+    if (p[9] != 17 /* udp */ || capLen < hdrLen + 8) return;
+    const uint8_t *udp = p + hdrLen;
+    src = addrString(AF_INET, p + 12, (udp[0] << 8) | udp[1]);
+    dst = addrString(AF_INET, p + 16, (udp[2] << 8) | udp[3]);
+  } else if (version == 6) {
+    hdrLen = 40;
+    if (capLen < hdrLen + 8 || p[6] != 17) return;
+    const uint8_t *udp = p + hdrLen;
+    src = addrString(AF_INET6, p + 8,  (udp[0] << 8) | udp[1]);
+    dst = addrString(AF_INET6, p + 24, (udp[2] << 8) | udp[3]);
+  } else {
+    return;
+  }
+  hdrLen += 8;
+
+  decodeKcp(pkt, src, dst, p + hdrLen, capLen - hdrLen,
+            origLen > hdrLen ? origLen - hdrLen : 0);
+}
+
+static bool readPcapng(const vector<uint8_t> &file) {
+  vector<int> linkTypes;
+  size_t off = 0;
+
+  while (off + 12 <= file.size()) {
+    const uint8_t *b = &file[off];
+    const uint32_t type = le32(b);
+    const uint32_t len  = le32(b + 4);
+    if (len < 12 || off + len > file.size()) {
+      fprintf(stderr, "bad block at %zu\n", off);
+      return false;
+    }
+
+    if (type == 0x0A0D0D0Au) {
+      if (le32(b + 8) != 0x1A2B3C4Du) {
+        fprintf(stderr, "byte-swapped pcapng is not supported\n");
+        return false;
+      }
+      linkTypes.clear();
+    } else if (type == 1 && len >= 20) {
+      linkTypes.push_back(le16(b + 8));
+    } else if (type == 6 && len >= 32) {
+      const uint32_t ifid = le32(b + 8);
+      Packet pkt;
+      pkt.timeUs_   = ((uint64_t)le32(b + 12) << 32) | le32(b + 16);
+      pkt.capLen_   = le32(b + 20);
+      pkt.origLen_  = le32(b + 24);
+      pkt.data_     = b + 28;
+      pkt.linkType_ = ifid < linkTypes.size() ? linkTypes[ifid] : -1;
+      if (28 + pkt.capLen_ <= len)
+        handlePacket(pkt);
+    }
+    off += len;
+  }
+  return true;
+}
+
+static bool readPcap(const vector<uint8_t> &file) {
+  if (file.size() < 24) return false;
+  const uint32_t magic = le32(&file[0]);
+  const bool nano = (magic == 0xa1b23c4du);
+  const int linkType = (int)le32(&file[20]);
+
+  size_t off = 24;
+  while (off + 16 <= file.size()) {
+    const uint8_t *h = &file[off];
+    Packet pkt;
+    pkt.timeUs_   = (uint64_t)le32(h) * 1000000 + (nano ? le32(h + 4) / 1000 : le32(h + 4));
+    pkt.capLen_   = le32(h + 8);
+    pkt.origLen_  = le32(h + 12);
+    pkt.data_     = h + 16;
+    pkt.linkType_ = linkType;
+    if (off + 16 + pkt.capLen_ > file.size()) break;
+    handlePacket(pkt);
+    off += 16 + pkt.capLen_;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int c;
+  while ((c = getopt(argc, argv, "qh")) != -1) {
+    switch (c) {
+      case 'q':
+        gQuiet = true;
+        break;
+      case 'h': default:
+        fprintf(stderr, "Usage:\n\tkcpdump [-q] <capture.pcapng>\n");
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage:\n\tkcpdump [-q] <capture.pcapng>\n");
+    return 1;
+  }
+
+  FILE *f = fopen(argv[optind], "rb");
+  if (f == nullptr) {
+    perror(argv[optind]);
+    return 1;
+  }
+  vector<uint8_t> file;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    file.insert(file.end(), buf, buf + n);
+  }
+  fclose(f);
+
+  if (file.size() < 4) {
+    fprintf(stderr, "file too short\n");
+    return 1;
+  }
+  const uint32_t magic = le32(&file[0]);
+  bool ok;
+  if (magic == 0x0A0D0D0Au) {
+    ok = readPcapng(file);
+  } else if (magic == 0xa1b2c3d4u || magic == 0xa1b23c4du) {
+    ok = readPcap(file);
+  } else {
+    fprintf(stderr, "not a pcap/pcapng file\n");
+    return 1;
+  }
+
+  // summary
+  printf("\n%-50s %8s %8s %8s %8s %10s %10s\n", "flow", "packets", "push",
+         "retrans", "acks", "rtt_avg", "rtt_max");
+  for (const auto &f : gFlows) {
+    const FlowStats &s = f.second;
+    printf("%-50s %8llu %8llu %8llu %8llu %8.3fms %8.3fms\n", f.first.c_str(),
+           (unsigned long long)s.packets_, (unsigned long long)s.push_,
+           (unsigned long long)s.retrans_, (unsigned long long)s.acks_,
+           s.rttCount_ ? s.rttSumUs_ / 1000.0 / s.rttCount_ : 0.0,
+           s.rttMaxUs_ / 1000.0);
+  }
+  return ok ? 0 : 1;
+}
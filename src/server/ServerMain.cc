@@ -28,16 +28,39 @@
 #include <errno.h>
 #include <unistd.h>
 
-#include <fstream>
-#include <streambuf>
-
 #include <glog/logging.h>
 
 #include "Server.h"
-#include "utilities_js.hpp"
+#include "Config.h"
 
 Server *gServer = nullptr;
 
+// keys of tserver_conf.json, also see kSocketOptionsSchema, kKcpParamsSchema,
+// kRateLimitSchema & kUpstreamPoolSchema
+static const ConfigField kServerConfSchema[] = {
+  {"listen_udp_ip",       CONF_STR,  CONF_REQUIRED, nullptr, 0, 0, nullptr},
+  {"listen_udp_port",     CONF_INT,  CONF_REQUIRED, nullptr, 1, 65535, nullptr},
+  {"upstream_tcp_host",   CONF_STR,  CONF_REQUIRED, nullptr, 0, 0, nullptr},
+  {"upstream_tcp_port",   CONF_INT,  CONF_REQUIRED, nullptr, 1, 65535, nullptr},
+  {"upstream_tcp_family", CONF_ENUM, 0, "\"any\"", 0, 0, "any|ipv4|ipv6|fastest"},
+  {"tcp_routes",          CONF_ARRAY, CONF_RELOADABLE, "[]", 0, 0, nullptr},
+  {"tcp_read_timeout",    CONF_INT,  CONF_RELOADABLE, "120", 0, 86400, nullptr},
+  {"tcp_write_timeout",   CONF_INT,  CONF_RELOADABLE, "900", 0, 86400, nullptr},
+  {"io_engine",           CONF_ENUM, 0, "\"libevent\"", 0, 0, "libevent|io_uring"},
+  {"log_async",           CONF_BOOL, 0, "true", 0, 0, nullptr},
+  {"log_payload_sample",  CONF_INT,  CONF_RELOADABLE, "0", 0, UINT32_MAX, nullptr},
+  {"control_socket",      CONF_STR,  0, "\"\"", 0, 0, nullptr},
+  {"capture_packets",     CONF_INT,  0, "0", 0, 1048576, nullptr},
+  {"capture_snaplen",     CONF_INT,  0, "64", 24, PMTU_MAX_LIMIT, nullptr},
+  {"capture_path",        CONF_STR,  0, "\"/tmp/tserver\"", 0, 0, nullptr},
+  {"pmtu_max",            CONF_INT,  0, "1472", PMTU_MIN, PMTU_MAX_LIMIT, nullptr},
+  {"udp_checksum",        CONF_BOOL, 0, "false", 0, 0, nullptr},
+  {"kcp_compact_header",  CONF_BOOL, 0, "false", 0, 0, nullptr},
+  {"stream_supersede_notify", CONF_BOOL, CONF_RELOADABLE, "false", 0, 0, nullptr},
+  {"stream_notify_delta", CONF_BOOL, 0, "false", 0, 0, nullptr},
+  {nullptr}
+};
+
 void handler(int sig) {
   if (gServer) {
     gServer->stop();
@@ -85,20 +108,92 @@ int main(int argc, char **argv) {
   signal(SIGINT,  handler);
 
   try {
-    JsonNode j;  // conf json
-    // parse xxxx.json
-    std::ifstream agentConf(optConf);
-    string agentJsonStr((std::istreambuf_iterator<char>(agentConf)),
-                        std::istreambuf_iterator<char>());
-    if (!JsonNode::parse(agentJsonStr.c_str(),
-                         agentJsonStr.c_str() + agentJsonStr.length(), j)) {
-      LOG(ERROR) << "json decode failure";
+    Config conf;
+    conf.addSchema(kServerConfSchema);
+    conf.addSchema(kSocketOptionsSchema);
+    conf.addSchema(kKcpParamsSchema);
+    conf.addSchema(kRateLimitSchema);
+    conf.addSchema(kTunnelCryptoSchema);
+    conf.addSchema(kUpstreamPoolSchema);
+    if (!conf.load(optConf)) {
+      LOG(ERROR) << "load config failure: " << optConf;
       exit(EXIT_FAILURE);
     }
 
-    gServer = new Server(j["listen_udp_ip"].str(),    j["listen_udp_port"].uint16(),
-                         j["upstream_tcp_host"].str(),  j["upstream_tcp_port"].uint16(),
-                         j["tcp_read_timeout"].int32(), j["tcp_write_timeout"].int32());
+    // payload logging is off unless sampled, it's expensive on hot paths
+    gLogPayloadSample = (uint32_t)conf.getInt("log_payload_sample");
+    // write & flush log files in a background thread
+    if (conf.getBool("log_async")) {
+      FLAGS_logbuflevel = 0;  // buffer INFO, the flushing is not on the loop
+      installAsyncLogger();
+    }
+
+    gServer = new Server(conf.getStr("listen_udp_ip"),
+                         (uint16_t)conf.getInt("listen_udp_port"),
+                         conf.getStr("upstream_tcp_host"),
+                         (uint16_t)conf.getInt("upstream_tcp_port"),
+                         (int32_t)conf.getInt("tcp_read_timeout"),
+                         (int32_t)conf.getInt("tcp_write_timeout"));
+
+    int family;
+    parseAddrFamily(conf.getStr("upstream_tcp_family"), &family);
+    gServer->setUpstreamFamily(family);
+
+    // upstreams of the client's other listeners, by route, and the other
+    // endpoints of route 0
+    RouteTable routes;
+    if (!parseRouteUpstreams(conf.getValue("tcp_routes"), &routes)) {
+      exit(EXIT_FAILURE);
+    }
+    gServer->setRoutes(routes);
+
+    // balancing, health checks & ejection among the endpoints of a route
+    UpstreamPoolParams poolParams;
+    poolParams.load(conf);
+    gServer->setUpstreamPoolParams(poolParams);
+    gServer->setIoEngine(conf.getStr("io_engine"));
+
+    SocketOptions opts;
+    opts.load(conf);
+    gServer->setSocketOptions(opts);
+
+    KcpParams kcpParams;
+    kcpParams.load(conf);
+    gServer->setKcpParams(kcpParams);
+
+    // bytes/s, 0: unlimited
+    RateLimits rateLimits;
+    rateLimits.load(conf);
+    gServer->setRateLimits(rateLimits);
+
+    // pre-shared key of the hello & the session keys, empty: plaintext
+    int cipher;
+    if (!parseAeadCipher(conf.getStr("tunnel_cipher"), &cipher)) {
+      exit(EXIT_FAILURE);
+    }
+    gServer->setTunnelKey(conf.getStr("tunnel_key"), cipher);
+    // crc32c trailer on the datagrams of clients asking for it
+    gServer->setUdpChecksum(conf.getBool("udp_checksum"));
+    // varint kcp headers without the conv, when both sides have it
+    gServer->setCompactHeader(conf.getBool("kcp_compact_header"));
+    // a clean_jobs mining.notify cancels the stale ones still in kcp
+    gServer->setSupersedeNotify(conf.getBool("stream_supersede_notify"));
+    // notify lines as deltas of the previous one, for clients asking for it
+    gServer->setNotifyDelta(conf.getBool("stream_notify_delta"));
+
+    gServer->setPmtuMax((uint16_t)conf.getInt("pmtu_max"));
+
+    // unix socket path of runtime commands, empty: off
+    gServer->setControlSocket(conf.getStr("control_socket"));
+
+    // ring of the last udp datagrams, dumped to <capture_path>-<time>.pcapng
+    // on SIGUSR1 or the control command "capture"
+    gServer->setCapture((size_t)conf.getInt("capture_packets"),
+                        (uint16_t)conf.getInt("capture_snaplen"),
+                        conf.getStr("capture_path"));
+
+    // SIGHUP reloads the CONF_RELOADABLE keys
+    gServer->setConfig(conf);
 
     if (!gServer->setup()) {
       LOG(ERROR) << "setup failure";
@@ -106,6 +201,7 @@ int main(int argc, char **argv) {
       gServer->run();
     }
     delete gServer;
+    shutdownAsyncLogger();
   }
   catch (std::exception & e) {
     LOG(FATAL) << "exception: " << e.what();
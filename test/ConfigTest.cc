@@ -0,0 +1,215 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "gtest/gtest.h"
+
+#include "Config.h"
+
+#include <algorithm>
+
+static bool parse(const string &json, ConfigValue *v, string *error) {
+  return parseJson(json.data(), json.data() + json.size(), v, error);
+}
+
+static bool hasError(const Config &conf, const string &error) {
+  const vector<string> &e = conf.errors();
+  return std::find(e.begin(), e.end(), error) != e.end();
+}
+
+static const ConfigField kTestSchema[] = {
+  {"host",    CONF_STR,  CONF_REQUIRED,   nullptr,     0, 0,   nullptr},
+  {"port",    CONF_INT,  0,               "3333",      1, 65535, nullptr},
+  {"timeout", CONF_INT,  CONF_RELOADABLE, "60",        0, 0,   nullptr},
+  {"debug",   CONF_BOOL, CONF_RELOADABLE, "false",     0, 0,   nullptr},
+  {"mode",    CONF_ENUM, 0,               "\"fast\"",  0, 0,   "fast|slow"},
+  {"routes",  CONF_ARRAY, 0,              "[]",        0, 0,   nullptr},
+  {nullptr}
+};
+
+
+TEST(Config, ParseValues) {
+  ConfigValue v;
+  string error;
+  ASSERT_TRUE(parse(" {\"a\": [1, -2, 3.5, 1e3], \"b\": {\"c\": null},"
+                    " \"d\": true, \"e\": false} ", &v, &error)) << error;
+  ASSERT_EQ(v.type_, ConfigValue::OBJECT);
+
+  const ConfigValue *a = v.find("a");
+  ASSERT_TRUE(a != nullptr);
+  ASSERT_EQ(a->items_.size(), 4u);
+  ASSERT_EQ(a->items_[0].type_, ConfigValue::INT);
+  ASSERT_EQ(a->items_[1].int_, -2);
+  ASSERT_EQ(a->items_[2].type_, ConfigValue::DOUBLE);
+  ASSERT_EQ(a->items_[2].double_, 3.5);
+  ASSERT_EQ(a->items_[3].type_, ConfigValue::DOUBLE);
+  ASSERT_EQ(a->items_[3].double_, 1000.0);
+
+  ASSERT_EQ(v.find("b")->find("c")->type_, ConfigValue::NUL);
+  ASSERT_TRUE(v.find("d")->bool_);
+  ASSERT_FALSE(v.find("e")->bool_);
+  ASSERT_TRUE(v.find("f") == nullptr);
+
+  // members keep the file order
+  ASSERT_EQ(v.toString(), "{\"a\":[1,-2,3.5,1000],\"b\":{\"c\":null},"
+                          "\"d\":true,\"e\":false}");
+}
+
+TEST(Config, ParseStrings) {
+  ConfigValue v;
+  string error;
+
+  ASSERT_TRUE(parse("\"q\\\" b\\\\ s\\/ \\b\\f\\n\\r\\t\"", &v, &error)) << error;
+  ASSERT_EQ(v.str_, "q\" b\\ s/ \b\f\n\r\t");
+
+  // 1, 2, 3 bytes of utf-8 and a surrogate pair of 4
+  ASSERT_TRUE(parse("\"\\u0041\\u00e9\\u20AC\\ud83d\\ude00\"", &v, &error)) << error;
+  ASSERT_EQ(v.str_, "A\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+
+  // raw utf-8 is taken as it is
+  ASSERT_TRUE(parse("\"\xe2\x82\xac\"", &v, &error)) << error;
+  ASSERT_EQ(v.str_, "\xe2\x82\xac");
+
+  // and written back escaped only where json needs it
+  v.str_ = string("a\"\\\x01", 4);
+  ASSERT_EQ(v.toString(), "\"a\\\"\\\\\\u0001\"");
+}
+
+TEST(Config, ParseErrors) {
+  ConfigValue v;
+  string error;
+
+  ASSERT_FALSE(parse("{\n  \"a\": 1,\n  \"b\": tru\n}", &v, &error));
+  ASSERT_EQ(error, "line 3, column 8: invalid literal");
+
+  ASSERT_FALSE(parse("{\"a\": 1 \"b\": 2}", &v, &error));
+  ASSERT_EQ(error, "line 1, column 9: expected ',' or '}'");
+
+  ASSERT_FALSE(parse("{\"a\": 1,\n\"a\": 2}", &v, &error));
+  ASSERT_EQ(error, "line 2, column 1: duplicate key: a");
+
+  ASSERT_FALSE(parse("[1, 2", &v, &error));
+  ASSERT_EQ(error, "line 1, column 6: unterminated array");
+
+  ASSERT_FALSE(parse("\"abc", &v, &error));
+  ASSERT_EQ(error, "line 1, column 5: unterminated string");
+
+  ASSERT_FALSE(parse("\"a\\x\"", &v, &error));
+  ASSERT_EQ(error, "line 1, column 4: invalid escape");
+
+  ASSERT_FALSE(parse("\"\\u12g4\"", &v, &error));
+  ASSERT_EQ(error, "line 1, column 7: invalid \\u escape");
+
+  ASSERT_FALSE(parse("\"\\ud83d\"", &v, &error));
+  ASSERT_EQ(error, "line 1, column 8: unpaired surrogate");
+
+  ASSERT_FALSE(parse("\"a\nb\"", &v, &error));
+  ASSERT_EQ(error, "line 1, column 3: control character in string");
+
+  ASSERT_FALSE(parse("{} x", &v, &error));
+  ASSERT_EQ(error, "line 1, column 4: trailing characters");
+
+  ASSERT_FALSE(parse("-", &v, &error));
+  ASSERT_EQ(error, "line 1, column 2: invalid number");
+
+  ASSERT_FALSE(parse("99999999999999999999", &v, &error));
+  ASSERT_EQ(error, "line 1, column 1: number out of range: 99999999999999999999");
+
+  ASSERT_FALSE(parse("", &v, &error));
+  ASSERT_EQ(error, "line 1, column 1: unexpected end of input");
+
+  ASSERT_FALSE(parse(string(100, '[') + string(100, ']'), &v, &error));
+  ASSERT_EQ(error, "line 1, column 66: nested too deep");
+}
+
+TEST(Config, Defaults) {
+  Config conf;
+  conf.addSchema(kTestSchema);
+  ASSERT_TRUE(conf.loadString("{\"host\": \"pool\", \"port\": 443}"));
+  ASSERT_TRUE(conf.errors().empty());
+
+  ASSERT_EQ(conf.getStr("host"), "pool");
+  ASSERT_EQ(conf.getInt("port"), 443);
+  ASSERT_EQ(conf.getInt("timeout"), 60);
+  ASSERT_FALSE(conf.getBool("debug"));
+  ASSERT_EQ(conf.getStr("mode"), "fast");
+  ASSERT_EQ(conf.getValue("routes").type_, ConfigValue::ARRAY);
+  ASSERT_TRUE(conf.has("routes"));
+}
+
+TEST(Config, ErrorsCollected) {
+  Config conf;
+  conf.addSchema(kTestSchema);
+  ASSERT_FALSE(conf.loadString("{\"prot\": 1, \"port\": 70000,"
+                               " \"timeout\": \"60\", \"mode\": \"slowest\","
+                               " \"debug\": 1}"));
+
+  // every problem at once, not only the first
+  ASSERT_EQ(conf.errors().size(), 6u);
+  ASSERT_TRUE(hasError(conf, "unknown key: prot"));
+  ASSERT_TRUE(hasError(conf, "port: 70000 out of range [1, 65535]"));
+  ASSERT_TRUE(hasError(conf, "timeout: expected int, got string \"60\""));
+  ASSERT_TRUE(hasError(conf, "mode: \"slowest\" should be one of: fast|slow"));
+  ASSERT_TRUE(hasError(conf, "debug: expected bool, got int 1"));
+  ASSERT_TRUE(hasError(conf, "missing key: host"));
+
+  // a parse error stops there
+  ASSERT_FALSE(conf.loadString("{\"host\": }"));
+  ASSERT_EQ(conf.errors().size(), 1u);
+  ASSERT_EQ(conf.errors()[0], "line 1, column 10: invalid number");
+
+  ASSERT_FALSE(conf.loadString("[]"));
+  ASSERT_EQ(conf.errors().size(), 1u);
+  ASSERT_EQ(conf.errors()[0], "should be an object");
+
+  // a failed load keeps the values of the last good one
+  ASSERT_TRUE(conf.loadString("{\"host\": \"a\"}"));
+  ASSERT_FALSE(conf.loadString("{\"host\": \"b\", \"port\": 0}"));
+  ASSERT_EQ(conf.getStr("host"), "a");
+}
+
+TEST(Config, Diff) {
+  Config running, conf;
+  running.addSchema(kTestSchema);
+  conf.addSchema(kTestSchema);
+  ASSERT_TRUE(running.loadString("{\"host\": \"a\", \"timeout\": 30}"));
+
+  // the same values, explicit or by default, are no change
+  ASSERT_TRUE(conf.loadString("{\"host\": \"a\", \"timeout\": 30,"
+                              " \"port\": 3333}"));
+  vector<string> ignored;
+  ASSERT_EQ(conf.logDiff(running, &ignored), 0);
+  ASSERT_TRUE(ignored.empty());
+
+  ASSERT_TRUE(conf.loadString("{\"host\": \"b\", \"timeout\": 10,"
+                              " \"debug\": true, \"mode\": \"slow\"}"));
+  ASSERT_EQ(conf.logDiff(running, &ignored), 4);
+  ASSERT_TRUE(conf.changed(running, "timeout"));
+  ASSERT_TRUE(conf.changed(running, "debug"));
+  ASSERT_TRUE(conf.changed(running, "host"));
+  ASSERT_FALSE(conf.changed(running, "port"));
+
+  // reloadable ones are applied, the others wait for a restart
+  ASSERT_EQ(ignored.size(), 2u);
+  ASSERT_EQ(ignored[0], "host");
+  ASSERT_EQ(ignored[1], "mode");
+}
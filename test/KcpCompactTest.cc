@@ -0,0 +1,239 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "gtest/gtest.h"
+
+#include "KcpCompact.h"
+
+// ikcp.c
+#define IKCP_CMD_PUSH  81
+#define IKCP_CMD_ACK   82
+#define IKCP_CMD_WASK  83
+#define IKCP_CMD_WINS  84
+#define IKCP_OVERHEAD  24
+
+static const uint32_t kConv = 0x12345678u;
+
+struct Segment {
+  uint8_t  cmd_;
+  uint8_t  frg_;
+  uint16_t wnd_;
+  uint32_t ts_;
+  uint32_t sn_;
+  uint32_t una_;
+  string   data_;
+};
+
+static void appendSegment(string *datagram, const Segment &seg) {
+  char header[IKCP_OVERHEAD];
+  *(uint32_t *)header        = kConv;
+  header[4]                  = (char)seg.cmd_;
+  header[5]                  = (char)seg.frg_;
+  *(uint16_t *)(header + 6)  = seg.wnd_;
+  *(uint32_t *)(header + 8)  = seg.ts_;
+  *(uint32_t *)(header + 12) = seg.sn_;
+  *(uint32_t *)(header + 16) = seg.una_;
+  *(uint32_t *)(header + 20) = (uint32_t)seg.data_.size();
+  datagram->append(header, IKCP_OVERHEAD);
+  datagram->append(seg.data_);
+}
+
+// compresses & expands `datagram`, returns the compressed size
+static size_t roundTrip(KcpCompactCodec *codec, const string &datagram) {
+  size_t len = 0;
+  const uint8_t *p = codec->compress((const uint8_t *)datagram.data(),
+                                     datagram.size(), &len);
+  EXPECT_TRUE(p != nullptr);
+  if (p == nullptr)
+    return 0;
+  const string compact((const char *)p, len);
+
+  size_t expandedLen = 0;
+  p = codec->expand((const uint8_t *)compact.data(), compact.size(), kConv,
+                    &expandedLen);
+  EXPECT_TRUE(p != nullptr);
+  if (p == nullptr)
+    return 0;
+  EXPECT_EQ(string((const char *)p, expandedLen), datagram);
+  return len;
+}
+
+static bool expands(KcpCompactCodec *codec, const string &compact) {
+  size_t len = 0;
+  return codec->expand((const uint8_t *)compact.data(), compact.size(), kConv,
+                       &len) != nullptr;
+}
+
+
+TEST(KcpCompact, RoundTrip) {
+  KcpCompactCodec codec;
+  string datagram;
+  appendSegment(&datagram, {IKCP_CMD_PUSH, 2, 128, 1000, 50, 48, "abc"});
+  appendSegment(&datagram, {IKCP_CMD_PUSH, 1, 128, 1000, 51, 48, "defg"});
+  appendSegment(&datagram, {IKCP_CMD_PUSH, 0, 128, 1001, 52, 48, "h"});
+  // a flush's acks of older segments come with older timestamps
+  appendSegment(&datagram, {IKCP_CMD_ACK,  0, 128, 990,  40, 48, ""});
+  appendSegment(&datagram, {IKCP_CMD_ACK,  0, 128, 985,  39, 48, ""});
+  appendSegment(&datagram, {IKCP_CMD_WASK, 0, 128, 1001, 0,  48, ""});
+  appendSegment(&datagram, {IKCP_CMD_WINS, 0, 128, 1001, 0,  48, ""});
+
+  const size_t len = roundTrip(&codec, datagram);
+  ASSERT_LT(len, datagram.size() / 3);
+  ASSERT_EQ(codec.inBytes_, datagram.size());
+  ASSERT_EQ(codec.outBytes_, len);
+}
+
+TEST(KcpCompact, RoundTripWrapping) {
+  KcpCompactCodec codec;
+  string datagram;
+  // ts, sn and una wrap inside the datagram, una is ahead of sn
+  appendSegment(&datagram, {IKCP_CMD_PUSH, 0, 32, 0xfffffff0u, 0xfffffffeu,
+                            0xffffffffu, "x"});
+  appendSegment(&datagram, {IKCP_CMD_PUSH, 0, 32, 0x00000010u, 0xffffffffu,
+                            0x00000001u, "y"});
+  appendSegment(&datagram, {IKCP_CMD_PUSH, 0, 32, 0x00000011u, 0x00000000u,
+                            0x00000002u, "z"});
+  appendSegment(&datagram, {IKCP_CMD_ACK,  0, 32, 0xfffffff0u, 0xfffffffeu,
+                            0x00000002u, ""});
+  roundTrip(&codec, datagram);
+
+  // and una is behind sn by a wrap in the first segment
+  datagram.clear();
+  appendSegment(&datagram, {IKCP_CMD_ACK, 0, 32, 0, 0, 0xffffffffu, ""});
+  roundTrip(&codec, datagram);
+}
+
+TEST(KcpCompact, WindowChange) {
+  KcpCompactCodec codec;
+  string same, changed;
+  for (int i = 0; i < 4; i++) {
+    const Segment seg = {IKCP_CMD_ACK, 0, 256, 1000, (uint32_t)i, 0, ""};
+    appendSegment(&same, seg);
+  }
+  for (int i = 0; i < 4; i++) {
+    // changes after the first segment only
+    const Segment seg = {IKCP_CMD_ACK, 0, (uint16_t)(i == 0 ? 256 : 0), 1000,
+                         (uint32_t)i, 0, ""};
+    appendSegment(&changed, seg);
+  }
+  const size_t sameLen    = roundTrip(&codec, same);
+  const size_t changedLen = roundTrip(&codec, changed);
+  // one byte for the only wnd that changed
+  ASSERT_EQ(changedLen, sameLen + 1);
+}
+
+TEST(KcpCompact, Empty) {
+  KcpCompactCodec codec;
+  string datagram;
+  // frg & len 0 aren't written
+  appendSegment(&datagram, {IKCP_CMD_WASK, 0, 0, 0, 0, 0, ""});
+  ASSERT_EQ(roundTrip(&codec, datagram), 5u);
+
+  // an empty datagram stays empty
+  size_t len = 1;
+  ASSERT_TRUE(codec.compress((const uint8_t *)"", 0, &len) != nullptr);
+  ASSERT_EQ(len, 0u);
+}
+
+TEST(KcpCompact, WorstCase) {
+  KcpCompactCodec codec;
+  string datagram;
+  // five byte varints for ts, sn & una, three for wnd, three for len
+  const string data(1 << 14, 'd');
+  appendSegment(&datagram, {IKCP_CMD_PUSH, 255, 0xffff, 0xffffffffu,
+                            0xffffffffu, 0x7fffffffu, data});
+  for (int i = 0; i < 8; i++) {
+    const bool odd = i % 2;
+    const Segment seg = {IKCP_CMD_PUSH, 255, (uint16_t)(odd ? 0xffff : 0x7fff),
+                         odd ? 0xffffffffu : 0x7fffffffu,
+                         odd ? 0xffffffffu : 0x7fffffffu,
+                         odd ? 0x7fffffffu : 0xffffffffu, data};
+    appendSegment(&datagram, seg);
+  }
+  const size_t len = roundTrip(&codec, datagram);
+  // 23 bytes of header each, kcp's is 24
+  ASSERT_EQ(len, 9 * (23 + data.size()));
+
+  // a segment with nothing in it can't grow either
+  datagram.clear();
+  appendSegment(&datagram, {IKCP_CMD_ACK, 0, 0xffff, 0xffffffffu,
+                            0xffffffffu, 0x7fffffffu, ""});
+  appendSegment(&datagram, {IKCP_CMD_ACK, 0, 0x7fff, 0x7fffffffu,
+                            0x7fffffffu, 0xffffffffu, ""});
+  ASSERT_LE(roundTrip(&codec, datagram), datagram.size());
+}
+
+TEST(KcpCompact, CompressRejected) {
+  KcpCompactCodec codec;
+  string datagram;
+  appendSegment(&datagram, {IKCP_CMD_PUSH, 0, 32, 0, 0, 0, "abc"});
+  size_t len = 0;
+
+  // a truncated header or data
+  ASSERT_TRUE(codec.compress((const uint8_t *)datagram.data(),
+                             IKCP_OVERHEAD - 1, &len) == nullptr);
+  ASSERT_TRUE(codec.compress((const uint8_t *)datagram.data(),
+                             datagram.size() - 1, &len) == nullptr);
+  // not a kcp command
+  datagram[4] = 0;
+  ASSERT_TRUE(codec.compress((const uint8_t *)datagram.data(),
+                             datagram.size(), &len) == nullptr);
+}
+
+TEST(KcpCompact, ExpandRejected) {
+  KcpCompactCodec codec;
+  string datagram;
+  appendSegment(&datagram, {IKCP_CMD_PUSH, 0, 32, 300, 200, 100, "abc"});
+  size_t len = 0;
+  const uint8_t *p = codec.compress((const uint8_t *)datagram.data(),
+                                    datagram.size(), &len);
+  ASSERT_TRUE(p != nullptr);
+  const string good((const char *)p, len);
+  ASSERT_TRUE(expands(&codec, good));
+
+  // the first segment without a window
+  string bad = good;
+  bad[0] &= ~0x08;
+  ASSERT_FALSE(expands(&codec, bad));
+
+  // truncated varints, of ts and of the last field
+  ASSERT_FALSE(expands(&codec, string("\x09\x80", 2)));
+  ASSERT_FALSE(expands(&codec, string("\x09\x00\x00\x00\xff", 5)));
+
+  // a len past the end
+  ASSERT_FALSE(expands(&codec, string("\x29\x00\x00\x00\x00\x05" "abcd", 10)));
+  ASSERT_FALSE(expands(&codec, good.substr(0, good.size() - 1)));
+
+  // a wnd over 16 bits
+  ASSERT_FALSE(expands(&codec, string("\x09\x00\x00\x00\x80\x80\x04", 7)));
+
+  // a frg flag without one
+  ASSERT_FALSE(expands(&codec, string("\x19\x00\x00\x00\x00", 5)));
+
+  // not a kcp command
+  ASSERT_FALSE(expands(&codec, string("\x08\x00\x00\x00\x00", 5)));
+  ASSERT_FALSE(expands(&codec, string("\x0f\x00\x00\x00\x00", 5)));
+
+  ASSERT_EQ(codec.failures_, 9u);
+  ASSERT_TRUE(expands(&codec, string("\x09\x00\x00\x00\x00", 5)));
+}
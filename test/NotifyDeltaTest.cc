@@ -0,0 +1,169 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "gtest/gtest.h"
+
+#include "NotifyDelta.h"
+
+static const string kNotify1 =
+  "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"1a2b\","
+  "\"00000000000000000006a4e2f1c0d1b2a3948576a5b4c3d2e1f00112233445566\","
+  "\"01000000010000000000000000000000000000000000000000000000000000000000"
+  "000000ffffffff4b03a1b20a\",\"0a636b706f6f6c0000000000ffffffff02\","
+  "[\"a1b2c3d4e5f60718293a4b5c6d7e8f90a1b2c3d4e5f60718293a4b5c6d7e8f90\"],"
+  "\"20000000\",\"17053894\",\"6530a8f1\",false]}\n";
+
+static const string kNotify2 =
+  "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"1a2c\","
+  "\"00000000000000000006a4e2f1c0d1b2a3948576a5b4c3d2e1f00112233445566\","
+  "\"01000000010000000000000000000000000000000000000000000000000000000000"
+  "000000ffffffff4b03a1b20a\",\"0a636b706f6f6c0000000000ffffffff02\","
+  "[\"a1b2c3d4e5f60718293a4b5c6d7e8f90a1b2c3d4e5f60718293a4b5c6d7e8f90\"],"
+  "\"20000000\",\"17053894\",\"6530a8f9\",true]}\n";
+
+static string encode(NotifyDelta *delta, const string &ref,
+                     const string &line) {
+  string ops;
+  delta->encode(ref, line.data(), line.size(), &ops);
+  return ops;
+}
+
+static bool decode(const string &ref, const string &ops, string *line) {
+  return NotifyDelta::decode(ref, (const uint8_t *)ops.data(), ops.size(),
+                             line);
+}
+
+// varint(n << 1 | 1) + varint(from), n & from < 64
+static string copyOp(const uint8_t n, const uint8_t from) {
+  string op;
+  op.push_back((char)(n << 1 | 1));
+  op.push_back((char)from);
+  return op;
+}
+
+
+TEST(NotifyDelta, RoundTrip) {
+  NotifyDelta delta;
+  const string ops = encode(&delta, kNotify1, kNotify2);
+  // a few literals between copies
+  ASSERT_LT(ops.size(), kNotify2.size() / 8);
+
+  string line;
+  ASSERT_TRUE(decode(kNotify1, ops, &line));
+  ASSERT_EQ(line, kNotify2);
+
+  ASSERT_EQ(delta.notifies_, 1u);
+  ASSERT_EQ(delta.inBytes_, kNotify2.size());
+  ASSERT_EQ(delta.outBytes_, ops.size());
+
+  // the same line is a single copy
+  ASSERT_EQ(encode(&delta, kNotify2, kNotify2).size(), 3u);
+}
+
+TEST(NotifyDelta, RoundTripFull) {
+  NotifyDelta delta;
+  // NOTIFY_DELTA_FULL: one literal of the whole line
+  const string ops = encode(&delta, "", kNotify1);
+  ASSERT_EQ(ops.size(), kNotify1.size() + 2);
+
+  string line;
+  ASSERT_TRUE(decode("", ops, &line));
+  ASSERT_EQ(line, kNotify1);
+
+  // and an empty line is no ops at all
+  ASSERT_TRUE(encode(&delta, kNotify1, "").empty());
+  ASSERT_TRUE(decode(kNotify1, "", &line));
+  ASSERT_TRUE(line.empty());
+}
+
+TEST(NotifyDelta, RoundTripShifted) {
+  NotifyDelta delta;
+  // the reference is the line with fields moved around it
+  const string ref = "[\"extra\",\"fields\"]" + kNotify1.substr(40) +
+                     kNotify1.substr(0, 40);
+  const string ops = encode(&delta, ref, kNotify1);
+  ASSERT_LT(ops.size(), kNotify1.size() / 8);
+
+  string line;
+  ASSERT_TRUE(decode(ref, ops, &line));
+  ASSERT_EQ(line, kNotify1);
+}
+
+TEST(NotifyDelta, RoundTripShortReference) {
+  NotifyDelta delta;
+  // too short to copy from, all literals
+  const char *refs[] = {"", "{", "{\"id\":nu", "{\"id\":nul"};
+  for (const char *ref : refs) {
+    const string ops = encode(&delta, ref, kNotify1);
+    string line;
+    ASSERT_TRUE(decode(ref, ops, &line)) << ref;
+    ASSERT_EQ(line, kNotify1) << ref;
+  }
+  // a line as short as the reference
+  const string ops = encode(&delta, "12345678", "12345678");
+  string line;
+  ASSERT_TRUE(decode("12345678", ops, &line));
+  ASSERT_EQ(line, "12345678");
+}
+
+TEST(NotifyDelta, DecodeRejected) {
+  string line;
+  const string ref = "0123456789abcdef";
+
+  ASSERT_TRUE(decode(ref, copyOp(16, 0), &line));
+  ASSERT_EQ(line, ref);
+  ASSERT_TRUE(decode(ref, copyOp(4, 12), &line));
+  ASSERT_EQ(line, "cdef");
+
+  // truncated varints: of an op, of a copy's offset, of a literal
+  ASSERT_FALSE(decode(ref, string("\x80", 1), &line));
+  ASSERT_FALSE(decode(ref, string("\x21", 1), &line));
+  ASSERT_FALSE(decode(ref, string("\x21\x80", 2), &line));
+  ASSERT_FALSE(decode(ref, string("\x08" "abc", 4), &line));
+  // one longer than 32 bits
+  ASSERT_FALSE(decode(ref, string("\xff\xff\xff\xff\xff\x01", 6), &line));
+
+  // copies past the reference
+  ASSERT_FALSE(decode(ref, copyOp(17, 0), &line));
+  ASSERT_FALSE(decode(ref, copyOp(4, 13), &line));
+  ASSERT_FALSE(decode("", copyOp(1, 0), &line));
+
+  // n == 0, a copy or a literal
+  ASSERT_FALSE(decode(ref, copyOp(0, 0), &line));
+  ASSERT_FALSE(decode(ref, string("\x00", 1), &line));
+
+  // longer than NOTIFY_DELTA_MAX_LINE
+  string big(NOTIFY_DELTA_MAX_LINE, 'x');
+  string ops;
+  NotifyDelta delta;
+  delta.encode("", big.data(), big.size(), &ops);
+  ASSERT_TRUE(decode("", ops, &line));
+  ASSERT_EQ(line, big);
+  ops += copyOp(1, 0);
+  ASSERT_FALSE(decode(ref, ops, &line));
+
+  big.push_back('x');
+  ops.clear();
+  delta.encode("", big.data(), big.size(), &ops);
+  ASSERT_FALSE(decode("", ops, &line));
+}
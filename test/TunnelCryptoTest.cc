@@ -0,0 +1,247 @@
+/*
+ MIT License
+
+ Copyright (c) 2016 BTC.COM
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include "gtest/gtest.h"
+
+#include "TunnelCrypto.h"
+
+// a client & server pair of one session, `n` datagrams sealed by the client
+class AeadPair {
+public:
+  AeadCodec client_;
+  AeadCodec server_;
+  vector<string> sealed_;  // [i]: counter i + 1
+
+  bool init(const int cipher, const int n) {
+    const TunnelKey key("test key");
+    uint8_t clientRandom[HELLO_RANDOM_LEN], serverRandom[HELLO_RANDOM_LEN];
+    randomBytes(clientRandom, sizeof(clientRandom));
+    randomBytes(serverRandom, sizeof(serverRandom));
+    if (!key.setSessionKeys(&client_, cipher, true,
+                            clientRandom, serverRandom, 1234) ||
+        !key.setSessionKeys(&server_, cipher, false,
+                            clientRandom, serverRandom, 1234)) {
+      return false;
+    }
+    for (int i = 0; i < n; i++) {
+      const string plain = "datagram " + std::to_string(i + 1);
+      size_t len = 0;
+      const uint8_t *p = client_.seal((const uint8_t *)plain.data(),
+                                      plain.size(), &len);
+      sealed_.push_back(string((const char *)p, len));
+    }
+    return true;
+  }
+
+  bool open(const uint64_t counter) {
+    const string &d = sealed_[counter - 1];
+    size_t len = 0;
+    const uint8_t *p = server_.open((const uint8_t *)d.data(), d.size(), &len);
+    if (p == nullptr)
+      return false;
+    EXPECT_EQ(string((const char *)p, len),
+              "datagram " + std::to_string(counter));
+    return true;
+  }
+
+  bool openForged(const uint64_t counter) {
+    string d = sealed_[counter - 1];
+    d[d.size() - 1] ^= 1;
+    size_t len = 0;
+    return server_.open((const uint8_t *)d.data(), d.size(), &len) != nullptr;
+  }
+};
+
+
+TEST(TunnelCrypto, SealOpen) {
+  const int ciphers[] = {AEAD_AES_128_GCM, AEAD_CHACHA20_POLY1305};
+  for (const int cipher : ciphers) {
+    AeadPair pair;
+    ASSERT_TRUE(pair.init(cipher, 3));
+    ASSERT_EQ(pair.sealed_[0].size(),
+              strlen("datagram 1") + AEAD_OVERHEAD);
+    ASSERT_TRUE(pair.open(1));
+    ASSERT_TRUE(pair.open(2));
+    ASSERT_TRUE(pair.open(3));
+    ASSERT_EQ(pair.server_.opened_, 3u);
+
+    // the client doesn't open its own direction
+    const string &d = pair.sealed_[0];
+    size_t len = 0;
+    ASSERT_TRUE(pair.client_.open((const uint8_t *)d.data(), d.size(),
+                                  &len) == nullptr);
+    // nor anything shorter than the overhead
+    ASSERT_TRUE(pair.server_.open((const uint8_t *)d.data(),
+                                  AEAD_OVERHEAD - 1, &len) == nullptr);
+  }
+}
+
+TEST(TunnelCrypto, CounterZero) {
+  AeadPair pair;
+  ASSERT_TRUE(pair.init(AEAD_AES_128_GCM, 1));
+  string d = pair.sealed_[0];
+  memset(&d[0], 0, AEAD_COUNTER_LEN);
+  size_t len = 0;
+  ASSERT_TRUE(pair.server_.open((const uint8_t *)d.data(), d.size(),
+                                &len) == nullptr);
+  ASSERT_EQ(pair.server_.replays_, 1u);
+}
+
+TEST(TunnelCrypto, Duplicate) {
+  AeadPair pair;
+  ASSERT_TRUE(pair.init(AEAD_AES_128_GCM, 2));
+  ASSERT_TRUE(pair.open(1));
+  ASSERT_FALSE(pair.open(1));
+  ASSERT_TRUE(pair.open(2));
+  ASSERT_FALSE(pair.open(2));
+  ASSERT_FALSE(pair.open(1));
+  ASSERT_EQ(pair.server_.replays_, 3u);
+}
+
+TEST(TunnelCrypto, OutOfOrder) {
+  AeadPair pair;
+  ASSERT_TRUE(pair.init(AEAD_AES_128_GCM, AEAD_REPLAY_WINDOW + 10));
+  ASSERT_TRUE(pair.open(10));
+  ASSERT_TRUE(pair.open(3));
+  ASSERT_TRUE(pair.open(5));
+  ASSERT_FALSE(pair.open(3));
+  ASSERT_TRUE(pair.open(4));
+
+  // the oldest counter still inside the window, and one past it
+  ASSERT_TRUE(pair.open(AEAD_REPLAY_WINDOW + 10));
+  ASSERT_TRUE(pair.open(11));
+  ASSERT_FALSE(pair.open(10));
+  ASSERT_FALSE(pair.open(9));
+  ASSERT_EQ(pair.server_.replays_, 3u);
+}
+
+TEST(TunnelCrypto, TooOld) {
+  AeadPair pair;
+  ASSERT_TRUE(pair.init(AEAD_AES_128_GCM, AEAD_REPLAY_WINDOW + 100));
+  ASSERT_TRUE(pair.open(AEAD_REPLAY_WINDOW + 100));
+  // never opened, but too old to tell
+  ASSERT_FALSE(pair.open(1));
+  ASSERT_FALSE(pair.open(100));
+  ASSERT_TRUE(pair.open(101));
+  ASSERT_EQ(pair.server_.replays_, 2u);
+}
+
+TEST(TunnelCrypto, JumpClearsWindow) {
+  const int jump = AEAD_REPLAY_WINDOW + 100;
+  AeadPair pair;
+  ASSERT_TRUE(pair.init(AEAD_AES_128_GCM, 1000 + jump));
+  ASSERT_TRUE(pair.open(1000));
+  ASSERT_TRUE(pair.open(1000 + jump));
+
+  // the same slot as 1000, opened before the jump
+  ASSERT_TRUE(pair.open(1000 + AEAD_REPLAY_WINDOW));
+  // and one the window slid over one by one
+  ASSERT_TRUE(pair.open(1000 + jump - 1));
+  ASSERT_EQ(pair.server_.replays_, 0u);
+}
+
+TEST(TunnelCrypto, ForgedTag) {
+  AeadPair pair;
+  ASSERT_TRUE(pair.init(AEAD_AES_128_GCM, AEAD_REPLAY_WINDOW + 100));
+  ASSERT_TRUE(pair.open(50));
+
+  // neither marks its counter nor moves the window
+  ASSERT_FALSE(pair.openForged(60));
+  ASSERT_FALSE(pair.openForged(AEAD_REPLAY_WINDOW + 100));
+  ASSERT_EQ(pair.server_.authFailures_, 2u);
+  ASSERT_EQ(pair.server_.replays_, 0u);
+
+  ASSERT_TRUE(pair.open(60));
+  ASSERT_TRUE(pair.open(1));
+  ASSERT_TRUE(pair.open(AEAD_REPLAY_WINDOW + 100));
+}
+
+
+static Hello makeTestHello(const uint32_t conv) {
+  Hello hello;
+  hello.conv_     = conv;
+  hello.features_ = TUNNEL_FEATURE_AES_128_GCM;
+  randomBytes(hello.random_, HELLO_RANDOM_LEN);
+  hello.time_     = 1234567;
+  return hello;
+}
+
+TEST(TunnelCrypto, Hello) {
+  const TunnelKey key("test key");
+  const Hello hello = makeTestHello(100);
+  const string msg = key.makeHello(hello, nullptr);
+  ASSERT_EQ(msg.size(), (size_t)HELLO_LEN);
+
+  Hello parsed;
+  ASSERT_TRUE(key.parseHello((const uint8_t *)msg.data(), msg.size(),
+                             nullptr, &parsed));
+  ASSERT_EQ(parsed.conv_, 100u);
+  ASSERT_EQ(parsed.features_, (uint32_t)TUNNEL_FEATURE_AES_128_GCM);
+  ASSERT_EQ(memcmp(parsed.random_, hello.random_, HELLO_RANDOM_LEN), 0);
+  ASSERT_EQ(parsed.time_, 1234567u);
+
+  // the answer is bound to the client's random
+  const Hello answer = makeTestHello(100);
+  const string ans = key.makeHello(answer, hello.random_);
+  ASSERT_TRUE(key.parseHello((const uint8_t *)ans.data(), ans.size(),
+                             hello.random_, &parsed));
+  ASSERT_EQ(memcmp(parsed.random_, answer.random_, HELLO_RANDOM_LEN), 0);
+}
+
+TEST(TunnelCrypto, HelloRejected) {
+  const TunnelKey key("test key");
+  const Hello hello = makeTestHello(100);
+  Hello parsed;
+
+  // another key
+  const string other = TunnelKey("other key").makeHello(hello, nullptr);
+  ASSERT_FALSE(key.parseHello((const uint8_t *)other.data(), other.size(),
+                              nullptr, &parsed));
+
+  // any byte changed
+  const string msg = key.makeHello(hello, nullptr);
+  for (size_t i = 0; i < msg.size(); i++) {
+    string bad = msg;
+    bad[i] ^= 0x40;
+    ASSERT_FALSE(key.parseHello((const uint8_t *)bad.data(), bad.size(),
+                                nullptr, &parsed)) << "byte " << i;
+  }
+
+  // an answer to another client's hello
+  uint8_t peerRandom[HELLO_RANDOM_LEN];
+  memcpy(peerRandom, hello.random_, HELLO_RANDOM_LEN);
+  const string ans = key.makeHello(makeTestHello(100), peerRandom);
+  peerRandom[0] ^= 1;
+  ASSERT_FALSE(key.parseHello((const uint8_t *)ans.data(), ans.size(),
+                              peerRandom, &parsed));
+  // or read as a client's hello
+  ASSERT_FALSE(key.parseHello((const uint8_t *)ans.data(), ans.size(),
+                              nullptr, &parsed));
+
+  // a keyed server rejects an unkeyed hello
+  const string plain = TunnelKey().makeHello(hello, nullptr);
+  ASSERT_FALSE(key.parseHello((const uint8_t *)plain.data(), plain.size(),
+                              nullptr, &parsed));
+  ASSERT_TRUE(TunnelKey().parseHello((const uint8_t *)plain.data(),
+                                     plain.size(), nullptr, &parsed));
+}